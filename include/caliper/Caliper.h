@@ -112,6 +112,13 @@ public:
         /// this channel. It is for local cleanup only.
         caliper_cbvec finish_evt;
 
+        /// \brief Invoked when the channel is activated with
+        ///   Caliper::activate_channel().
+        caliper_cbvec activate_evt;
+        /// \brief Invoked when the channel is deactivated with
+        ///   Caliper::deactivate_channel().
+        caliper_cbvec deactivate_evt;
+
         /// \brief Invoked when a snapshot is being taken.
         ///
         /// Use this callback to take performance measurements and append them
@@ -139,6 +146,12 @@ public:
         /// causes output services (e.g., report or recorder) to trigger a
         /// flush.
         event_cbvec write_output_evt;
+        /// \brief Start writing output in the background.
+        ///
+        /// This is invoked by the Caliper::flush_and_write_async() API call.
+        /// Output services that support it start writing output and complete
+        /// it at the next write_output_evt. Other services ignore it.
+        event_cbvec write_output_async_evt;
 
         /// \brief Invoked at a memory region begin.
         track_mem_cbvec track_mem_evt;
@@ -411,6 +424,23 @@ public:
     /// \param input_flush_info User-provided flush context information
     void flush_and_write(ChannelBody* chB, SnapshotView flush_info);
 
+    /// \brief Start writing \a chB's snapshot buffer contents in the
+    ///   background.
+    ///
+    /// Output services that support it (e.g., mpireport) flush the
+    /// channel's data and start writing the output in a helper thread.
+    /// The next flush_and_write() call on \a chB waits for the background
+    /// operation to complete instead of writing the data again. Snapshots
+    /// taken after this call are not included in the output. Services that
+    /// do not support background output write their data at the next
+    /// flush_and_write() as usual.
+    ///
+    /// This function is not signal safe.
+    ///
+    /// \param chB The channel to flush
+    /// \param input_flush_info User-provided flush context information
+    void flush_and_write_async(ChannelBody* chB, SnapshotView flush_info);
+
     /// \brief Clear snapshot buffers on \a channel
     ///
     /// Clears aggregation and trace buffers. Data in those buffers
@@ -619,6 +649,11 @@ public:
     /// \brief Return node with given \a id
     Node* node(cali_id_t id) const;
 
+    /// \brief Invoke \a fn for each node in the process' context tree
+    ///
+    /// Nodes created concurrently while this runs may or may not be visited.
+    void for_each_node(const std::function<void(const Node*)>& fn) const;
+
     /// \brief Merge all nodes in \a nodelist into a single path under \a parent
     ///
     /// Creates a new path under \a parent with the contents of \a nodelist,
@@ -91,6 +91,14 @@ public:
     /// The base class implementation invokes Caliper::flush_and_write().
     virtual void flush();
 
+    /// \brief Start flushing the underlying %Caliper channel in the
+    ///   background.
+    ///
+    ///   The base class implementation invokes
+    /// Caliper::flush_and_write_async(). A subsequent flush() completes the
+    /// operation.
+    virtual void flush_async();
+
     /// \brief Return the underlying config map.
     config_map_t copy_config() const;
 
@@ -465,6 +465,27 @@ public:
     /// \endcode
     void flush();
 
+    /// \brief Start flushing all configured measurement channels in the
+    ///   background
+    ///
+    /// Invokes the ChannelController::flush_async() method on all
+    /// configuration channel controllers created by the ConfigManager.
+    /// For MPI programs, channels that aggregate across ranks (e.g.,
+    /// runtime-report or runtime-profile with use.mpi) start the cross-rank
+    /// reduction in a helper thread, overlapping it with the remaining
+    /// program execution. This requires MPI to be initialized with
+    /// MPI_THREAD_MULTIPLE; otherwise the reduction happens at flush().
+    /// Call flush() afterwards to wait for completion. Data recorded after
+    /// flush_async() is not included in the output. Collective.
+    ///
+    /// \code
+    /// mgr.flush_async();
+    /// // ... program teardown ...
+    /// mgr.flush(); // waits for the background reduction
+    /// MPI_Finalize();
+    /// \endcode
+    void flush_async();
+
     /// \brief Check if the given config string is valid.
     ///
     /// If \a allow_extra_kv_pairs is set to \e false, extra key-value pairs
@@ -15,6 +15,8 @@
 
 #include "caliper/SnapshotRecord.h"
 
+#include <thread>
+
 namespace cali
 {
 
@@ -39,6 +41,15 @@ struct QuerySpec;
  * This function is effectively a blocking collective operation over
  * \a comm with the usual MPI collective semantics.
  *
+ * Processes on the same node first merge their data through an MPI
+ * shared-memory window. One process per node then takes part in a
+ * k-ary reduction tree. Before the reduction, rank 0 broadcasts a
+ * dictionary of its context tree nodes, so that processes only need
+ * to send nodes that are not in the dictionary. The tree fan-in, the
+ * shared-memory step, and the node dictionary can be configured with
+ * the \a CALI_MPIREDUCE_FANIN, \a CALI_MPIREDUCE_SHARED_MEMORY, and
+ * \a CALI_MPIREDUCE_NODE_DICTIONARY config variables.
+ *
  * \param db   Metadata information for \a a. The metadata database
  *    may be modified during the operation.
  * \param a    Provides the aggregation configuration and local input
@@ -61,6 +72,54 @@ void collective_flush(
     MPI_Comm         comm
 );
 
+/**
+ * \brief Start a collective_flush() in a background thread
+ *
+ * Performs the process-local flush and aggregation steps in the calling
+ * thread, then returns a thread that runs the cross-process reduction
+ * over \a comm and writes the result to \a stream on rank 0. Snapshots
+ * taken after this call returns are not included in the output. The
+ * caller must join the thread before freeing \a comm. Because the
+ * reduction overlaps with MPI calls in other threads, MPI must be
+ * initialized with \a MPI_THREAD_MULTIPLE.
+ *
+ * \ingroup ReaderAPI
+ */
+
+std::thread collective_flush_async(
+    OutputStream&    stream,
+    Caliper&         c,
+    ChannelBody*     chB,
+    SnapshotView     flush_info,
+    const QuerySpec& local_query,
+    const QuerySpec& cross_query,
+    MPI_Comm         comm
+);
+
+/**
+ * \brief Write the process-local query results of all processes in
+ *   \a comm into a single shared .cali file.
+ *
+ * Each process aggregates its data with \a query and serializes the
+ * result into a self-contained section. Section offsets are computed
+ * with an exclusive scan, and the sections are written collectively
+ * with MPI-IO into the file of the rank 0 \a stream. If that stream is
+ * not a file stream, the sections are gathered and written by rank 0.
+ * A footer index with the offset and size of each rank's section
+ * follows the sections. This is a collective operation over \a comm.
+ *
+ * \ingroup ReaderAPI
+ */
+
+void collective_file_flush(
+    OutputStream&    stream,
+    Caliper&         c,
+    ChannelBody*     chB,
+    SnapshotView     flush_info,
+    const QuerySpec& query,
+    MPI_Comm         comm
+);
+
 } /* namespace cali */
 
 extern "C"
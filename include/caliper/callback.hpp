@@ -7,6 +7,7 @@
 #ifndef UTIL_CALLBACK_HPP
 #define UTIL_CALLBACK_HPP
 
+#include <cstddef>
 #include <functional>
 #include <vector>
 
@@ -26,6 +27,16 @@ public:
 
     bool empty() const { return mCb.empty(); }
 
+    std::size_t size() const { return mCb.size(); }
+
+    /// \brief Remove all connected callback functions and return them
+    std::vector<std::function<F>> disconnect_all()
+    {
+        std::vector<std::function<F>> ret;
+        ret.swap(mCb);
+        return ret;
+    }
+
     template <class... Args>
     void operator() (Args&&... a)
     {
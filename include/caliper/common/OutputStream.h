@@ -10,6 +10,7 @@
 
 #include <iostream>
 #include <memory>
+#include <string>
 #include <vector>
 
 namespace cali
@@ -37,6 +38,10 @@ public:
 
     StreamType type() const;
 
+    /// \brief Return the stream's file name for file streams, or an empty
+    ///   string for other stream types
+    std::string filename() const;
+
     /// \brief Return a C++ ostream. Opens/creates the underlying file stream
     ///   if needed.
     std::ostream* stream();
@@ -12,6 +12,8 @@
 
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace cali
 {
@@ -20,6 +22,11 @@ class CaliperMetadataAccessInterface;
 
 /// \brief Perform aggregation operations on Caliper data
 /// \ingroup ReaderAPI
+///
+/// Multiple threads can add() records concurrently: each thread aggregates
+/// into its own table, and the tables are merged in flush(). Records added
+/// concurrently must refer to the same metadata DB, and flush() must not
+/// run concurrently with add().
 
 class Aggregator
 {
@@ -39,6 +46,15 @@ public:
     static const QuerySpec::FunctionSignature* aggregation_defs();
 
     static std::string get_aggregation_attribute_name(const QuerySpec::AggregationOp& op);
+
+    /// \brief Return the names of all output attributes of \a op
+    ///   (e.g., the bins of a histogram)
+    static std::vector<std::string> get_aggregation_attribute_names(const QuerySpec::AggregationOp& op);
+
+    /// \brief Return the names of all attributes the aggregation operations
+    ///   in \a spec read, including the results of an earlier aggregation
+    ///   (e.g., \a sum#x for sum(x)) that are aggregated again
+    static std::vector<std::string> get_input_attribute_names(const QuerySpec& spec);
 };
 
 } // namespace cali
@@ -0,0 +1,47 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file CaliBinaryWriter.h
+/// \brief CaliBinaryWriter class definition
+
+#pragma once
+
+#include "caliper/common/Entry.h"
+
+#include <memory>
+#include <vector>
+
+namespace cali
+{
+
+class CaliperMetadataAccessInterface;
+class OutputStream;
+
+/// \brief Writes snapshot records in the binary columnar .calib format
+/// \ingroup ReaderAPI
+///
+/// Snapshot records are buffered and written column-wise in row groups of
+/// \a rows_per_group records. The file is only complete after close(),
+/// which writes the last row group and the footer index. Each writer must
+/// write into its own file.
+class CaliBinaryWriter
+{
+    struct CaliBinaryWriterImpl;
+    std::shared_ptr<CaliBinaryWriterImpl> mP;
+
+public:
+
+    CaliBinaryWriter() {}
+    CaliBinaryWriter(OutputStream& os, size_t rows_per_group = 16384);
+
+    size_t num_written() const;
+
+    void write_snapshot(const CaliperMetadataAccessInterface&, const std::vector<Entry>&);
+
+    void write_globals(const CaliperMetadataAccessInterface&, const std::vector<Entry>&);
+
+    /// \brief Write out buffered records and the footer index
+    void close();
+};
+
+} // namespace cali
@@ -8,14 +8,17 @@
 
 #include "RecordProcessor.h"
 
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cali
 {
 
 class CaliperMetadataDB;
+struct QuerySpec;
 
 class CaliReader
 {
@@ -30,8 +33,47 @@ public:
     bool        error() const;
     std::string error_msg() const;
 
+    /// \brief Use the query \a spec to skip unneeded data in binary
+    ///   (.calib) input
+    ///
+    /// With query hints, the reader can skip row groups whose column
+    /// statistics rule out the query's filter conditions, and immediate
+    /// columns that the query does not use. Records must still be passed
+    /// through the query's filter. Has no effect on text input.
+    void set_query_hints(const QuerySpec& spec);
+
     void read(std::istream& is, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc);
     void read(const std::string& filename, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc);
+
+    /// \brief Read only the given section (i.e., MPI rank) of a shared
+    ///   .cali file, using the file's footer index to seek to it
+    void read_section(
+        const std::string& filename,
+        unsigned           section,
+        CaliperMetadataDB& db,
+        NodeProcessFn      node_proc,
+        SnapshotProcessFn  snap_proc
+    );
+
+    /// \brief Read a file with multiple threads, one for each snapshot
+    ///   processor in \a snap_procs
+    ///
+    /// The file is split into contiguous chunks. Node records are merged
+    /// into \a db in stream order first. Then, snapshot records of the
+    /// i-th chunk are decoded in parallel and passed to \a snap_procs[i] in
+    /// the order in which they appear in the stream. The snapshot processors
+    /// can run concurrently, but \a node_proc is only called serially.
+    /// If given, \a chunk_done(i) is called by the thread that read the
+    /// i-th chunk after its last snapshot record. Falls back to serial
+    /// reading with the first snapshot processor if the file cannot be
+    /// memory-mapped (e.g., for stdin).
+    void read_parallel(
+        const std::string&              filename,
+        CaliperMetadataDB&              db,
+        NodeProcessFn                   node_proc,
+        std::vector<SnapshotProcessFn>& snap_procs,
+        std::function<void(size_t)>     chunk_done = nullptr
+    );
 };
 
 } // namespace cali
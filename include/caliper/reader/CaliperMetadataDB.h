@@ -23,7 +23,7 @@ namespace cali
 class Node;
 class Variant;
 
-typedef std::map<cali_id_t, cali_id_t> IdMap;
+typedef std::unordered_map<cali_id_t, cali_id_t> IdMap;
 
 /// \brief Maintains a context tree and provides metadata information.
 /// \ingroup ReaderAPI
@@ -47,6 +47,18 @@ public:
 
     Node* merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const std::string& data, IdMap& idmap);
 
+    /// \brief Merge a node with text-encoded \a data of length \a len.
+    ///   String data is copied into the metadata DB's string store only
+    ///   if it is not already there.
+    Node* merge_node(
+        cali_id_t   node_id,
+        cali_id_t   attr_id,
+        cali_id_t   prnt_id,
+        const char* data,
+        size_t      len,
+        IdMap&      idmap
+    );
+
     EntryList merge_snapshot(
         size_t          n_nodes,
         const cali_id_t node_ids[],
@@ -62,9 +74,16 @@ public:
 
     Entry merge_entry(cali_id_t node_id, const IdMap& idmap);
     Entry merge_entry(cali_id_t attr_id, const std::string& data, const IdMap& idmap);
+    Entry merge_entry(cali_id_t attr_id, const char* data, size_t len, const IdMap& idmap);
+
+    /// \brief Copy string \a str of length \a len into the metadata DB's
+    ///   string store if it is not already there, and return a string variant
+    ///   pointing to the stored copy
+    Variant make_string_variant(const char* str, size_t len);
 
     void merge_global(cali_id_t node_id, const IdMap& idmap);
     void merge_global(cali_id_t attr_id, const std::string& data, const IdMap& idmap);
+    void merge_global(cali_id_t attr_id, const char* data, size_t len, const IdMap& idmap);
 
     //
     // --- Query API
@@ -934,6 +934,28 @@ void Caliper::flush_and_write(ChannelBody* chB, SnapshotView input_flush_info)
     chB->events.write_output_evt(this, chB, flush_info.view());
 }
 
+void Caliper::flush_and_write_async(ChannelBody* chB, SnapshotView input_flush_info)
+{
+    std::lock_guard<::siglock> g(sT->lock);
+
+    SnapshotRecord flush_info;
+    flush_info.builder().append(input_flush_info);
+
+    {
+        std::lock_guard<std::mutex> gbb(chB->channel_blackboard_lock);
+        chB->channel_blackboard.snapshot(flush_info.builder());
+    }
+    {
+        std::lock_guard<std::mutex> gbb(sG->process_blackboard_lock);
+        sG->process_blackboard.snapshot(flush_info.builder());
+    }
+    sT->thread_blackboard.snapshot(flush_info.builder());
+
+    Log(1).stream() << chB->name << ": Starting background flush" << std::endl;
+
+    chB->events.write_output_async_evt(this, chB, flush_info.view());
+}
+
 void Caliper::clear(Channel* chn)
 {
     std::lock_guard<::siglock> g(sT->lock);
@@ -1308,6 +1330,11 @@ Node* Caliper::node(cali_id_t id) const
     return sT->tree.node(id);
 }
 
+void Caliper::for_each_node(const std::function<void(const Node*)>& fn) const
+{
+    sT->tree.for_each_node(fn);
+}
+
 Variant Caliper::exchange(const Attribute& attr, const Variant& data)
 {
     int prop  = attr.properties();
@@ -1410,6 +1437,7 @@ void Caliper::delete_channel(Channel& channel)
 
 void Caliper::activate_channel(Channel& channel)
 {
+    bool was_active       = channel.mP->is_active;
     channel.mP->is_active = true;
 
     auto it = std::find(sG->active_channels.begin(), sG->active_channels.end(), channel);
@@ -1417,6 +1445,9 @@ void Caliper::activate_channel(Channel& channel)
         sG->active_channels.emplace_back(channel);
 
     sG->max_active_channels = std::max(sG->max_active_channels, sG->active_channels.size());
+
+    if (!was_active)
+        channel.mP->events.activate_evt(this, &channel);
 }
 
 void Caliper::deactivate_channel(Channel& channel)
@@ -1425,7 +1456,11 @@ void Caliper::deactivate_channel(Channel& channel)
     if (it != sG->active_channels.end())
         sG->active_channels.erase(it);
 
+    bool was_active       = channel.mP->is_active;
     channel.mP->is_active = false;
+
+    if (was_active)
+        channel.mP->events.deactivate_evt(this, &channel);
 }
 
 /// \brief Release current thread
@@ -137,6 +137,13 @@ void ChannelController::flush()
         Caliper().flush_and_write(chn.body(), SnapshotView());
 }
 
+void ChannelController::flush_async()
+{
+    Channel chn = channel();
+    if (chn)
+        Caliper().flush_and_write_async(chn.body(), SnapshotView());
+}
+
 std::string ChannelController::name() const
 {
     return mP->name;
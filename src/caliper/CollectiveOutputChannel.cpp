@@ -105,7 +105,14 @@ public:
         }
 
         Caliper c;
-        cali::collective_flush(stream, c, m_channel->channel_body(), SnapshotView(), local_spec, cross_spec, comm);
+
+        auto cfg = m_channel->copy_config();
+        auto it  = cfg.find("CALI_MPIREPORT_SHARED_FILE");
+
+        if (it != cfg.end() && StringConverter(it->second).to_bool())
+            cali::collective_file_flush(stream, c, m_channel->channel_body(), SnapshotView(), local_spec, comm);
+        else
+            cali::collective_flush(stream, c, m_channel->channel_body(), SnapshotView(), local_spec, cross_spec, comm);
     }
 
     void collective_flush(MPI_Comm comm) override
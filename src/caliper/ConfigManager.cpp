@@ -1523,6 +1523,12 @@ void ConfigManager::flush()
         chn->flush();
 }
 
+void ConfigManager::flush_async()
+{
+    for (ChannelPtr& chn : mP->m_channels)
+        chn->flush_async();
+}
+
 std::string ConfigManager::check(const char* configstr, bool allow_extra_kv_pairs) const
 {
     // Make a copy of our data because parsing the string modifies its state
@@ -28,7 +28,7 @@ MetadataTree::GlobalData::GlobalData(MemoryPool& pool)
     num_blocks      = config.get("num_blocks").to_uint();
     nodes_per_block = std::min<uint64_t>(config.get("nodes_per_block").to_uint(), 256);
 
-    node_blocks = new NodeBlock[num_blocks];
+    node_blocks = new NodeBlock[num_blocks]();
 
     Node* chunk = pool.aligned_alloc<Node>(nodes_per_block);
 
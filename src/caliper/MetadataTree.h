@@ -9,6 +9,7 @@
 
 #include "../common/RuntimeConfig.h"
 
+#include <algorithm>
 #include <atomic>
 
 namespace cali
@@ -108,6 +109,27 @@ public:
         return g->node_blocks[block].chunk + index;
     }
 
+    template <class F>
+    void for_each_node(F fn) const
+    {
+        GlobalData* g = mG.load();
+
+        size_t num_blocks = std::min<size_t>(g->next_block.load(), g->num_blocks);
+
+        //   Skip slots whose node is still being constructed by another
+        // thread, i.e. that don't carry their own id yet
+        for (size_t b = 0; b < num_blocks; ++b) {
+            const NodeBlock& block = g->node_blocks[b];
+
+            for (size_t i = 0; block.chunk && i < block.index; ++i) {
+                const Node* node = block.chunk + i;
+
+                if (node->id() == b * g->nodes_per_block + i)
+                    fn(node);
+            }
+        }
+    }
+
     Node* root() const { return &(mG.load()->root); }
 
     Node* type_node(cali_attr_type type) const { return mG.load()->type_nodes[type]; };
@@ -6,154 +6,517 @@
 #include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
 
+#include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 
-#include "../common/CompressedSnapshotRecord.h"
 #include "../common/NodeBuffer.h"
-#include "../common/SnapshotBuffer.h"
+#include "../common/RuntimeConfig.h"
 
-#include <set>
+#include "../common/util/vlenc.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
 
 using namespace cali;
 
 namespace
 {
 
-void recursive_append_path(
-    const CaliperMetadataAccessInterface& db,
-    const Node*                           node,
-    NodeBuffer&                           buf,
-    std::set<cali_id_t>&                  written_nodes
-)
+const ConfigSet::Entry s_configdata[] = {
+    // key, type, value, short description, long description
+    { "fanin",
+      CALI_TYPE_UINT,
+      "8",
+      "Fan-in of the cross-process reduction tree",
+      "Maximum number of child processes each process receives data from in the\n"
+      "cross-process reduction tree. Must be the same on all processes." },
+    { "shared_memory",
+      CALI_TYPE_BOOL,
+      "true",
+      "Merge data of processes on the same node through shared memory first",
+      "Merge data of processes on the same node through an MPI shared-memory window\n"
+      "before running the cross-node reduction tree over one process per node.\n"
+      "Must be the same on all processes." },
+    { "node_dictionary",
+      CALI_TYPE_BOOL,
+      "true",
+      "Broadcast a shared node dictionary before the reduction",
+      "Broadcast the context tree nodes of rank 0 to all processes before the reduction.\n"
+      "Processes then refer to these nodes by their dictionary id instead of sending\n"
+      "them along with their data. Must be the same on all processes." },
+    ConfigSet::Terminator
+};
+
+/// \brief Sizes of a packed node and snapshot buffer pair
+struct PackHeader {
+    uint64_t node_count;
+    uint64_t node_size;
+    uint64_t snap_count;
+    uint64_t snap_size;
+};
+
+/// Node ids below this are bootstrap nodes, which are the same in every
+/// metadata DB. They are never sent.
+constexpr cali_id_t FirstWireId = 12;
+
+/// \brief Node dictionary shared by all processes in the reduction.
+///
+/// Rank 0 broadcasts the nodes its aggregation records refer to, and
+/// every process merges them into its metadata DB. Nodes that are in the
+/// dictionary have the same (wire) id on every process, so they don't
+/// need to be sent with each process's data.
+class NodeDictionary
 {
-    if (!node || node->id() == CALI_INV_ID)
-        return;
-    if (written_nodes.count(node->id()) > 0)
-        return;
+    std::unordered_map<cali_id_t, cali_id_t> m_wire_ids; ///< local node id -> wire id
+    IdMap                                    m_idmap;    ///< wire id -> local node id
 
-    if (node->attribute() < node->id())
-        recursive_append_path(db, db.node(node->attribute()), buf, written_nodes);
+public:
 
-    recursive_append_path(db, node->parent(), buf, written_nodes);
+    size_t size() const { return m_idmap.size(); }
 
-    if (written_nodes.count(node->id()) > 0)
-        return;
+    /// \brief Return the wire id of local node \a id, or CALI_INV_ID if
+    ///   the node is not in the dictionary.
+    cali_id_t wire_id(cali_id_t id) const
+    {
+        auto it = m_wire_ids.find(id);
+        return it == m_wire_ids.end() ? CALI_INV_ID : it->second;
+    }
 
-    written_nodes.insert(node->id());
-    buf.append(node);
-}
+    /// \brief Id map to merge data from other processes, pre-populated
+    ///   with the dictionary nodes.
+    const IdMap& idmap() const { return m_idmap; }
 
-void pack_and_send(int dest, CaliperMetadataAccessInterface& db, Aggregator& aggregator, MPI_Comm comm)
+    void import(const NodeBuffer& nodebuf, CaliperMetadataDB& db)
+    {
+        nodebuf.for_each([this, &db](const NodeBuffer::NodeInfo& info) {
+            Node* node = db.merge_node(info.node_id, info.attr_id, info.parent_id, info.value, m_idmap);
+
+            if (node) {
+                m_wire_ids[node->id()] = info.node_id;
+                m_idmap[info.node_id]  = node->id();
+            }
+        });
+    }
+};
+
+/// \brief Serialized aggregation records for the exchange between processes.
+///
+/// Unlike a CompressedSnapshotRecord, which holds at most 127 node and 127
+/// immediate entries, a record here can have any number of entries, as
+/// needed for percentile sketches and large histograms. Each record holds
+/// the number of node entries and their ids, followed by the number of
+/// immediate entries and their attribute ids and values.
+class RecordBuffer
 {
-    NodeBuffer     nodebuf;
-    SnapshotBuffer snapbuf;
+    std::vector<unsigned char> m_data;
+    size_t                     m_count;
+
+public:
+
+    RecordBuffer() : m_count(0) {}
+
+    void append(
+        const std::vector<cali_id_t>& node_ids,
+        const std::vector<cali_id_t>& attr_ids,
+        const std::vector<Variant>&   values
+    )
+    {
+        size_t pos = m_data.size();
+
+        // worst case: 10 bytes per count and id, 20 bytes per value
+        m_data.resize(pos + 20 + 10 * node_ids.size() + 30 * attr_ids.size());
 
-    std::set<cali_id_t> written_nodes;
+        unsigned char* buf = m_data.data();
 
-    aggregator.flush(
-        db,
-        [&nodebuf, &snapbuf, &written_nodes](CaliperMetadataAccessInterface& db, const EntryList& list) {
-            for (const Entry& e : list)
-                if (e.node())
-                    recursive_append_path(db, e.node(), nodebuf, written_nodes);
-                else if (e.is_immediate())
-                    recursive_append_path(db, db.node(e.attribute()), nodebuf, written_nodes);
+        pos += vlenc_u64(node_ids.size(), buf + pos);
+        for (cali_id_t id : node_ids)
+            pos += vlenc_u64(id, buf + pos);
 
-            snapbuf.append(CompressedSnapshotRecord(list.size(), list.data()));
+        pos += vlenc_u64(attr_ids.size(), buf + pos);
+        for (size_t i = 0; i < attr_ids.size(); ++i) {
+            pos += vlenc_u64(attr_ids[i], buf + pos);
+            pos += values[i].pack(buf + pos);
         }
-    );
 
+        m_data.resize(pos);
+        ++m_count;
+    }
+
+    size_t count() const { return m_count; }
+
+    size_t size() const { return m_data.size(); }
+
+    const unsigned char* data() const { return m_data.data(); }
+
+    /// \brief Expose the buffer for a read from an external source (e.g.,
+    ///   MPI), and set count and size.
+    unsigned char* import(size_t size, size_t count)
     {
-        unsigned nodecount = nodebuf.count();
+        m_data.resize(size);
+        m_count = count;
 
-        MPI_Send(&nodecount, 1, MPI_UNSIGNED, dest, 1, comm);
-        // Work with pre-3.0 MPIs that take non-const void* :-/
-        MPI_Send(const_cast<unsigned char*>(nodebuf.data()), nodebuf.size(), MPI_BYTE, dest, 2, comm);
+        return m_data.data();
     }
+};
+
+/// \brief Packs aggregation records for the exchange between processes.
+///
+/// Records refer to nodes by wire id. Dictionary and bootstrap nodes are
+/// referenced directly. Other nodes are added to the node buffer with new
+/// wire ids above the dictionary range. Using small, dense ids keeps the
+/// variable-length encoded node references in the snapshot records short.
+class RecordPacker
+{
+    const NodeDictionary&                    m_dict;
+    NodeBuffer&                              m_nodebuf;
+    std::unordered_map<cali_id_t, cali_id_t> m_new_ids;
+    cali_id_t                                m_next_id;
+
+public:
 
+    RecordPacker(const NodeDictionary& dict, NodeBuffer& nodebuf)
+        : m_dict(dict), m_nodebuf(nodebuf), m_next_id(FirstWireId + dict.size())
+    {}
+
+    cali_id_t pack_node(const CaliperMetadataAccessInterface& db, const Node* node)
     {
-        unsigned snapcount = snapbuf.count();
+        if (!node || node->id() == CALI_INV_ID)
+            return CALI_INV_ID;
+        if (node->id() < FirstWireId)
+            return node->id();
+
+        cali_id_t id = m_dict.wire_id(node->id());
+
+        if (id != CALI_INV_ID)
+            return id;
+
+        auto it = m_new_ids.find(node->id());
+
+        if (it != m_new_ids.end())
+            return it->second;
+
+        NodeBuffer::NodeInfo info;
+
+        info.attr_id   = pack_node(db, db.node(node->attribute()));
+        info.parent_id = pack_node(db, node->parent());
+        info.node_id   = m_next_id++;
+        info.value     = node->data();
 
-        MPI_Send(&snapcount, 1, MPI_UNSIGNED, dest, 3, comm);
-        MPI_Send(const_cast<unsigned char*>(snapbuf.data()), snapbuf.size(), MPI_BYTE, dest, 4, comm);
+        m_new_ids.emplace(node->id(), info.node_id);
+        m_nodebuf.append(info);
+
+        return info.node_id;
     }
-}
 
-size_t receive_and_merge_nodes(int source, CaliperMetadataDB& db, IdMap& idmap, MPI_Comm comm)
+    void pack_record(const CaliperMetadataAccessInterface& db, const EntryList& list, RecordBuffer& snapbuf)
+    {
+        std::vector<cali_id_t> node_ids;
+        std::vector<cali_id_t> attr_ids;
+        std::vector<Variant>   values;
+
+        for (const Entry& e : list)
+            if (e.is_reference()) {
+                node_ids.push_back(pack_node(db, e.node()));
+            } else if (e.is_immediate()) {
+                attr_ids.push_back(pack_node(db, db.node(e.attribute())));
+                values.push_back(e.value());
+            }
+
+        snapbuf.append(node_ids, attr_ids, values);
+    }
+};
+
+PackHeader pack(
+    CaliperMetadataAccessInterface& db,
+    Aggregator&                     aggregator,
+    const NodeDictionary&           dict,
+    NodeBuffer&                     nodebuf,
+    RecordBuffer&                   snapbuf
+)
 {
-    unsigned count = 0;
+    RecordPacker packer(dict, nodebuf);
 
-    MPI_Recv(&count, 1, MPI_UNSIGNED, source, 1, comm, MPI_STATUS_IGNORE);
+    aggregator.flush(db, [&packer, &snapbuf](CaliperMetadataAccessInterface& db, const EntryList& list) {
+        packer.pack_record(db, list, snapbuf);
+    });
 
-    MPI_Status status;
-    int        size = 0;
+    return PackHeader { nodebuf.count(), nodebuf.size(), snapbuf.count(), snapbuf.size() };
+}
 
-    MPI_Probe(source, 2, comm, &status);
-    MPI_Get_count(&status, MPI_BYTE, &size);
+/// \brief Broadcast the nodes of rank 0's aggregation records in \a comm
+///   and merge them into every process's \a db.
+void setup_dictionary(CaliperMetadataDB& db, Aggregator& aggr, NodeDictionary& dict, MPI_Comm comm)
+{
+    int rank = 0;
+    MPI_Comm_rank(comm, &rank);
 
     NodeBuffer nodebuf;
 
-    MPI_Recv(nodebuf.import(size, count), size, MPI_BYTE, source, 2, comm, MPI_STATUS_IGNORE);
+    if (rank == 0) {
+        NodeDictionary empty;
+        RecordPacker   packer(empty, nodebuf);
+        RecordBuffer   snapbuf;
+
+        aggr.flush(db, [&packer, &snapbuf](CaliperMetadataAccessInterface& db, const EntryList& list) {
+            packer.pack_record(db, list, snapbuf);
+        });
+    }
+
+    uint64_t info[2] = { nodebuf.count(), nodebuf.size() };
+    MPI_Bcast(info, 2, MPI_UINT64_T, 0, comm);
+
+    unsigned char* buf = rank == 0 ? const_cast<unsigned char*>(nodebuf.data()) : nodebuf.import(info[1], info[0]);
+    MPI_Bcast(buf, info[1], MPI_BYTE, 0, comm);
+
+    dict.import(nodebuf, db);
 
+    Log(2).stream() << "aggregate_over_mpi: Node dictionary has " << info[0] << " nodes (" << info[1] << " bytes)"
+                    << std::endl;
+}
+
+void merge_nodes(const NodeBuffer& nodebuf, CaliperMetadataDB& db, IdMap& idmap)
+{
     nodebuf.for_each([&db, &idmap](const NodeBuffer::NodeInfo& info) {
         db.merge_node(info.node_id, info.attr_id, info.parent_id, info.value, idmap);
     });
+}
+
+void merge_snapshots(
+    const unsigned char* data,
+    size_t               count,
+    CaliperMetadataDB&   db,
+    const IdMap&         idmap,
+    SnapshotProcessFn    snap_fn
+)
+{
+    size_t pos = 0;
+
+    std::vector<cali_id_t> node_ids;
+    std::vector<cali_id_t> attr_ids;
+    std::vector<Variant>   values;
+
+    for (size_t i = 0; i < count; ++i) {
+        node_ids.resize(vldec_u64(data + pos, &pos));
+
+        for (cali_id_t& id : node_ids)
+            id = vldec_u64(data + pos, &pos);
+
+        attr_ids.resize(vldec_u64(data + pos, &pos));
+        values.resize(attr_ids.size());
+
+        for (size_t j = 0; j < attr_ids.size(); ++j) {
+            attr_ids[j] = vldec_u64(data + pos, &pos);
+            values[j]   = Variant::unpack(data + pos, &pos, nullptr);
+        }
 
-    return nodebuf.size();
+        snap_fn(
+            db,
+            db.merge_snapshot(node_ids.size(), node_ids.data(), attr_ids.size(), attr_ids.data(), values.data(), idmap)
+        );
+    }
 }
 
-size_t receive_and_merge_snapshots(
-    int                source,
-    CaliperMetadataDB& db,
-    const IdMap&       idmap,
-    SnapshotProcessFn  snap_fn,
-    MPI_Comm           comm
+//
+// --- Cross-process reduction tree
+//
+
+void pack_and_send(
+    int                             dest,
+    CaliperMetadataAccessInterface& db,
+    Aggregator&                     aggregator,
+    const NodeDictionary&           dict,
+    MPI_Comm                        comm
 )
 {
-    unsigned count = 0;
+    NodeBuffer   nodebuf;
+    RecordBuffer snapbuf;
 
-    MPI_Recv(&count, 1, MPI_UNSIGNED, source, 3, comm, MPI_STATUS_IGNORE);
+    PackHeader hdr = pack(db, aggregator, dict, nodebuf, snapbuf);
 
-    MPI_Status status;
-    int        size = 0;
+    MPI_Request reqs[3];
 
-    MPI_Probe(source, 4, comm, &status);
-    MPI_Get_count(&status, MPI_BYTE, &size);
+    // The header tells the receiver the buffer sizes, so it can post the
+    // receives for both buffers right away without probing
+    MPI_Isend(&hdr, 4, MPI_UINT64_T, dest, 1, comm, &reqs[0]);
+    // Work with pre-3.0 MPIs that take non-const void* :-/
+    MPI_Isend(const_cast<unsigned char*>(nodebuf.data()), nodebuf.size(), MPI_BYTE, dest, 2, comm, &reqs[1]);
+    MPI_Isend(const_cast<unsigned char*>(snapbuf.data()), snapbuf.size(), MPI_BYTE, dest, 3, comm, &reqs[2]);
 
-    SnapshotBuffer snapbuf;
+    MPI_Waitall(3, reqs, MPI_STATUSES_IGNORE);
+}
 
-    MPI_Recv(snapbuf.import(size, count), size, MPI_BYTE, source, 4, comm, MPI_STATUS_IGNORE);
+struct ChildData {
+    PackHeader   hdr;
+    NodeBuffer   nodebuf;
+    RecordBuffer snapbuf;
+    int          pending;
+};
+
+/// \brief Receive and merge data from all \a children. Receives are
+///   posted for all children up front; data from each child is merged as
+///   soon as it is complete, while the other transfers are in flight.
+void receive_and_merge(
+    const std::vector<int>& children,
+    CaliperMetadataDB&      db,
+    const NodeDictionary&   dict,
+    SnapshotProcessFn       snap_fn,
+    MPI_Comm                comm
+)
+{
+    const int n = static_cast<int>(children.size());
 
-    size_t pos = 0;
+    std::vector<ChildData> data(n);
 
-    for (size_t i = 0; i < snapbuf.count(); ++i) {
-        CompressedSnapshotRecordView view(snapbuf.data() + pos, &pos);
+    // reqs[i] is the header receive for child i; reqs[n+2*i] and
+    // reqs[n+2*i+1] are its node and snapshot buffer receives
+    std::vector<MPI_Request> reqs(3 * n, MPI_REQUEST_NULL);
 
-        // currently 127 entries is the max for compressed snapshots
-        cali_id_t node_ids[128];
-        cali_id_t attr_ids[128];
-        Variant   values[128];
+    for (int i = 0; i < n; ++i) {
+        data[i].pending = 3;
+        MPI_Irecv(&data[i].hdr, 4, MPI_UINT64_T, children[i], 1, comm, &reqs[i]);
+    }
 
-        view.unpack_nodes(128, node_ids);
-        view.unpack_immediate(128, attr_ids, values);
+    for (int remaining = n; remaining > 0;) {
+        int idx = MPI_UNDEFINED;
+        MPI_Waitany(3 * n, reqs.data(), &idx, MPI_STATUS_IGNORE);
+
+        if (idx == MPI_UNDEFINED)
+            break;
+
+        int        child = idx < n ? idx : (idx - n) / 2;
+        ChildData& d     = data[child];
+
+        if (idx < n) {
+            MPI_Irecv(
+                d.nodebuf.import(d.hdr.node_size, d.hdr.node_count),
+                d.hdr.node_size,
+                MPI_BYTE,
+                children[child],
+                2,
+                comm,
+                &reqs[n + 2 * child]
+            );
+            MPI_Irecv(
+                d.snapbuf.import(d.hdr.snap_size, d.hdr.snap_count),
+                d.hdr.snap_size,
+                MPI_BYTE,
+                children[child],
+                3,
+                comm,
+                &reqs[n + 2 * child + 1]
+            );
+        }
 
-        snap_fn(db, db.merge_snapshot(view.num_nodes(), node_ids, view.num_immediates(), attr_ids, values, idmap));
+        if (--d.pending == 0) {
+            IdMap idmap(dict.idmap());
+
+            merge_nodes(d.nodebuf, db, idmap);
+            merge_snapshots(d.snapbuf.data(), d.snapbuf.count(), db, idmap, snap_fn);
+
+            --remaining;
+        }
     }
+}
+
+/// \brief Reduce over a \a fanin -ary tree in \a comm, with rank 0 as the root
+void reduce_over_tree(CaliperMetadataDB& db, Aggregator& aggr, const NodeDictionary& dict, int fanin, MPI_Comm comm)
+{
+    int commsize = 1;
+    int rank     = 0;
 
-    return snapbuf.size();
+    MPI_Comm_size(comm, &commsize);
+    MPI_Comm_rank(comm, &rank);
+
+    std::vector<int> children;
+
+    for (int child = fanin * rank + 1; child <= fanin * rank + fanin && child < commsize; ++child)
+        children.push_back(child);
+
+    if (!children.empty())
+        ::receive_and_merge(children, db, dict, aggr, comm);
+
+    if (rank > 0)
+        ::pack_and_send((rank - 1) / fanin, db, aggr, dict, comm);
 }
 
-size_t receive_and_merge(int source, CaliperMetadataDB& db, SnapshotProcessFn snap_fn, MPI_Comm comm)
+//
+// --- Node-local reduction
+//
+
+#if MPI_VERSION >= 3
+
+/// \brief Merge the data of all processes in \a node_comm into the
+///   aggregator on rank 0 of \a node_comm.
+///
+/// Each process packs its data into its own segment of a shared-memory
+/// window. Rank 0 then merges the segments directly from shared memory.
+void reduce_over_shared_memory(CaliperMetadataDB& db, Aggregator& aggr, const NodeDictionary& dict, MPI_Comm node_comm)
 {
-    IdMap  idmap;
-    size_t bytes = 0;
+    int node_rank = 0;
+    int node_size = 1;
+
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+
+    NodeBuffer   nodebuf;
+    RecordBuffer snapbuf;
+    PackHeader   hdr { 0, 0, 0, 0 };
+
+    if (node_rank > 0)
+        hdr = pack(db, aggr, dict, nodebuf, snapbuf);
+
+    MPI_Aint segsize = node_rank > 0 ? sizeof(PackHeader) + hdr.node_size + hdr.snap_size : 0;
+
+    unsigned char* seg = nullptr;
+    MPI_Win        win;
+
+    MPI_Win_allocate_shared(segsize, 1, MPI_INFO_NULL, node_comm, &seg, &win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
 
-    bytes += receive_and_merge_nodes(source, db, idmap, comm);
-    bytes += receive_and_merge_snapshots(source, db, idmap, snap_fn, comm);
+    if (node_rank > 0) {
+        std::memcpy(seg, &hdr, sizeof(PackHeader));
+        std::copy_n(nodebuf.data(), hdr.node_size, seg + sizeof(PackHeader));
+        std::copy_n(snapbuf.data(), hdr.snap_size, seg + sizeof(PackHeader) + hdr.node_size);
+    }
+
+    MPI_Win_sync(win);
+    MPI_Barrier(node_comm);
+
+    if (node_rank == 0) {
+        MPI_Win_sync(win);
+
+        for (int r = 1; r < node_size; ++r) {
+            MPI_Aint       size      = 0;
+            int            disp_unit = 1;
+            unsigned char* ptr       = nullptr;
+
+            MPI_Win_shared_query(win, r, &size, &disp_unit, &ptr);
+
+            PackHeader h;
+            std::memcpy(&h, ptr, sizeof(PackHeader));
+
+            NodeBuffer tmp;
+            std::copy_n(ptr + sizeof(PackHeader), h.node_size, tmp.import(h.node_size, h.node_count));
+
+            IdMap idmap(dict.idmap());
 
-    return bytes;
+            merge_nodes(tmp, db, idmap);
+            merge_snapshots(ptr + sizeof(PackHeader) + h.node_size, h.snap_count, db, idmap, aggr);
+        }
+    }
+
+    // keep the segments alive until rank 0 is done reading them
+    MPI_Barrier(node_comm);
+
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
 }
 
+#endif
+
 } // namespace
 
 namespace cali
@@ -161,21 +524,50 @@ namespace cali
 
 void aggregate_over_mpi(CaliperMetadataDB& metadb, Aggregator& aggr, MPI_Comm comm)
 {
-    int commsize = 1;
-    int rank = 0;
+    ConfigSet cfg = RuntimeConfig::get_default_config().init("mpireduce", s_configdata);
 
-    MPI_Comm_size(comm, &commsize);
-    MPI_Comm_rank(comm, &rank);
+    int fanin = std::max(cfg.get("fanin").to_int(), 2);
+
+    NodeDictionary dict;
+
+    if (cfg.get("node_dictionary").to_bool())
+        ::setup_dictionary(metadb, aggr, dict, comm);
+
+#if MPI_VERSION >= 3
+    if (cfg.get("shared_memory").to_bool()) {
+        int rank = 0;
+        MPI_Comm_rank(comm, &rank);
+
+        // Ordering the node communicator by rank makes the lowest rank on
+        // each node the node leader, so rank 0 of comm is a leader and
+        // becomes rank 0 of the leader communicator.
+        MPI_Comm node_comm;
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+
+        int node_rank = 0;
+        int node_size = 1;
 
-    for (int steppow2 = 1; steppow2 < commsize; steppow2 *= 2) {
-        // receive and merge
-        if (rank % (2 * steppow2) == 0 && rank + steppow2 < commsize)
-            ::receive_and_merge(rank + steppow2, metadb, aggr, comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        MPI_Comm_size(node_comm, &node_size);
 
-        // send up the tree (happens only in one step for each rank, and never for rank 0)
-        if (rank % steppow2 == 0 && rank % (2 * steppow2) != 0)
-            ::pack_and_send(rank - steppow2, metadb, aggr, comm);
+        if (node_size > 1)
+            ::reduce_over_shared_memory(metadb, aggr, dict, node_comm);
+
+        MPI_Comm_free(&node_comm);
+
+        MPI_Comm leader_comm;
+        MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, rank, &leader_comm);
+
+        if (leader_comm != MPI_COMM_NULL) {
+            ::reduce_over_tree(metadb, aggr, dict, fanin, leader_comm);
+            MPI_Comm_free(&leader_comm);
+        }
+
+        return;
     }
+#endif
+
+    ::reduce_over_tree(metadb, aggr, dict, fanin, comm);
 }
 
 } // namespace cali
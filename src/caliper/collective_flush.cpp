@@ -3,6 +3,7 @@
 
 #include "caliper/Caliper.h"
 
+#include "caliper/common/Log.h"
 #include "caliper/common/OutputStream.h"
 
 #include "caliper/reader/Aggregator.h"
@@ -18,33 +19,190 @@
 
 #include <mpi.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 using namespace cali;
 
-namespace cali
+namespace
 {
 
-void collective_flush(
-    OutputStream&    stream,
-    Caliper&         c,
-    ChannelBody*     chB,
-    SnapshotView     flush_info,
-    const QuerySpec& local_query,
-    const QuerySpec& cross_query,
-    MPI_Comm         comm
+// Maximum number of bytes a process writes in a single MPI-IO call
+constexpr uint64_t SharedFileChunkSize = 1ULL << 30;
+
+/// \brief Create the shared-file footer index from the (offset, size) pairs
+///   of all sections.
+///
+/// The index consists of an "__rec=index" record with the rank, offset, and
+/// size of each section, followed by a fixed-length "__rec=index_end" record
+/// with the index record's offset, so readers can find the index from the
+/// end of the file.
+std::string make_shared_file_index(const std::vector<uint64_t>& sections)
+{
+    size_t   n         = sections.size() / 2;
+    uint64_t index_pos = n > 0 ? sections[2 * n - 2] + sections[2 * n - 1] : 0;
+
+    std::ostringstream os;
+
+    os << "__rec=index,rank=";
+    for (size_t i = 0; i < n; ++i)
+        os << (i > 0 ? "=" : "") << i;
+    os << ",offset=";
+    for (size_t i = 0; i < n; ++i)
+        os << (i > 0 ? "=" : "") << sections[2 * i];
+    os << ",size=";
+    for (size_t i = 0; i < n; ++i)
+        os << (i > 0 ? "=" : "") << sections[2 * i + 1];
+    os << '\n';
+
+    char buf[48];
+    snprintf(buf, sizeof(buf), "__rec=index_end,offset=%020llu\n", static_cast<unsigned long long>(index_pos));
+    os << buf;
+
+    return os.str();
+}
+
+void write_shared_file(
+    const std::string&           filename,
+    const std::string&           data,
+    uint64_t                     offset,
+    const std::vector<uint64_t>& sections,
+    MPI_Comm                     comm
 )
 {
-    CaliperMetadataDB db;
+    int rank = 0;
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_File fh;
+    int      ret =
+        MPI_File_open(comm, const_cast<char*>(filename.c_str()), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+
+    if (ret != MPI_SUCCESS) {
+        if (rank == 0)
+            Log(0).stream() << "collective_file_flush: Could not open " << filename << std::endl;
+        return;
+    }
+
+    MPI_File_set_size(fh, 0);
+
+    // Write in chunks to stay within the int count limit. All processes
+    // must make the same number of collective calls.
+
+    uint64_t size       = data.size();
+    uint64_t num_chunks = (size + SharedFileChunkSize - 1) / SharedFileChunkSize;
+    uint64_t max_chunks = 0;
+
+    MPI_Allreduce(&num_chunks, &max_chunks, 1, MPI_UINT64_T, MPI_MAX, comm);
+
+    for (uint64_t i = 0; i < max_chunks; ++i) {
+        uint64_t pos   = std::min(i * SharedFileChunkSize, size);
+        int      count = static_cast<int>(std::min(SharedFileChunkSize, size - pos));
+
+        MPI_File_write_at_all(
+            fh,
+            static_cast<MPI_Offset>(offset + pos),
+            const_cast<char*>(data.data() + pos),
+            count,
+            MPI_BYTE,
+            MPI_STATUS_IGNORE
+        );
+    }
+
+    if (rank == 0) {
+        std::string index = make_shared_file_index(sections);
+        uint64_t    n     = sections.size() / 2;
+
+        MPI_File_write_at(
+            fh,
+            static_cast<MPI_Offset>(sections[2 * n - 2] + sections[2 * n - 1]),
+            const_cast<char*>(index.data()),
+            static_cast<int>(index.size()),
+            MPI_BYTE,
+            MPI_STATUS_IGNORE
+        );
+    }
+
+    MPI_File_close(&fh);
+}
+
+/// \brief Send each process' section to rank 0 in chunks of at most
+///   SharedFileChunkSize bytes and write them to \a out on rank 0, in
+///   rank order. Used when the output is too large for MPI_Gatherv.
+void gather_in_chunks(const std::string& data, const std::vector<uint64_t>& sections, MPI_Comm comm, std::ostream* out)
+{
+    int rank   = 0;
+    int nranks = 1;
 
-    db.add_attribute_aliases(cross_query.aliases);
-    db.add_attribute_units(cross_query.units);
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nranks);
 
-    Aggregator cross_agg(cross_query);
-    Aggregator local_agg(local_query);
+    if (rank != 0) {
+        for (uint64_t pos = 0; pos < data.size(); pos += SharedFileChunkSize) {
+            int count = static_cast<int>(std::min(SharedFileChunkSize, data.size() - pos));
+            MPI_Send(const_cast<char*>(data.data() + pos), count, MPI_CHAR, 0, 0, comm);
+        }
+
+        return;
+    }
+
+    out->write(data.data(), data.size());
+
+    std::vector<char> buf;
 
-    Preprocessor cross_pp(cross_query);
-    Preprocessor local_pp(local_query);
+    for (int r = 1; r < nranks; ++r) {
+        uint64_t size = sections[2 * r + 1];
 
-    RecordSelector cross_filter(cross_query);
+        for (uint64_t pos = 0; pos < size; pos += SharedFileChunkSize) {
+            int count = static_cast<int>(std::min(SharedFileChunkSize, size - pos));
+
+            buf.resize(count);
+            MPI_Recv(buf.data(), count, MPI_CHAR, r, 0, comm, MPI_STATUS_IGNORE);
+            out->write(buf.data(), count);
+        }
+    }
+
+    *out << make_shared_file_index(sections);
+    out->flush();
+}
+
+/// \brief Intermediate state of a collective flush operation between the
+///   process-local and the cross-process step
+struct CollectiveFlushData {
+    QuerySpec          cross_query;
+    CaliperMetadataDB  db;
+    Aggregator         cross_agg;
+    std::vector<Entry> globals;
+
+    CollectiveFlushData(const QuerySpec& query) : cross_query(query), cross_agg(query)
+    {
+        db.add_attribute_aliases(query.aliases);
+        db.add_attribute_units(query.units);
+    }
+};
+
+// Flush this rank's caliper data through the local aggregation step into
+// the cross-process aggregator
+void local_flush(
+    CollectiveFlushData& data,
+    Caliper&             c,
+    ChannelBody*         chB,
+    SnapshotView         flush_info,
+    const QuerySpec&     local_query
+)
+{
+    CaliperMetadataDB& db = data.db;
+
+    Aggregator     local_agg(local_query);
+    Preprocessor   cross_pp(data.cross_query);
+    Preprocessor   local_pp(local_query);
+    RecordSelector cross_filter(data.cross_query);
     RecordSelector local_filter(local_query);
 
     // flush this rank's caliper data into local aggregator
@@ -62,6 +220,8 @@ void collective_flush(
         }
     );
 
+    Aggregator& cross_agg = data.cross_agg;
+
     // flush local aggregator results into cross-process aggregator
     local_agg.flush(
         db,
@@ -73,6 +233,12 @@ void collective_flush(
         }
     );
 
+    data.globals = c.get_globals(chB);
+}
+
+// Run the cross-process aggregation and write the result on rank 0
+void cross_flush_and_write(CollectiveFlushData& data, OutputStream& stream, Caliper& c, MPI_Comm comm)
+{
     int rank = 0;
 
     // cross-process aggregation, if we have MPI
@@ -81,16 +247,16 @@ void collective_flush(
 
         // do the global cross-process aggregation:
         //   aggregate_over_mpi() does all the magic
-        aggregate_over_mpi(db, cross_agg, comm);
+        aggregate_over_mpi(data.db, data.cross_agg, comm);
     }
 
     // rank 0's aggregator contains the global result:
     //   create a formatter and print it out
     if (rank == 0) {
         // import globals from runtime Caliper object
-        db.import_globals(c, c.get_globals(chB));
+        data.db.import_globals(c, data.globals);
 
-        QuerySpec spec = cross_query;
+        QuerySpec spec = data.cross_query;
 
         // set default formatter to table if it hasn't been set
         if (spec.format.opt == QuerySpec::FormatSpec::Default)
@@ -98,9 +264,196 @@ void collective_flush(
 
         FormatProcessor formatter(spec, stream);
 
-        cross_agg.flush(db, formatter);
+        data.cross_agg.flush(data.db, formatter);
+        formatter.flush(data.db);
+    }
+}
+
+} // namespace
+
+namespace cali
+{
+
+void collective_flush(
+    OutputStream&    stream,
+    Caliper&         c,
+    ChannelBody*     chB,
+    SnapshotView     flush_info,
+    const QuerySpec& local_query,
+    const QuerySpec& cross_query,
+    MPI_Comm         comm
+)
+{
+    CollectiveFlushData data(cross_query);
+
+    local_flush(data, c, chB, flush_info, local_query);
+    cross_flush_and_write(data, stream, c, comm);
+}
+
+std::thread collective_flush_async(
+    OutputStream&    stream,
+    Caliper&         c,
+    ChannelBody*     chB,
+    SnapshotView     flush_info,
+    const QuerySpec& local_query,
+    const QuerySpec& cross_query,
+    MPI_Comm         comm
+)
+{
+    std::shared_ptr<CollectiveFlushData> data = std::make_shared<CollectiveFlushData>(cross_query);
+
+    local_flush(*data, c, chB, flush_info, local_query);
+
+    return std::thread([data, stream, comm]() {
+        OutputStream out(stream);
+        Caliper      c;
+
+        cross_flush_and_write(*data, out, c, comm);
+    });
+}
+
+void collective_file_flush(
+    OutputStream&    stream,
+    Caliper&         c,
+    ChannelBody*     chB,
+    SnapshotView     flush_info,
+    const QuerySpec& query,
+    MPI_Comm         comm
+)
+{
+    CaliperMetadataDB db;
+
+    db.add_attribute_aliases(query.aliases);
+    db.add_attribute_units(query.units);
+
+    Aggregator     agg(query);
+    Preprocessor   pp(query);
+    RecordSelector filter(query);
+
+    c.flush(
+        chB,
+        flush_info,
+        [&db, &agg, &pp, &filter](CaliperMetadataAccessInterface& in_db, const std::vector<Entry>& rec) {
+            EntryList mrec = pp.process(db, db.merge_snapshot(in_db, rec));
+
+            if (filter.pass(db, mrec))
+                agg.add(db, mrec);
+        }
+    );
+
+    db.import_globals(c, c.get_globals(chB));
+
+    int rank   = 0;
+    int nranks = 1;
+
+    if (comm != MPI_COMM_NULL) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &nranks);
+    }
+
+    QuerySpec spec = query;
+
+    // sections must be self-contained .cali streams
+    if (spec.format.opt != QuerySpec::FormatSpec::Default && strcmp(spec.format.formatter.name, "cali") != 0 && rank == 0)
+        Log(1).stream() << "collective_file_flush: Using cali format instead of " << spec.format.formatter.name
+                        << std::endl;
+
+    spec.format = CalQLParser("format cali").spec().format;
+
+    std::ostringstream os;
+    os << "__rec=section,rank=" << rank << '\n';
+
+    {
+        OutputStream section;
+        section.set_stream(&os);
+
+        FormatProcessor formatter(spec, section);
+
+        agg.flush(db, formatter);
         formatter.flush(db);
     }
+
+    std::string data = os.str();
+
+    if (comm == MPI_COMM_NULL) {
+        std::ostream* out = stream.stream();
+        *out << data << make_shared_file_index({ 0, data.size() });
+        out->flush();
+        return;
+    }
+
+    // compute section offsets and collect them on rank 0 for the index
+
+    uint64_t size   = data.size();
+    uint64_t offset = 0;
+
+    MPI_Exscan(&size, &offset, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    if (rank == 0)
+        offset = 0;
+
+    uint64_t              section[2] = { offset, size };
+    std::vector<uint64_t> sections(rank == 0 ? 2 * nranks : 0);
+
+    MPI_Gather(section, 2, MPI_UINT64_T, sections.data(), 2, MPI_UINT64_T, 0, comm);
+
+    // rank 0 decides where the output goes: file streams are written
+    // collectively with MPI-IO, others are gathered on rank 0
+
+    std::string filename = (rank == 0 ? stream.filename() : std::string());
+    uint64_t    len      = filename.size();
+
+    MPI_Bcast(&len, 1, MPI_UINT64_T, 0, comm);
+    filename.resize(len);
+    MPI_Bcast(&filename[0], static_cast<int>(len), MPI_CHAR, 0, comm);
+
+    if (!filename.empty()) {
+        write_shared_file(filename, data, offset, sections, comm);
+        return;
+    }
+
+    // MPI_Gatherv takes int counts and displacements: gather in pieces
+    // if the sections don't fit
+
+    uint64_t total = 0;
+    MPI_Allreduce(&size, &total, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    if (total > static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+        gather_in_chunks(data, sections, comm, stream.stream());
+        return;
+    }
+
+    std::vector<int> counts(rank == 0 ? nranks : 0);
+    std::vector<int> displs(rank == 0 ? nranks : 0);
+    std::string      all;
+
+    if (rank == 0) {
+        for (int i = 0; i < nranks; ++i) {
+            counts[i] = static_cast<int>(sections[2 * i + 1]);
+            displs[i] = static_cast<int>(sections[2 * i]);
+        }
+        all.resize(total);
+    }
+
+    int count = static_cast<int>(size);
+
+    MPI_Gatherv(
+        const_cast<char*>(data.data()),
+        count,
+        MPI_CHAR,
+        &all[0],
+        counts.data(),
+        displs.data(),
+        MPI_CHAR,
+        0,
+        comm
+    );
+
+    if (rank == 0) {
+        std::ostream* out = stream.stream();
+        *out << all << make_shared_file_index(sections);
+        out->flush();
+    }
 }
 
 } // namespace cali
@@ -68,6 +68,9 @@ public:
             config()["CALI_MPIREPORT_FILENAME"]          = output;
             config()["CALI_MPIREPORT_WRITE_ON_FINALIZE"] = "false";
             config()["CALI_MPIREPORT_CONFIG"]            = opts.build_query("local", query);
+
+            if (opts.is_enabled("output.shared_file"))
+                config()["CALI_MPIREPORT_SHARED_FILE"] = "true";
         } else {
             config()["CALI_SERVICES_ENABLE"].append(",report");
             config()["CALI_REPORT_FILENAME"] = output;
@@ -100,7 +103,7 @@ cali::ChannelController* make_controller(
 {
     std::string format = opts.get("output.format", "cali");
 
-    if (format == "hatchet")
+    if (format == "hatchet" || opts.is_enabled("output.shared_file"))
         format = "cali";
 
     if (!(format == "json-split" || format == "json" || format == "cali")) {
@@ -135,6 +138,10 @@ const char* controller_spec = R"json(
    "name": "use.mpi",
    "type": "bool",
    "description": "Merge results into a single output stream in MPI programs"
+  },{
+   "name": "output.shared_file",
+   "type": "bool",
+   "description": "With use.mpi, write per-rank profiles into one shared .cali file using MPI-IO"
   },{
    "name": "time.inclusive",
    "type": "bool",
@@ -170,7 +170,42 @@ const char* mpireport_spec = R"json(
       order by
         percent_total#sum#time.duration desc
      "
+  },
+ "options":
+ [
+  {
+   "name": "topology",
+   "type": "bool",
+   "description": "Add a communication topology summary (destination ranks and bytes sent per rank)",
+   "config":
+   { "CALI_MPI_COMM_MATRIX": "true",
+     "CALI_MPIREPORT_CONFIG":
+       "let
+          sum#time.duration=scale(sum#time.duration.ns,1e-9)
+        select
+          mpi.function as Function,
+          min(count) as \"Count (min)\",
+          max(count) as \"Count (max)\",
+          min(sum#time.duration) as \"Time (min)\",
+          max(sum#time.duration) as \"Time (max)\",
+          avg(sum#time.duration) as \"Time (avg)\",
+          percent_total(sum#time.duration) as \"Time %\",
+          min(comm.matrix.rank_degree) as \"Dst ranks (min)\",
+          max(comm.matrix.rank_degree) as \"Dst ranks (max)\",
+          avg(comm.matrix.rank_degree) as \"Dst ranks (avg)\",
+          min(comm.matrix.rank_volume) as \"Bytes sent (min)\",
+          max(comm.matrix.rank_volume) as \"Bytes sent (max)\",
+          avg(comm.matrix.rank_volume) as \"Bytes sent (avg)\"
+        group by
+          mpi.function
+        format
+          table
+        order by
+          percent_total#sum#time.duration desc
+       "
+   }
   }
+ ]
 }
 )json";
 
@@ -350,6 +385,20 @@ const char* builtin_base_option_specs = R"json(
  "type": "bool",
  "description": "Print program metadata (Caliper globals and Adiak data)",
  "category": "treeformatter"
+},{
+ "name": "overhead",
+ "description": "Measure and report the time spent inside Caliper",
+ "type": "bool",
+ "category": "metric",
+ "services": [ "overhead" ],
+ "inherit": [ "print.metadata" ]
+},{
+ "name": "time.compensate_overhead",
+ "description": "Subtract estimated instrumentation overhead from region times",
+ "type": "bool",
+ "category": "metric",
+ "services": [ "timer" ],
+ "config": { "CALI_TIMER_COMPENSATE_OVERHEAD": "true" }
 },{
  "name": "order_as_visited",
  "type": "bool",
@@ -510,6 +559,28 @@ const char* builtin_mpi_option_specs = R"json(
     ]
   }
  ]
+},
+{
+ "name": "comm.matrix",
+ "description": "Number of destination ranks and bytes sent per region (communication matrix summary)",
+ "type": "bool",
+ "category": "metric",
+ "services": [ "mpi" ],
+ "config": { "CALI_MPI_COMM_MATRIX": "true", "CALI_MPI_BLACKLIST": "MPI_Wtime,MPI_Comm_rank,MPI_Comm_size" },
+ "query":
+ {
+  "local":
+  "select
+    max(comm.matrix.degree) as \"Dst ranks\" unit count,
+    sum(comm.matrix.volume) as \"Bytes sent\" unit Byte",
+  "cross":
+  "select
+    min(max#comm.matrix.degree) as \"Dst ranks (min)\" unit count,
+    avg(max#comm.matrix.degree) as \"Dst ranks (avg)\" unit count,
+    max(max#comm.matrix.degree) as \"Dst ranks (max)\" unit count,
+    avg(sum#comm.matrix.volume) as \"Bytes sent (avg)\" unit Byte,
+    max(sum#comm.matrix.volume) as \"Bytes sent (max)\" unit Byte"
+ }
 }
 ]
 )json";
@@ -609,6 +680,18 @@ const char* builtin_gotcha_option_specs = R"json(
     avg(avg#avg#alloc.size) as \"Avg Bytes/alloc\",
     max(max#max#alloc.size) as \"Max Bytes/alloc\""
  }
+},{
+ "name": "alloc.counts",
+ "description": "Report number and bytes of system memory allocations per region",
+ "type": "bool",
+ "category": "metric",
+ "services": [ "sysalloc" ],
+ "config": { "CALI_SYSALLOC_COUNT_ALLOCATIONS": "true" },
+ "query":
+ {
+  "local": "let sa.count=first(sum#sysalloc.alloc.count,sysalloc.alloc.count),sa.bytes=first(sum#sysalloc.alloc.bytes,sysalloc.alloc.bytes) select sum(sa.count) as \"Allocs\",sum(sa.bytes) as \"Bytes allocated\" unit Byte",
+  "cross": "select sum(sum#sa.count) as \"Allocs\",avg(sum#sa.bytes) as \"Avg bytes allocated\" unit Byte,sum(sum#sa.bytes) as \"Total bytes allocated\" unit Byte"
+ }
 },{
  "name": "mem.pages",
  "description": "Memory pages used via /proc/self/statm",
@@ -151,3 +151,30 @@ TEST(ChannelAPITest, WriteReport)
 
     cali_delete_channel(chn_id);
 }
+
+TEST(ChannelAPITest, FlushAndWriteAsync)
+{
+    Caliper   c;
+    cali_id_t chn_id = create_channel("chn.async", 0, { { "CALI_CHANNEL_CONFIG_CHECK", "false" } });
+    Channel   chn    = c.get_channel(chn_id);
+
+    int async_count = 0;
+    int write_count = 0;
+
+    chn.events().write_output_async_evt.connect([&async_count](Caliper*, ChannelBody*, SnapshotView) {
+        ++async_count;
+    });
+    chn.events().write_output_evt.connect([&write_count](Caliper*, ChannelBody*, SnapshotView) { ++write_count; });
+
+    c.flush_and_write_async(chn.body(), SnapshotView());
+
+    EXPECT_EQ(async_count, 1);
+    EXPECT_EQ(write_count, 0);
+
+    c.flush_and_write(chn.body(), SnapshotView());
+
+    EXPECT_EQ(async_count, 1);
+    EXPECT_EQ(write_count, 1);
+
+    c.delete_channel(chn);
+}
@@ -107,3 +107,44 @@ TEST(MetadataTreeTest, ReplaceAll)
 
     tree.print_statistics(std::cout) << std::endl;
 }
+
+TEST(MetadataTreeTest, ForEachNode)
+{
+    Caliper c;
+
+    Attribute addr_attr = c.create_attribute("test.metatree.foreach.addr", CALI_TYPE_ADDR, CALI_ATTR_DEFAULT);
+
+    MetadataTree tree;
+
+    // nodes under a separate root aren't reachable from the tree root
+
+    Node     root(CALI_INV_ID, CALI_INV_ID, Variant());
+    Variant  addrs[600];
+    uint64_t sum = 0;
+
+    for (uint64_t i = 0; i < 600; ++i) {
+        uint64_t addr = 0x1000 + i;
+        addrs[i]      = Variant(CALI_TYPE_ADDR, &addr, sizeof(addr));
+        sum += addr;
+    }
+
+    ASSERT_NE(tree.get_path(addr_attr, 600, addrs, &root), nullptr);
+
+    int      count     = 0;
+    uint64_t found_sum = 0;
+
+    tree.for_each_node([&](const Node* node) {
+        if (node->attribute() == addr_attr.id()) {
+            ++count;
+            found_sum += node->data().to_uint();
+        }
+    });
+
+    EXPECT_EQ(count, 600);
+    EXPECT_EQ(found_sum, sum);
+
+    count = 0;
+    c.for_each_node([&](const Node* node) { count += (node->attribute() == addr_attr.id() ? 1 : 0); });
+
+    EXPECT_EQ(count, 600);
+}
@@ -172,6 +172,27 @@ size_t CompressedSnapshotRecord::append(size_t n, const Node* const node_vec[])
 {
     size_t skipped = 0;
 
+    while (n > 0) {
+        cali_id_t ids[m_blocksize];
+        size_t    blk = std::min(n, m_blocksize);
+
+        for (size_t i = 0; i < blk; ++i)
+            ids[i] = node_vec[i]->id();
+
+        skipped += append(blk, ids);
+
+        node_vec += blk;
+        n -= blk;
+    }
+
+    return skipped;
+}
+
+/// \brief Append node entries given by node id
+size_t CompressedSnapshotRecord::append(size_t n, const cali_id_t node_id_vec[])
+{
+    size_t skipped = 0;
+
     // blockwise encode, size check, and copy
     while (n > 0) {
         unsigned char tmp[m_blocksize * 10];
@@ -180,12 +201,12 @@ size_t CompressedSnapshotRecord::append(size_t n, const Node* const node_vec[])
 
         // encode to temp buffer
         for (size_t i = 0; i < blk; ++i)
-            len += vlenc_u64(node_vec[i]->id(), tmp + len);
+            len += vlenc_u64(node_id_vec[i], tmp + len);
 
-        // size check, copy to actual buffer
+        // size check, copy to actual buffer (behind the existing node entries)
         if (m_num_nodes + blk < 128 && m_imm_pos + m_imm_len + len <= m_buffer_len) {
             ::save_memmove(m_buffer + m_imm_pos + len, m_buffer + m_imm_pos, m_imm_len);
-            memcpy(m_buffer + 1, tmp, len);
+            memcpy(m_buffer + m_imm_pos, tmp, len);
 
             m_imm_pos += len;
             m_num_nodes += blk;
@@ -197,7 +218,7 @@ size_t CompressedSnapshotRecord::append(size_t n, const Node* const node_vec[])
         m_needed_len += len;
 
         // advance
-        node_vec += blk;
+        node_id_vec += blk;
         n -= blk;
     }
 
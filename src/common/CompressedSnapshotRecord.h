@@ -130,6 +130,9 @@ public:
     /// \brief Append node entries
     size_t append(size_t n, const Node* const node_vec[]);
 
+    /// \brief Append node entries given by node id
+    size_t append(size_t n, const cali_id_t node_id_vec[]);
+
     /// \brief Append immediate entries
     size_t append(size_t n, const cali_id_t attr_vec[], const Variant data_vec[]);
 
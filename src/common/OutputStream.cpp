@@ -180,6 +180,11 @@ OutputStream::StreamType OutputStream::type() const
     return mP->type;
 }
 
+std::string OutputStream::filename() const
+{
+    return mP->type == StreamType::File ? std::string(mP->filename) : std::string();
+}
+
 std::ostream* OutputStream::stream()
 {
     return mP->stream();
@@ -62,6 +62,47 @@ TEST(CompressedSnapshotRecordTest, Append)
     delete n1;
 }
 
+TEST(CompressedSnapshotRecordTest, AppendManyNodes)
+{
+    Node* nodes[6];
+
+    for (int i = 0; i < 6; ++i)
+        nodes[i] = new Node(100 + i, 2, Variant(i));
+
+    cali_id_t ids_in[3]  = { 300, 301, 302 };
+    cali_id_t attr_in[1] = { 42 };
+    Variant   data_in[1] = { Variant(1.23) };
+
+    CompressedSnapshotRecord rec;
+
+    EXPECT_EQ(rec.append(1, attr_in, data_in), static_cast<size_t>(0));
+    EXPECT_EQ(rec.append(6, nodes), static_cast<size_t>(0));
+    EXPECT_EQ(rec.append(3, ids_in), static_cast<size_t>(0));
+
+    ASSERT_EQ(rec.num_nodes(), static_cast<size_t>(9));
+    ASSERT_EQ(rec.num_immediates(), static_cast<size_t>(1));
+
+    cali_id_t node_out[9];
+    cali_id_t attr_out[1];
+    Variant   data_out[1];
+
+    CompressedSnapshotRecordView view(rec.view());
+
+    view.unpack_nodes(9, node_out);
+    view.unpack_immediate(1, attr_out, data_out);
+
+    for (int i = 0; i < 6; ++i)
+        EXPECT_EQ(node_out[i], nodes[i]->id());
+    for (int i = 0; i < 3; ++i)
+        EXPECT_EQ(node_out[6 + i], ids_in[i]);
+
+    EXPECT_EQ(attr_out[0], attr_in[0]);
+    EXPECT_EQ(data_out[0], data_in[0]);
+
+    for (int i = 0; i < 6; ++i)
+        delete nodes[i];
+}
+
 TEST(CompressedSnapshotRecordTest, AppendEntrylist)
 {
     // setup mock attribute keys
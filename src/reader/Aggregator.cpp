@@ -12,12 +12,24 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 
+#include "../common/CompressedSnapshotRecord.h"
+
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <mutex>
+#include <thread>
+#include <type_traits>
 
 using namespace cali;
 
@@ -26,17 +38,97 @@ using namespace cali;
 namespace
 {
 
+inline uint64_t mix_hash(uint64_t h, uint64_t val)
+{
+    h ^= val;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
 std::size_t compute_key_hash(const std::vector<Entry>& key)
 {
-    std::size_t hash = 0;
+    uint64_t hash = 0xcbf29ce484222325ULL;
     for (const Entry& e : key) {
-        hash += e.node()->id();
+        hash = mix_hash(hash, e.node()->id());
         if (e.is_immediate())
-            hash += e.value().to_uint();
+            hash = mix_hash(hash, e.value().to_uint());
     }
-    return hash;
+    return static_cast<std::size_t>(hash);
 }
 
+/// \brief Byte buffer for kernel states and keys in aggregation spill files
+class SpillBuffer
+{
+    std::vector<unsigned char> m_data;
+    std::size_t                m_pos; ///< read position
+
+public:
+
+    SpillBuffer() : m_pos(0) {}
+
+    void append(const void* data, std::size_t len)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        m_data.insert(m_data.end(), p, p + len);
+    }
+
+    void extract(void* data, std::size_t len)
+    {
+        std::memcpy(data, m_data.data() + m_pos, len);
+        m_pos += len;
+    }
+
+    template<typename T>
+    void write(const T& val)
+    {
+        append(&val, sizeof(T));
+    }
+
+    template<typename T>
+    void read(T& val)
+    {
+        extract(&val, sizeof(T));
+    }
+
+    template<typename T>
+    void write_vector(const std::vector<T>& vec)
+    {
+        write(static_cast<uint64_t>(vec.size()));
+        if (!vec.empty())
+            append(vec.data(), vec.size() * sizeof(T));
+    }
+
+    template<typename T>
+    void read_vector(std::vector<T>& vec)
+    {
+        uint64_t n = 0;
+        read(n);
+        vec.resize(n);
+        if (n > 0)
+            extract(vec.data(), n * sizeof(T));
+    }
+
+    const unsigned char* read_ptr() const { return m_data.data() + m_pos; }
+
+    void skip(std::size_t len) { m_pos += len; }
+
+    std::size_t size() const { return m_data.size(); }
+
+    const unsigned char* data() const { return m_data.data(); }
+
+    /// \brief Discard the contents and return a \a len bytes buffer to read into
+    unsigned char* reset(std::size_t len)
+    {
+        m_data.resize(len);
+        m_pos = 0;
+        return m_data.data();
+    }
+
+    void clear() { reset(0); }
+};
+
 class CustomAttributeManager
 {
     std::string    m_name;
@@ -54,6 +146,8 @@ public:
     CustomAttributeManager(const std::string& name, const std::string& prefix, cali_attr_type type, int prop = 0)
         : m_name { name }, m_prefix { prefix }, m_type { type }, m_prop { prop } { }
 
+    std::string name() const { return m_prefix + m_name; }
+
     Attribute get(CaliperMetadataAccessInterface& db)
     {
         if (!m_attr)
@@ -77,6 +171,13 @@ public:
     AggregationAttributeManager(const std::string& name, const std::string& prefix, int prop = 0)
         : m_name { name }, m_prefix { prefix }, m_prop { prop } { }
 
+    /// \brief Append the names of the target and the derived attribute to \a names
+    void append_names(std::vector<std::string>& names) const
+    {
+        names.push_back(m_name);
+        names.push_back(m_prefix + m_name);
+    }
+
     Attribute target_attr(CaliperMetadataAccessInterface& db)
     {
         if (!m_target_attr)
@@ -107,35 +208,167 @@ inline int apply_to_matching_entries(CaliperMetadataAccessInterface& db, Aggrega
     return count;
 }
 
-class AggregateKernelConfig;
+class KernelStates;
 
-class AggregateKernel
+class AggregateKernelConfig
 {
 public:
 
-    virtual ~AggregateKernel() {}
+    virtual ~AggregateKernelConfig() {}
+
+    virtual bool is_inclusive() const { return false; }
+
+    /// \brief Create the state storage of this kernel for an aggregation table
+    virtual KernelStates* make_states() = 0;
 
-    // For inclusive metrics, parent_aggregate is invoked for parent nodes
-    virtual void parent_aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) { aggregate(db, list); }
-    virtual int aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) = 0;
-    virtual void append_result(CaliperMetadataAccessInterface& db, EntryList& list)   = 0;
+    /// \brief Append the names of the attributes this kernel reads to
+    ///   \a names. This includes the attributes with the results of an
+    ///   earlier aggregation, which the kernel reads when re-aggregating.
+    virtual void append_input_names(std::vector<std::string>& names) const = 0;
+
+    /// \brief Merge table-wide kernel state (e.g., totals) from another
+    ///   table's config
+    virtual void merge(const AggregateKernelConfig&) {}
 };
 
-class AggregateKernelConfig
+/// \brief Holds the states of one aggregation kernel for all entries of an
+///   aggregation table
+class KernelStates
 {
 public:
 
-    virtual ~AggregateKernelConfig() {}
+    virtual ~KernelStates() {}
 
-    virtual bool is_inclusive() const { return false; }
-    virtual AggregateKernel* make_kernel() = 0;
+    virtual void add_entry() = 0;
+
+    virtual int  aggregate(size_t idx, CaliperMetadataAccessInterface& db, const EntryList& list)        = 0;
+    virtual void parent_aggregate(size_t idx, CaliperMetadataAccessInterface& db, const EntryList& list) = 0;
+    virtual void merge(size_t idx, const KernelStates& from, size_t from_idx)                          = 0;
+    virtual void append_result(size_t idx, CaliperMetadataAccessInterface& db, EntryList& list)         = 0;
+
+    // --- spill support
+
+    /// \brief Write the state of entry \a idx into \a buf
+    virtual void save(size_t idx, SpillBuffer& buf) const = 0;
+    /// \brief Read a saved state from \a buf and merge it into entry \a idx
+    virtual void load_and_merge(size_t idx, SpillBuffer& buf) = 0;
+    /// \brief Remove all entries
+    virtual void clear() = 0;
+    /// \brief Size of an entry's state in bytes
+    virtual size_t entry_size() const = 0;
+    /// \brief Heap memory held by the states of all entries in bytes
+    virtual size_t heap_size() const = 0;
+};
+
+/// \brief Stores the kernel states of kernel type \a K contiguously
+template<class K>
+class KernelStatesT : public KernelStates
+{
+    typename K::Config* m_config;
+    std::vector<K>      m_kernels;
+    size_t              m_heap_size; ///< sum of the kernels' heap sizes
+
+    // account for the change of a kernel's heap size from \a before to \a after
+    void update_heap_size(size_t before, size_t after) { m_heap_size = m_heap_size - before + after; }
+
+public:
+
+    KernelStatesT(typename K::Config* config) : m_config { config }, m_heap_size { 0 } {}
+
+    void add_entry() override { m_kernels.emplace_back(); }
+
+    int aggregate(size_t idx, CaliperMetadataAccessInterface& db, const EntryList& list) override
+    {
+        K&     k      = m_kernels[idx];
+        size_t before = k.heap_size();
+        int    ret    = k.aggregate(*m_config, db, list);
+
+        update_heap_size(before, k.heap_size());
+        return ret;
+    }
+
+    void parent_aggregate(size_t idx, CaliperMetadataAccessInterface& db, const EntryList& list) override
+    {
+        K&     k      = m_kernels[idx];
+        size_t before = k.heap_size();
+
+        k.parent_aggregate(*m_config, db, list);
+        update_heap_size(before, k.heap_size());
+    }
+
+    void merge(size_t idx, const KernelStates& from, size_t from_idx) override
+    {
+        K&     k      = m_kernels[idx];
+        size_t before = k.heap_size();
+
+        k.merge(static_cast<const KernelStatesT<K>&>(from).m_kernels[from_idx]);
+        update_heap_size(before, k.heap_size());
+    }
+
+    void append_result(size_t idx, CaliperMetadataAccessInterface& db, EntryList& list) override
+    {
+        m_kernels[idx].append_result(*m_config, db, list);
+    }
+
+    void save(size_t idx, SpillBuffer& buf) const override { m_kernels[idx].save(buf); }
+
+    void load_and_merge(size_t idx, SpillBuffer& buf) override
+    {
+        K k;
+        k.load(buf);
+
+        size_t before = m_kernels[idx].heap_size();
+
+        m_kernels[idx].merge(k);
+        update_heap_size(before, m_kernels[idx].heap_size());
+    }
+
+    void clear() override
+    {
+        std::vector<K>().swap(m_kernels);
+        m_heap_size = 0;
+    }
+
+    size_t entry_size() const override { return sizeof(K); }
+
+    size_t heap_size() const override { return m_heap_size; }
+};
+
+/// \brief Base class for aggregation kernels
+///
+/// Kernels are stored by value in per-kernel arrays (see KernelStatesT),
+/// so they don't use virtual functions. A kernel class \a K implements
+/// aggregate(), merge(), and append_result(). Kernels that aren't
+/// trivially copyable also implement save() and load() for spill files.
+template<class K>
+class AggregateKernel
+{
+public:
+
+    // For inclusive metrics, parent_aggregate is invoked for parent nodes
+    template<class Config>
+    void parent_aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& list)
+    {
+        static_cast<K*>(this)->aggregate(config, db, list);
+    }
+
+    void save(SpillBuffer& buf) const
+    {
+        static_assert(std::is_trivially_copyable<K>::value, "Kernel must implement save() and load()");
+        buf.write(*static_cast<const K*>(this));
+    }
+
+    void load(SpillBuffer& buf) { buf.read(*static_cast<K*>(this)); }
+
+    /// \brief Heap memory held by the kernel state in bytes
+    size_t heap_size() const { return 0; }
 };
 
 //
 // --- CountKernel
 //
 
-class CountKernel : public AggregateKernel
+class CountKernel : public AggregateKernel<CountKernel>
 {
 public:
 
@@ -147,18 +380,23 @@ public:
 
         Attribute attr(CaliperMetadataAccessInterface& db) { return m_count_attr.get(db); }
 
-        AggregateKernel* make_kernel() override { return new CountKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<CountKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override
+        {
+            names.push_back(m_count_attr.name());
+        }
 
         Config() : m_count_attr { "count", CALI_TYPE_UINT } {}
 
         static AggregateKernelConfig* create(const std::vector<std::string>&) { return new Config; }
     };
 
-    CountKernel(Config* config) : m_count(0), m_config(config) {}
+    CountKernel() : m_count(0) {}
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& list)
     {
-        Attribute count_attr = m_config->attr(db);
+        Attribute count_attr = config.attr(db);
         cali_id_t count_attr_id = count_attr.id();
         for (const Entry& e : list)
             if (e.attribute() == count_attr_id) {
@@ -170,20 +408,20 @@ public:
         return 1;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& list) override
+    void merge(const CountKernel& k) { m_count += k.m_count; }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& list)
     {
-        uint64_t count = m_count.load();
-        if (count > 0)
-            list.push_back(Entry(m_config->attr(db), Variant(cali_make_variant_from_uint(count))));
+        if (m_count > 0)
+            list.push_back(Entry(config.attr(db), Variant(cali_make_variant_from_uint(m_count))));
     }
 
 private:
 
-    std::atomic<uint64_t> m_count;
-    Config*               m_config;
+    uint64_t m_count;
 };
 
-class ScaledCountKernel : public AggregateKernel
+class ScaledCountKernel : public AggregateKernel<ScaledCountKernel>
 {
 public:
 
@@ -198,7 +436,12 @@ public:
 
         double get_scale() const { return m_scale; }
 
-        AggregateKernel* make_kernel() { return new ScaledCountKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<ScaledCountKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override
+        {
+            names.push_back(m_count_attr.name());
+        }
 
         explicit Config(const std::string& scale_str)
             : m_count_attr { scale_str, "scount#", CALI_TYPE_UINT }
@@ -210,11 +453,11 @@ public:
         friend class ScaledCountKernel;
     };
 
-    ScaledCountKernel(Config* config) : m_count(0), m_config(config) {}
+    ScaledCountKernel() : m_count(0) {}
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& list)
     {
-        Attribute count_attr = m_config->m_count_attr.get(db);
+        Attribute count_attr = config.m_count_attr.get(db);
         for (const Entry& e : list)
             if (e.attribute() == count_attr.id()) {
                 m_count += e.value().to_uint();
@@ -225,25 +468,26 @@ public:
         return 1;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& list) override
+    void merge(const ScaledCountKernel& k) { m_count += k.m_count; }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& list)
     {
         if (m_count > 0) {
-            list.push_back(Entry(m_config->m_count_attr.get(db), Variant(m_count)));
-            list.push_back(Entry(m_config->m_result_attr.get(db), Variant(m_config->get_scale() * m_count)));
+            list.push_back(Entry(config.m_count_attr.get(db), Variant(m_count)));
+            list.push_back(Entry(config.m_result_attr.get(db), Variant(config.get_scale() * m_count)));
         }
     }
 
 private:
 
     uint64_t m_count;
-    Config*  m_config;
 };
 
 //
 // --- SumKernel
 //
 
-class SumKernel : public AggregateKernel
+class SumKernel : public AggregateKernel<SumKernel>
 {
 public:
 
@@ -257,7 +501,9 @@ public:
         AggregationAttributeManager& attr() { return m_attr_mgr; }
 
         bool is_inclusive() const override { return m_is_inclusive; }
-        AggregateKernel* make_kernel() override { return new SumKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<SumKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override { m_attr_mgr.append_names(names); }
 
         Config(const std::string& target_name, bool is_inclusive) :
             m_attr_mgr { target_name, is_inclusive ? "inclusive#" : "sum#" },
@@ -275,26 +521,29 @@ public:
         }
     };
 
-    SumKernel(Config* config) : m_config(config) {}
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        return apply_to_matching_entries(db, config.attr(), rec, [this](const Entry& e){ m_sum += e.value(); });
+    }
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    void merge(const SumKernel& k)
     {
-        return apply_to_matching_entries(db, m_config->attr(), rec, [this](const Entry& e){ m_sum += e.value(); });
+        if (k.m_sum)
+            m_sum += k.m_sum;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& rec) override
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& rec)
     {
         if (m_sum)
-            rec.push_back(Entry(m_config->attr().derived_attr(db), m_sum));
+            rec.push_back(Entry(config.attr().derived_attr(db), m_sum));
     }
 
 private:
 
     Variant m_sum;
-    Config* m_config;
 };
 
-class ScaledSumKernel : public AggregateKernel
+class ScaledSumKernel : public AggregateKernel<ScaledSumKernel>
 {
 public:
 
@@ -314,7 +563,9 @@ public:
         double get_scale() const { return m_scale; }
 
         bool is_inclusive() const override { return m_inclusive; }
-        AggregateKernel* make_kernel() override { return new ScaledSumKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<ScaledSumKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override { m_sum_attr.append_names(names); }
 
         Config(const std::vector<std::string>& cfg, bool inclusive)
             : m_sum_attr { cfg[0], inclusive ? "iscsum#" : "scsum#", CALI_ATTR_HIDDEN }
@@ -334,28 +585,31 @@ public:
         }
     };
 
-    ScaledSumKernel(Config* config) : m_config(config) {}
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        return apply_to_matching_entries(db, config.sum_attr(), rec, [this](const Entry& e){ m_sum += e.value(); });
+    }
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    void merge(const ScaledSumKernel& k)
     {
-        return apply_to_matching_entries(db, m_config->sum_attr(), rec, [this](const Entry& e){ m_sum += e.value(); });
+        if (k.m_sum)
+            m_sum += k.m_sum;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& rec) override
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& rec)
     {
         if (m_sum) {
-            rec.push_back(Entry(m_config->sum_attr().derived_attr(db), Variant(m_sum)));
-            rec.push_back(Entry(m_config->result_attr(db), Variant(m_config->get_scale() * m_sum.to_double())));
+            rec.push_back(Entry(config.sum_attr().derived_attr(db), Variant(m_sum)));
+            rec.push_back(Entry(config.result_attr(db), Variant(config.get_scale() * m_sum.to_double())));
         }
     }
 
 private:
 
     Variant m_sum;
-    Config* m_config;
 };
 
-class MinKernel : public AggregateKernel
+class MinKernel : public AggregateKernel<MinKernel>
 {
 public:
 
@@ -369,7 +623,9 @@ public:
         AggregationAttributeManager& attr() { return m_attr_mgr; }
 
         bool is_inclusive() const override { return m_is_inclusive; }
-        AggregateKernel* make_kernel() override { return new MinKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<MinKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override { m_attr_mgr.append_names(names); }
 
         Config(const std::string& name, bool inclusive)
             : m_attr_mgr(name, inclusive ? "imin#" : "min#")
@@ -387,26 +643,29 @@ public:
         }
     };
 
-    MinKernel(Config* config) : m_config(config) {}
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        return apply_to_matching_entries(db, config.attr(), rec, [this](const Entry& e){ m_min.min(e.value()); } );
+    }
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    void merge(const MinKernel& k)
     {
-        return apply_to_matching_entries(db, m_config->attr(), rec, [this](const Entry& e){ m_min.min(e.value()); } );
+        if (!k.m_min.empty())
+            m_min.min(k.m_min);
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& rec) override
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& rec)
     {
         if (!m_min.empty())
-            rec.push_back(Entry(m_config->attr().derived_attr(db), m_min));
+            rec.push_back(Entry(config.attr().derived_attr(db), m_min));
     }
 
 private:
 
     Variant m_min;
-    Config* m_config;
 };
 
-class MaxKernel : public AggregateKernel
+class MaxKernel : public AggregateKernel<MaxKernel>
 {
 public:
 
@@ -420,7 +679,9 @@ public:
         AggregationAttributeManager& attr() { return m_attr_mgr; }
 
         bool is_inclusive() const override { return m_is_inclusive; }
-        AggregateKernel* make_kernel() override { return new MaxKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<MaxKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override { m_attr_mgr.append_names(names); }
 
         Config(const std::string& name, bool inclusive)
             : m_attr_mgr(name, inclusive ? "imax#" : "max#")
@@ -438,26 +699,29 @@ public:
         }
     };
 
-    MaxKernel(Config* config) : m_config(config) {}
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        return apply_to_matching_entries(db, config.attr(), rec, [this](const Entry& e){ m_max.max(e.value()); });
+    }
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    void merge(const MaxKernel& k)
     {
-        return apply_to_matching_entries(db, m_config->attr(), rec, [this](const Entry& e){ m_max.max(e.value()); });
+        if (!k.m_max.empty())
+            m_max.max(k.m_max);
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& rec) override
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& rec)
     {
         if (!m_max.empty())
-            rec.push_back(Entry(m_config->attr().derived_attr(db), m_max));
+            rec.push_back(Entry(config.attr().derived_attr(db), m_max));
     }
 
 private:
 
     Variant m_max;
-    Config* m_config;
 };
 
-class AvgKernel : public AggregateKernel
+class AvgKernel : public AggregateKernel<AvgKernel>
 {
 public:
 
@@ -469,7 +733,13 @@ public:
 
     public:
 
-        AggregateKernel* make_kernel() override { return new AvgKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<AvgKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override
+        {
+            m_sum_attr.append_names(names);
+            names.push_back(m_count_attr.name());
+        }
 
         Config(const std::string& name)
             : m_sum_attr { name, "avg.sum#", CALI_ATTR_HIDDEN }
@@ -482,15 +752,15 @@ public:
         friend class AvgKernel;
     };
 
-    AvgKernel(Config* config) : m_count(0), m_config(config) {}
+    AvgKernel() : m_count(0) {}
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& list)
     {
-        Attribute tgt_attr = m_config->m_sum_attr.target_attr(db);
+        Attribute tgt_attr = config.m_sum_attr.target_attr(db);
         if (!tgt_attr)
             return 0;
-        Attribute sum_attr = m_config->m_sum_attr.derived_attr(db);
-        Attribute count_attr = m_config->m_count_attr.get(db);
+        Attribute sum_attr = config.m_sum_attr.derived_attr(db);
+        Attribute count_attr = config.m_count_attr.get(db);
         int count = 0;
 
         for (const Entry& e : list) {
@@ -510,12 +780,19 @@ public:
         return count;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& list) override
+    void merge(const AvgKernel& k)
+    {
+        if (k.m_sum)
+            m_sum += k.m_sum;
+        m_count += k.m_count;
+    }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& list)
     {
         if (m_count > 0) {
-            list.push_back(Entry(m_config->m_avg_attr.derived_attr(db), m_sum.div(m_count)));
-            list.push_back(Entry(m_config->m_sum_attr.derived_attr(db), m_sum));
-            list.push_back(Entry(m_config->m_count_attr.get(db), Variant(cali_make_variant_from_uint(m_count))));
+            list.push_back(Entry(config.m_avg_attr.derived_attr(db), m_sum.div(m_count)));
+            list.push_back(Entry(config.m_sum_attr.derived_attr(db), m_sum));
+            list.push_back(Entry(config.m_count_attr.get(db), Variant(cali_make_variant_from_uint(m_count))));
         }
     }
 
@@ -523,14 +800,13 @@ private:
 
     uint64_t m_count;
     Variant  m_sum;
-    Config*  m_config;
 };
 
 //
 // --- ScaledRatioKernel
 //
 
-class ScaledRatioKernel : public AggregateKernel
+class ScaledRatioKernel : public AggregateKernel<ScaledRatioKernel>
 {
 public:
 
@@ -549,7 +825,13 @@ public:
         double get_scale() const { return m_scale; }
 
         bool is_inclusive() const override { return m_inclusive; }
-        AggregateKernel* make_kernel() override { return new ScaledRatioKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<ScaledRatioKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override
+        {
+            m_tgt1.append_names(names);
+            m_tgt2.append_names(names);
+        }
 
         Config(const std::vector<std::string>& cfg, bool is_inclusive)
             : m_tgt1 { cfg[0], is_inclusive ? "isr.sum#" : "sr.sum#", CALI_ATTR_HIDDEN }
@@ -575,25 +857,31 @@ public:
         friend class ScaledRatioKernel;
     };
 
-    ScaledRatioKernel(Config* config) : m_config(config) {}
-
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
     {
         int count = 0;
-        count += apply_to_matching_entries(db, m_config->m_tgt1, rec, [this](const Entry& e){ m_sum1 += e.value(); });
-        count += apply_to_matching_entries(db, m_config->m_tgt2, rec, [this](const Entry& e){ m_sum2 += e.value(); });
+        count += apply_to_matching_entries(db, config.m_tgt1, rec, [this](const Entry& e){ m_sum1 += e.value(); });
+        count += apply_to_matching_entries(db, config.m_tgt2, rec, [this](const Entry& e){ m_sum2 += e.value(); });
         return count;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& rec) override
+    void merge(const ScaledRatioKernel& k)
+    {
+        if (k.m_sum1)
+            m_sum1 += k.m_sum1;
+        if (k.m_sum2)
+            m_sum2 += k.m_sum2;
+    }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& rec)
     {
         if (m_sum1)
-            rec.push_back(Entry(m_config->m_tgt1.derived_attr(db), m_sum1));
+            rec.push_back(Entry(config.m_tgt1.derived_attr(db), m_sum1));
         if (m_sum2) {
-            rec.push_back(Entry(m_config->m_tgt2.derived_attr(db), m_sum2));
+            rec.push_back(Entry(config.m_tgt2.derived_attr(db), m_sum2));
             if (m_sum1)
                 rec.push_back(
-                    Entry(m_config->m_ratio_attr.get(db), Variant(m_config->get_scale() * m_sum1.to_double() / m_sum2.to_double()))
+                    Entry(config.m_ratio_attr.get(db), Variant(config.get_scale() * m_sum1.to_double() / m_sum2.to_double()))
                 );
         }
     }
@@ -602,14 +890,13 @@ private:
 
     Variant m_sum1;
     Variant m_sum2;
-    Config* m_config;
 };
 
 //
 // --- PercentTotalKernel
 //
 
-class PercentTotalKernel : public AggregateKernel
+class PercentTotalKernel : public AggregateKernel<PercentTotalKernel>
 {
 public:
 
@@ -627,7 +914,17 @@ public:
         AggregationAttributeManager& sum_attr() { return m_sum_attr; }
         Attribute result_attr(CaliperMetadataAccessInterface& db) { return m_result_attr.get(db); }
 
-        AggregateKernel* make_kernel() override { return new PercentTotalKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<PercentTotalKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override { m_sum_attr.append_names(names); }
+
+        void merge(const AggregateKernelConfig& other) override
+        {
+            const Config& cfg = static_cast<const Config&>(other);
+
+            if (cfg.m_total)
+                add(cfg.m_total);
+        }
 
         void add(Variant val)
         {
@@ -655,28 +952,34 @@ public:
         }
     };
 
-    PercentTotalKernel(Config* config) : m_config(config) {}
-
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
     {
-        return apply_to_matching_entries(db, m_config->sum_attr(), rec, [this](const Entry& e){
+        return apply_to_matching_entries(db, config.sum_attr(), rec, [this, &config](const Entry& e){
                 m_sum += e.value();
                 m_isum += e.value();
-                m_config->add(e.value());
+                config.add(e.value());
             });
     }
 
-    void parent_aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    void parent_aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        apply_to_matching_entries(db, config.sum_attr(), rec, [this](const Entry& e){ m_isum += e.value(); });
+    }
+
+    void merge(const PercentTotalKernel& k)
     {
-        apply_to_matching_entries(db, m_config->sum_attr(), rec, [this](const Entry& e){ m_isum += e.value(); });
+        if (k.m_sum)
+            m_sum += k.m_sum;
+        if (k.m_isum)
+            m_isum += k.m_isum;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& list) override
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& list)
     {
-        double total = m_config->get_total();
+        double total = config.get_total();
         if (m_isum && total > 0.0) {
-            list.push_back(Entry(m_config->sum_attr().derived_attr(db), Variant(m_sum)));
-            list.push_back(Entry(m_config->result_attr(db), Variant(100.0 * m_isum.to_double() / total)));
+            list.push_back(Entry(config.sum_attr().derived_attr(db), Variant(m_sum)));
+            list.push_back(Entry(config.result_attr(db), Variant(100.0 * m_isum.to_double() / total)));
         }
     }
 
@@ -684,14 +987,13 @@ private:
 
     Variant m_sum;
     Variant m_isum; // inclusive sum
-    Config* m_config;
 };
 
 //
 // --- AnyKernel
 //
 
-class AnyKernel : public AggregateKernel
+class AnyKernel : public AggregateKernel<AnyKernel>
 {
 public:
 
@@ -703,7 +1005,9 @@ public:
 
         AggregationAttributeManager& attr() { return m_attr; }
 
-        AggregateKernel* make_kernel() override { return new AnyKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<AnyKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override { m_attr.append_names(names); }
 
         Config(const std::string& name, bool inclusive) : m_attr { name, "any#" } { }
 
@@ -713,28 +1017,31 @@ public:
         }
     };
 
-    AnyKernel(Config* config) : m_config(config) {}
-
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& rec) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
     {
         if (m_val.empty())
-            return apply_to_matching_entries(db, m_config->attr(), rec, [this](const Entry& e) { m_val = e.value(); });
+            return apply_to_matching_entries(db, config.attr(), rec, [this](const Entry& e) { m_val = e.value(); });
         return 1;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& rec) override
+    void merge(const AnyKernel& k)
+    {
+        if (m_val.empty())
+            m_val = k.m_val;
+    }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& rec)
     {
         if (!m_val.empty())
-            rec.push_back(Entry(m_config->attr().derived_attr(db), m_val));
+            rec.push_back(Entry(config.attr().derived_attr(db), m_val));
     }
 
 private:
 
     Variant m_val;
-    Config* m_config;
 };
 
-class VarianceKernel : public AggregateKernel
+class VarianceKernel : public AggregateKernel<VarianceKernel>
 {
 public:
 
@@ -763,7 +1070,7 @@ public:
 
         bool get_statistics_attributes(CaliperMetadataAccessInterface& db, StatisticsAttributes& a)
         {
-            if (!m_target_attr)
+            if (!get_target_attr(db))
                 return false;
             if (a.sum) {
                 a = m_stat_attrs;
@@ -784,21 +1091,27 @@ public:
             return true;
         }
 
-        AggregateKernel* make_kernel() { return new VarianceKernel(this); }
+        KernelStates* make_states() override { return new KernelStatesT<VarianceKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override
+        {
+            for (const char* prefix : { "", "var.count#", "var.sum#", "var.sqsum#" })
+                names.push_back(prefix + m_target_attr_name);
+        }
 
         Config(const std::string& name) : m_target_attr_name(name) {}
 
         static AggregateKernelConfig* create(const std::vector<std::string>& cfg) { return new Config(cfg.front()); }
     };
 
-    VarianceKernel(Config* config) : m_count(0), m_sum(0.0), m_sqsum(0.0), m_config(config) {}
+    VarianceKernel() : m_count(0), m_sum(0.0), m_sqsum(0.0) {}
 
-    int aggregate(CaliperMetadataAccessInterface& db, const EntryList& list) override
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& list)
     {
-        Attribute            target_attr = m_config->get_target_attr(db);
+        Attribute            target_attr = config.get_target_attr(db);
         StatisticsAttributes stat_attr;
 
-        if (!m_config->get_statistics_attributes(db, stat_attr))
+        if (!config.get_statistics_attributes(db, stat_attr))
             return 0;
 
         int count = 0;
@@ -824,12 +1137,19 @@ public:
         return count;
     }
 
-    void append_result(CaliperMetadataAccessInterface& db, EntryList& list) override
+    void merge(const VarianceKernel& k)
+    {
+        m_count += k.m_count;
+        m_sum += k.m_sum;
+        m_sqsum += k.m_sqsum;
+    }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& list)
     {
         if (m_count > 0) {
             StatisticsAttributes stat_attr;
 
-            if (!m_config->get_statistics_attributes(db, stat_attr))
+            if (!config.get_statistics_attributes(db, stat_attr))
                 return;
 
             double avg = m_sum / m_count;
@@ -845,120 +1165,1028 @@ private:
     unsigned m_count;
     double   m_sum;
     double   m_sqsum;
-    Config*  m_config;
 };
 
-enum KernelID {
-    Count         = 0,
-    Sum           = 1,
-    ScaledRatio   = 2,
-    PercentTotal  = 3,
-    InclusiveSum  = 4,
-    Min           = 5,
-    Max           = 6,
-    Avg           = 7,
-    ScaledSum     = 8,
-    IScaledSum    = 9,
-    IPercentTotal = 10,
-    Any           = 11,
-    ScaledCount   = 12,
-    IRatio        = 13,
-    IMin          = 14,
-    IMax          = 15,
-    Variance      = 16
-};
 
-#define MAX_KERNEL_ID Variance
+//
+// --- Order statistics (percentile, median, histogram)
+//
 
-const char* kernel_args[] = { "attribute" };
-const char* sratio_args[] = { "numerator", "denominator", "scale" };
-const char* scale_args[]  = { "attribute", "scale" };
-const char* scount_args[] = { "scale" };
+/// \brief A mergeable sketch for approximate order statistics
+///
+/// Values are counted in logarithmic buckets, starting with 16 buckets per
+/// power of two. A bucket's representative value is then within 2.2%
+/// (2^(1/32) - 1) of each value in it. The sketch holds at most NumBuckets
+/// non-empty buckets: when it needs more, it merges neighboring buckets,
+/// halving its resolution and doubling the error bound. With 1024 buckets,
+/// this only happens if the positive values span more than 64 powers of two.
+/// Values <= 0 are counted separately. Merging two sketches gives the same
+/// result as adding all values into one sketch, so the sketch can be
+/// combined across threads, files, and processes.
+class QuantileSketch
+{
+public:
 
-const QuerySpec::FunctionSignature kernel_signatures[] = {
-    { KernelID::Count, "count", 0, 0, nullptr },
-    { KernelID::Sum, "sum", 1, 1, kernel_args },
-    { KernelID::ScaledRatio, "ratio", 2, 3, sratio_args },
-    { KernelID::PercentTotal, "percent_total", 1, 1, kernel_args },
-    { KernelID::InclusiveSum, "inclusive_sum", 1, 1, kernel_args },
-    { KernelID::Min, "min", 1, 1, kernel_args },
-    { KernelID::Max, "max", 1, 1, kernel_args },
-    { KernelID::Avg, "avg", 1, 1, kernel_args },
-    { KernelID::ScaledSum, "scale", 2, 2, scale_args },
-    { KernelID::IScaledSum, "inclusive_scale", 2, 2, scale_args },
-    { KernelID::IPercentTotal, "inclusive_percent_total", 1, 1, kernel_args },
-    { KernelID::Any, "any", 1, 1, kernel_args },
-    { KernelID::ScaledCount, "scale_count", 1, 1, scount_args },
-    { KernelID::IRatio, "inclusive_ratio", 2, 3, sratio_args },
-    { KernelID::IMin, "inclusive_min", 1, 1, kernel_args },
-    { KernelID::IMax, "inclusive_max", 1, 1, kernel_args },
-    { KernelID::Variance, "variance", 1, 1, kernel_args },
+    static const int NumBuckets       = 1024;
+    static const int BucketsPerOctave = 16;
 
-    QuerySpec::FunctionSignatureTerminator
-};
+private:
 
-const struct KernelInfo {
-    const char* name;
-    AggregateKernelConfig* (*create)(const std::vector<std::string>& cfg);
-} kernel_list[] = { { "count", CountKernel::Config::create },
-                    { "sum", SumKernel::Config::create },
-                    { "ratio", ScaledRatioKernel::Config::create },
-                    { "percent_total", PercentTotalKernel::Config::create },
-                    { "inclusive_sum", SumKernel::Config::create_inclusive },
-                    { "min", MinKernel::Config::create },
-                    { "max", MaxKernel::Config::create },
-                    { "avg", AvgKernel::Config::create },
-                    { "scale", ScaledSumKernel::Config::create },
-                    { "inclusive_scale", ScaledSumKernel::Config::create_inclusive },
-                    { "inclusive_percent_total", PercentTotalKernel::Config::create_inclusive },
-                    { "any", AnyKernel::Config::create },
-                    { "scale_count", ScaledCountKernel::Config::create },
-                    { "inclusive_ratio", ScaledRatioKernel::Config::create_inclusive },
-                    { "inclusive_min", MinKernel::Config::create_inclusive },
-                    { "inclusive_max", MaxKernel::Config::create_inclusive },
-                    { "variance", VarianceKernel::Config::create },
+    int      m_level; ///< number of times the resolution was halved
+    uint64_t m_zeros; ///< number of values <= 0
+    uint64_t m_count;
+    double   m_min;
+    double   m_max;
 
-                    { 0, 0 } };
+    std::vector<std::pair<int, uint64_t>> m_buckets; ///< (key, count), sorted by key
 
-} // namespace
+    static int floor_shift(int key, int level) { return key >= 0 ? key >> level : -((-key - 1) >> level) - 1; }
 
-struct Aggregator::AggregatorImpl {
-    // --- data
+    int bucket_key(double val) const
+    {
+        return floor_shift(static_cast<int>(std::floor(std::log2(val) * BucketsPerOctave)), m_level);
+    }
 
-    std::vector<std::string> m_key_strings;
-    std::vector<Attribute>   m_key_attrs;
+    void collapse()
+    {
+        ++m_level;
 
-    bool m_select_all;
-    bool m_select_nested;
+        size_t n = 0;
 
-    std::vector<AggregateKernelConfig*> m_kernel_configs;
+        for (size_t i = 0; i < m_buckets.size(); ++i) {
+            int key = floor_shift(m_buckets[i].first, 1);
 
-    struct AggregateEntry {
-        std::vector<Entry>                            key;
-        std::vector<std::unique_ptr<AggregateKernel>> kernels;
-        std::size_t                                   next_entry_idx;
-    };
+            if (n > 0 && m_buckets[n - 1].first == key) {
+                m_buckets[n - 1].second += m_buckets[i].second;
+            } else {
+                m_buckets[n++] = std::make_pair(key, m_buckets[i].second);
+            }
+        }
 
-    std::vector<std::unique_ptr<AggregateEntry>> m_entries;
+        m_buckets.resize(n);
+    }
 
-    std::vector<std::size_t> m_hashmap;
+    void add_bucket(int key, uint64_t n)
+    {
+        auto it = std::lower_bound(m_buckets.begin(), m_buckets.end(), std::make_pair(key, static_cast<uint64_t>(0)));
 
-    std::mutex m_lock;
+        if (it != m_buckets.end() && it->first == key)
+            it->second += n;
+        else
+            m_buckets.insert(it, std::make_pair(key, n));
 
-    //
-    // --- parse config
-    //
+        while (m_buckets.size() > static_cast<size_t>(NumBuckets))
+            collapse();
+    }
 
-    void configure(const QuerySpec& spec)
+    void update_range(double min, double max, uint64_t n)
     {
-        //
-        // --- key config
-        //
+        m_min = (m_count == 0 ? min : std::min(m_min, min));
+        m_max = (m_count == 0 ? max : std::max(m_max, max));
+        m_count += n;
+    }
 
-        m_kernel_configs.clear();
-        m_key_strings.clear();
+    /// \brief Representative value of bucket \a key
+    double bucket_value(int key) const
+    {
+        double width = static_cast<double>(1 << m_level) / BucketsPerOctave;
+        return std::min(std::max(std::exp2((key + 0.5) * width), m_min), m_max);
+    }
 
-        m_select_all    = false;
+public:
+
+    QuantileSketch() : m_level(0), m_zeros(0), m_count(0), m_min(0.0), m_max(0.0) {}
+
+    uint64_t count() const { return m_count; }
+    double   min() const { return m_min; }
+    double   max() const { return m_max; }
+    int      level() const { return m_level; }
+    uint64_t zeros() const { return m_zeros; }
+
+    const std::vector<std::pair<int, uint64_t>>& buckets() const { return m_buckets; }
+
+    void add(double val, uint64_t n = 1)
+    {
+        if (val > 0.0)
+            add_bucket(bucket_key(val), n);
+        else
+            m_zeros += n;
+
+        update_range(val, val, n);
+    }
+
+    void merge(const QuantileSketch& other)
+    {
+        if (other.m_count == 0)
+            return;
+
+        while (m_level < other.m_level)
+            collapse();
+
+        for (const auto& b : other.m_buckets)
+            add_bucket(floor_shift(b.first, m_level - other.m_level), b.second);
+
+        m_zeros += other.m_zeros;
+        update_range(other.m_min, other.m_max, other.m_count);
+    }
+
+    /// \brief Estimate the value with rank \a r (0 <= r < count())
+    double value_at_rank(uint64_t r) const
+    {
+        if (r == 0)
+            return m_min;
+        if (r + 1 >= m_count)
+            return m_max;
+        if (r < m_zeros)
+            return std::min(m_min, 0.0);
+
+        uint64_t cum = m_zeros;
+
+        for (const auto& b : m_buckets) {
+            cum += b.second;
+            if (cum > r)
+                return bucket_value(b.first);
+        }
+
+        return m_max;
+    }
+
+    /// \brief Estimate the \a q quantile (0 <= q <= 1), interpolating
+    ///   linearly between ranks like the exact percentile
+    double quantile(double q) const
+    {
+        if (m_count == 0)
+            return 0.0;
+
+        double   rank = q * static_cast<double>(m_count - 1);
+        uint64_t lo   = static_cast<uint64_t>(rank);
+        double   v_lo = value_at_rank(lo);
+
+        return v_lo + (rank - lo) * (value_at_rank(lo + 1) - v_lo);
+    }
+
+    /// \brief Distribute the sketch's values over \a bins equal-width bins
+    ///   between min() and max()
+    void histogram(std::vector<uint64_t>& bins) const
+    {
+        double width = (m_max - m_min) / bins.size();
+
+        auto bin = [&](double v) {
+            size_t b = width > 0.0 ? static_cast<size_t>((v - m_min) / width) : 0;
+            return std::min(b, bins.size() - 1);
+        };
+
+        bins[bin(std::min(m_min, 0.0))] += m_zeros;
+
+        for (const auto& b : m_buckets)
+            bins[bin(bucket_value(b.first))] += b.second;
+    }
+
+    /// \brief Encode a bucket's key and count in a single integer
+    static uint64_t pack_bucket(int key, uint64_t n)
+    {
+        uint64_t zigzag = key >= 0 ? 2 * static_cast<uint64_t>(key) : 2 * static_cast<uint64_t>(-(key + 1)) + 1;
+        return (n << 16) | (zigzag & 0xFFFF);
+    }
+
+    void save(SpillBuffer& buf) const
+    {
+        buf.write(m_level);
+        buf.write(m_zeros);
+        buf.write(m_count);
+        buf.write(m_min);
+        buf.write(m_max);
+        buf.write(static_cast<uint64_t>(m_buckets.size()));
+
+        for (const auto& b : m_buckets) {
+            buf.write(b.first);
+            buf.write(b.second);
+        }
+    }
+
+    void load(SpillBuffer& buf)
+    {
+        uint64_t n = 0;
+
+        buf.read(m_level);
+        buf.read(m_zeros);
+        buf.read(m_count);
+        buf.read(m_min);
+        buf.read(m_max);
+        buf.read(n);
+
+        m_buckets.resize(n);
+
+        for (auto& b : m_buckets) {
+            buf.read(b.first);
+            buf.read(b.second);
+        }
+    }
+
+    /// \brief Restore a sketch from its encoded state
+    void unpack(int level, uint64_t zeros, double min, double max, const std::vector<uint64_t>& packed)
+    {
+        *this   = QuantileSketch();
+        m_level = level;
+        m_zeros = zeros;
+
+        uint64_t count = zeros;
+
+        for (uint64_t p : packed) {
+            uint64_t zigzag = p & 0xFFFF;
+            int      key    = (zigzag & 1) ? -static_cast<int>(zigzag / 2) - 1 : static_cast<int>(zigzag / 2);
+
+            add_bucket(key, p >> 16);
+            count += p >> 16;
+        }
+
+        update_range(min, max, count);
+    }
+};
+
+const int QuantileSketch::NumBuckets;
+const int QuantileSketch::BucketsPerOctave;
+
+/// \brief Computes percentiles, medians, or histograms of an attribute
+///
+/// In exact mode, the kernel stores all values of the attribute in each
+/// group up to MaxExactValues, and switches to the sketch when it holds
+/// more. In sketch mode, it only uses the QuantileSketch. In both modes,
+/// the sketch state is appended to the output records as hidden
+/// attributes, so output records can be aggregated again (e.g., across
+/// processes) with approximate results. Sketch-mode results have a
+/// ".sketch" suffix in their names (e.g., median.sketch#x), so that exact
+/// and sketch-mode ops on the same attribute can be combined.
+class QuantileKernel : public AggregateKernel<QuantileKernel>
+{
+public:
+
+    static const size_t MaxExactValues = 1 << 20;
+
+    enum Op { Percentile, Histogram };
+
+    class Config : public AggregateKernelConfig
+    {
+        std::string m_target_name;
+        std::string m_result_prefix; ///< e.g., "p90", "median.sketch", "histogram"
+        std::string m_result_name;
+        Attribute   m_target_attr;
+
+        Op     m_op;
+        double m_percentile;
+        size_t m_num_bins;
+        bool   m_exact;
+        bool   m_warned;
+
+        // output attributes
+        Attribute              m_result_attr;
+        Attribute              m_hist_min_attr;
+        Attribute              m_hist_max_attr;
+        std::vector<Attribute> m_bin_attrs;
+
+        // sketch state attributes
+        Attribute m_sketch_attr;
+        Attribute m_sketch_level_attr;
+        Attribute m_sketch_zeros_attr;
+        Attribute m_sketch_min_attr;
+        Attribute m_sketch_max_attr;
+
+        static bool parse_mode(const std::vector<std::string>& cfg, size_t pos)
+        {
+            if (cfg.size() <= pos || cfg[pos] == "exact")
+                return true;
+            if (cfg[pos] != "sketch")
+                Log(0).stream() << "aggregator: Unknown percentile mode \"" << cfg[pos] << "\", using exact mode"
+                                << std::endl;
+
+            return cfg[pos] != "sketch";
+        }
+
+        void create_attributes(CaliperMetadataAccessInterface& db)
+        {
+            int prop   = CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS;
+            int h_prop = prop | CALI_ATTR_HIDDEN;
+
+            if (m_op == Percentile) {
+                m_result_attr = db.create_attribute(m_result_name, CALI_TYPE_DOUBLE, prop);
+            } else {
+                m_hist_min_attr = db.create_attribute(m_result_prefix + ".min#" + m_target_name, CALI_TYPE_DOUBLE, prop);
+                m_hist_max_attr = db.create_attribute(m_result_prefix + ".max#" + m_target_name, CALI_TYPE_DOUBLE, prop);
+
+                for (size_t b = 0; b < m_num_bins; ++b)
+                    m_bin_attrs.push_back(db.create_attribute(
+                        m_result_prefix + ".bin." + std::to_string(b) + "#" + m_target_name,
+                        CALI_TYPE_UINT,
+                        prop
+                    ));
+            }
+
+            m_sketch_attr       = db.create_attribute("sketch#" + m_target_name, CALI_TYPE_UINT, h_prop);
+            m_sketch_level_attr = db.create_attribute("sketch.level#" + m_target_name, CALI_TYPE_INT, h_prop);
+            m_sketch_zeros_attr = db.create_attribute("sketch.zeros#" + m_target_name, CALI_TYPE_UINT, h_prop);
+            m_sketch_min_attr   = db.create_attribute("sketch.min#" + m_target_name, CALI_TYPE_DOUBLE, h_prop);
+            m_sketch_max_attr   = db.create_attribute("sketch.max#" + m_target_name, CALI_TYPE_DOUBLE, h_prop);
+        }
+
+    public:
+
+        Config(const std::string& target, const std::string& prefix, Op op, bool exact)
+            : m_target_name { target }
+            , m_result_prefix { prefix }
+            , m_result_name { prefix + "#" + target }
+            , m_op { op }
+            , m_percentile { 50.0 }
+            , m_num_bins { 10 }
+            , m_exact { exact }
+            , m_warned { false }
+        { }
+
+        /// \brief Name prefix of the result attributes of op \a name, given
+        ///   the op's \a cfg arguments with the mode argument at \a mode_pos
+        static std::string result_prefix(const std::string& name, const std::vector<std::string>& cfg, size_t mode_pos)
+        {
+            return cfg.size() > mode_pos && cfg[mode_pos] == "sketch" ? name + ".sketch" : name;
+        }
+
+        Op     op() const { return m_op; }
+        double percentile() const { return m_percentile; }
+        size_t num_bins() const { return m_num_bins; }
+        bool   is_exact() const { return m_exact; }
+
+        KernelStates* make_states() override { return new KernelStatesT<QuantileKernel>(this); }
+
+        void append_input_names(std::vector<std::string>& names) const override
+        {
+            for (const char* prefix : { "", "sketch#", "sketch.level#", "sketch.zeros#", "sketch.min#", "sketch.max#" })
+                names.push_back(prefix + m_target_name);
+        }
+
+        /// \brief Look up the target and sketch state attributes
+        ///
+        /// The sketch state attributes are resolved on their own, so that
+        /// saved percentile results can be re-aggregated even if the raw
+        /// target attribute is not in the input. Returns false if neither
+        /// is present (yet).
+        bool resolve(CaliperMetadataAccessInterface& db)
+        {
+            if (!m_target_attr)
+                m_target_attr = db.get_attribute(m_target_name);
+
+            if (!m_sketch_level_attr && (m_target_attr || db.get_attribute("sketch.level#" + m_target_name)))
+                create_attributes(db);
+
+            return static_cast<bool>(m_sketch_level_attr);
+        }
+
+        /// \brief The raw target attribute; may be invalid
+        Attribute target_attr() const { return m_target_attr; }
+
+        void warn_exact_limit()
+        {
+            if (!m_warned)
+                Log(1).stream() << "aggregator: More than " << MaxExactValues << " values of " << m_target_name
+                                << " in a group, " << m_result_name << " results are approximate" << std::endl;
+
+            m_warned = true;
+        }
+
+        /// \brief Read sketch state entries in \a rec into \a sketch
+        bool read_sketch(const EntryList& rec, QuantileSketch& sketch)
+        {
+            bool     found = false;
+            int      level = 0;
+            uint64_t zeros = 0;
+            double   min   = 0.0;
+            double   max   = 0.0;
+
+            std::vector<uint64_t> packed;
+
+            for (const Entry& e : rec) {
+                if (!e.is_immediate())
+                    continue;
+
+                cali_id_t id = e.attribute();
+
+                if (id == m_sketch_attr.id())
+                    packed.push_back(e.value().to_uint());
+                else if (id == m_sketch_level_attr.id()) {
+                    level = e.value().to_int();
+                    found = true;
+                } else if (id == m_sketch_zeros_attr.id())
+                    zeros = e.value().to_uint();
+                else if (id == m_sketch_min_attr.id())
+                    min = e.value().to_double();
+                else if (id == m_sketch_max_attr.id())
+                    max = e.value().to_double();
+            }
+
+            if (found)
+                sketch.unpack(level, zeros, min, max, packed);
+
+            return found && sketch.count() > 0;
+        }
+
+        /// \brief Append the sketch state to \a list, unless another kernel
+        ///   for the same attribute already did
+        void append_sketch(const QuantileSketch& sketch, EntryList& list)
+        {
+            for (const Entry& e : list)
+                if (e.is_immediate() && e.attribute() == m_sketch_level_attr.id())
+                    return;
+
+            list.push_back(Entry(m_sketch_level_attr, Variant(sketch.level())));
+            list.push_back(Entry(m_sketch_min_attr, Variant(sketch.min())));
+            list.push_back(Entry(m_sketch_max_attr, Variant(sketch.max())));
+
+            if (sketch.zeros() > 0)
+                list.push_back(Entry(m_sketch_zeros_attr, Variant(cali_make_variant_from_uint(sketch.zeros()))));
+
+            for (const auto& b : sketch.buckets())
+                list.push_back(
+                    Entry(m_sketch_attr, Variant(cali_make_variant_from_uint(QuantileSketch::pack_bucket(b.first, b.second))))
+                );
+        }
+
+        void append_result(const std::vector<double>& res, EntryList& list)
+        {
+            if (m_op == Percentile) {
+                list.push_back(Entry(m_result_attr, Variant(res.front())));
+            } else {
+                list.push_back(Entry(m_hist_min_attr, Variant(res[0])));
+                list.push_back(Entry(m_hist_max_attr, Variant(res[1])));
+
+                for (size_t b = 0; b < m_num_bins; ++b)
+                    list.push_back(
+                        Entry(m_bin_attrs[b], Variant(cali_make_variant_from_uint(static_cast<uint64_t>(res[b + 2]))))
+                    );
+            }
+        }
+
+        static AggregateKernelConfig* create_percentile(const std::vector<std::string>& cfg)
+        {
+            const char* str = cfg[1].c_str();
+            char*       end = nullptr;
+            double      p   = std::strtod(str, &end);
+
+            if (end == str || *end != '\0') {
+                Log(0).stream() << "aggregator: Error: Invalid percentile \"" << cfg[1] << "\" in percentile("
+                                << cfg[0] << "," << cfg[1] << ")" << std::endl;
+                return nullptr;
+            }
+
+            Config* c = new Config(cfg[0], result_prefix("p" + cfg[1], cfg, 2), Percentile, parse_mode(cfg, 2));
+            c->m_percentile = std::min(std::max(p, 0.0), 100.0);
+            return c;
+        }
+
+        static AggregateKernelConfig* create_median(const std::vector<std::string>& cfg)
+        {
+            return new Config(cfg[0], result_prefix("median", cfg, 1), Percentile, parse_mode(cfg, 1));
+        }
+
+        static AggregateKernelConfig* create_histogram(const std::vector<std::string>& cfg)
+        {
+            Config* c     = new Config(cfg[0], result_prefix("histogram", cfg, 2), Histogram, parse_mode(cfg, 2));
+            c->m_num_bins = std::min(std::max(std::atoi(cfg[1].c_str()), 1), 100);
+            return c;
+        }
+    };
+
+    int aggregate(Config& config, CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        if (!config.resolve(db))
+            return 0;
+
+        Attribute tgt_attr = config.target_attr();
+        int       count    = 0;
+
+        if (tgt_attr)
+            for (const Entry& e : rec)
+                if (e.is_immediate() && e.attribute() == tgt_attr.id()) {
+                    add(config, e.value().to_double());
+                    ++count;
+                }
+
+        QuantileSketch sketch;
+
+        if (config.read_sketch(rec, sketch)) {
+            merge_sketch(sketch);
+            ++count;
+        }
+
+        return count;
+    }
+
+    void merge(const QuantileKernel& k)
+    {
+        if (k.m_sketch) {
+            merge_sketch(*k.m_sketch);
+            return;
+        }
+
+        // like add(), switch to the sketch when there are too many values
+        if (!m_sketch && m_values.size() + k.m_values.size() > MaxExactValues)
+            make_sketch();
+
+        if (m_sketch)
+            for (double v : k.m_values)
+                m_sketch->add(v);
+        else
+            m_values.insert(m_values.end(), k.m_values.begin(), k.m_values.end());
+    }
+
+    void append_result(Config& config, CaliperMetadataAccessInterface& db, EntryList& list)
+    {
+        // the config may belong to a merged table that never saw an input record
+        if ((m_values.empty() && !m_sketch) || !config.resolve(db))
+            return;
+
+        std::vector<double> res;
+        QuantileSketch      sketch;
+
+        if (m_sketch)
+            sketch = *m_sketch;
+        else
+            for (double v : m_values)
+                sketch.add(v);
+
+        if (config.op() == Percentile) {
+            res.push_back(m_sketch ? sketch.quantile(config.percentile() / 100.0) : exact_percentile(config.percentile()));
+        } else {
+            std::vector<uint64_t> bins(config.num_bins(), 0);
+
+            if (m_sketch)
+                sketch.histogram(bins);
+            else
+                exact_histogram(bins);
+
+            res.push_back(sketch.min());
+            res.push_back(sketch.max());
+
+            for (uint64_t n : bins)
+                res.push_back(static_cast<double>(n));
+        }
+
+        config.append_result(res, list);
+        config.append_sketch(sketch, list);
+    }
+
+    void save(SpillBuffer& buf) const
+    {
+        buf.write(static_cast<bool>(m_sketch));
+
+        if (m_sketch)
+            m_sketch->save(buf);
+        else
+            buf.write_vector(m_values);
+    }
+
+    void load(SpillBuffer& buf)
+    {
+        bool has_sketch = false;
+        buf.read(has_sketch);
+
+        if (has_sketch) {
+            m_sketch.reset(new QuantileSketch);
+            m_sketch->load(buf);
+        } else
+            buf.read_vector(m_values);
+    }
+
+    size_t heap_size() const
+    {
+        size_t size = m_values.capacity() * sizeof(double);
+
+        if (m_sketch)
+            size += sizeof(QuantileSketch) + m_sketch->buckets().capacity() * sizeof(std::pair<int, uint64_t>);
+
+        return size;
+    }
+
+    QuantileKernel() = default;
+    QuantileKernel(QuantileKernel&&) = default;
+
+    QuantileKernel(const QuantileKernel& k)
+        : m_values(k.m_values), m_sketch(k.m_sketch ? new QuantileSketch(*k.m_sketch) : nullptr)
+    { }
+
+private:
+
+    std::vector<double>             m_values;
+    std::unique_ptr<QuantileSketch> m_sketch;
+
+    void make_sketch()
+    {
+        m_sketch.reset(new QuantileSketch);
+
+        for (double v : m_values)
+            m_sketch->add(v);
+
+        std::vector<double>().swap(m_values);
+    }
+
+    void add(Config& config, double val)
+    {
+        if (m_sketch) {
+            m_sketch->add(val);
+        } else if (!config.is_exact()) {
+            make_sketch();
+            m_sketch->add(val);
+        } else {
+            m_values.push_back(val);
+
+            if (m_values.size() > MaxExactValues) {
+                config.warn_exact_limit();
+                make_sketch();
+            }
+        }
+    }
+
+    void merge_sketch(const QuantileSketch& sketch)
+    {
+        if (!m_sketch)
+            make_sketch();
+
+        m_sketch->merge(sketch);
+    }
+
+    /// \brief Linearly interpolated percentile \a p of the stored values
+    double exact_percentile(double p)
+    {
+        double pos = p / 100.0 * (m_values.size() - 1);
+        size_t lo  = static_cast<size_t>(pos);
+
+        std::nth_element(m_values.begin(), m_values.begin() + lo, m_values.end());
+
+        double v_lo = m_values[lo];
+
+        if (lo + 1 >= m_values.size())
+            return v_lo;
+
+        double v_hi = *std::min_element(m_values.begin() + lo + 1, m_values.end());
+
+        return v_lo + (pos - lo) * (v_hi - v_lo);
+    }
+
+    void exact_histogram(std::vector<uint64_t>& bins) const
+    {
+        auto   mm    = std::minmax_element(m_values.begin(), m_values.end());
+        double min   = *mm.first;
+        double width = (*mm.second - min) / bins.size();
+
+        for (double v : m_values) {
+            size_t b = width > 0.0 ? static_cast<size_t>((v - min) / width) : 0;
+            bins[std::min(b, bins.size() - 1)] += 1;
+        }
+    }
+};
+
+const size_t QuantileKernel::MaxExactValues;
+
+enum KernelID {
+    Count         = 0,
+    Sum           = 1,
+    ScaledRatio   = 2,
+    PercentTotal  = 3,
+    InclusiveSum  = 4,
+    Min           = 5,
+    Max           = 6,
+    Avg           = 7,
+    ScaledSum     = 8,
+    IScaledSum    = 9,
+    IPercentTotal = 10,
+    Any           = 11,
+    ScaledCount   = 12,
+    IRatio        = 13,
+    IMin          = 14,
+    IMax          = 15,
+    Variance      = 16,
+    Percentile    = 17,
+    Median        = 18,
+    Histogram     = 19
+};
+
+#define MAX_KERNEL_ID Histogram
+
+const char* kernel_args[] = { "attribute" };
+const char* sratio_args[] = { "numerator", "denominator", "scale" };
+const char* scale_args[]  = { "attribute", "scale" };
+const char* scount_args[] = { "scale" };
+const char* pct_args[]    = { "attribute", "percentile", "mode" };
+const char* median_args[] = { "attribute", "mode" };
+const char* hist_args[]   = { "attribute", "bins", "mode" };
+
+const QuerySpec::FunctionSignature kernel_signatures[] = {
+    { KernelID::Count, "count", 0, 0, nullptr },
+    { KernelID::Sum, "sum", 1, 1, kernel_args },
+    { KernelID::ScaledRatio, "ratio", 2, 3, sratio_args },
+    { KernelID::PercentTotal, "percent_total", 1, 1, kernel_args },
+    { KernelID::InclusiveSum, "inclusive_sum", 1, 1, kernel_args },
+    { KernelID::Min, "min", 1, 1, kernel_args },
+    { KernelID::Max, "max", 1, 1, kernel_args },
+    { KernelID::Avg, "avg", 1, 1, kernel_args },
+    { KernelID::ScaledSum, "scale", 2, 2, scale_args },
+    { KernelID::IScaledSum, "inclusive_scale", 2, 2, scale_args },
+    { KernelID::IPercentTotal, "inclusive_percent_total", 1, 1, kernel_args },
+    { KernelID::Any, "any", 1, 1, kernel_args },
+    { KernelID::ScaledCount, "scale_count", 1, 1, scount_args },
+    { KernelID::IRatio, "inclusive_ratio", 2, 3, sratio_args },
+    { KernelID::IMin, "inclusive_min", 1, 1, kernel_args },
+    { KernelID::IMax, "inclusive_max", 1, 1, kernel_args },
+    { KernelID::Variance, "variance", 1, 1, kernel_args },
+    { KernelID::Percentile, "percentile", 2, 3, pct_args },
+    { KernelID::Median, "median", 1, 2, median_args },
+    { KernelID::Histogram, "histogram", 2, 3, hist_args },
+
+    QuerySpec::FunctionSignatureTerminator
+};
+
+const struct KernelInfo {
+    const char* name;
+    AggregateKernelConfig* (*create)(const std::vector<std::string>& cfg);
+} kernel_list[] = { { "count", CountKernel::Config::create },
+                    { "sum", SumKernel::Config::create },
+                    { "ratio", ScaledRatioKernel::Config::create },
+                    { "percent_total", PercentTotalKernel::Config::create },
+                    { "inclusive_sum", SumKernel::Config::create_inclusive },
+                    { "min", MinKernel::Config::create },
+                    { "max", MaxKernel::Config::create },
+                    { "avg", AvgKernel::Config::create },
+                    { "scale", ScaledSumKernel::Config::create },
+                    { "inclusive_scale", ScaledSumKernel::Config::create_inclusive },
+                    { "inclusive_percent_total", PercentTotalKernel::Config::create_inclusive },
+                    { "any", AnyKernel::Config::create },
+                    { "scale_count", ScaledCountKernel::Config::create },
+                    { "inclusive_ratio", ScaledRatioKernel::Config::create_inclusive },
+                    { "inclusive_min", MinKernel::Config::create_inclusive },
+                    { "inclusive_max", MaxKernel::Config::create_inclusive },
+                    { "variance", VarianceKernel::Config::create },
+                    { "percentile", QuantileKernel::Config::create_percentile },
+                    { "median", QuantileKernel::Config::create_median },
+                    { "histogram", QuantileKernel::Config::create_histogram },
+
+                    { 0, 0 } };
+
+/// \brief Create the kernel configs for the aggregation operations in \a spec
+std::vector<AggregateKernelConfig*> make_kernel_configs(const QuerySpec& spec)
+{
+    std::vector<AggregateKernelConfig*> ret;
+
+    switch (spec.aggregate.selection) {
+    case QuerySpec::AggregationSelection::Default:
+    case QuerySpec::AggregationSelection::All:
+        ret.push_back(CountKernel::Config::create(std::vector<std::string>()));
+        // TODO: pick class.aggregatable attributes
+        break;
+    case QuerySpec::AggregationSelection::List:
+        for (const QuerySpec::AggregationOp& k : spec.aggregate.list) {
+            if (k.op.id >= 0 && k.op.id <= MAX_KERNEL_ID) {
+                AggregateKernelConfig* cfg = (*::kernel_list[k.op.id].create)(k.args);
+
+                // the kernel logs an error if it rejects its arguments
+                if (cfg)
+                    ret.push_back(cfg);
+            } else {
+                Log(0).stream() << "aggregator: Error: Unknown aggregation kernel " << k.op.id << " ("
+                                << (k.op.name ? k.op.name : "") << ")" << std::endl;
+            }
+        }
+        break;
+    case QuerySpec::AggregationSelection::None:
+        break;
+    }
+
+    return ret;
+}
+
+/// \brief Temporary files for aggregation table entries that exceed the
+///   table's memory limit
+///
+/// Entries are hash-partitioned over NumPartitions files, so that each
+/// partition can be merged separately. Each spill level uses a different
+/// partition function: a partition that is itself too large to merge in
+/// memory is split again at the next level. Each entry is stored as a
+/// length-prefixed record holding the CompressedSnapshotRecord-encoded key
+/// and the kernel states. Node and attribute ids refer to the metadata DB
+/// of the aggregation, so spill files are only valid within the process.
+/// The files are created in $TMPDIR (default /tmp) and removed right away.
+/// Writes go through a per-partition buffer whose size is derived from the
+/// table's memory limit.
+class SpillFiles
+{
+public:
+
+    static const int NumPartitions = 16;
+
+private:
+
+    static const size_t MaxWriteBufferSize = 1 << 20;
+
+    int    m_level;
+    size_t m_buffer_size;
+
+    std::FILE*                 m_files[NumPartitions];
+    std::vector<unsigned char> m_buffers[NumPartitions];
+
+    uint64_t m_bytes_written;
+    bool     m_create_failed;
+
+    static std::FILE* create_tmpfile()
+    {
+        const char* dir  = std::getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") + "/cali-aggregate-XXXXXX";
+
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+
+        int fd = mkstemp(name.data());
+
+        if (fd < 0) {
+            Log(0).stream() << "aggregator: Cannot create spill file " << path << ", keeping data in memory"
+                            << std::endl;
+            return nullptr;
+        }
+
+        unlink(name.data());
+
+        return fdopen(fd, "w+b");
+    }
+
+    // Write partition p's buffer to its file. If we can't create the file,
+    // the data stays in memory.
+    bool write_buffer(int p)
+    {
+        std::vector<unsigned char>& buf = m_buffers[p];
+
+        if (buf.empty())
+            return true;
+
+        if (!m_files[p] && !m_create_failed) {
+            m_files[p]       = create_tmpfile();
+            m_create_failed = !m_files[p];
+        }
+
+        if (!m_files[p])
+            return false;
+
+        if (std::fseek(m_files[p], 0, SEEK_END) != 0 || std::fwrite(buf.data(), 1, buf.size(), m_files[p]) != buf.size())
+            Log(0).stream() << "aggregator: Error writing spill file" << std::endl;
+
+        m_bytes_written += buf.size();
+        buf.clear();
+
+        // release storage that a large record grew past the reserved size
+        if (buf.capacity() > m_buffer_size)
+            std::vector<unsigned char>().swap(buf);
+
+        return true;
+    }
+
+public:
+
+    /// \brief Create spill files whose write buffers take up at most a
+    ///   quarter of \a mem_limit bytes in total
+    SpillFiles(int level, std::size_t mem_limit)
+        : m_level(level),
+          m_buffer_size(std::min(mem_limit / (4 * NumPartitions), MaxWriteBufferSize)),
+          m_bytes_written(0),
+          m_create_failed(false)
+    {
+        for (int p = 0; p < NumPartitions; ++p)
+            m_files[p] = nullptr;
+    }
+
+    SpillFiles(const SpillFiles&)            = delete;
+    SpillFiles& operator= (const SpillFiles&) = delete;
+
+    ~SpillFiles()
+    {
+        for (int p = 0; p < NumPartitions; ++p)
+            if (m_files[p])
+                std::fclose(m_files[p]);
+    }
+
+    int level() const { return m_level; }
+
+    uint64_t bytes_written() const { return m_bytes_written; }
+
+    /// \brief Memory reserved for the write buffers
+    std::size_t buffer_size() const { return NumPartitions * m_buffer_size; }
+
+    int partition(std::size_t hash) const
+    {
+        return static_cast<int>((mix_hash(hash, static_cast<uint64_t>(m_level) + 1) >> 32) % NumPartitions);
+    }
+
+    void write(int p, const SpillBuffer& rec)
+    {
+        uint32_t             len  = static_cast<uint32_t>(rec.size());
+        const unsigned char* lenp = reinterpret_cast<const unsigned char*>(&len);
+
+        if (m_buffers[p].capacity() == 0)
+            m_buffers[p].reserve(m_buffer_size);
+
+        m_buffers[p].insert(m_buffers[p].end(), lenp, lenp + sizeof(len));
+        m_buffers[p].insert(m_buffers[p].end(), rec.data(), rec.data() + rec.size());
+
+        if (m_buffers[p].size() >= m_buffer_size)
+            write_buffer(p);
+    }
+
+    /// \brief Invoke \a fn on each record in partition \a p
+    void read(int p, std::function<void(SpillBuffer&)> fn)
+    {
+        SpillBuffer rec;
+        uint32_t    len = 0;
+
+        write_buffer(p);
+
+        if (m_files[p]) {
+            std::FILE* f = m_files[p];
+
+            std::rewind(f);
+
+            while (std::fread(&len, sizeof(len), 1, f) == 1) {
+                if (std::fread(rec.reset(len), 1, len, f) != len) {
+                    Log(0).stream() << "aggregator: Error reading spill file" << std::endl;
+                    break;
+                }
+
+                fn(rec);
+            }
+        }
+
+        // records that could not be written to a file
+
+        const std::vector<unsigned char>& buf = m_buffers[p];
+
+        for (std::size_t pos = 0; pos + sizeof(len) <= buf.size(); pos += len) {
+            std::memcpy(&len, buf.data() + pos, sizeof(len));
+            pos += sizeof(len);
+            std::memcpy(rec.reset(len), buf.data() + pos, len);
+            fn(rec);
+        }
+    }
+};
+
+const int SpillFiles::NumPartitions;
+const size_t SpillFiles::MaxWriteBufferSize;
+
+/// \brief A single-threaded aggregation table
+///
+/// Stores the aggregation keys in an open-addressing hash index that grows
+/// with the number of entries. The kernel states of each aggregation
+/// kernel are stored contiguously in a KernelStates object, indexed by the
+/// entry index.
+///
+/// With a memory limit, the table moves all of its entries into SpillFiles
+/// when their estimated size exceeds the limit. The spilled partitions are
+/// merged one at a time in flush().
+class AggregateTable
+{
+    static const int MaxSpillLevel = 4;
+
+    const QuerySpec& m_spec;
+
+    std::vector<std::string> m_key_strings;
+    std::vector<Attribute>   m_key_attrs;
+
+    bool m_select_all;
+    bool m_select_nested;
+
+    std::vector<AggregateKernelConfig*>        m_kernel_configs;
+    std::vector<std::unique_ptr<KernelStates>> m_kernel_states;
+
+    std::vector<std::vector<Entry>> m_keys;
+    std::vector<std::size_t>        m_hashes;
+
+    // hash index: entry index + 1 for each slot, or 0 for an empty slot
+    std::vector<std::size_t> m_index;
+
+    // scratch space for process()
+    std::vector<const Node*> m_path_nodes;
+    std::vector<const Node*> m_non_path_nodes;
+    std::vector<Entry>       m_key;
+
+    // --- spill state
+
+    std::atomic<std::size_t>    m_mem_limit;  ///< memory limit in bytes, or 0
+    std::size_t                 m_mem_use;    ///< estimated size of keys and fixed-size kernel states
+    std::size_t                 m_entry_size; ///< fixed size of an entry
+    int                         m_level;      ///< spill level, > 0 for partition merge tables
+    std::unique_ptr<SpillFiles> m_spill;
+
+    //
+    // --- parse config
+    //
+
+    void configure(const QuerySpec& spec)
+    {
+        //
+        // --- key config
+        //
+
+        m_select_all    = false;
         m_select_nested = spec.groupby.use_path;
 
         switch (spec.groupby.selection) {
@@ -976,25 +2204,68 @@ struct Aggregator::AggregatorImpl {
         // --- kernel config
         //
 
-        switch (spec.aggregate.selection) {
-        case QuerySpec::AggregationSelection::Default:
-        case QuerySpec::AggregationSelection::All:
-            m_kernel_configs.push_back(CountKernel::Config::create(std::vector<std::string>()));
-            // TODO: pick class.aggregatable attributes
-            break;
-        case QuerySpec::AggregationSelection::List:
-            for (const QuerySpec::AggregationOp& k : spec.aggregate.list) {
-                if (k.op.id >= 0 && k.op.id <= MAX_KERNEL_ID) {
-                    m_kernel_configs.push_back((*::kernel_list[k.op.id].create)(k.args));
-                } else {
-                    Log(0).stream() << "aggregator: Error: Unknown aggregation kernel " << k.op.id << " ("
-                                    << (k.op.name ? k.op.name : "") << ")" << std::endl;
-                }
-            }
-            break;
-        case QuerySpec::AggregationSelection::None:
-            break;
+        m_kernel_configs = ::make_kernel_configs(spec);
+
+        for (AggregateKernelConfig* k_cfg : m_kernel_configs)
+            m_kernel_states.emplace_back(k_cfg->make_states());
+
+        m_entry_size = sizeof(std::vector<Entry>) + sizeof(std::size_t);
+
+        for (const auto& s : m_kernel_states)
+            m_entry_size += s->entry_size();
+    }
+
+    //
+    // --- hash index
+    //
+
+    void grow_index()
+    {
+        std::vector<std::size_t> index(2 * m_index.size(), static_cast<std::size_t>(0));
+        std::size_t              mask = index.size() - 1;
+
+        for (std::size_t i = 0; i < m_hashes.size(); ++i) {
+            std::size_t pos = m_hashes[i] & mask;
+            while (index[pos])
+                pos = (pos + 1) & mask;
+            index[pos] = i + 1;
+        }
+
+        m_index.swap(index);
+    }
+
+    std::size_t get_aggregation_entry(const std::vector<Entry>& key, std::size_t hash)
+    {
+        // --- lookup key
+
+        std::size_t mask = m_index.size() - 1;
+        std::size_t pos  = hash & mask;
+
+        for (; m_index[pos]; pos = (pos + 1) & mask) {
+            std::size_t i = m_index[pos] - 1;
+            if (m_hashes[i] == hash && m_keys[i] == key)
+                return i;
         }
+
+        // --- key not found: create a new entry
+
+        std::size_t idx = m_keys.size();
+
+        m_keys.push_back(key);
+        m_hashes.push_back(hash);
+
+        for (auto& s : m_kernel_states)
+            s->add_entry();
+
+        m_mem_use += m_entry_size + key.size() * sizeof(Entry);
+
+        m_index[pos] = idx + 1;
+
+        // keep the load factor below 3/4
+        if (4 * m_keys.size() > 3 * m_index.size())
+            grow_index();
+
+        return idx;
     }
 
     //
@@ -1026,45 +2297,113 @@ struct Aggregator::AggregatorImpl {
         return false;
     }
 
-    AggregateEntry* get_aggregation_entry(const std::vector<Entry>& key)
+    //
+    // --- spilling
+    //
+
+    void clear_entries()
     {
-        // --- lookup key
+        std::vector<std::vector<Entry>>().swap(m_keys);
+        std::vector<std::size_t>().swap(m_hashes);
+
+        for (auto& s : m_kernel_states)
+            s->clear();
 
-        std::size_t hash = compute_key_hash(key) % m_hashmap.size();
-        for (size_t i = m_hashmap[hash]; i; i = m_entries[i]->next_entry_idx) {
-            if (key == m_entries[i]->key)
-                return m_entries[i].get();
+        m_index.assign(1024, static_cast<std::size_t>(0));
+        m_mem_use = 0;
+    }
+
+    /// \brief Move all entries into the spill files
+    void spill()
+    {
+        if (m_keys.empty())
+            return;
+
+        if (!m_spill) {
+            m_spill.reset(new SpillFiles(m_level, m_mem_limit.load(std::memory_order_relaxed)));
+            Log(2).stream() << "aggregator: Memory limit exceeded, spilling aggregation table (level " << m_level
+                            << ") to disk" << std::endl;
         }
 
-        // --- hash key not found: create a new entry
+        SpillBuffer                rec;
+        std::vector<unsigned char> buf;
 
-        std::vector<std::unique_ptr<AggregateKernel>> kernels;
-        kernels.reserve(m_kernel_configs.size());
+        for (std::size_t i = 0; i < m_keys.size(); ++i) {
+            // worst-case encoding is 30 bytes per entry
+            buf.resize(2 + 30 * m_keys[i].size());
 
-        for (AggregateKernelConfig* k_cfg : m_kernel_configs)
-            kernels.emplace_back(k_cfg->make_kernel());
+            CompressedSnapshotRecord key(buf.size(), buf.data());
+
+            if (key.append(m_keys[i].size(), m_keys[i].data()) > 0)
+                Log(0).stream() << "aggregator: Aggregation key with " << m_keys[i].size()
+                                << " entries is too large to spill, dropping some key entries" << std::endl;
 
-        size_t idx = m_entries.size();
-        m_entries.emplace_back(new AggregateEntry { key, std::move(kernels), m_hashmap[hash] });
-        m_hashmap[hash] = idx;
+            rec.clear();
+            rec.append(key.data(), key.size());
 
-        return m_entries[idx].get();
+            for (const auto& s : m_kernel_states)
+                s->save(i, rec);
+
+            m_spill->write(m_spill->partition(m_hashes[i]), rec);
+        }
+
+        clear_entries();
+    }
+
+    void check_mem_limit()
+    {
+        std::size_t limit = m_mem_limit.load(std::memory_order_relaxed);
+
+        if (limit == 0 || m_level >= MaxSpillLevel)
+            return;
+
+        std::size_t use = m_mem_use + m_index.size() * sizeof(std::size_t) + (m_spill ? m_spill->buffer_size() : 0);
+
+        // kernel states with heap memory, e.g. the values of exact percentiles
+        for (const auto& s : m_kernel_states)
+            use += s->heap_size();
+
+        if (use > limit)
+            spill();
     }
 
+    /// \brief Merge a spilled entry into this table
+    void merge_spilled(CaliperMetadataAccessInterface& db, SpillBuffer& rec)
+    {
+        size_t                       len = 0;
+        CompressedSnapshotRecordView view(rec.read_ptr(), &len);
+
+        rec.skip(len);
+
+        // keys have immediate entries first, the snapshot record has them last
+        std::vector<Entry> key = view.to_entrylist(&db);
+        std::rotate(key.begin(), key.begin() + view.num_nodes(), key.end());
+
+        std::size_t idx = get_aggregation_entry(key, compute_key_hash(key));
+
+        for (auto& s : m_kernel_states)
+            s->load_and_merge(idx, rec);
+    }
+
+    void merge_configs(const AggregateTable& from)
+    {
+        for (size_t k = 0; k < m_kernel_configs.size(); ++k)
+            m_kernel_configs[k]->merge(*from.m_kernel_configs[k]);
+    }
+
+public:
+
+    void set_mem_limit(std::size_t limit) { m_mem_limit.store(limit, std::memory_order_relaxed); }
+
     void process(CaliperMetadataAccessInterface& db, const EntryList& rec)
     {
-        std::lock_guard<std::mutex> g(m_lock);
         update_key_attributes(db);
 
         // --- Unravel nodes, filter for key attributes
 
-        std::vector<const Node*> path_nodes;
-        std::vector<const Node*> non_path_nodes;
-        std::vector<Entry> key;
-
-        path_nodes.reserve(32);
-        non_path_nodes.reserve(32);
-        key.reserve(2 + m_key_attrs.size());
+        m_path_nodes.clear();
+        m_non_path_nodes.clear();
+        m_key.clear();
 
         for (const Entry& e : rec) {
             if (e.is_reference()) {
@@ -1073,56 +2412,82 @@ struct Aggregator::AggregatorImpl {
                     bool is_nested = attr.is_nested();
                     if (m_select_all || (m_select_nested && is_nested) || is_key(attr)) {
                         if (is_nested)
-                            path_nodes.push_back(node);
+                            m_path_nodes.push_back(node);
                         else
-                            non_path_nodes.push_back(node);
+                            m_non_path_nodes.push_back(node);
                     }
                 }
             } else if (is_key(db.get_attribute(e.attribute()))) {
                 // Only include explicitly selected immediate entries in the key.
-                key.emplace_back(e);
+                m_key.emplace_back(e);
             }
         }
 
         // --- Canonicalize key by sorting by attribute ids
 
-        std::sort(key.begin(), key.end(), [](const Entry& a, const Entry& b) {
+        std::sort(m_key.begin(), m_key.end(), [](const Entry& a, const Entry& b) {
             return a.attribute() < b.attribute();
         });
 
         // --- Make node entry for non-path nodes and put it in the key
 
-        if (!non_path_nodes.empty()) {
-            std::reverse(non_path_nodes.begin(), non_path_nodes.end());
-            key.emplace_back(db.make_tree_entry(non_path_nodes.size(), non_path_nodes.data()));
+        if (!m_non_path_nodes.empty()) {
+            std::reverse(m_non_path_nodes.begin(), m_non_path_nodes.end());
+            m_key.emplace_back(db.make_tree_entry(m_non_path_nodes.size(), m_non_path_nodes.data()));
         }
 
         // --- Add path entry to key
 
         Node* path_node = nullptr;
 
-        if (!path_nodes.empty()) {
-            std::reverse(path_nodes.begin(), path_nodes.end());
-            path_node = db.make_tree_entry(path_nodes.size(), path_nodes.data());
-            key.emplace_back(path_node);
+        if (!m_path_nodes.empty()) {
+            std::reverse(m_path_nodes.begin(), m_path_nodes.end());
+            path_node = db.make_tree_entry(m_path_nodes.size(), m_path_nodes.data());
+            m_key.emplace_back(path_node);
         }
 
         // --- Aggregate
 
-        AggregateEntry* entry = get_aggregation_entry(key);
+        std::size_t idx = get_aggregation_entry(m_key, compute_key_hash(m_key));
 
-        for (size_t k = 0; k < entry->kernels.size(); ++k) {
-            int matches = entry->kernels[k]->aggregate(db, rec);
+        for (size_t k = 0; k < m_kernel_states.size(); ++k) {
+            int matches = m_kernel_states[k]->aggregate(idx, db, rec);
 
             // for inclusive kernels, aggregate for all parent nodes as well
             if (m_kernel_configs[k]->is_inclusive() && (matches > 0) && path_node) {
                 for (Node* node = path_node->parent(); node && node->attribute() != CALI_INV_ID; node = node->parent()) {
-                    key.back() = Entry(node);
-                    AggregateEntry* p_entry = get_aggregation_entry(key);
-                    p_entry->kernels[k]->parent_aggregate(db, rec);
+                    m_key.back() = Entry(node);
+                    std::size_t p_idx = get_aggregation_entry(m_key, compute_key_hash(m_key));
+                    m_kernel_states[k]->parent_aggregate(p_idx, db, rec);
                 }
             }
         }
+
+        check_mem_limit();
+    }
+
+    /// \brief Merge the entries of \a from into this table. Both tables
+    ///   must be created from the same query spec, and their keys must
+    ///   refer to the same metadata DB.
+    void merge(CaliperMetadataAccessInterface& db, const AggregateTable& from)
+    {
+        merge_configs(from);
+
+        for (std::size_t i = 0; i < from.m_keys.size(); ++i) {
+            std::size_t idx = get_aggregation_entry(from.m_keys[i], from.m_hashes[i]);
+
+            for (size_t k = 0; k < m_kernel_states.size(); ++k)
+                m_kernel_states[k]->merge(idx, *from.m_kernel_states[k], i);
+
+            check_mem_limit();
+        }
+
+        if (from.m_spill)
+            for (int p = 0; p < SpillFiles::NumPartitions; ++p)
+                from.m_spill->read(p, [this, &db](SpillBuffer& rec) {
+                    merge_spilled(db, rec);
+                    check_mem_limit();
+                });
     }
 
     //
@@ -1131,30 +2496,60 @@ struct Aggregator::AggregatorImpl {
 
     void flush(CaliperMetadataAccessInterface& db, const SnapshotProcessFn push)
     {
-        std::lock_guard<std::mutex> g(m_lock);
+        if (m_spill) {
+            // Merge and flush the spilled partitions one at a time. The
+            // merged partition tables spill again if they exceed the limit.
 
-        for (const auto &entry : m_entries) {
-            if (!entry)
-                continue;
-            std::vector<Entry> rec(entry->key);
-            for (auto const& k : entry->kernels)
-                k->append_result(db, rec);
+            spill();
+
+            for (int p = 0; p < SpillFiles::NumPartitions; ++p) {
+                AggregateTable part(m_spec, m_mem_limit.load(), m_level + 1);
+
+                part.merge_configs(*this);
+                m_spill->read(p, [&part, &db](SpillBuffer& rec) {
+                    part.merge_spilled(db, rec);
+                    part.check_mem_limit();
+                });
+                part.flush(db, push);
+            }
+
+            Log(2).stream() << "aggregator: Merged " << m_spill->bytes_written() << " bytes of spilled data (level "
+                            << m_level << ")" << std::endl;
+
+            return;
+        }
+
+        for (std::size_t i = 0; i < m_keys.size(); ++i) {
+            std::vector<Entry> rec(m_keys[i]);
+            for (auto& s : m_kernel_states)
+                s->append_result(i, db, rec);
             push(db, rec);
         }
     }
 
-    AggregatorImpl(const QuerySpec& spec) : m_select_all(false)
+    AggregateTable(const QuerySpec& spec, std::size_t mem_limit = 0, int level = 0)
+        : m_spec(spec),
+          m_select_all(false),
+          m_select_nested(false),
+          m_mem_limit(mem_limit),
+          m_mem_use(0),
+          m_entry_size(0),
+          m_level(level)
     {
         configure(spec);
 
-        m_entries.reserve(4096);
-        m_hashmap.assign(4096, static_cast<size_t>(0));
-        // zero marks the end of the hash chain, so we must block out slot 0 for actual entries
-        m_entries.emplace_back(std::unique_ptr<AggregateEntry>());
+        m_index.assign(1024, static_cast<std::size_t>(0));
+        m_path_nodes.reserve(32);
+        m_non_path_nodes.reserve(32);
     }
 
-    ~AggregatorImpl()
+    AggregateTable(const AggregateTable&) = delete;
+    AggregateTable& operator= (const AggregateTable&) = delete;
+
+    ~AggregateTable()
     {
+        m_kernel_states.clear();
+
         for (AggregateKernelConfig* c : m_kernel_configs)
             delete c;
 
@@ -1162,6 +2557,96 @@ struct Aggregator::AggregatorImpl {
     }
 };
 
+} // namespace
+
+/// Each thread that adds records to an aggregator gets its own aggregation
+/// table, so concurrent add() calls don't need to synchronize. The tables
+/// are merged when the aggregator is flushed. With a memory limit, the
+/// tables split the limit evenly.
+struct Aggregator::AggregatorImpl {
+    // --- data
+
+    QuerySpec m_spec;
+    uint64_t  m_id;
+
+    std::vector<std::pair<std::thread::id, std::unique_ptr<AggregateTable>>> m_tables;
+    std::mutex m_tables_lock;
+
+    static std::atomic<uint64_t> s_next_id;
+
+    AggregateTable* get_local_table()
+    {
+        // cache the last aggregator/table pair used by this thread
+        struct TableCache {
+            uint64_t        id;
+            AggregateTable* table;
+        };
+
+        static thread_local TableCache cache { 0, nullptr };
+
+        if (cache.id == m_id)
+            return cache.table;
+
+        std::thread::id this_id = std::this_thread::get_id();
+        AggregateTable* table   = nullptr;
+
+        {
+            std::lock_guard<std::mutex> g(m_tables_lock);
+
+            for (auto& p : m_tables)
+                if (p.first == this_id) {
+                    table = p.second.get();
+                    break;
+                }
+
+            if (!table) {
+                m_tables.emplace_back(this_id, std::unique_ptr<AggregateTable>(new AggregateTable(m_spec)));
+                table = m_tables.back().second.get();
+
+                // split the memory limit evenly between the threads' tables
+                for (auto& p : m_tables)
+                    p.second->set_mem_limit(m_spec.aggregation_memory_limit / m_tables.size());
+            }
+        }
+
+        cache.id    = m_id;
+        cache.table = table;
+
+        return table;
+    }
+
+    void process(CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        get_local_table()->process(db, rec);
+    }
+
+    void flush(CaliperMetadataAccessInterface& db, const SnapshotProcessFn push)
+    {
+        std::lock_guard<std::mutex> g(m_tables_lock);
+
+        if (m_tables.empty())
+            return;
+        if (m_tables.size() == 1) {
+            m_tables.front().second->flush(db, push);
+            return;
+        }
+
+        // merge into a temporary table so that the thread-local tables stay
+        // valid for subsequent add() and flush() calls
+
+        AggregateTable merged(m_spec, m_spec.aggregation_memory_limit);
+
+        for (auto& p : m_tables)
+            merged.merge(db, *p.second);
+
+        merged.flush(db, push);
+    }
+
+    AggregatorImpl(const QuerySpec& spec) : m_spec(spec), m_id(s_next_id++) {}
+};
+
+std::atomic<uint64_t> Aggregator::AggregatorImpl::s_next_id { 1 };
+
 Aggregator::Aggregator(const QuerySpec& spec) : mP { new AggregatorImpl(spec) }
 {}
 
@@ -1217,7 +2702,40 @@ std::string Aggregator::get_aggregation_attribute_name(const QuerySpec::Aggregat
         return std::string("imax#") + op.args[0];
     case KernelID::Variance:
         return std::string("variance#") + op.args[0];
+    case KernelID::Percentile:
+        return QuantileKernel::Config::result_prefix("p" + op.args[1], op.args, 2) + "#" + op.args[0];
+    case KernelID::Median:
+        return QuantileKernel::Config::result_prefix("median", op.args, 1) + "#" + op.args[0];
+    case KernelID::Histogram:
+        return QuantileKernel::Config::result_prefix("histogram", op.args, 2) + ".bin.0#" + op.args[0];
     }
 
     return std::string();
 }
+
+std::vector<std::string> Aggregator::get_input_attribute_names(const QuerySpec& spec)
+{
+    std::vector<std::string> ret;
+
+    for (AggregateKernelConfig* cfg : ::make_kernel_configs(spec)) {
+        cfg->append_input_names(ret);
+        delete cfg;
+    }
+
+    return ret;
+}
+
+std::vector<std::string> Aggregator::get_aggregation_attribute_names(const QuerySpec::AggregationOp& op)
+{
+    if (op.op.id != KernelID::Histogram)
+        return { get_aggregation_attribute_name(op) };
+
+    std::string              prefix = QuantileKernel::Config::result_prefix("histogram", op.args, 2);
+    std::vector<std::string> ret { prefix + ".min#" + op.args[0], prefix + ".max#" + op.args[0] };
+    int                      num_bins = std::min(std::max(std::atoi(op.args[1].c_str()), 1), 100);
+
+    for (int b = 0; b < num_bins; ++b)
+        ret.push_back(prefix + ".bin." + std::to_string(b) + "#" + op.args[0]);
+
+    return ret;
+}
@@ -11,6 +11,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <sstream>
 
 using namespace cali;
@@ -86,7 +87,7 @@ struct CalQLParser::CalQLParserImpl {
     std::string            error_msg;
     std::istream::pos_type error_pos;
 
-    enum Clause { None = 0, Aggregate, Format, Group, Select, Sort, Where, Let };
+    enum Clause { None = 0, Aggregate, Format, Group, Select, Sort, Where, Let, Limit };
 
     Clause get_clause_from_word(const std::string& w)
     {
@@ -94,7 +95,7 @@ struct CalQLParser::CalQLParserImpl {
             const char* name;
             Clause      clause;
         } keywords[] = { { "aggregate", Aggregate }, { "format", Format }, { "group", Group }, { "select", Select },
-                         { "order", Sort },          { "where", Where },   { "let", Let },
+                         { "order", Sort },          { "where", Where },   { "let", Let },       { "limit", Limit },
 
                          { nullptr, None } };
 
@@ -304,10 +305,11 @@ struct CalQLParser::CalQLParserImpl {
                             spec.aggregate.list.push_back(op);
                             selection_attr_name = Aggregator::get_aggregation_attribute_name(op);
 
-                            // explicitly add aggregation attribute name to the list
+                            // explicitly add aggregation attribute names to the list
                             if (spec.select.selection != QuerySpec::AttributeSelection::All) {
+                                auto names = Aggregator::get_aggregation_attribute_names(op);
                                 spec.select.selection = QuerySpec::AttributeSelection::List;
-                                spec.select.list.push_back(selection_attr_name);
+                                spec.select.list.insert(spec.select.list.end(), names.begin(), names.end());
                             }
                         }
                     } else {
@@ -588,6 +590,21 @@ struct CalQLParser::CalQLParserImpl {
             parse_clause_from_word(next_keyword, is);
     }
 
+    void parse_limit(std::istream& is)
+    {
+        std::string arg = util::read_word(is, ",;=<>()\n");
+
+        if (arg.empty() || !std::all_of(arg.begin(), arg.end(), ::isdigit)) {
+            set_error("Expected record count for LIMIT, got \"" + arg + "\"", is);
+            return;
+        }
+
+        spec.limit = static_cast<std::size_t>(std::strtoull(arg.c_str(), nullptr, 10));
+
+        if (spec.limit == 0)
+            set_error("LIMIT must be greater than 0", is);
+    }
+
     void parse_clause(Clause clause, std::istream& is)
     {
         switch (clause) {
@@ -614,6 +631,9 @@ struct CalQLParser::CalQLParserImpl {
         case Let:
             parse_let(is);
             break;
+        case Limit:
+            parse_limit(is);
+            break;
         case None:
             // do nothing
             break;
@@ -0,0 +1,451 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// CaliBinaryWriter implementation
+
+#include "caliper/reader/CaliBinaryWriter.h"
+
+#include "calib_format.h"
+
+#include "caliper/common/CaliperMetadataAccessInterface.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+using namespace cali;
+using namespace cali::calib;
+
+namespace
+{
+
+/// \brief Collects the values of one attribute (and value type) in a row group
+struct Column {
+    cali_id_t      attr;
+    cali_attr_type type;
+
+    uint64_t count;
+    uint64_t last_row;
+    uint64_t prev;
+
+    Encoder rows;   // row index deltas
+    Encoder values; // encoded values
+
+    Variant min_val;
+    Variant max_val;
+
+    Column(cali_id_t a, cali_attr_type t) : attr { a }, type { t }, count { 0 }, last_row { 0 }, prev { 0 } {}
+
+    void add(uint64_t row, const Variant& v, uint64_t str_index)
+    {
+        rows.put_uint(row - last_row);
+        last_row = row;
+        ++count;
+
+        switch (type) {
+        case CALI_TYPE_INT:
+        case CALI_TYPE_UINT:
+        case CALI_TYPE_ADDR:
+            {
+                // delta-encode against the previous value
+                uint64_t u = (type == CALI_TYPE_INT ? static_cast<uint64_t>(v.to_int64()) : v.to_uint());
+                values.put_int(static_cast<int64_t>(u - prev));
+                prev = u;
+            }
+            break;
+        case CALI_TYPE_DOUBLE:
+            values.put_double(v.to_double());
+            break;
+        case CALI_TYPE_BOOL:
+            values.put_u8(v.to_bool() ? 1 : 0);
+            break;
+        case CALI_TYPE_TYPE:
+            values.put_uint(static_cast<uint64_t>(v.to_attr_type()));
+            break;
+        case CALI_TYPE_STRING:
+            values.put_uint(str_index);
+            break;
+        default:
+            break;
+        }
+
+        if (has_stats(type)) {
+            if (min_val.empty() || v < min_val)
+                min_val = v;
+            if (max_val.empty() || max_val < v)
+                max_val = v;
+        }
+    }
+};
+
+} // namespace
+
+struct CaliBinaryWriter::CaliBinaryWriterImpl {
+    OutputStream m_os;
+    std::mutex   m_lock;
+
+    size_t   m_rows_per_group;
+    size_t   m_num_written;
+    uint64_t m_pos;
+    bool     m_closed;
+
+    // --- nodes and strings not yet written
+
+    std::set<cali_id_t> m_written_nodes;
+    Encoder             m_nodes;
+    uint64_t            m_num_nodes;
+
+    std::unordered_map<std::string, uint64_t> m_strings;
+    Encoder                                   m_new_strings;
+    uint64_t                                  m_first_new_string;
+
+    // --- the current row group
+
+    uint64_t                                                  m_num_rows;
+    Encoder                                                   m_ref_counts;
+    Encoder                                                   m_ref_ids;
+    uint64_t                                                  m_prev_ref;
+    std::vector<Column>                                       m_columns; // in order of first appearance
+    std::map<std::pair<cali_id_t, cali_attr_type>, size_t>    m_column_index;
+    std::set<cali_id_t>                                       m_group_ref_nodes;
+    std::set<cali_id_t>                                       m_group_ref_attrs;
+
+    // --- the footer index
+
+    Encoder             m_index;
+    uint64_t            m_num_blocks;
+    std::set<cali_id_t> m_all_attrs;
+
+    CaliBinaryWriterImpl(OutputStream& os, size_t rows_per_group)
+        : m_os(os),
+          m_rows_per_group(std::max<size_t>(rows_per_group, 1)),
+          m_num_written(0),
+          m_pos(0),
+          m_closed(false),
+          m_num_nodes(0),
+          m_first_new_string(0),
+          m_num_rows(0),
+          m_prev_ref(0),
+          m_num_blocks(0)
+    {}
+
+    ~CaliBinaryWriterImpl() { close(); }
+
+    void write_raw(const void* data, size_t len)
+    {
+        std::ostream* os = m_os.stream();
+
+        if (m_pos == 0) {
+            Encoder header;
+            header.put_bytes(magic, sizeof(magic));
+            header.put_uint(version);
+
+            os->write(reinterpret_cast<const char*>(header.data()), header.size());
+            m_pos += header.size();
+        }
+
+        os->write(static_cast<const char*>(data), len);
+        m_pos += len;
+    }
+
+    void write_block(BlockKind kind, const Encoder& payload, const Encoder* index_info = nullptr)
+    {
+        Encoder head;
+        head.put_u8(kind);
+        head.put_uint(payload.size());
+
+        if (m_pos == 0) // write the header before taking the block offset
+            write_raw(nullptr, 0);
+
+        m_index.put_u8(kind);
+        m_index.put_uint(m_pos);
+        m_index.put_uint(head.size() + payload.size());
+        if (index_info)
+            m_index.put_bytes(index_info->data(), index_info->size());
+
+        ++m_num_blocks;
+
+        write_raw(head.data(), head.size());
+        write_raw(payload.data(), payload.size());
+    }
+
+    void recursive_write_node(const CaliperMetadataAccessInterface& db, cali_id_t id)
+    {
+        if (id < 11) // don't write the hard-coded metadata nodes
+            return;
+        if (m_written_nodes.count(id) > 0)
+            return;
+
+        Node* node = db.node(id);
+
+        if (!node)
+            return;
+
+        recursive_write_node(db, node->attribute());
+
+        Node* parent = node->parent();
+
+        if (parent && parent->id() != CALI_INV_ID)
+            recursive_write_node(db, parent->id());
+
+        m_nodes.put_uint(id);
+        m_nodes.put_uint(node->attribute());
+        m_nodes.put_uint(parent && parent->id() != CALI_INV_ID ? parent->id() + 1 : 0);
+        m_nodes.put_value(node->data());
+
+        ++m_num_nodes;
+        ++m_num_written;
+
+        m_written_nodes.insert(id);
+    }
+
+    uint64_t string_index(const Variant& v)
+    {
+        size_t len = v.size();
+        const char* str = static_cast<const char*>(v.data());
+
+        if (len > 0 && str[len - 1] == '\0')
+            --len;
+
+        auto ret = m_strings.emplace(std::string(str, len), m_strings.size());
+
+        if (ret.second)
+            m_new_strings.put_string(str, len);
+
+        return ret.first->second;
+    }
+
+    void flush_metadata()
+    {
+        if (m_num_nodes > 0) {
+            Encoder payload;
+            payload.put_uint(m_num_nodes);
+            payload.put_bytes(m_nodes.data(), m_nodes.size());
+
+            write_block(BlockKind::Nodes, payload);
+
+            m_nodes.clear();
+            m_num_nodes = 0;
+        }
+
+        if (m_strings.size() > m_first_new_string) {
+            Encoder payload;
+            payload.put_uint(m_first_new_string);
+            payload.put_uint(m_strings.size() - m_first_new_string);
+            payload.put_bytes(m_new_strings.data(), m_new_strings.size());
+
+            write_block(BlockKind::Strings, payload);
+
+            m_new_strings.clear();
+            m_first_new_string = m_strings.size();
+        }
+    }
+
+    void flush_group()
+    {
+        flush_metadata();
+
+        if (m_num_rows == 0)
+            return;
+
+        Encoder payload;
+        Encoder info;
+
+        payload.put_uint(m_num_rows);
+        payload.put_buffer(m_ref_counts);
+        payload.put_buffer(m_ref_ids);
+        payload.put_uint(m_columns.size());
+
+        info.put_uint(m_num_rows);
+        info.put_uint(m_group_ref_attrs.size());
+        for (cali_id_t attr : m_group_ref_attrs)
+            info.put_uint(attr);
+        info.put_uint(m_columns.size());
+
+        for (const Column& col : m_columns) {
+            payload.put_uint(col.attr);
+            payload.put_u8(static_cast<unsigned char>(col.type));
+            payload.put_uint(col.count);
+            payload.put_buffer(col.rows);
+            payload.put_buffer(col.values);
+
+            info.put_uint(col.attr);
+            info.put_u8(static_cast<unsigned char>(col.type));
+
+            if (!col.min_val.empty()) {
+                info.put_u8(1);
+                info.put_value(col.min_val);
+                info.put_value(col.max_val);
+            } else {
+                info.put_u8(0);
+            }
+        }
+
+        write_block(BlockKind::RowGroup, payload, &info);
+
+        m_num_rows = 0;
+        m_prev_ref = 0;
+        m_ref_counts.clear();
+        m_ref_ids.clear();
+        m_columns.clear();
+        m_column_index.clear();
+        m_group_ref_nodes.clear();
+        m_group_ref_attrs.clear();
+    }
+
+    void add_ref_attributes(const CaliperMetadataAccessInterface& db, cali_id_t id)
+    {
+        if (!m_group_ref_nodes.insert(id).second)
+            return;
+
+        for (const Node* node = db.node(id); node && node->id() != CALI_INV_ID; node = node->parent()) {
+            m_group_ref_attrs.insert(node->attribute());
+            m_all_attrs.insert(node->attribute());
+        }
+    }
+
+    void write_snapshot(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec)
+    {
+        std::lock_guard<std::mutex> g(m_lock);
+
+        uint64_t num_refs = 0;
+
+        for (const Entry& e : rec) {
+            if (e.is_reference()) {
+                cali_id_t id = e.node()->id();
+
+                recursive_write_node(db, id);
+                add_ref_attributes(db, id);
+
+                m_ref_ids.put_int(static_cast<int64_t>(id - m_prev_ref));
+                m_prev_ref = id;
+                ++num_refs;
+            } else if (e.is_immediate()) {
+                Variant        v    = e.value();
+                cali_attr_type type = v.type();
+
+                // like the text format, we can't store binary blobs
+                if (type == CALI_TYPE_INV || type == CALI_TYPE_USR || type == CALI_TYPE_PTR)
+                    continue;
+
+                cali_id_t attr = e.attribute();
+
+                recursive_write_node(db, attr);
+                m_all_attrs.insert(attr);
+
+                auto ret = m_column_index.emplace(std::make_pair(attr, type), m_columns.size());
+
+                if (ret.second)
+                    m_columns.emplace_back(attr, type);
+
+                m_columns[ret.first->second].add(m_num_rows, v, type == CALI_TYPE_STRING ? string_index(v) : 0);
+            }
+        }
+
+        m_ref_counts.put_uint(num_refs);
+
+        ++m_num_written;
+
+        if (++m_num_rows >= m_rows_per_group)
+            flush_group();
+    }
+
+    void write_globals(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec)
+    {
+        std::lock_guard<std::mutex> g(m_lock);
+
+        Encoder  refs;
+        Encoder  imms;
+        uint64_t num_refs = 0;
+        uint64_t num_imms = 0;
+
+        for (const Entry& e : rec) {
+            if (e.is_reference()) {
+                recursive_write_node(db, e.node()->id());
+                refs.put_uint(e.node()->id());
+                ++num_refs;
+            } else if (e.is_immediate()) {
+                recursive_write_node(db, e.attribute());
+                imms.put_uint(e.attribute());
+                imms.put_value(e.value());
+                ++num_imms;
+            }
+        }
+
+        // keep stream order: write pending snapshots and nodes first
+        flush_group();
+
+        Encoder payload;
+        payload.put_uint(num_refs);
+        payload.put_bytes(refs.data(), refs.size());
+        payload.put_uint(num_imms);
+        payload.put_bytes(imms.data(), imms.size());
+
+        write_block(BlockKind::Globals, payload);
+
+        ++m_num_written;
+    }
+
+    void close()
+    {
+        if (m_closed)
+            return;
+
+        flush_group();
+
+        Encoder payload;
+        payload.put_uint(m_num_blocks);
+        payload.put_bytes(m_index.data(), m_index.size());
+        payload.put_uint(m_all_attrs.size());
+        for (cali_id_t attr : m_all_attrs)
+            payload.put_uint(attr);
+
+        if (m_pos == 0) // empty file: still write the header
+            write_raw(nullptr, 0);
+
+        uint64_t index_pos = m_pos;
+
+        write_block(BlockKind::Index, payload);
+
+        Encoder trailer;
+        for (int i = 0; i < 8; ++i)
+            trailer.put_u8(static_cast<unsigned char>(index_pos >> (8 * i)));
+        trailer.put_bytes(trailer_magic, sizeof(trailer_magic));
+
+        write_raw(trailer.data(), trailer.size());
+
+        m_os.stream()->flush();
+        m_closed = true;
+    }
+};
+
+CaliBinaryWriter::CaliBinaryWriter(OutputStream& os, size_t rows_per_group)
+    : mP(new CaliBinaryWriterImpl(os, rows_per_group))
+{}
+
+size_t CaliBinaryWriter::num_written() const
+{
+    return mP ? mP->m_num_written : 0;
+}
+
+void CaliBinaryWriter::write_snapshot(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
+{
+    mP->write_snapshot(db, list);
+}
+
+void CaliBinaryWriter::write_globals(const CaliperMetadataAccessInterface& db, const std::vector<Entry>& list)
+{
+    mP->write_globals(db, list);
+}
+
+void CaliBinaryWriter::close()
+{
+    std::lock_guard<std::mutex> g(mP->m_lock);
+    mP->close();
+}
@@ -3,36 +3,62 @@
 
 #include "caliper/reader/CaliReader.h"
 
+#include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
 
 #include "caliper/common/Log.h"
 
 #include "../common/StringConverter.h"
 
+#include "calib_format.h"
+
 #include <algorithm>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <iterator>
+#include <set>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace cali;
 
 namespace
 {
 
+/// \brief A word in the input buffer
+struct Token {
+    const char* ptr;
+    size_t      len;
+};
+
+/// \brief Parses a single record in a (mutable) input buffer
 class fast_istringstream
 {
-    std::string::iterator it_;
-    std::string::iterator end_;
+    char* it_;
+    char* end_;
 
 public:
 
-    fast_istringstream(std::string::iterator b, std::string::iterator e) : it_ { b }, end_ { e } {}
+    fast_istringstream(char* b, char* e) : it_ { b }, end_ { e } {}
 
     inline bool good() const { return it_ != end_; }
     inline char get() { return *it_++; }
     inline void unget() { --it_; }
 
+    inline char* pos() const { return it_; }
+    inline char* end() const { return end_; }
+    inline void  seek(char* p) { it_ = p; }
+
     inline bool matches(char c)
     {
         if (it_ != end_) {
@@ -61,70 +87,256 @@ public:
 inline uint64_t read_uint64_element(fast_istringstream& is)
 {
     uint64_t ret = 0;
+    char*    p   = is.pos();
+    char*    end = is.end();
 
-    while (is.good()) {
-        char c = is.get();
+    for (; p < end; ++p) {
+        char c = *p;
 
-        if (c == '=' || c == ',') {
-            is.unget();
+        if (c == '=' || c == ',')
             break;
-        }
 
         ret = ret * 10 + static_cast<uint64_t>(c - '0');
     }
 
+    is.seek(p);
     return ret;
 }
 
-inline std::string read_escaped_word(fast_istringstream& is)
+/// \brief Read a word up to the next unescaped ',' or '='.
+///
+/// Returns a token pointing into the input buffer. Words with escaped
+/// characters are unescaped in place, which only ever shortens them.
+inline Token read_escaped_word(fast_istringstream& is)
 {
-    std::string w;
-    w.reserve(32);
-    bool escape = false;
+    char* begin = is.pos();
+    char* end   = is.end();
+    char* p     = begin;
 
-    while (is.good()) {
-        char c = is.get();
+    // fast path: no escapes
 
-        if (escape) {
-            w.push_back(c == 'n' ? '\n' : c);
-            escape = false;
-        } else {
-            if (c == '=' || c == ',') {
-                is.unget();
+    while (p < end && *p != ',' && *p != '=' && *p != '\\')
+        ++p;
+
+    if (p == end || *p != '\\') {
+        is.seek(p);
+        return { begin, static_cast<size_t>(p - begin) };
+    }
+
+    // slow path: unescape in place
+
+    char* out = p;
+
+    while (p < end) {
+        char c = *p;
+
+        if (c == '\\') {
+            if (++p == end)
                 break;
-            } else if (c == '\\') {
-                escape = true;
-            } else {
-                w.push_back(c);
-            }
+            *out++ = (*p == 'n' ? '\n' : *p);
+            ++p;
+        } else if (c == ',' || c == '=') {
+            break;
+        } else {
+            *out++ = *p++;
         }
     }
 
-    return w;
+    is.seek(p);
+    return { begin, static_cast<size_t>(out - begin) };
 }
 
-inline std::vector<cali_id_t> read_id_list(fast_istringstream& is)
+inline void read_id_list(fast_istringstream& is, std::vector<cali_id_t>& list)
 {
-    std::vector<cali_id_t> ret;
-    ret.reserve(8);
+    list.clear();
 
     do {
-        ret.push_back(read_uint64_element(is));
+        list.push_back(read_uint64_element(is));
     } while (is.matches('='));
-
-    return ret;
 }
 
-inline std::vector<std::string> read_string_list(fast_istringstream& is)
+inline void read_string_list(fast_istringstream& is, std::vector<Token>& list)
 {
-    std::vector<std::string> ret;
-    ret.reserve(8);
+    list.clear();
 
     do {
-        ret.emplace_back(read_escaped_word(is));
+        list.push_back(read_escaped_word(is));
     } while (is.matches('='));
+}
 
-    return ret;
+/// \brief Maps a file into memory for reading
+///
+/// The mapping is private and writable so that the parser can unescape
+/// words in place. Modified pages are never written back to the file.
+class MappedFile
+{
+    char*  m_data;
+    size_t m_size;
+
+public:
+
+    MappedFile(const std::string& filename) : m_data { nullptr }, m_size { 0 }
+    {
+        int fd = open(filename.c_str(), O_RDONLY);
+
+        if (fd < 0)
+            return;
+
+        struct stat sb;
+
+        if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0) {
+            void* ptr = mmap(nullptr, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+            if (ptr != MAP_FAILED) {
+                m_data = static_cast<char*>(ptr);
+                m_size = static_cast<size_t>(sb.st_size);
+
+                madvise(ptr, m_size, MADV_SEQUENTIAL);
+            }
+        }
+
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if (m_data)
+            munmap(m_data, m_size);
+    }
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator= (const MappedFile&) = delete;
+
+    char*  data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+inline cali_id_t map_id(cali_id_t id, const IdMap& idmap)
+{
+    auto it = idmap.find(id);
+    return it == idmap.end() ? id : it->second;
+}
+
+/// \brief A block in a binary .calib file
+struct BinaryBlock {
+    calib::BlockKind     kind;
+    const unsigned char* data; ///< payload
+    size_t               size; ///< payload size
+
+    // row group statistics from the footer index
+
+    struct ColumnInfo {
+        cali_id_t      attr;
+        cali_attr_type type;
+        Variant        min_val;
+        Variant        max_val;
+    };
+
+    bool                    has_info;
+    std::vector<cali_id_t>  ref_attrs;
+    std::vector<ColumnInfo> columns;
+};
+
+/// \brief Split a .calib buffer into its blocks. Uses the footer index if
+///   there is one, otherwise scans the blocks sequentially.
+bool read_binary_blocks(const unsigned char* buf, size_t size, std::vector<BinaryBlock>& blocks)
+{
+    calib::Decoder header(buf + sizeof(calib::magic), size - sizeof(calib::magic));
+
+    if (header.get_uint() != calib::version)
+        return false;
+
+    const size_t data_begin = size - header.remaining();
+
+    auto block_at = [buf, size](uint64_t offset, BinaryBlock& block) {
+        if (offset >= size)
+            return false;
+
+        calib::Decoder d(buf + offset, size - offset);
+
+        block.kind     = static_cast<calib::BlockKind>(d.get_u8());
+        block.size     = d.get_uint();
+        block.data     = d.get_bytes(block.size);
+        block.has_info = false;
+
+        return d.ok();
+    };
+
+    // try the footer index
+
+    if (size >= data_begin + calib::trailer_size
+        && memcmp(buf + size - sizeof(calib::trailer_magic), calib::trailer_magic, sizeof(calib::trailer_magic)) == 0) {
+        uint64_t index_pos = 0;
+
+        for (int i = 7; i >= 0; --i)
+            index_pos = (index_pos << 8) | buf[size - calib::trailer_size + i];
+
+        BinaryBlock index;
+
+        if (block_at(index_pos, index) && index.kind == calib::BlockKind::Index) {
+            calib::Decoder d(index.data, index.size);
+            uint64_t       num_blocks = d.get_uint();
+
+            for (uint64_t i = 0; i < num_blocks && d.ok(); ++i) {
+                BinaryBlock block;
+
+                unsigned char kind   = d.get_u8();
+                uint64_t      offset = d.get_uint();
+                d.get_uint(); // size
+
+                if (!block_at(offset, block) || block.kind != kind)
+                    return false;
+
+                if (block.kind == calib::BlockKind::RowGroup) {
+                    d.get_uint(); // num_rows
+
+                    uint64_t num_ref_attrs = d.get_uint();
+                    for (uint64_t a = 0; a < num_ref_attrs && d.ok(); ++a)
+                        block.ref_attrs.push_back(d.get_uint());
+
+                    uint64_t num_columns = d.get_uint();
+                    for (uint64_t c = 0; c < num_columns && d.ok(); ++c) {
+                        BinaryBlock::ColumnInfo info;
+
+                        info.attr = d.get_uint();
+                        info.type = static_cast<cali_attr_type>(d.get_u8());
+
+                        if (d.get_u8()) {
+                            info.min_val = d.get_value();
+                            info.max_val = d.get_value();
+                        }
+
+                        block.columns.push_back(info);
+                    }
+
+                    block.has_info = d.ok();
+                }
+
+                blocks.push_back(block);
+            }
+
+            if (d.ok())
+                return true;
+        }
+
+        blocks.clear();
+    }
+
+    // no (valid) index: the file may be truncated. Read what's there.
+
+    for (size_t pos = data_begin; pos < size;) {
+        BinaryBlock block;
+
+        if (!block_at(pos, block))
+            break;
+        if (block.kind == calib::BlockKind::Index)
+            break;
+
+        blocks.push_back(block);
+        pos = (block.data - buf) + block.size;
+    }
+
+    return true;
 }
 
 } // namespace
@@ -134,7 +346,18 @@ struct CaliReader::CaliReaderImpl {
     std::string  m_error_msg;
     unsigned int m_num_read;
 
-    CaliReaderImpl() : m_error { false } {}
+    // scratch buffers for record parsing
+    std::vector<cali_id_t> m_refs;
+    std::vector<cali_id_t> m_attr;
+    std::vector<Token>     m_data;
+    std::vector<Entry>     m_rec;
+
+    // query hints for binary input
+    bool                              m_select_columns;
+    std::set<std::string>             m_columns;
+    std::vector<QuerySpec::Condition> m_skip_conditions;
+
+    CaliReaderImpl() : m_error { false }, m_select_columns { false } {}
 
     void set_error(const std::string& msg)
     {
@@ -144,16 +367,16 @@ struct CaliReader::CaliReaderImpl {
 
     void read_node(fast_istringstream& is, CaliperMetadataDB& db, IdMap& idmap, NodeProcessFn& node_proc)
     {
-        cali_id_t   attr_id = CALI_INV_ID;
-        cali_id_t   node_id = CALI_INV_ID;
-        cali_id_t   prnt_id = CALI_INV_ID;
-        std::string data_str;
+        cali_id_t attr_id = CALI_INV_ID;
+        cali_id_t node_id = CALI_INV_ID;
+        cali_id_t prnt_id = CALI_INV_ID;
+        Token     data    = { "", 0 };
 
         do {
             if (is.matches(5, "attr="))
                 attr_id = read_uint64_element(is);
             else if (is.matches(5, "data="))
-                data_str = read_escaped_word(is);
+                data = read_escaped_word(is);
             else if (is.matches(3, "id="))
                 node_id = read_uint64_element(is);
             else if (is.matches(7, "parent="))
@@ -167,7 +390,7 @@ struct CaliReader::CaliReaderImpl {
             return;
         }
 
-        const Node* node = db.merge_node(node_id, attr_id, prnt_id, data_str, idmap);
+        const Node* node = db.merge_node(node_id, attr_id, prnt_id, data.ptr, data.len, idmap);
 
         if (node)
             node_proc(db, node);
@@ -175,61 +398,52 @@ struct CaliReader::CaliReaderImpl {
             set_error("Invalid node record");
     }
 
-    void read_snapshot(fast_istringstream& is, CaliperMetadataDB& db, IdMap& idmap, SnapshotProcessFn& snap_proc)
+    void read_entry_lists(fast_istringstream& is)
     {
-        std::vector<cali_id_t>   refs;
-        std::vector<cali_id_t>   attr;
-        std::vector<std::string> data;
+        m_refs.clear();
+        m_attr.clear();
+        m_data.clear();
 
         do {
             if (is.matches(4, "ref="))
-                refs = read_id_list(is);
+                read_id_list(is, m_refs);
             else if (is.matches(5, "attr="))
-                attr = read_id_list(is);
+                read_id_list(is, m_attr);
             else if (is.matches(5, "data="))
-                data = read_string_list(is);
+                read_string_list(is, m_data);
             else
                 break;
         } while (is.matches(','));
 
-        if (attr.size() != data.size())
+        if (m_attr.size() != m_data.size())
             set_error("attr / data size mismatch");
+    }
+
+    void read_snapshot(fast_istringstream& is, CaliperMetadataDB& db, IdMap& idmap, SnapshotProcessFn& snap_proc)
+    {
+        read_entry_lists(is);
 
-        std::vector<Entry> rec;
-        rec.reserve(refs.size() + std::min(attr.size(), data.size()));
+        size_t n_imm = std::min(m_attr.size(), m_data.size());
 
-        for (cali_id_t id : refs)
-            rec.push_back(db.merge_entry(id, idmap));
-        for (size_t i = 0; i < std::min(attr.size(), data.size()); ++i)
-            rec.push_back(db.merge_entry(attr[i], data[i], idmap));
+        m_rec.clear();
+        m_rec.reserve(m_refs.size() + n_imm);
 
-        snap_proc(db, rec);
+        for (cali_id_t id : m_refs)
+            m_rec.push_back(db.merge_entry(id, idmap));
+        for (size_t i = 0; i < n_imm; ++i)
+            m_rec.push_back(db.merge_entry(m_attr[i], m_data[i].ptr, m_data[i].len, idmap));
+
+        snap_proc(db, m_rec);
     }
 
     void read_globals(fast_istringstream& is, CaliperMetadataDB& db, IdMap& idmap)
     {
-        std::vector<cali_id_t>   refs;
-        std::vector<cali_id_t>   attr;
-        std::vector<std::string> data;
+        read_entry_lists(is);
 
-        do {
-            if (is.matches(4, "ref="))
-                refs = read_id_list(is);
-            else if (is.matches(5, "attr="))
-                attr = read_id_list(is);
-            else if (is.matches(5, "data="))
-                data = read_string_list(is);
-            else
-                break;
-        } while (is.matches(','));
-
-        if (attr.size() != data.size())
-            set_error("attr / data size mismatch");
-
-        for (cali_id_t id : refs)
+        for (cali_id_t id : m_refs)
             db.merge_global(id, idmap);
-        for (size_t i = 0; i < std::min(attr.size(), data.size()); ++i)
-            db.merge_global(attr[i], data[i], idmap);
+        for (size_t i = 0; i < std::min(m_attr.size(), m_data.size()); ++i)
+            db.merge_global(m_attr[i], m_data[i].ptr, m_data[i].len, idmap);
     }
 
     void read_record(
@@ -246,20 +460,614 @@ struct CaliReader::CaliReaderImpl {
             read_snapshot(is, db, idmap, snap_proc);
         } else if (is.matches(14, "__rec=globals,")) {
             read_globals(is, db, idmap);
+        } else if (is.matches(14, "__rec=section,")) {
+            // sections of a shared file are independent streams
+            idmap.clear();
+        } else if (is.matches(12, "__rec=index,") || is.matches(16, "__rec=index_end,")) {
+            // shared-file footer index: nothing to do
         } else {
             set_error(std::string("Unknown/invalid record: ") + is.context());
         }
     }
 
+    /// \brief Parse all records in the given buffer. Modifies the buffer.
+    void read_buffer(
+        char*              buf,
+        size_t             size,
+        CaliperMetadataDB& db,
+        IdMap&             idmap,
+        NodeProcessFn&     node_proc,
+        SnapshotProcessFn& snap_proc
+    )
+    {
+        char* end = buf + size;
+
+        for (char* line = buf; line < end;) {
+            char* eol = static_cast<char*>(memchr(line, '\n', end - line));
+
+            if (!eol)
+                eol = end;
+
+            if (eol > line) {
+                fast_istringstream isstream { line, eol };
+                read_record(isstream, db, idmap, node_proc, snap_proc);
+            }
+
+            line = eol + 1;
+        }
+    }
+
+    void read_buffer(char* buf, size_t size, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc)
+    {
+        IdMap idmap;
+        read_buffer(buf, size, db, idmap, node_proc, snap_proc);
+    }
+
+    /// \brief Parse the buffer in parallel, using one thread per entry in
+    ///   \a snap_procs. Modifies the buffer.
+    ///
+    /// The buffer is split into line-aligned chunks. The first pass scans
+    /// the chunks in parallel for records other than snapshots. These are
+    /// few, but must be processed in stream order: the second pass merges
+    /// them serially and builds the id map for each section of the stream.
+    /// In the third pass, the threads decode the snapshot records of their
+    /// chunk in parallel and pass them to their snapshot processor. Snapshots
+    /// within a chunk are processed in stream order.
+    ///
+    /// Because all nodes are merged before any snapshot is decoded,
+    /// snapshots may reference nodes that appear later in the stream.
+    void read_buffer_parallel(
+        char*                              buf,
+        size_t                             size,
+        CaliperMetadataDB&                 db,
+        NodeProcessFn&                     node_proc,
+        std::vector<SnapshotProcessFn>&    snap_procs,
+        const std::function<void(size_t)>& chunk_done
+    )
+    {
+        struct Line {
+            char* begin;
+            char* end;
+        };
+
+        const size_t num_chunks = snap_procs.size();
+        char* const  end        = buf + size;
+
+        // chunk boundaries: each chunk starts at the beginning of a line
+
+        std::vector<char*> chunks(num_chunks + 1, end);
+        chunks[0] = buf;
+
+        for (size_t i = 1; i < num_chunks; ++i) {
+            char* p = std::max(chunks[i - 1], buf + (size / num_chunks) * i);
+
+            if (p > buf && p < end && *(p - 1) != '\n') {
+                p = static_cast<char*>(memchr(p, '\n', end - p));
+                p = (p ? p + 1 : end);
+            }
+
+            chunks[i] = p;
+        }
+
+        auto is_ctx = [](char* b, char* e) {
+            return e - b > 10 && std::equal(b, b + 10, "__rec=ctx,");
+        };
+        auto is_section = [](char* b, char* e) {
+            return e - b > 14 && std::equal(b, b + 14, "__rec=section,");
+        };
+
+        auto for_each_line = [](char* b, char* e, std::function<void(char*, char*)> fn) {
+            for (char* line = b; line < e;) {
+                char* eol = static_cast<char*>(memchr(line, '\n', e - line));
+
+                if (!eol)
+                    eol = e;
+                if (eol > line)
+                    fn(line, eol);
+
+                line = eol + 1;
+            }
+        };
+
+        // --- pass 1: find non-snapshot records
+
+        std::vector<std::vector<Line>> meta_lines(num_chunks);
+
+        {
+            std::vector<std::thread> threads;
+
+            for (size_t i = 0; i < num_chunks; ++i)
+                threads.emplace_back([&, i]() {
+                    for_each_line(chunks[i], chunks[i + 1], [&](char* b, char* e) {
+                        if (!is_ctx(b, e))
+                            meta_lines[i].push_back({ b, e });
+                    });
+                });
+
+            for (auto& t : threads)
+                t.join();
+        }
+
+        // --- pass 2: merge nodes and globals in stream order
+
+        std::deque<IdMap>  idmaps(1);
+        std::vector<char*> section_begin;
+        SnapshotProcessFn  snap_proc_noop = [](CaliperMetadataAccessInterface&, const EntryList&) {};
+
+        for (const auto& lines : meta_lines)
+            for (const Line& line : lines) {
+                if (is_section(line.begin, line.end)) {
+                    section_begin.push_back(line.begin);
+                    idmaps.emplace_back();
+                } else {
+                    fast_istringstream is { line.begin, line.end };
+                    read_record(is, db, idmaps.back(), node_proc, snap_proc_noop);
+                }
+            }
+
+        meta_lines.clear();
+
+        // --- pass 3: decode snapshots in parallel
+
+        std::vector<CaliReaderImpl> workers(num_chunks);
+
+        {
+            std::vector<std::thread> threads;
+
+            for (size_t i = 0; i < num_chunks; ++i)
+                threads.emplace_back([&, i]() {
+                    // id map index: the number of section records before this chunk
+                    size_t section =
+                        std::lower_bound(section_begin.begin(), section_begin.end(), chunks[i]) - section_begin.begin();
+
+                    for_each_line(chunks[i], chunks[i + 1], [&](char* b, char* e) {
+                        if (is_ctx(b, e)) {
+                            fast_istringstream is { b + 10, e };
+                            workers[i].read_snapshot(is, db, idmaps[section], snap_procs[i]);
+                        } else if (is_section(b, e)) {
+                            ++section;
+                        }
+                    });
+
+                    if (chunk_done)
+                        chunk_done(i);
+                });
+
+            for (auto& t : threads)
+                t.join();
+        }
+
+        for (const CaliReaderImpl& w : workers)
+            if (w.m_error && !m_error)
+                set_error(w.m_error_msg);
+    }
+
+    //
+    // --- binary (.calib) input
+    //
+
+    void set_query_hints(const QuerySpec& spec)
+    {
+        typedef QuerySpec::Condition Cond;
+
+        std::set<std::string> targets;
+
+        for (const auto& p : spec.preprocess_ops)
+            targets.insert(p.target);
+
+        // row groups can be skipped if they can't match one of the filter
+        // conditions. Skip conditions on attributes that are created in
+        // preprocessing.
+
+        m_skip_conditions.clear();
+
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            for (const Cond& c : spec.filter.list)
+                if (c.op != Cond::None && c.op != Cond::NotExist && c.op != Cond::NotEqual
+                    && targets.count(c.attr_name) == 0)
+                    m_skip_conditions.push_back(c);
+
+        // collect the attributes that the query uses. Nested (reference)
+        // attributes are always read, this only selects immediate columns.
+
+        bool do_aggregate = spec.aggregate.selection != QuerySpec::AggregationSelection::None;
+
+        m_select_columns = true;
+        m_columns.clear();
+
+        if (do_aggregate) {
+            if (spec.groupby.selection == QuerySpec::AttributeSelection::Default
+                || spec.groupby.selection == QuerySpec::AttributeSelection::All)
+                m_select_columns = false;
+            if (spec.select.selection == QuerySpec::AttributeSelection::All)
+                m_select_columns = false;
+        } else if (spec.select.selection != QuerySpec::AttributeSelection::List) {
+            m_select_columns = false;
+        }
+
+        if (!m_select_columns)
+            return;
+
+        if (spec.select.selection == QuerySpec::AttributeSelection::List)
+            m_columns.insert(spec.select.list.begin(), spec.select.list.end());
+        if (do_aggregate && spec.groupby.selection == QuerySpec::AttributeSelection::List)
+            m_columns.insert(spec.groupby.list.begin(), spec.groupby.list.end());
+        if (do_aggregate) {
+            // kernels also read their own results when re-aggregating
+            // aggregated data
+            std::vector<std::string> names = Aggregator::get_input_attribute_names(spec);
+            m_columns.insert(names.begin(), names.end());
+        }
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            for (const Cond& c : spec.filter.list)
+                m_columns.insert(c.attr_name);
+        if (spec.sort.selection == QuerySpec::SortSelection::List)
+            for (const auto& s : spec.sort.list)
+                m_columns.insert(s.attribute);
+        for (const auto& p : spec.preprocess_ops) {
+            m_columns.insert(p.target);
+            m_columns.insert(p.op.args.begin(), p.op.args.end());
+            m_columns.insert(p.cond.attr_name);
+        }
+    }
+
+    /// \brief Returns \a true if the row group can't match the filter
+    ///   conditions given in the query hints
+    bool skip_row_group(const BinaryBlock& block, CaliperMetadataDB& db, const IdMap& idmap)
+    {
+        typedef QuerySpec::Condition Cond;
+
+        if (!block.has_info)
+            return false;
+
+        for (const Cond& c : m_skip_conditions) {
+            Attribute attr = db.get_attribute(c.attr_name);
+
+            if (!attr) // the attribute doesn't exist (yet), so no record can match
+                return true;
+
+            bool in_refs = false;
+
+            for (cali_id_t id : block.ref_attrs)
+                if (::map_id(id, idmap) == attr.id())
+                    in_refs = true;
+
+            if (in_refs)
+                continue;
+
+            bool    match = false;
+            Variant val   = Variant::from_string(attr.type(), c.value.c_str());
+
+            for (const auto& col : block.columns) {
+                if (::map_id(col.attr, idmap) != attr.id())
+                    continue;
+
+                if (c.op == Cond::Exist || col.min_val.empty() || col.type != val.type()) {
+                    match = true;
+                    break;
+                }
+
+                const Variant& lo = col.min_val;
+                const Variant& hi = col.max_val;
+
+                switch (c.op) {
+                case Cond::Equal:
+                    match = !(val < lo) && !(hi < val);
+                    break;
+                case Cond::LessThan:
+                    match = lo < val;
+                    break;
+                case Cond::GreaterThan:
+                    match = val < hi;
+                    break;
+                case Cond::LessOrEqual:
+                    match = !(val < lo);
+                    break;
+                case Cond::GreaterOrEqual:
+                    match = !(hi < val);
+                    break;
+                default:
+                    match = true;
+                }
+
+                if (match)
+                    break;
+            }
+
+            if (!match)
+                return true;
+        }
+
+        return false;
+    }
+
+    void read_binary_nodes(const BinaryBlock& block, CaliperMetadataDB& db, IdMap& idmap, NodeProcessFn& node_proc)
+    {
+        calib::Decoder d(block.data, block.size);
+        uint64_t       num_nodes = d.get_uint();
+
+        for (uint64_t i = 0; i < num_nodes && d.ok(); ++i) {
+            cali_id_t node_id = d.get_uint();
+            cali_id_t attr_id = d.get_uint();
+            cali_id_t prnt_id = d.get_uint();
+            Variant   data    = d.get_value();
+
+            if (!d.ok())
+                break;
+
+            if (db.get_attribute(::map_id(attr_id, idmap)).is_hidden())
+                data = Variant(CALI_TYPE_USR, nullptr, 0);
+
+            const Node* node =
+                db.merge_node(node_id, attr_id, prnt_id > 0 ? prnt_id - 1 : CALI_INV_ID, data, idmap);
+
+            if (node)
+                node_proc(db, node);
+            else
+                set_error("Invalid node record");
+        }
+
+        if (!d.ok())
+            set_error("Invalid nodes block");
+    }
+
+    void read_binary_strings(const BinaryBlock& block, CaliperMetadataDB& db, std::vector<Variant>& strings)
+    {
+        calib::Decoder d(block.data, block.size);
+
+        uint64_t first = d.get_uint();
+        uint64_t count = d.get_uint();
+
+        if (first != strings.size()) {
+            set_error("Invalid string dictionary block");
+            return;
+        }
+
+        for (uint64_t i = 0; i < count && d.ok(); ++i) {
+            size_t      len = d.get_uint();
+            const char* str = reinterpret_cast<const char*>(d.get_bytes(len));
+
+            if (str)
+                strings.push_back(db.make_string_variant(str, len));
+        }
+
+        if (!d.ok())
+            set_error("Invalid string dictionary block");
+    }
+
+    void read_binary_globals(const BinaryBlock& block, CaliperMetadataDB& db, const IdMap& idmap)
+    {
+        calib::Decoder d(block.data, block.size);
+
+        uint64_t num_refs = d.get_uint();
+        for (uint64_t i = 0; i < num_refs && d.ok(); ++i)
+            db.merge_global(d.get_uint(), idmap);
+
+        uint64_t num_imms = d.get_uint();
+        for (uint64_t i = 0; i < num_imms && d.ok(); ++i) {
+            cali_id_t attr_id = d.get_uint();
+            Variant   val     = d.get_value();
+            Attribute attr    = db.get_attribute(::map_id(attr_id, idmap));
+
+            if (!attr || !attr.is_global() || !d.ok())
+                continue;
+            if (val.type() == CALI_TYPE_STRING)
+                val = db.make_string_variant(static_cast<const char*>(val.data()), val.size());
+
+            db.set_global(attr, val);
+        }
+
+        if (!d.ok())
+            set_error("Invalid globals block");
+    }
+
+    void read_row_group(
+        const BinaryBlock&          block,
+        CaliperMetadataDB&          db,
+        const IdMap&                idmap,
+        const std::vector<Variant>& strings,
+        SnapshotProcessFn&          snap_proc
+    )
+    {
+        calib::Decoder d(block.data, block.size);
+
+        uint64_t num_rows = d.get_uint();
+
+        if (num_rows > block.size) { // each row takes at least one byte
+            set_error("Invalid row group");
+            return;
+        }
+
+        std::vector<EntryList> rows(num_rows);
+
+        // --- references
+
+        {
+            calib::Decoder counts = d.get_buffer();
+            calib::Decoder ids    = d.get_buffer();
+            uint64_t       id     = 0;
+
+            for (EntryList& row : rows) {
+                uint64_t n = counts.get_uint();
+
+                for (uint64_t i = 0; i < n && ids.ok(); ++i) {
+                    id += static_cast<uint64_t>(ids.get_int());
+                    row.push_back(db.merge_entry(id, idmap));
+                }
+            }
+        }
+
+        // --- immediate columns
+
+        uint64_t num_columns = d.get_uint();
+
+        for (uint64_t c = 0; c < num_columns && d.ok(); ++c) {
+            cali_id_t      attr_id = d.get_uint();
+            cali_attr_type type    = static_cast<cali_attr_type>(d.get_u8());
+            uint64_t       count   = d.get_uint();
+            calib::Decoder rowidx  = d.get_buffer();
+            calib::Decoder values  = d.get_buffer();
+
+            Attribute attr = db.get_attribute(::map_id(attr_id, idmap));
+
+            if (!attr)
+                continue;
+            if (m_select_columns && m_columns.count(attr.name()) == 0)
+                continue;
+
+            uint64_t row  = 0;
+            uint64_t prev = 0;
+
+            for (uint64_t i = 0; i < count && values.ok(); ++i) {
+                row += rowidx.get_uint();
+
+                Variant val;
+
+                switch (type) {
+                case CALI_TYPE_INT:
+                case CALI_TYPE_UINT:
+                case CALI_TYPE_ADDR:
+                    {
+                        prev += static_cast<uint64_t>(values.get_int());
+                        val = Variant(type, &prev, sizeof(prev));
+                    }
+                    break;
+                case CALI_TYPE_DOUBLE:
+                    val = Variant(values.get_double());
+                    break;
+                case CALI_TYPE_BOOL:
+                    val = Variant(values.get_u8() != 0);
+                    break;
+                case CALI_TYPE_TYPE:
+                    val = Variant(static_cast<cali_attr_type>(values.get_uint()));
+                    break;
+                case CALI_TYPE_STRING:
+                    {
+                        uint64_t idx = values.get_uint();
+                        if (idx < strings.size())
+                            val = strings[idx];
+                    }
+                    break;
+                default:
+                    break;
+                }
+
+                if (row < num_rows && !val.empty())
+                    rows[row].push_back(Entry(attr, val));
+            }
+
+            if (!rowidx.ok() || !values.ok())
+                set_error("Invalid column data");
+        }
+
+        if (!d.ok())
+            set_error("Invalid row group");
+
+        for (const EntryList& row : rows)
+            snap_proc(db, row);
+    }
+
+    /// \brief Read a .calib buffer. Row groups are decoded in parallel if
+    ///   there is more than one snapshot processor, see read_buffer_parallel().
+    void read_binary(
+        const unsigned char*               buf,
+        size_t                             size,
+        CaliperMetadataDB&                 db,
+        NodeProcessFn&                     node_proc,
+        std::vector<SnapshotProcessFn>&    snap_procs,
+        const std::function<void(size_t)>& chunk_done = nullptr
+    )
+    {
+        std::vector<BinaryBlock> blocks;
+
+        if (!::read_binary_blocks(buf, size, blocks)) {
+            set_error("Unsupported .calib format version");
+            return;
+        }
+
+        IdMap                           idmap;
+        std::vector<Variant>            strings;
+        std::vector<const BinaryBlock*> row_groups;
+
+        for (const BinaryBlock& block : blocks) {
+            switch (block.kind) {
+            case calib::BlockKind::Nodes:
+                read_binary_nodes(block, db, idmap, node_proc);
+                break;
+            case calib::BlockKind::Strings:
+                read_binary_strings(block, db, strings);
+                break;
+            case calib::BlockKind::Globals:
+                read_binary_globals(block, db, idmap);
+                break;
+            case calib::BlockKind::RowGroup:
+                if (!skip_row_group(block, db, idmap))
+                    row_groups.push_back(&block);
+                break;
+            default:
+                break;
+            }
+        }
+
+        const size_t num_chunks = std::min(snap_procs.size(), std::max<size_t>(row_groups.size(), 1));
+
+        if (num_chunks < 2) {
+            for (const BinaryBlock* block : row_groups)
+                read_row_group(*block, db, idmap, strings, snap_procs.front());
+            if (chunk_done)
+                chunk_done(0);
+            return;
+        }
+
+        std::vector<CaliReaderImpl> workers(num_chunks);
+        std::vector<std::thread>    threads;
+
+        for (size_t i = 0; i < num_chunks; ++i)
+            threads.emplace_back([&, i]() {
+                size_t b = (row_groups.size() * i) / num_chunks;
+                size_t e = (row_groups.size() * (i + 1)) / num_chunks;
+
+                workers[i].m_select_columns = m_select_columns;
+                workers[i].m_columns        = m_columns;
+
+                for (size_t g = b; g < e; ++g)
+                    workers[i].read_row_group(*row_groups[g], db, idmap, strings, snap_procs[i]);
+
+                if (chunk_done)
+                    chunk_done(i);
+            });
+
+        for (auto& t : threads)
+            t.join();
+
+        for (const CaliReaderImpl& w : workers)
+            if (w.m_error && !m_error)
+                set_error(w.m_error_msg);
+    }
+
+    void read_binary(const unsigned char* buf, size_t size, CaliperMetadataDB& db, NodeProcessFn& node_proc, SnapshotProcessFn& snap_proc)
+    {
+        std::vector<SnapshotProcessFn> snap_procs { snap_proc };
+        read_binary(buf, size, db, node_proc, snap_procs);
+    }
+
     void read(std::istream& is, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc)
     {
+        if (is.peek() == calib::magic[0]) {
+            std::string buf { std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>() };
+
+            if (calib::has_magic(buf.data(), buf.size())) {
+                read_binary(reinterpret_cast<const unsigned char*>(buf.data()), buf.size(), db, node_proc, snap_proc);
+                return;
+            }
+        }
+
         IdMap idmap;
 
         for (std::string line; std::getline(is, line);) {
             if (line.empty())
                 continue;
-            fast_istringstream isstream { line.begin(), line.end() };
-            read_record(isstream, db, idmap, node_proc, snap_proc);
+            read_buffer(&line[0], line.size(), db, idmap, node_proc, snap_proc);
         }
     }
 };
@@ -280,6 +1088,11 @@ std::string CaliReader::error_msg() const
     return mP->m_error_msg;
 }
 
+void CaliReader::set_query_hints(const QuerySpec& spec)
+{
+    mP->set_query_hints(spec);
+}
+
 void CaliReader::read(std::istream& is, CaliperMetadataDB& db, NodeProcessFn node_proc, SnapshotProcessFn snap_proc)
 {
     mP->read(is, db, node_proc, snap_proc);
@@ -295,6 +1108,27 @@ void CaliReader::read(
     if (filename.empty())
         mP->read(std::cin, db, node_proc, snap_proc);
     else {
+        // Regular files are memory-mapped and parsed in place. Use the
+        // stream reader for everything else (pipes, empty files, or if the
+        // mapping fails).
+
+        MappedFile file(filename);
+
+        if (file.data()) {
+            if (calib::has_magic(file.data(), file.size()))
+                mP->read_binary(
+                    reinterpret_cast<const unsigned char*>(file.data()),
+                    file.size(),
+                    db,
+                    node_proc,
+                    snap_proc
+                );
+            else
+                mP->read_buffer(file.data(), file.size(), db, node_proc, snap_proc);
+
+            return;
+        }
+
         std::ifstream is(filename.c_str());
 
         if (!is) {
@@ -305,4 +1139,118 @@ void CaliReader::read(
 
         mP->read(is, db, node_proc, snap_proc);
     }
-}
\ No newline at end of file
+}
+
+void CaliReader::read_section(
+    const std::string& filename,
+    unsigned           section,
+    CaliperMetadataDB& db,
+    NodeProcessFn      node_proc,
+    SnapshotProcessFn  snap_proc
+)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+
+    if (!is) {
+        mP->set_error(std::string("Cannot open file ") + filename);
+        return;
+    }
+
+    // the fixed-length "__rec=index_end,offset=<20 digits>\n" record at
+    // the end of the file points to the index record
+
+    const std::streamoff index_end_len = 44;
+    std::string          line;
+
+    is.seekg(-index_end_len, std::ios::end);
+    std::getline(is, line);
+
+    if (!is || line.compare(0, 23, "__rec=index_end,offset=") != 0) {
+        mP->set_error(filename + " has no shared-file index");
+        return;
+    }
+
+    uint64_t index_pos = std::stoull(line.substr(23));
+
+    is.seekg(static_cast<std::streamoff>(index_pos));
+    std::getline(is, line);
+
+    std::vector<cali_id_t> ranks;
+    std::vector<cali_id_t> offsets;
+    std::vector<cali_id_t> sizes;
+
+    fast_istringstream isstream { &line[0], &line[0] + line.size() };
+
+    if (isstream.matches(12, "__rec=index,")) {
+        do {
+            if (isstream.matches(5, "rank="))
+                read_id_list(isstream, ranks);
+            else if (isstream.matches(7, "offset="))
+                read_id_list(isstream, offsets);
+            else if (isstream.matches(5, "size="))
+                read_id_list(isstream, sizes);
+            else
+                break;
+        } while (isstream.matches(','));
+    }
+
+    if (offsets.size() != sizes.size() || offsets.empty()) {
+        mP->set_error(filename + ": invalid shared-file index");
+        return;
+    }
+    if (section >= offsets.size()) {
+        mP->set_error(filename + ": no section " + std::to_string(section));
+        return;
+    }
+
+    std::string buf(sizes[section], '\0');
+
+    is.seekg(static_cast<std::streamoff>(offsets[section]));
+    is.read(&buf[0], static_cast<std::streamsize>(buf.size()));
+
+    if (!is) {
+        mP->set_error(filename + ": cannot read section " + std::to_string(section));
+        return;
+    }
+
+    mP->read_buffer(&buf[0], buf.size(), db, node_proc, snap_proc);
+}
+
+void CaliReader::read_parallel(
+    const std::string&              filename,
+    CaliperMetadataDB&              db,
+    NodeProcessFn                   node_proc,
+    std::vector<SnapshotProcessFn>& snap_procs,
+    std::function<void(size_t)>     chunk_done
+)
+{
+    if (snap_procs.empty())
+        return;
+
+    if (snap_procs.size() > 1 && !filename.empty()) {
+        MappedFile file(filename);
+
+        if (file.data()) {
+            if (calib::has_magic(file.data(), file.size()))
+                mP->read_binary(
+                    reinterpret_cast<const unsigned char*>(file.data()),
+                    file.size(),
+                    db,
+                    node_proc,
+                    snap_procs,
+                    chunk_done
+                );
+            else
+                mP->read_buffer_parallel(file.data(), file.size(), db, node_proc, snap_procs, chunk_done);
+
+            return;
+        }
+    }
+
+    // fall back to serial reading, e.g. for stdin or pipes
+
+    read(filename, db, node_proc, snap_procs.front());
+
+    if (chunk_done)
+        chunk_done(0);
+}
@@ -9,11 +9,14 @@
 #include "caliper/common/Node.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 #include <map>
 #include <mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace cali;
@@ -27,20 +30,215 @@ inline cali_id_t map_id(cali_id_t id, const IdMap& idmap)
     return it == idmap.end() ? id : it->second;
 }
 
+inline uint64_t mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// FNV-1a
+inline uint64_t hash_bytes(const void* data, size_t len, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// Number of lock stripes for the node index and the string database
+const size_t num_shards = 64;
+
+inline size_t shard_of(size_t hash)
+{
+    return (hash >> 24) % num_shards;
+}
+
+/// \brief Key for the (parent, attribute, value) -> node index
+struct NodeKey {
+    cali_id_t parent;
+    cali_id_t attr;
+    Variant   data;
+
+    bool operator== (const NodeKey& k) const { return parent == k.parent && attr == k.attr && data == k.data; }
+};
+
+/// \brief Hash a Variant by its normalized value
+///
+/// Numbers hash by numeric value regardless of their type, and doubles with
+/// an integral value hash like the integer. Variants that compare equal
+/// therefore always hash equal, even if Variant::operator== is relaxed to
+/// compare across numeric types.
+inline uint64_t hash_variant(const Variant& v, uint64_t h)
+{
+    cali_variant_t cv = v.c_variant();
+
+    switch (v.type()) {
+    case CALI_TYPE_STRING:
+    case CALI_TYPE_USR:
+        return ::hash_bytes(cv.value.unmanaged_const_ptr, v.size(), h ^ v.size());
+    case CALI_TYPE_INT:
+    case CALI_TYPE_UINT:
+    case CALI_TYPE_ADDR:
+        return ::mix(h ^ cv.value.v_uint);
+    case CALI_TYPE_DOUBLE:
+        {
+            double d = cv.value.v_double;
+
+            if (d == 0.0)
+                return ::mix(h); // +0.0 and -0.0
+            if (d > -9.2e18 && d < 9.2e18 && d == static_cast<double>(static_cast<int64_t>(d)))
+                return ::mix(h ^ static_cast<uint64_t>(static_cast<int64_t>(d)));
+            if (d >= 9.2e18 && d < 1.8e19 && d == static_cast<double>(static_cast<uint64_t>(d)))
+                return ::mix(h ^ static_cast<uint64_t>(d));
+
+            return ::mix(h ^ cv.value.v_uint);
+        }
+    case CALI_TYPE_BOOL:
+        return ::mix(h ^ (cv.value.v_bool ? 1 : 0));
+    case CALI_TYPE_TYPE:
+        return ::mix(h ^ static_cast<uint64_t>(cv.value.v_type));
+    default:
+        return ::mix(h ^ cv.value.v_uint);
+    }
+}
+
+struct NodeKeyHash {
+    size_t operator() (const NodeKey& k) const
+    {
+        return ::mix(::hash_variant(k.data, ::mix(k.parent ^ ::mix(k.attr))));
+    }
+};
+
+struct StringKey {
+    const char* str;
+    size_t      len;
+
+    bool operator== (const StringKey& k) const { return len == k.len && strncmp(str, k.str, len) == 0; }
+};
+
+struct StringKeyHash {
+    size_t operator() (const StringKey& k) const { return ::mix(::hash_bytes(k.str, k.len)); }
+};
+
+/// \brief Node list with lock-free lookup by id
+///
+/// Nodes are stored in chunks of geometrically growing size, so existing
+/// entries never move. Chunk k holds (1 << (first_chunk_bits + k)) nodes.
+class NodeList
+{
+    static const unsigned first_chunk_bits = 10;
+    static const unsigned max_chunks       = 40;
+
+    std::atomic<std::atomic<Node*>*> m_chunks[max_chunks];
+    std::atomic<size_t>              m_size;
+
+    static void locate(size_t id, unsigned& chunk, size_t& offset)
+    {
+        size_t   j = (id >> first_chunk_bits) + 1;
+        unsigned k = 0;
+
+        while (j >>= 1)
+            ++k;
+
+        chunk  = k;
+        offset = id + (size_t(1) << first_chunk_bits) - (size_t(1) << (first_chunk_bits + k));
+    }
+
+public:
+
+    NodeList() : m_size { 0 }
+    {
+        for (auto& c : m_chunks)
+            c.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~NodeList()
+    {
+        for (auto& c : m_chunks)
+            delete[] c.load(std::memory_order_relaxed);
+    }
+
+    NodeList(const NodeList&)            = delete;
+    NodeList& operator= (const NodeList&) = delete;
+
+    size_t size() const { return m_size.load(std::memory_order_acquire); }
+
+    /// \brief Allocate a new node id
+    cali_id_t reserve() { return m_size.fetch_add(1); }
+
+    /// \brief Store \a node with the id given by reserve()
+    void set(cali_id_t id, Node* node)
+    {
+        unsigned k;
+        size_t   offset;
+
+        locate(id, k, offset);
+
+        std::atomic<Node*>* chunk = m_chunks[k].load(std::memory_order_acquire);
+
+        if (!chunk) {
+            size_t              n   = size_t(1) << (first_chunk_bits + k);
+            std::atomic<Node*>* tmp = new std::atomic<Node*>[n];
+
+            for (size_t i = 0; i < n; ++i)
+                tmp[i].store(nullptr, std::memory_order_relaxed);
+
+            if (m_chunks[k].compare_exchange_strong(chunk, tmp, std::memory_order_acq_rel))
+                chunk = tmp;
+            else
+                delete[] tmp; // another thread was faster, chunk is now set
+        }
+
+        chunk[offset].store(node, std::memory_order_release);
+    }
+
+    /// \brief Return the node with the given id, or \a nullptr if it
+    ///   doesn't exist (yet)
+    Node* get(cali_id_t id) const
+    {
+        if (id >= size())
+            return nullptr;
+
+        unsigned k;
+        size_t   offset;
+
+        locate(id, k, offset);
+
+        std::atomic<Node*>* chunk = m_chunks[k].load(std::memory_order_acquire);
+        return chunk ? chunk[offset].load(std::memory_order_acquire) : nullptr;
+    }
+};
+
 } // namespace
 
 struct CaliperMetadataDB::CaliperMetadataDBImpl {
-    Node               m_root;  ///< (Artificial) root node
-    std::vector<Node*> m_nodes; ///< Node list
-    mutable std::mutex m_node_lock;
+    Node     m_root;  ///< (Artificial) root node
+    NodeList m_nodes; ///< Node list
+
+    /// \brief Lock-striped (parent, attribute, value) -> node index
+    struct NodeIndexShard {
+        std::mutex                                      lock;
+        std::unordered_map<NodeKey, Node*, NodeKeyHash> nodes;
+    } m_node_index[num_shards];
 
     Node* m_type_nodes[CALI_MAXTYPE + 1] = { 0 };
 
     std::map<std::string, Node*> m_attributes;
     mutable std::mutex           m_attribute_lock;
 
-    std::vector<const char*> m_string_db;
-    mutable std::mutex       m_string_db_lock;
+    /// \brief Lock-striped string database
+    struct StringShard {
+        std::mutex                                   lock;
+        std::unordered_set<StringKey, StringKeyHash> strings;
+    } m_string_db[num_shards];
 
     std::vector<Entry> m_globals;
     std::mutex         m_globals_lock;
@@ -51,22 +249,9 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
     Attribute m_alias_attr;
     Attribute m_unit_attr;
 
-    inline Node* node(cali_id_t id) const
-    {
-        std::lock_guard<std::mutex> g(m_node_lock);
+    inline Node* node(cali_id_t id) const { return m_nodes.get(id); }
 
-        return id < m_nodes.size() ? m_nodes[id] : nullptr;
-    }
-
-    inline Attribute attribute(cali_id_t id) const
-    {
-        std::lock_guard<std::mutex> g(m_node_lock);
-
-        if (id >= m_nodes.size())
-            return Attribute();
-
-        return Attribute::make_attribute(m_nodes[id]);
-    }
+    inline Attribute attribute(cali_id_t id) const { return Attribute::make_attribute(m_nodes.get(id)); }
 
     void setup_bootstrap_nodes()
     {
@@ -84,36 +269,66 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
             { 11, CALI_TYPE_PTR    }
         };
 
-        m_nodes.resize(12);
+        for (int i = 0; i < 12; ++i)
+            m_nodes.reserve();
 
         for (const auto &t : bootstrap_type_nodes) {
             Node* node = new Node(t.id, 9, cali_make_variant_from_type(t.type));
             m_root.append(node);
-            m_nodes[t.id] = node;
+            m_nodes.set(t.id, node);
             m_type_nodes[t.type] = node;
+            add_to_index(&m_root, node);
+        }
+
+        const struct { uint64_t id; const char* name; cali_attr_type type; } bootstrap_attr_nodes[] = {
+            {  8, "cali.attribute.name", CALI_TYPE_STRING },
+            {  9, "cali.attribute.type", CALI_TYPE_TYPE   },
+            { 10, "cali.attribute.prop", CALI_TYPE_INT    }
+        };
+
+        for (const auto &a : bootstrap_attr_nodes) {
+            Node* node = new Node(a.id, 8, Variant(a.name));
+            m_type_nodes[a.type]->append(node);
+            m_nodes.set(a.id, node);
+            add_to_index(m_type_nodes[a.type], node);
         }
 
-        m_nodes[ 8] = new Node( 8, 8, Variant("cali.attribute.name"));
-        m_nodes[ 9] = new Node( 9, 8, Variant("cali.attribute.type"));
-        m_nodes[10] = new Node(10, 8, Variant("cali.attribute.prop"));
-        
-        m_type_nodes[CALI_TYPE_STRING]->append(m_nodes[ 8]);
-        m_type_nodes[CALI_TYPE_TYPE  ]->append(m_nodes[ 9]);
-        m_type_nodes[CALI_TYPE_INT   ]->append(m_nodes[10]);
+        m_attributes.insert(std::make_pair("cali.attribute.name", m_nodes.get(8)));
+    }
+
+    void add_to_index(Node* parent, Node* node)
+    {
+        NodeKey         key { parent->id(), node->attribute(), node->data() };
+        NodeIndexShard& shard = m_node_index[::shard_of(NodeKeyHash()(key))];
 
-        m_attributes.insert(std::make_pair("cali.attribute.name", m_nodes[8]));
+        std::lock_guard<std::mutex> g(shard.lock);
+        shard.nodes.emplace(key, node);
     }
 
-    Node* create_node(cali_id_t attr_id, const Variant& data, Node* parent)
+    /// \brief Find the child node of \a parent with the given attribute
+    ///   and value, or create it if it doesn't exist. If \a data is a
+    ///   string, it must already be in the string database!
+    Node* find_or_create_node(Node* parent, cali_id_t attr_id, const Variant& data, bool* created = nullptr)
     {
-        // NOTE: We assume that m_node_lock is locked!
+        NodeKey         key { parent->id(), attr_id, data };
+        NodeIndexShard& shard = m_node_index[::shard_of(NodeKeyHash()(key))];
 
-        Node* node = new Node(m_nodes.size(), attr_id, data);
+        std::lock_guard<std::mutex> g(shard.lock);
 
-        m_nodes.push_back(node);
+        auto it = shard.nodes.find(key);
 
-        if (parent)
-            parent->append(node);
+        if (it != shard.nodes.end())
+            return it->second;
+
+        cali_id_t id   = m_nodes.reserve();
+        Node*     node = new Node(id, attr_id, data);
+
+        m_nodes.set(id, node);
+        parent->append(node);
+        shard.nodes.emplace(key, node);
+
+        if (created)
+            *created = true;
 
         return node;
     }
@@ -124,25 +339,26 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
         if (len > 0 && str[len - 1] == '\0')
             --len;
 
-        std::lock_guard<std::mutex> g(m_string_db_lock);
+        StringKey    key { str, len };
+        StringShard& shard = m_string_db[::shard_of(StringKeyHash()(key))];
+
+        std::lock_guard<std::mutex> g(shard.lock);
 
-        auto it = std::lower_bound(m_string_db.begin(), m_string_db.end(), str, [len](const char* a, const char* b) {
-            return strncmp(a, b, len) < 0;
-        });
+        auto it = shard.strings.find(key);
 
-        if (it != m_string_db.end() && strncmp(str, *it, len) == 0 && strlen(*it) == len)
-            return Variant(CALI_TYPE_STRING, *it, len);
+        if (it != shard.strings.end())
+            return Variant(CALI_TYPE_STRING, it->str, len);
 
         char* ptr = new char[len + 1];
-        strncpy(ptr, str, len);
+        memcpy(ptr, str, len);
         ptr[len] = '\0';
 
-        m_string_db.insert(it, ptr);
+        shard.strings.insert(StringKey { ptr, len });
 
         return Variant(CALI_TYPE_STRING, ptr, len);
     }
 
-    Variant make_variant(cali_attr_type type, const std::string& str)
+    Variant make_variant(cali_attr_type type, const char* str, size_t len)
     {
         Variant ret;
 
@@ -154,15 +370,32 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
             Log(0).stream() << "CaliperMetadataDB: Can't read USR data at this point" << std::endl;
             break;
         case CALI_TYPE_STRING:
-            ret = make_string_variant(str.data(), str.size());
+            ret = make_string_variant(str, len);
             break;
         default:
-            ret = Variant::from_string(type, str.c_str());
+            {
+                // Variant::from_string() needs a terminated string. Numbers
+                // are short, so this usually avoids a heap allocation.
+                char buf[64];
+
+                if (len < sizeof(buf)) {
+                    memcpy(buf, str, len);
+                    buf[len] = '\0';
+                    ret = Variant::from_string(type, buf);
+                } else {
+                    ret = Variant::from_string(type, std::string(str, len).c_str());
+                }
+            }
         }
 
         return ret;
     }
 
+    Variant make_variant(cali_attr_type type, const std::string& str)
+    {
+        return make_variant(type, str.data(), str.size());
+    }
+
     /// Merge node given by un-mapped node info from stream with given \a idmap into DB
     /// If \a v_data is a string, it must already be in the string database!
     Node* merge_node(cali_id_t node_id, cali_id_t attr_id, cali_id_t prnt_id, const Variant& v_data)
@@ -180,31 +413,18 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
         Node* parent = &m_root;
 
         if (prnt_id != CALI_INV_ID) {
-            std::lock_guard<std::mutex> g(m_node_lock);
+            parent = node(prnt_id);
 
-            if (prnt_id >= m_nodes.size()) {
+            if (!parent) {
                 Log(0).stream() << "CaliperMetadataDB::merge_node(): Invalid parent node " << prnt_id << " for "
                                 << "id=" << node_id << ", attr=" << attr_id << ", parent=" << prnt_id
                                 << ", value=" << v_data << std::endl;
                 return nullptr;
             }
-
-            parent = m_nodes[prnt_id];
         }
 
-        Node* node     = nullptr;
         bool  new_node = false;
-
-        {
-            std::lock_guard<std::mutex> g(m_node_lock);
-
-            node = parent->find_child_node(attr_id, v_data);
-
-            if (!node) {
-                node     = create_node(attr_id, v_data, parent);
-                new_node = true;
-            }
-        }
+        Node* node     = find_or_create_node(parent, attr_id, v_data, &new_node);
 
         if (new_node && node->attribute() == Attribute::NAME_ATTR_ID) {
             std::lock_guard<std::mutex> g(m_attribute_lock);
@@ -255,7 +475,7 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
         if (!node || node->id() == CALI_INV_ID)
             return nullptr;
         if (node->id() < 12)
-            return m_nodes[node->id()];
+            return m_nodes.get(node->id());
 
         Node* attr_node = recursive_merge_node(db.node(node->attribute()), db);
         Node* parent    = recursive_merge_node(node->parent(), db);
@@ -327,8 +547,6 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
         if (!parent)
             parent = &m_root;
 
-        std::lock_guard<std::mutex> g(m_node_lock);
-
         for (size_t i = 0; i < n; ++i) {
             if (attr[i].store_as_value())
                 continue;
@@ -338,11 +556,7 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
             if (v_data.type() == CALI_TYPE_STRING)
                 v_data = make_string_variant(static_cast<const char*>(data[i].data()), data[i].size());
 
-            node = parent->find_child_node(attr[i].id(), v_data);
-
-            if (!node)
-                node = create_node(attr[i].id(), v_data, parent);
-
+            node   = find_or_create_node(parent, attr[i].id(), v_data);
             parent = node;
         }
 
@@ -356,14 +570,8 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
         if (!parent)
             parent = &m_root;
 
-        std::lock_guard<std::mutex> g(m_node_lock);
-
         for (size_t i = 0; i < n; ++i) {
-            node = parent->find_child_node(nodelist[i]->attribute(), nodelist[i]->data());
-
-            if (!node)
-                node = create_node(nodelist[i]->attribute(), nodelist[i]->data(), parent);
-
+            node   = find_or_create_node(parent, nodelist[i]->attribute(), nodelist[i]->data());
             parent = node;
         }
 
@@ -483,7 +691,6 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
 
     CaliperMetadataDBImpl() : m_root { CALI_INV_ID, CALI_INV_ID, {} }
     {
-        m_nodes.reserve(1000);
         setup_bootstrap_nodes();
 
         m_alias_attr =
@@ -493,10 +700,11 @@ struct CaliperMetadataDB::CaliperMetadataDBImpl {
 
     ~CaliperMetadataDBImpl()
     {
-        for (const char* str : m_string_db)
-            delete[] str;
-        for (Node* n : m_nodes)
-            delete n;
+        for (auto& shard : m_string_db)
+            for (const StringKey& k : shard.strings)
+                delete[] k.str;
+        for (size_t i = 0; i < m_nodes.size(); ++i)
+            delete m_nodes.get(i);
     }
 }; // CaliperMetadataDBImpl
 
@@ -537,6 +745,18 @@ Node* CaliperMetadataDB::merge_node(
     const std::string& data,
     IdMap&             idmap
 )
+{
+    return merge_node(node_id, attr_id, prnt_id, data.data(), data.size(), idmap);
+}
+
+Node* CaliperMetadataDB::merge_node(
+    cali_id_t   node_id,
+    cali_id_t   attr_id,
+    cali_id_t   prnt_id,
+    const char* data,
+    size_t      len,
+    IdMap&      idmap
+)
 {
     Attribute attr = mP->attribute(::map_id(attr_id, idmap));
     Variant   v_data;
@@ -544,7 +764,7 @@ Node* CaliperMetadataDB::merge_node(
     if (attr.is_hidden()) // skip reading data from hidden entries
         v_data = Variant(CALI_TYPE_USR, nullptr, 0);
     else
-        v_data = mP->make_variant(attr.type(), data);
+        v_data = mP->make_variant(attr.type(), data, len);
 
     return mP->merge_node(node_id, attr_id, prnt_id, v_data, idmap);
 }
@@ -573,9 +793,19 @@ Entry CaliperMetadataDB::merge_entry(cali_id_t node_id, const IdMap& idmap)
 }
 
 Entry CaliperMetadataDB::merge_entry(cali_id_t attr_id, const std::string& data, const IdMap& idmap)
+{
+    return merge_entry(attr_id, data.data(), data.size(), idmap);
+}
+
+Entry CaliperMetadataDB::merge_entry(cali_id_t attr_id, const char* data, size_t len, const IdMap& idmap)
 {
     Attribute attr = mP->attribute(::map_id(attr_id, idmap));
-    return attr ? Entry(attr, mP->make_variant(attr.type(), data)) : Entry();
+    return attr ? Entry(attr, mP->make_variant(attr.type(), data, len)) : Entry();
+}
+
+Variant CaliperMetadataDB::make_string_variant(const char* str, size_t len)
+{
+    return mP->make_string_variant(str, len);
 }
 
 void CaliperMetadataDB::merge_global(cali_id_t node_id, const IdMap& idmap)
@@ -584,10 +814,15 @@ void CaliperMetadataDB::merge_global(cali_id_t node_id, const IdMap& idmap)
 }
 
 void CaliperMetadataDB::merge_global(cali_id_t attr_id, const std::string& data, const IdMap& idmap)
+{
+    merge_global(attr_id, data.data(), data.size(), idmap);
+}
+
+void CaliperMetadataDB::merge_global(cali_id_t attr_id, const char* data, size_t len, const IdMap& idmap)
 {
     Attribute attr = mP->attribute(::map_id(attr_id, idmap));
     if (attr)
-        mP->set_global(attr, mP->make_variant(attr.type(), data));
+        mP->set_global(attr, mP->make_variant(attr.type(), data, len));
 }
 
 Node* CaliperMetadataDB::node(cali_id_t id) const
@@ -669,8 +904,14 @@ void CaliperMetadataDB::add_attribute_units(const std::map<std::string, std::str
 
 std::ostream& CaliperMetadataDB::print_statistics(std::ostream& os)
 {
-    os << "CaliperMetadataDB: stored " << mP->m_nodes.size() << " nodes, " << mP->m_string_db.size() << " strings."
-       << std::endl;
+    size_t num_strings = 0;
+
+    for (auto& shard : mP->m_string_db) {
+        std::lock_guard<std::mutex> g(shard.lock);
+        num_strings += shard.strings.size();
+    }
+
+    os << "CaliperMetadataDB: stored " << mP->m_nodes.size() << " nodes, " << num_strings << " strings." << std::endl;
 
     return os;
 }
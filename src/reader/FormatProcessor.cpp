@@ -10,11 +10,16 @@
 #include "TreeFormatter.h"
 #include "UserFormatter.h"
 
+#include "caliper/reader/CaliBinaryWriter.h"
 #include "caliper/reader/CaliWriter.h"
 
 #include "caliper/common/CaliperMetadataAccessInterface.h"
 #include "caliper/common/OutputStream.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
 using namespace cali;
 
 namespace
@@ -25,7 +30,7 @@ const char* tree_kernel_args[]   = { "path-attributes", "column-width", "print-g
 const char* table_kernel_args[]  = { "column-width", "print-globals" };
 const char* json_kernel_args[]   = { "object", "pretty", "quote-all", "separate-nested", "records", "split" };
 
-enum FormatterID { Cali = 0, Json = 1, Expand = 2, Format = 3, Table = 4, Tree = 5, JsonSplit = 6 };
+enum FormatterID { Cali = 0, Json = 1, Expand = 2, Format = 3, Table = 4, Tree = 5, JsonSplit = 6, CaliBinary = 7 };
 
 const QuerySpec::FunctionSignature formatters[] = { { FormatterID::Cali, "cali", 0, 0, nullptr },
                                                     { FormatterID::Json, "json", 0, 6, json_kernel_args },
@@ -34,6 +39,7 @@ const QuerySpec::FunctionSignature formatters[] = { { FormatterID::Cali, "cali",
                                                     { FormatterID::Table, "table", 0, 2, table_kernel_args },
                                                     { FormatterID::Tree, "tree", 0, 3, tree_kernel_args },
                                                     { FormatterID::JsonSplit, "json-split", 0, 0, nullptr },
+                                                    { FormatterID::CaliBinary, "calib", 0, 0, nullptr },
 
                                                     QuerySpec::FunctionSignatureTerminator };
 
@@ -53,12 +59,155 @@ public:
     void flush(CaliperMetadataAccessInterface& db, std::ostream&) { m_writer.write_globals(db, db.get_globals()); }
 };
 
+class CaliBinaryFormatter : public Formatter
+{
+    CaliBinaryWriter m_writer;
+
+public:
+
+    CaliBinaryFormatter(OutputStream& os) : m_writer(CaliBinaryWriter(os)) {}
+
+    void process_record(CaliperMetadataAccessInterface& db, const EntryList& list)
+    {
+        m_writer.write_snapshot(db, list);
+    }
+
+    void flush(CaliperMetadataAccessInterface& db, std::ostream&)
+    {
+        m_writer.write_globals(db, db.get_globals());
+        m_writer.close();
+    }
+};
+
+/// \brief Implements LIMIT: keeps the first n records in ORDER BY order
+///   in a bounded heap, so we never hold more than n records in memory.
+///   Without ORDER BY, the first n input records are passed through.
+class RecordLimit
+{
+    struct Item {
+        std::vector<Variant> key;
+        uint64_t             seq;
+        EntryList            rec;
+    };
+
+    std::vector<QuerySpec::SortSpec> m_sort;
+    std::vector<Attribute>           m_sort_attrs;
+
+    std::size_t m_limit;
+    uint64_t    m_seq;
+
+    std::vector<Item> m_heap;
+    std::mutex        m_lock;
+
+    // Returns true if lhs comes before rhs in the output. The formatters
+    // apply one stable sort per ORDER BY attribute, which makes the last
+    // attribute the primary sort key; we rank records the same way.
+    bool before(const Item& lhs, const Item& rhs) const
+    {
+        for (std::size_t i = m_sort.size(); i > 0; --i) {
+            const Variant& a = lhs.key[i - 1];
+            const Variant& b = rhs.key[i - 1];
+
+            if (m_sort[i - 1].order == QuerySpec::SortSpec::Descending) {
+                if (b < a)
+                    return true;
+                if (a < b)
+                    return false;
+            } else {
+                if (a < b)
+                    return true;
+                if (b < a)
+                    return false;
+            }
+        }
+
+        return lhs.seq < rhs.seq;
+    }
+
+    static Variant get_value(const EntryList& rec, cali_id_t attr_id)
+    {
+        for (const Entry& e : rec) {
+            Variant v = e.value(attr_id);
+
+            if (!v.empty())
+                return v;
+        }
+
+        return Variant();
+    }
+
+public:
+
+    RecordLimit(const QuerySpec& spec) : m_limit(spec.limit), m_seq(0)
+    {
+        if (spec.sort.selection == QuerySpec::SortSelection::List)
+            m_sort = spec.sort.list;
+
+        m_sort_attrs.resize(m_sort.size());
+    }
+
+    /// \brief Add \a rec. Returns \a true if \a rec should be passed on to
+    ///   the formatter immediately.
+    bool add(CaliperMetadataAccessInterface& db, const EntryList& rec)
+    {
+        std::lock_guard<std::mutex> g(m_lock);
+
+        if (m_sort.empty())
+            return m_seq++ < m_limit;
+
+        Item item { {}, m_seq++, {} };
+        item.key.reserve(m_sort.size());
+
+        for (std::size_t i = 0; i < m_sort.size(); ++i) {
+            // aggregation result attributes may only appear during flush
+            if (!m_sort_attrs[i])
+                m_sort_attrs[i] = db.get_attribute(m_sort[i].attribute);
+
+            item.key.push_back(m_sort_attrs[i] ? get_value(rec, m_sort_attrs[i].id()) : Variant());
+        }
+
+        auto cmp = [this](const Item& lhs, const Item& rhs) { return before(lhs, rhs); };
+
+        if (m_heap.size() >= m_limit) {
+            // the heap top is the last record in the current selection
+            if (!before(item, m_heap.front()))
+                return false;
+
+            std::pop_heap(m_heap.begin(), m_heap.end(), cmp);
+            m_heap.pop_back();
+        }
+
+        item.rec = rec;
+        m_heap.push_back(std::move(item));
+        std::push_heap(m_heap.begin(), m_heap.end(), cmp);
+
+        return false;
+    }
+
+    /// \brief Move the selected records into \a out in output order
+    void flush(std::vector<EntryList>& out)
+    {
+        std::lock_guard<std::mutex> g(m_lock);
+
+        std::sort_heap(m_heap.begin(), m_heap.end(), [this](const Item& lhs, const Item& rhs) {
+            return before(lhs, rhs);
+        });
+
+        for (Item& item : m_heap)
+            out.push_back(std::move(item.rec));
+
+        m_heap.clear();
+    }
+};
+
 } // namespace
 
 struct FormatProcessor::FormatProcessorImpl {
     Formatter*   m_formatter;
     OutputStream m_stream;
 
+    std::unique_ptr<RecordLimit> m_limit;
+
     void create_formatter(const QuerySpec& spec)
     {
         if (spec.format.opt == QuerySpec::FormatSpec::Default) {
@@ -86,6 +235,9 @@ struct FormatProcessor::FormatProcessorImpl {
             case FormatterID::JsonSplit:
                 m_formatter = new JsonSplitFormatter(spec);
                 break;
+            case FormatterID::CaliBinary:
+                m_formatter = new CaliBinaryFormatter(m_stream);
+                break;
             }
         }
     }
@@ -93,6 +245,9 @@ struct FormatProcessor::FormatProcessorImpl {
     FormatProcessorImpl(OutputStream& stream, const QuerySpec& spec) : m_formatter(nullptr), m_stream(stream)
     {
         create_formatter(spec);
+
+        if (spec.limit > 0)
+            m_limit.reset(new RecordLimit(spec));
     }
 
     ~FormatProcessorImpl() { delete m_formatter; }
@@ -109,13 +264,25 @@ const QuerySpec::FunctionSignature* FormatProcessor::formatter_defs()
 
 void FormatProcessor::process_record(CaliperMetadataAccessInterface& db, const EntryList& rec)
 {
-    if (mP->m_formatter)
-        mP->m_formatter->process_record(db, rec);
+    if (!mP->m_formatter)
+        return;
+    if (mP->m_limit && !mP->m_limit->add(db, rec))
+        return;
+
+    mP->m_formatter->process_record(db, rec);
 }
 
 void FormatProcessor::flush(CaliperMetadataAccessInterface& db)
 {
     if (mP->m_formatter) {
+        if (mP->m_limit) {
+            std::vector<EntryList> recs;
+            mP->m_limit->flush(recs);
+
+            for (const EntryList& rec : recs)
+                mP->m_formatter->process_record(db, rec);
+        }
+
         std::ostream* os = mP->m_stream.stream();
         mP->m_formatter->flush(db, *os);
     }
@@ -181,8 +181,10 @@ struct JsonSplitFormatter::JsonSplitFormatterImpl {
             if (spec.groupby.selection == QuerySpec::AttributeSelection::List) {
                 m_attr_names.insert(m_attr_names.end(), spec.groupby.list.begin(), spec.groupby.list.end());
 
-                for (auto op : spec.aggregate.list)
-                    m_attr_names.push_back(Aggregator::get_aggregation_attribute_name(op));
+                for (auto op : spec.aggregate.list) {
+                    auto names = Aggregator::get_aggregation_attribute_names(op);
+                    m_attr_names.insert(m_attr_names.end(), names.begin(), names.end());
+                }
 
                 m_select_path = spec.groupby.use_path;
             } else {
@@ -0,0 +1,273 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file calib_format.h
+/// Definitions and encoding helpers for the binary columnar .calib format
+
+#pragma once
+
+#include "caliper/common/Variant.h"
+
+#include "../common/util/vlenc.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace cali
+{
+
+namespace calib
+{
+
+//   A .calib file consists of a header, a sequence of blocks, and a trailer:
+//
+//   header  : magic[8] version(vlenc)
+//   block   : kind(u8) size(vlenc) payload[size]
+//   trailer : index_offset(u64, little endian) trailer_magic[8]
+//
+//   Nodes and strings blocks always precede the row groups that use them.
+// The index block at the end lists the offset, size, and (for row groups)
+// the column statistics of every other block in the file.
+
+const unsigned char magic[8]         = { 0x89, 'C', 'A', 'L', 'I', 'B', '\r', '\n' };
+const unsigned char trailer_magic[8] = { 'C', 'A', 'L', 'I', 'B', 'E', 'N', 'D' };
+
+const uint64_t version      = 1;
+const size_t   trailer_size = 16;
+
+enum BlockKind : unsigned char { Nodes = 1, Strings = 2, RowGroup = 3, Globals = 4, Index = 5 };
+
+inline bool has_magic(const void* buf, size_t size)
+{
+    return size >= sizeof(magic) && memcmp(buf, magic, sizeof(magic)) == 0;
+}
+
+inline uint64_t zigzag_encode(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t zigzag_decode(uint64_t v)
+{
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+/// \brief Whether we keep min/max statistics for columns of type \a type
+inline bool has_stats(cali_attr_type type)
+{
+    return type == CALI_TYPE_INT || type == CALI_TYPE_UINT || type == CALI_TYPE_DOUBLE || type == CALI_TYPE_ADDR;
+}
+
+/// \brief Appends encoded values to a byte buffer
+class Encoder
+{
+    std::vector<unsigned char> m_buf;
+
+public:
+
+    void put_u8(unsigned char c) { m_buf.push_back(c); }
+
+    void put_uint(uint64_t val)
+    {
+        unsigned char tmp[10];
+        m_buf.insert(m_buf.end(), tmp, tmp + vlenc_u64(val, tmp));
+    }
+
+    void put_int(int64_t val) { put_uint(zigzag_encode(val)); }
+
+    void put_double(double val)
+    {
+        uint64_t u;
+        memcpy(&u, &val, sizeof(u));
+
+        for (int i = 0; i < 8; ++i)
+            m_buf.push_back(static_cast<unsigned char>(u >> (8 * i)));
+    }
+
+    void put_bytes(const void* data, size_t len)
+    {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        m_buf.insert(m_buf.end(), p, p + len);
+    }
+
+    void put_string(const void* data, size_t len)
+    {
+        put_uint(len);
+        put_bytes(data, len);
+    }
+
+    void put_buffer(const Encoder& enc)
+    {
+        put_uint(enc.size());
+        put_bytes(enc.data(), enc.size());
+    }
+
+    /// \brief Write a self-describing (type-tagged) value
+    void put_value(const Variant& v)
+    {
+        cali_attr_type type = v.type();
+
+        put_u8(static_cast<unsigned char>(type));
+
+        switch (type) {
+        case CALI_TYPE_INT:
+            put_int(v.to_int64());
+            break;
+        case CALI_TYPE_UINT:
+        case CALI_TYPE_ADDR:
+        case CALI_TYPE_PTR:
+            put_uint(v.to_uint());
+            break;
+        case CALI_TYPE_DOUBLE:
+            put_double(v.to_double());
+            break;
+        case CALI_TYPE_BOOL:
+            put_u8(v.to_bool() ? 1 : 0);
+            break;
+        case CALI_TYPE_TYPE:
+            put_uint(static_cast<uint64_t>(v.to_attr_type()));
+            break;
+        case CALI_TYPE_STRING:
+            {
+                size_t len = v.size();
+                // don't store terminating NULL characters
+                if (len > 0 && static_cast<const char*>(v.data())[len - 1] == '\0')
+                    --len;
+                put_string(v.data(), len);
+            }
+            break;
+        default: // CALI_TYPE_INV, CALI_TYPE_USR: no data
+            break;
+        }
+    }
+
+    const unsigned char* data() const { return m_buf.data(); }
+    size_t               size() const { return m_buf.size(); }
+    bool                 empty() const { return m_buf.empty(); }
+    void                 clear() { m_buf.clear(); }
+};
+
+/// \brief Reads encoded values from a byte buffer. Reads past the end
+///   of the buffer return zeros and set an error flag.
+class Decoder
+{
+    const unsigned char* m_p;
+    const unsigned char* m_end;
+    bool                 m_ok;
+
+public:
+
+    Decoder(const unsigned char* p, size_t size) : m_p { p }, m_end { p + size }, m_ok { true } {}
+
+    bool   ok() const { return m_ok; }
+    bool   done() const { return m_p >= m_end; }
+    size_t remaining() const { return m_p < m_end ? static_cast<size_t>(m_end - m_p) : 0; }
+
+    const unsigned char* pos() const { return m_p; }
+
+    unsigned char get_u8()
+    {
+        if (m_p >= m_end) {
+            m_ok = false;
+            return 0;
+        }
+        return *m_p++;
+    }
+
+    uint64_t get_uint()
+    {
+        if (m_end - m_p >= 10) {
+            size_t inc = 0;
+            uint64_t val = vldec_u64(m_p, &inc);
+            m_p += inc;
+            return val;
+        }
+
+        uint64_t val = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+            unsigned char c = get_u8();
+            val |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if (!(c & 0x80))
+                break;
+        }
+
+        return val;
+    }
+
+    int64_t get_int() { return zigzag_decode(get_uint()); }
+
+    double get_double()
+    {
+        uint64_t u = 0;
+
+        for (int i = 0; i < 8; ++i)
+            u |= static_cast<uint64_t>(get_u8()) << (8 * i);
+
+        double val;
+        memcpy(&val, &u, sizeof(val));
+        return val;
+    }
+
+    const unsigned char* get_bytes(size_t len)
+    {
+        if (static_cast<size_t>(m_end - m_p) < len) {
+            m_ok = false;
+            m_p  = m_end;
+            return nullptr;
+        }
+
+        const unsigned char* ret = m_p;
+        m_p += len;
+        return ret;
+    }
+
+    /// \brief Read a length-prefixed sub-buffer
+    Decoder get_buffer()
+    {
+        size_t               len = get_uint();
+        const unsigned char* p   = get_bytes(len);
+
+        return p ? Decoder(p, len) : Decoder(m_end, 0);
+    }
+
+    /// \brief Read a self-describing (type-tagged) value. String values
+    ///   point into the decoder's buffer.
+    Variant get_value()
+    {
+        cali_attr_type type = static_cast<cali_attr_type>(get_u8());
+
+        switch (type) {
+        case CALI_TYPE_INT:
+            return Variant(cali_make_variant_from_int64(get_int()));
+        case CALI_TYPE_UINT:
+        case CALI_TYPE_ADDR:
+        case CALI_TYPE_PTR:
+            {
+                uint64_t u = get_uint();
+                return Variant(type, &u, sizeof(u));
+            }
+        case CALI_TYPE_DOUBLE:
+            return Variant(get_double());
+        case CALI_TYPE_BOOL:
+            return Variant(get_u8() != 0);
+        case CALI_TYPE_TYPE:
+            return Variant(static_cast<cali_attr_type>(get_uint()));
+        case CALI_TYPE_STRING:
+            {
+                size_t               len = get_uint();
+                const unsigned char* p   = get_bytes(len);
+                return p ? Variant(CALI_TYPE_STRING, p, len) : Variant();
+            }
+        case CALI_TYPE_USR:
+            return Variant(CALI_TYPE_USR, nullptr, 0);
+        default:
+            return Variant();
+        }
+    }
+};
+
+} // namespace calib
+
+} // namespace cali
@@ -7,6 +7,9 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <cmath>
+#include <map>
+#include <thread>
 
 using namespace cali;
 
@@ -988,3 +991,475 @@ TEST(AggregatorTest, PercentTotalKernel)
     EXPECT_DOUBLE_EQ(dict[attr_pct.id()].value().to_double(), 0.0);
     EXPECT_DOUBLE_EQ(dict[attr_ipct.id()].value().to_double(), 100.0);
 }
+
+TEST(AggregatorTest, ConcurrentAdd)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx      = db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_NESTED);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    // make a two-level tree with 8 x 8 leaves
+
+    std::vector<cali_id_t> leaves;
+    cali_id_t              node_id = 100;
+
+    for (int i = 0; i < 8; ++i) {
+        cali_id_t parent_id = node_id++;
+        db.merge_node(parent_id, ctx.id(), CALI_INV_ID, Variant(i), idmap);
+
+        for (int j = 0; j < 8; ++j) {
+            db.merge_node(node_id, ctx.id(), parent_id, Variant(100 * i + j), idmap);
+            leaves.push_back(node_id++);
+        }
+    }
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("count"));
+    spec.aggregate.list.push_back(::make_op("sum", "val"));
+    spec.aggregate.list.push_back(::make_op("min", "val"));
+    spec.aggregate.list.push_back(::make_op("max", "val"));
+    spec.aggregate.list.push_back(::make_op("avg", "val"));
+    spec.aggregate.list.push_back(::make_op("inclusive_sum", "val"));
+    spec.aggregate.list.push_back(::make_op("percent_total", "val"));
+
+    const int num_threads = 4;
+    const int num_records = 4000;
+
+    std::vector<EntryList> records;
+
+    for (int i = 0; i < num_threads * num_records; ++i) {
+        cali_id_t id  = leaves[i % leaves.size()];
+        cali_id_t val = val_attr.id();
+        Variant   v(i % 97);
+
+        records.push_back(db.merge_snapshot(1, &id, 1, &val, &v, idmap));
+    }
+
+    auto to_strings = [](const std::vector<EntryList>& recs, CaliperMetadataAccessInterface& db) {
+        std::vector<std::map<std::string, std::string>> ret;
+
+        for (const EntryList& rec : recs) {
+            std::map<std::string, std::string> m;
+            for (const Entry& e : rec)
+                if (e.is_reference())
+                    m["ctx"] = e.value(db.get_attribute("ctx")).to_string();
+                else
+                    m[db.get_attribute(e.attribute()).name()] = e.value().to_string();
+            ret.push_back(m);
+        }
+
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    };
+
+    Aggregator serial(spec);
+
+    for (const EntryList& rec : records)
+        serial.add(db, rec);
+
+    std::vector<EntryList> serial_res;
+    serial.flush(db, [&serial_res](CaliperMetadataAccessInterface&, const EntryList& rec) {
+        serial_res.push_back(rec);
+    });
+
+    Aggregator               concurrent(spec);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&, t]() {
+            for (int i = t * num_records; i < (t + 1) * num_records; ++i)
+                concurrent.add(db, records[i]);
+        });
+
+    for (auto& t : threads)
+        t.join();
+
+    std::vector<EntryList> concurrent_res;
+    concurrent.flush(db, [&concurrent_res](CaliperMetadataAccessInterface&, const EntryList& rec) {
+        concurrent_res.push_back(rec);
+    });
+
+    EXPECT_EQ(serial_res.size(), leaves.size() + 8);
+    EXPECT_EQ(to_strings(serial_res, db), to_strings(concurrent_res, db));
+
+    // flushing again gives the same result
+    std::vector<EntryList> second_res;
+    concurrent.flush(db, [&second_res](CaliperMetadataAccessInterface&, const EntryList& rec) {
+        second_res.push_back(rec);
+    });
+
+    EXPECT_EQ(to_strings(concurrent_res, db), to_strings(second_res, db));
+}
+
+TEST(AggregatorTest, MemoryLimit)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx      = db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_NESTED);
+    Attribute grp_attr = db.create_attribute("grp", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    // make a two-level tree with 32 x 32 leaves
+
+    std::vector<cali_id_t> leaves;
+    cali_id_t              node_id = 100;
+
+    for (int i = 0; i < 32; ++i) {
+        cali_id_t parent_id = node_id++;
+        db.merge_node(parent_id, ctx.id(), CALI_INV_ID, Variant(i), idmap);
+
+        for (int j = 0; j < 32; ++j) {
+            db.merge_node(node_id, ctx.id(), parent_id, Variant(100 * i + j), idmap);
+            leaves.push_back(node_id++);
+        }
+    }
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::List;
+    spec.groupby.list.push_back("ctx");
+    spec.groupby.list.push_back("grp");
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("count"));
+    spec.aggregate.list.push_back(::make_op("sum", "val"));
+    spec.aggregate.list.push_back(::make_op("min", "val"));
+    spec.aggregate.list.push_back(::make_op("avg", "val"));
+    spec.aggregate.list.push_back(::make_op("variance", "val"));
+    spec.aggregate.list.push_back(::make_op("inclusive_sum", "val"));
+    spec.aggregate.list.push_back(::make_op("percent_total", "val"));
+    spec.aggregate.list.push_back(::make_op("percentile", "val", "90"));
+
+    std::vector<EntryList> records;
+
+    for (int i = 0; i < 20000; ++i) {
+        cali_id_t id       = leaves[i % leaves.size()];
+        cali_id_t attrs[2] = { grp_attr.id(), val_attr.id() };
+        Variant   vals[2]  = { Variant(i % 3), Variant(i % 97) };
+
+        records.push_back(db.merge_snapshot(1, &id, 2, attrs, vals, idmap));
+    }
+
+    auto to_strings = [](const std::vector<EntryList>& recs, CaliperMetadataAccessInterface& db) {
+        std::vector<std::map<std::string, std::string>> ret;
+
+        for (const EntryList& rec : recs) {
+            std::map<std::string, std::string> m;
+            for (const Entry& e : rec)
+                if (e.is_reference())
+                    m["ctx"] = e.value(db.get_attribute("ctx")).to_string();
+                else
+                    m[db.get_attribute(e.attribute()).name()] = e.value().to_string();
+            ret.push_back(m);
+        }
+
+        std::sort(ret.begin(), ret.end());
+        return ret;
+    };
+
+    auto aggregate = [&](const QuerySpec& spec, int num_threads) {
+        Aggregator               aggr(spec);
+        std::vector<std::thread> threads;
+        size_t                   n = records.size() / num_threads;
+
+        for (int t = 0; t < num_threads; ++t)
+            threads.emplace_back([&, t]() {
+                for (size_t i = t * n; i < (t + 1) * n; ++i)
+                    aggr.add(db, records[i]);
+            });
+
+        for (auto& t : threads)
+            t.join();
+
+        std::vector<EntryList> res;
+        aggr.flush(db, [&res](CaliperMetadataAccessInterface&, const EntryList& rec) { res.push_back(rec); });
+
+        return to_strings(res, db);
+    };
+
+    auto expected = aggregate(spec, 1);
+
+    EXPECT_EQ(expected.size(), 3 * (leaves.size() + 32));
+
+    spec.aggregation_memory_limit = 64 * 1024;
+
+    EXPECT_EQ(aggregate(spec, 1), expected);
+    EXPECT_EQ(aggregate(spec, 4), expected);
+}
+
+TEST(AggregatorTest, QuantileKernels)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx      = db.create_attribute("ctx", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx.id(), CALI_INV_ID, Variant("ctx"), idmap);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("percentile", "val", "95"));
+    spec.aggregate.list.push_back(::make_op("median", "val", "sketch"));
+    spec.aggregate.list.push_back(::make_op("histogram", "val", "4"));
+
+    // values 1..100 split across two aggregators
+
+    Aggregator a(spec), b(spec), exact(spec);
+
+    cali_id_t node_id = 100;
+    cali_id_t val_id  = val_attr.id();
+
+    for (int i = 1; i <= 100; ++i) {
+        Variant   v(i);
+        EntryList rec = db.merge_snapshot(1, &node_id, 1, &val_id, &v, idmap);
+
+        (i % 2 ? a : b).add(db, rec);
+        exact.add(db, rec);
+    }
+
+    Attribute attr_p95    = db.get_attribute("p95#val");
+    Attribute attr_median = db.get_attribute("median.sketch#val");
+    Attribute attr_hmin   = db.get_attribute("histogram.min#val");
+    Attribute attr_hmax   = db.get_attribute("histogram.max#val");
+    Attribute attr_bin0   = db.get_attribute("histogram.bin.0#val");
+    Attribute attr_bin3   = db.get_attribute("histogram.bin.3#val");
+    Attribute attr_sketch = db.get_attribute("sketch#val");
+
+    ASSERT_TRUE(attr_p95);
+    ASSERT_TRUE(attr_median);
+    ASSERT_TRUE(attr_hmin);
+    ASSERT_TRUE(attr_hmax);
+    ASSERT_TRUE(attr_bin0);
+    ASSERT_TRUE(attr_bin3);
+    ASSERT_TRUE(attr_sketch);
+    EXPECT_TRUE(attr_sketch.is_hidden());
+
+    std::vector<EntryList> resdb;
+
+    exact.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) { resdb.push_back(list); });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    auto dict = make_dict_from_entrylist(resdb.front());
+
+    EXPECT_DOUBLE_EQ(dict[attr_p95.id()].value().to_double(), 95.05);
+    EXPECT_NEAR(dict[attr_median.id()].value().to_double(), 50.5, 50.5 * 0.05);
+    EXPECT_DOUBLE_EQ(dict[attr_hmin.id()].value().to_double(), 1.0);
+    EXPECT_DOUBLE_EQ(dict[attr_hmax.id()].value().to_double(), 100.0);
+    EXPECT_EQ(dict[attr_bin0.id()].value().to_uint(), 25);
+    EXPECT_EQ(dict[attr_bin3.id()].value().to_uint(), 25);
+
+    // the sketch state is only written once
+    Attribute attr_top = db.get_attribute("sketch.level#val");
+
+    ASSERT_TRUE(attr_top);
+    EXPECT_EQ(std::count_if(resdb.front().begin(), resdb.front().end(), [attr_top](const Entry& e) {
+                  return e.attribute() == attr_top.id();
+              }),
+              1);
+
+    // merge b into a through the sketch state in the output records
+    b.flush(db, a);
+
+    resdb.clear();
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) { resdb.push_back(list); });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    dict = make_dict_from_entrylist(resdb.front());
+
+    EXPECT_NEAR(dict[attr_p95.id()].value().to_double(), 95.05, 95.05 * 0.05);
+    EXPECT_NEAR(dict[attr_median.id()].value().to_double(), 50.5, 50.5 * 0.05);
+    EXPECT_DOUBLE_EQ(dict[attr_hmin.id()].value().to_double(), 1.0);
+    EXPECT_DOUBLE_EQ(dict[attr_hmax.id()].value().to_double(), 100.0);
+
+    uint64_t total = 0;
+
+    for (int i = 0; i < 4; ++i)
+        total += dict[db.get_attribute("histogram.bin." + std::to_string(i) + "#val").id()].value().to_uint();
+
+    EXPECT_EQ(total, 100);
+}
+
+TEST(AggregatorTest, QuantileKernelsConcurrent)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx      = db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    for (int i = 0; i < 4; ++i)
+        db.merge_node(100 + i, ctx.id(), CALI_INV_ID, Variant(i), idmap);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("percentile", "val", "90"));
+    spec.aggregate.list.push_back(::make_op("median", "val", "sketch"));
+    spec.aggregate.list.push_back(::make_op("histogram", "val", "4"));
+
+    const int num_threads = 4;
+    const int num_records = 1000;
+
+    std::vector<EntryList> records;
+    cali_id_t              val_id = val_attr.id();
+
+    for (int i = 0; i < num_threads * num_records; ++i) {
+        cali_id_t node_id = 100 + (i % 4);
+        Variant   v(i % 101);
+
+        records.push_back(db.merge_snapshot(1, &node_id, 1, &val_id, &v, idmap));
+    }
+
+    auto to_map = [&db](const EntryList& rec) {
+        std::map<std::string, std::string> m;
+        for (const Entry& e : rec)
+            if (e.is_reference())
+                m["ctx"] = e.value(db.get_attribute("ctx")).to_string();
+            else
+                m[db.get_attribute(e.attribute()).name()] = e.value().to_string();
+        return m;
+    };
+
+    Aggregator serial(spec);
+
+    for (const EntryList& rec : records)
+        serial.add(db, rec);
+
+    std::vector<std::map<std::string, std::string>> serial_res;
+    serial.flush(db, [&](CaliperMetadataAccessInterface&, const EntryList& rec) { serial_res.push_back(to_map(rec)); });
+
+    Aggregator               concurrent(spec);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < num_threads; ++t)
+        threads.emplace_back([&, t]() {
+            for (int i = t * num_records; i < (t + 1) * num_records; ++i)
+                concurrent.add(db, records[i]);
+        });
+
+    for (auto& t : threads)
+        t.join();
+
+    std::vector<std::map<std::string, std::string>> res;
+    concurrent.flush(db, [&](CaliperMetadataAccessInterface&, const EntryList& rec) { res.push_back(to_map(rec)); });
+
+    ASSERT_EQ(res.size(), 4);
+
+    // the results of the merged per-thread tables use the regular result attributes
+    for (auto& m : res) {
+        EXPECT_EQ(m.count(""), 0);
+        EXPECT_EQ(m.count("p90#val"), 1);
+        EXPECT_EQ(m.count("median.sketch#val"), 1);
+        EXPECT_EQ(m.count("histogram.min#val"), 1);
+        EXPECT_EQ(m.count("histogram.bin.3#val"), 1);
+        EXPECT_EQ(m.count("sketch.level#val"), 1);
+    }
+
+    std::sort(serial_res.begin(), serial_res.end());
+    std::sort(res.begin(), res.end());
+
+    EXPECT_EQ(serial_res, res);
+}
+
+TEST(AggregatorTest, InvalidPercentile)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute ctx      = db.create_attribute("ctx", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_INT, CALI_ATTR_ASVALUE);
+
+    db.merge_node(100, ctx.id(), CALI_INV_ID, Variant(1), idmap);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::Default;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("count"));
+    spec.aggregate.list.push_back(::make_op("percentile", "val", "abc"));
+    spec.aggregate.list.push_back(::make_op("percentile", "val", "90x"));
+
+    // the invalid percentile ops are dropped, the other ops still work
+    Aggregator a(spec);
+
+    cali_id_t node_id = 100;
+    cali_id_t val_id  = val_attr.id();
+    Variant   v(42);
+
+    a.add(db, db.merge_snapshot(1, &node_id, 1, &val_id, &v, idmap));
+    a.add(db, db.merge_snapshot(1, &node_id, 1, &val_id, &v, idmap));
+
+    std::vector<EntryList> resdb;
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) { resdb.push_back(list); });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    Attribute count_attr = db.get_attribute("count");
+
+    ASSERT_TRUE(count_attr);
+    EXPECT_FALSE(db.get_attribute("pabc#val"));
+    EXPECT_FALSE(db.get_attribute("p90x#val"));
+
+    auto dict = make_dict_from_entrylist(resdb.front());
+
+    EXPECT_EQ(dict[count_attr.id()].value().to_uint(), 2);
+}
+
+TEST(AggregatorTest, QuantileSketchRange)
+{
+    CaliperMetadataDB db;
+    IdMap             idmap;
+
+    Attribute val_attr = db.create_attribute("val", CALI_TYPE_DOUBLE, CALI_ATTR_ASVALUE);
+
+    QuerySpec spec;
+
+    spec.groupby.selection = QuerySpec::SelectionList<std::string>::None;
+
+    spec.aggregate.selection = QuerySpec::SelectionList<QuerySpec::AggregationOp>::List;
+    spec.aggregate.list.push_back(::make_op("median", "val"));
+    spec.aggregate.list.push_back(::make_op("median", "val", "sketch"));
+
+    Aggregator a(spec);
+
+    cali_id_t val_id = val_attr.id();
+
+    // values spanning about 58 powers of two
+    for (int i = 0; i <= 100; ++i) {
+        Variant v(std::pow(1.5, i));
+        a.add(db, db.merge_snapshot(0, nullptr, 1, &val_id, &v, idmap));
+    }
+
+    std::vector<EntryList> resdb;
+    a.flush(db, [&resdb](CaliperMetadataAccessInterface&, const EntryList& list) { resdb.push_back(list); });
+
+    ASSERT_EQ(resdb.size(), 1);
+
+    Attribute attr_exact  = db.get_attribute("median#val");
+    Attribute attr_sketch = db.get_attribute("median.sketch#val");
+
+    ASSERT_TRUE(attr_exact);
+    ASSERT_TRUE(attr_sketch);
+
+    auto   dict   = make_dict_from_entrylist(resdb.front());
+    double median = std::pow(1.5, 50);
+
+    EXPECT_DOUBLE_EQ(dict[attr_exact.id()].value().to_double(), median);
+    EXPECT_NEAR(dict[attr_sketch.id()].value().to_double(), median, 0.022 * median);
+}
@@ -1,10 +1,18 @@
+#include "caliper/reader/CaliBinaryWriter.h"
 #include "caliper/reader/CaliReader.h"
 #include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
 #include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
 #include <sstream>
+#include <string>
+#include <vector>
 
 using namespace cali;
 
@@ -73,4 +81,337 @@ TEST(CaliReader, BasicRead)
     auto globals = db.get_globals();
 
     EXPECT_FALSE(globals.empty());
-}
\ No newline at end of file
+}
+
+TEST(CaliReader, SharedFileSections)
+{
+    // two sections re-using the same node ids, followed by the index
+    std::string sections[2] = {
+        "__rec=section,rank=0\n"
+        "__rec=node,id=40,attr=10,data=276,parent=3\n"
+        "__rec=node,id=41,attr=8,data=region,parent=40\n"
+        "__rec=node,id=42,attr=41,data=main\n"
+        "__rec=ctx,ref=42\n",
+        "__rec=section,rank=1\n"
+        "__rec=node,id=40,attr=10,data=276,parent=3\n"
+        "__rec=node,id=41,attr=8,data=region,parent=40\n"
+        "__rec=node,id=42,attr=41,data=foo\n"
+        "__rec=ctx,ref=42\n"
+    };
+
+    size_t      size0 = sections[0].size();
+    size_t      size1 = sections[1].size();
+    std::string index = "__rec=index,rank=0=1,offset=0=" + std::to_string(size0) + ",size=" + std::to_string(size0) +
+                        "=" + std::to_string(size1) + "\n";
+
+    char buf[48];
+    snprintf(buf, sizeof(buf), "__rec=index_end,offset=%020llu\n", static_cast<unsigned long long>(size0 + size1));
+
+    std::string filename = testing::TempDir() + "test_calireader_shared.cali";
+
+    {
+        std::ofstream os(filename.c_str(), std::ios::binary);
+        os << sections[0] << sections[1] << index << buf;
+    }
+
+    std::vector<std::string> regions;
+
+    NodeProcessFn     node_proc = [](CaliperMetadataAccessInterface&, const Node*) {};
+    SnapshotProcessFn snap_proc = [&regions](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+        Attribute attr = db.get_attribute("region");
+        for (const Entry& e : rec)
+            if (!e.value(attr).empty())
+                regions.push_back(e.value(attr).to_string());
+    };
+
+    {
+        CaliperMetadataDB db;
+        CaliReader        reader;
+
+        reader.read(filename, db, node_proc, snap_proc);
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+        ASSERT_EQ(regions.size(), 2);
+        EXPECT_EQ(regions[0], std::string("main"));
+        EXPECT_EQ(regions[1], std::string("foo"));
+    }
+
+    regions.clear();
+
+    {
+        CaliperMetadataDB db;
+        CaliReader        reader;
+
+        reader.read_section(filename, 1, db, node_proc, snap_proc);
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+        ASSERT_EQ(regions.size(), 1);
+        EXPECT_EQ(regions[0], std::string("foo"));
+
+        reader.read_section(filename, 2, db, node_proc, snap_proc);
+
+        EXPECT_TRUE(reader.error());
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST(CaliReader, EscapedStrings)
+{
+    const char* txt = "__rec=node,id=40,attr=10,data=276,parent=3\n"
+                      "__rec=node,id=41,attr=8,data=region,parent=40\n"
+                      "__rec=node,id=42,attr=41,data=a\\,b\\=c\\\\d\n"
+                      "__rec=ctx,ref=42,attr=41=41,data=x\\ny=plain\n";
+
+    std::string filename = testing::TempDir() + "test_calireader_escaped.cali";
+
+    {
+        std::ofstream os(filename.c_str(), std::ios::binary);
+        os << txt;
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        CaliperMetadataDB        db;
+        CaliReader               reader;
+        std::vector<std::string> values;
+
+        NodeProcessFn     node_proc = [](CaliperMetadataAccessInterface&, const Node*) {};
+        SnapshotProcessFn snap_proc = [&values](CaliperMetadataAccessInterface&, const EntryList& rec) {
+            for (const Entry& e : rec)
+                values.push_back(e.value().to_string());
+        };
+
+        if (pass == 0) {
+            std::istringstream is(txt);
+            reader.read(is, db, node_proc, snap_proc);
+        } else {
+            reader.read(filename, db, node_proc, snap_proc);
+        }
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+        ASSERT_EQ(values.size(), 3);
+        EXPECT_EQ(values[0], std::string("a,b=c\\d"));
+        EXPECT_EQ(values[1], std::string("x\ny"));
+        EXPECT_EQ(values[2], std::string("plain"));
+    }
+
+    std::remove(filename.c_str());
+}
+
+TEST(CaliReader, ParallelRead)
+{
+    std::string txt = std::string(cali_txt) + "__rec=section,rank=0\n"
+                                              "__rec=node,id=40,attr=10,data=276,parent=3\n"
+                                              "__rec=node,id=41,attr=8,data=region,parent=40\n"
+                                              "__rec=node,id=42,attr=41,data=bar\n"
+                                              "__rec=ctx,ref=42\n"
+                                              "__rec=section,rank=1\n"
+                                              "__rec=node,id=40,attr=10,data=276,parent=3\n"
+                                              "__rec=node,id=41,attr=8,data=region,parent=40\n"
+                                              "__rec=node,id=42,attr=41,data=baz\n"
+                                              "__rec=ctx,ref=42\n"
+                                              "__rec=ctx,ref=42\n";
+
+    std::string filename = testing::TempDir() + "test_calireader_parallel.cali";
+
+    {
+        std::ofstream os(filename.c_str(), std::ios::binary);
+        os << txt;
+    }
+
+    NodeProcessFn node_proc = [](CaliperMetadataAccessInterface&, const Node*) {};
+
+    auto make_snap_proc = [](std::vector<std::string>& out) {
+        return [&out](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+            Attribute   attr = db.get_attribute("region");
+            std::string str;
+            for (const Entry& e : rec)
+                if (!e.value(attr).empty())
+                    str = e.value(attr).to_string();
+            out.push_back(str);
+        };
+    };
+
+    std::vector<std::string> expected;
+
+    {
+        CaliperMetadataDB db;
+        CaliReader        reader;
+
+        reader.read(filename, db, node_proc, make_snap_proc(expected));
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+        ASSERT_EQ(expected.size(), 8);
+        EXPECT_EQ(expected[5], std::string("bar"));
+        EXPECT_EQ(expected[7], std::string("baz"));
+    }
+
+    for (size_t num_threads = 1; num_threads <= 16; num_threads *= 2) {
+        CaliperMetadataDB                     db;
+        CaliReader                            reader;
+        std::vector<std::vector<std::string>> results(num_threads);
+        std::vector<SnapshotProcessFn>        snap_procs;
+
+        for (auto& r : results)
+            snap_procs.push_back(make_snap_proc(r));
+
+        reader.read_parallel(filename, db, node_proc, snap_procs);
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+
+        std::vector<std::string> values;
+        for (const auto& r : results)
+            values.insert(values.end(), r.begin(), r.end());
+
+        EXPECT_EQ(values, expected) << "with " << num_threads << " threads";
+        EXPECT_EQ(db.get_globals().size(), 2);
+    }
+
+    std::remove(filename.c_str());
+}
+
+namespace
+{
+
+std::vector<std::string> record_to_strings(CaliperMetadataAccessInterface& db, const EntryList& rec)
+{
+    std::vector<std::string> ret;
+
+    for (const Entry& e : rec) {
+        if (e.is_reference()) {
+            for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent())
+                ret.push_back(db.get_attribute(node->attribute()).name() + "=" + node->data().to_string());
+        } else if (e.is_immediate()) {
+            ret.push_back(db.get_attribute(e.attribute()).name() + "=" + e.value().to_string());
+        }
+    }
+
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+} // namespace
+
+TEST(CaliReader, BinaryFormat)
+{
+    NodeProcessFn node_proc = [](CaliperMetadataAccessInterface&, const Node*) {};
+
+    std::vector<std::vector<std::string>> expected;
+    std::string                           filename = testing::TempDir() + "test_calireader_binary.calib";
+
+    {
+        CaliperMetadataDB  db;
+        CaliReader         reader;
+        std::istringstream is(cali_txt);
+        std::vector<EntryList> records;
+
+        reader.read(is, db, node_proc, [&](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+            records.push_back(rec);
+            expected.push_back(record_to_strings(db, rec));
+        });
+
+        ASSERT_FALSE(reader.error()) << reader.error_msg();
+
+        OutputStream stream;
+        stream.set_filename(filename.c_str());
+
+        // use small row groups to test row group skipping
+        CaliBinaryWriter writer(stream, 2);
+
+        for (const EntryList& rec : records)
+            writer.write_snapshot(db, rec);
+
+        writer.write_globals(db, db.get_globals());
+        writer.close();
+    }
+
+    // read all records
+
+    {
+        CaliperMetadataDB                     db;
+        CaliReader                            reader;
+        std::vector<std::vector<std::string>> result;
+
+        reader.read(filename, db, node_proc, [&](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+            result.push_back(record_to_strings(db, rec));
+        });
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+        EXPECT_EQ(result, expected);
+        EXPECT_EQ(db.get_globals().size(), 2);
+    }
+
+    // read from a stream
+
+    {
+        CaliperMetadataDB db;
+        CaliReader        reader;
+        std::ifstream     is(filename.c_str(), std::ios::binary);
+        size_t            count = 0;
+
+        reader.read(is, db, node_proc, [&](CaliperMetadataAccessInterface&, const EntryList&) { ++count; });
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+        EXPECT_EQ(count, expected.size());
+    }
+
+    // parallel read
+
+    {
+        CaliperMetadataDB                                  db;
+        CaliReader                                         reader;
+        std::vector<std::vector<std::vector<std::string>>> results(2);
+        std::vector<SnapshotProcessFn>                     snap_procs;
+
+        for (auto& r : results)
+            snap_procs.push_back([&r](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                r.push_back(record_to_strings(db, rec));
+            });
+
+        reader.read_parallel(filename, db, node_proc, snap_procs);
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+
+        std::vector<std::vector<std::string>> result = results[0];
+        result.insert(result.end(), results[1].begin(), results[1].end());
+
+        EXPECT_EQ(result, expected);
+    }
+
+    // skip row groups and columns with query hints
+
+    {
+        QuerySpec spec;
+
+        spec.aggregate.selection = QuerySpec::AggregationSelection::None;
+        spec.groupby.selection   = QuerySpec::AttributeSelection::None;
+        spec.select.selection    = QuerySpec::AttributeSelection::List;
+        spec.select.list         = { "region", "min#aggregate.slot" };
+        spec.filter.selection    = QuerySpec::FilterSelection::List;
+        spec.filter.list.push_back(QuerySpec::Condition(QuerySpec::Condition::Op::Equal, "min#aggregate.slot", "4"));
+        spec.sort.selection = QuerySpec::SortSelection::None;
+
+        CaliperMetadataDB                     db;
+        CaliReader                            reader;
+        std::vector<std::vector<std::string>> result;
+
+        reader.set_query_hints(spec);
+        reader.read(filename, db, node_proc, [&](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+            result.push_back(record_to_strings(db, rec));
+        });
+
+        EXPECT_FALSE(reader.error()) << reader.error_msg();
+
+        // only the last row group (with one record) can match
+        ASSERT_EQ(result.size(), 1);
+
+        std::vector<std::string> last;
+        for (const std::string& s : expected.back())
+            if (s.find("sum#sum#time.duration") == std::string::npos)
+                last.push_back(s);
+
+        EXPECT_EQ(result.front(), last);
+    }
+
+    std::remove(filename.c_str());
+}
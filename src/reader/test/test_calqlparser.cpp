@@ -236,6 +236,32 @@ TEST(CalQLParserTest, OrderByClause3)
     EXPECT_STREQ(q.format.formatter.name, "table");
 }
 
+TEST(CalQLParserTest, LimitClause)
+{
+    CalQLParser p("order by count desc limit 20 format table");
+
+    EXPECT_FALSE(p.error()) << "Unexpected parse error: " << p.error_msg();
+
+    QuerySpec q = p.spec();
+
+    EXPECT_EQ(q.limit, 20);
+    ASSERT_EQ(q.sort.list.size(), 1);
+    EXPECT_EQ(q.sort.list[0].attribute, "count");
+    EXPECT_STREQ(q.format.formatter.name, "table");
+
+    EXPECT_EQ(CalQLParser("select a").spec().limit, 0);
+
+    CalQLParser p1("limit ten");
+    EXPECT_TRUE(p1.error());
+    EXPECT_STREQ(p1.error_msg().c_str(), "Expected record count for LIMIT, got \"ten\"");
+
+    CalQLParser p2("select a limit 0");
+    EXPECT_TRUE(p2.error());
+
+    CalQLParser p3("limit");
+    EXPECT_TRUE(p3.error());
+}
+
 TEST(CalQLParserTest, FormatSpec)
 {
     {
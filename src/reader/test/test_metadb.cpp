@@ -4,6 +4,10 @@
 
 #include <gtest/gtest.h>
 
+#include <set>
+#include <thread>
+#include <vector>
+
 using namespace cali;
 
 TEST(MetaDBTest, MergeSnapshotFromDB)
@@ -150,6 +154,90 @@ TEST(MetadataDBTest, StringDB)
     EXPECT_EQ(os.str(), std::string("CaliperMetadataDB: stored 21 nodes, 6 strings.\n"));
 }
 
+TEST(MetadataDBTest, ConcurrentMerge)
+{
+    CaliperMetadataDB db;
+
+    Attribute str_attr = db.create_attribute("str.attr", CALI_TYPE_STRING, CALI_ATTR_DEFAULT);
+    Attribute int_attr = db.create_attribute("int.attr", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    // merge the same 3000 nodes (tree fan-out 10) from several threads
+
+    const int N = 3000;
+    const int T = 4;
+
+    std::vector<std::vector<Node*>> results(T, std::vector<Node*>(N, nullptr));
+    std::vector<std::thread>        threads;
+
+    for (int t = 0; t < T; ++t)
+        threads.emplace_back([&db, &results, str_attr, int_attr, t, N]() {
+            IdMap idmap;
+
+            for (int i = 0; i < N; ++i) {
+                cali_id_t prnt = i < 10 ? CALI_INV_ID : 1000 + i / 10;
+
+                if (i % 2)
+                    results[t][i] = db.merge_node(1000 + i, int_attr.id(), prnt, Variant(i), idmap);
+                else
+                    results[t][i] = db.merge_node(1000 + i, str_attr.id(), prnt, std::to_string(i), idmap);
+            }
+        });
+
+    for (auto& thread : threads)
+        thread.join();
+
+    for (int t = 1; t < T; ++t)
+        EXPECT_EQ(results[t], results[0]);
+
+    std::set<cali_id_t> ids;
+
+    for (int i = 0; i < N; ++i) {
+        Node* node = results[0][i];
+
+        ASSERT_NE(node, nullptr);
+        EXPECT_EQ(db.node(node->id()), node);
+        EXPECT_EQ(node->data().to_string(), std::to_string(i));
+        if (i >= 10) {
+            EXPECT_EQ(node->parent(), results[0][i / 10]);
+        }
+
+        ids.insert(node->id());
+    }
+
+    EXPECT_EQ(ids.size(), static_cast<size_t>(N));
+}
+
+TEST(MetadataDBTest, MergeMixedValueTypes)
+{
+    CaliperMetadataDB db;
+
+    Attribute attr = db.create_attribute("val.attr", CALI_TYPE_INT, CALI_ATTR_DEFAULT);
+
+    // values that hash alike after normalization but are different Variants
+    std::vector<Variant> values { Variant(3),     Variant(3u),   Variant(3.0),  Variant(true),
+                                  Variant(1),     Variant(1.0),  Variant(0.0),  Variant(-0.0),
+                                  Variant(-2),    Variant(-2.0), Variant(2.5),  Variant(0u),
+                                  Variant(CALI_TYPE_INT) };
+
+    std::vector<Node*> first, second;
+    IdMap              idmap;
+
+    for (size_t i = 0; i < values.size(); ++i)
+        first.push_back(db.merge_node(300 + i, attr.id(), CALI_INV_ID, values[i], idmap));
+    for (size_t i = 0; i < values.size(); ++i)
+        second.push_back(db.merge_node(400 + i, attr.id(), CALI_INV_ID, values[i], idmap));
+
+    EXPECT_EQ(first, second);
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        ASSERT_NE(first[i], nullptr);
+        EXPECT_EQ(first[i]->data(), values[i]);
+        for (size_t j = 0; j < i; ++j) {
+            EXPECT_NE(first[i], first[j]) << "values " << i << " and " << j;
+        }
+    }
+}
+
 TEST(MetadataDBTest, AliasesAndUnits)
 {
     CaliperMetadataDB db;
@@ -42,6 +42,8 @@ class ServicesManager
 {
     std::map<std::string, CaliperService> m_services;
 
+    std::map<cali_id_t, std::vector<std::string>> m_snapshot_cb_owners;
+
 public:
 
     std::vector<std::string> get_available_services() const
@@ -72,6 +74,17 @@ public:
             m_services[get_name_from_spec(s->name_or_spec)] = *s;
     }
 
+    void set_snapshot_callback_owners(cali_id_t channel_id, const std::vector<std::string>& owners)
+    {
+        m_snapshot_cb_owners[channel_id] = owners;
+    }
+
+    std::vector<std::string> get_snapshot_callback_owners(cali_id_t channel_id) const
+    {
+        auto it = m_snapshot_cb_owners.find(channel_id);
+        return it != m_snapshot_cb_owners.end() ? it->second : std::vector<std::string>();
+    }
+
     std::string get_service_description(const std::string& name)
     {
         auto service_itr = m_services.find(name);
@@ -165,10 +178,17 @@ void register_configured_services(Caliper* c, Channel* channel)
 
     ServicesManager* sM = ServicesManager::instance();
 
+    // remember which service connected which snapshot callback
+    std::vector<std::string> snapshot_cb_owners;
+
     for (const std::string& s : services) {
         if (!sM->register_service(s.c_str(), c, channel))
             Log(0).stream() << "Service \"" << s << "\" not found!" << std::endl;
+
+        snapshot_cb_owners.resize(channel->events().snapshot.size(), s);
     }
+
+    sM->set_snapshot_callback_owners(channel->id(), snapshot_cb_owners);
 }
 
 void add_service_specs(const CaliperService* services)
@@ -176,6 +196,11 @@ void add_service_specs(const CaliperService* services)
     ServicesManager::instance()->add_services(services);
 }
 
+std::vector<std::string> get_snapshot_callback_owners(const Channel* channel)
+{
+    return ServicesManager::instance()->get_snapshot_callback_owners(channel->id());
+}
+
 std::vector<std::string> get_available_services()
 {
     return ServicesManager::instance()->get_available_services();
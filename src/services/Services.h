@@ -43,6 +43,10 @@ bool register_service(Caliper* c, Channel* chn, const char* name);
 /// \brief Register all services in the channel config
 void register_configured_services(Caliper* c, Channel* chn);
 
+/// \brief Return the name of the service that connected each of the
+///   snapshot callbacks in \a chn, in callback order
+std::vector<std::string> get_snapshot_callback_owners(const Channel* chn);
+
 /// \brief Read and initialize runtime config set from given JSON spec
 ConfigSet init_config_from_spec(RuntimeConfig cfg, const char* spec);
 
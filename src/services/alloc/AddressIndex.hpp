@@ -0,0 +1,157 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file  AddressIndex.hpp
+/// \brief Sharded index of memory address ranges
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+namespace cali
+{
+
+/// \brief A sharded index of non-overlapping address ranges.
+///
+/// The address space is split into fixed-size buckets, which are
+/// distributed round-robin over a fixed number of shards. Each shard has
+/// its own lock and an ordered map of ranges. A range is stored in the
+/// shards of all buckets it overlaps, so that point lookups only search
+/// one shard. Lookups do not modify the index. Ranges that span more
+/// than MaxSpan buckets are kept in a separate, shared map.
+///
+/// T must provide \a start_addr and \a total_size members.
+template <class T>
+class AddressIndex
+{
+    static constexpr unsigned BucketBits = 16;
+    static constexpr unsigned NumShards  = 64;
+    static constexpr uint64_t MaxSpan    = 64;
+
+    struct Shard {
+        std::mutex            lock;
+        std::map<uint64_t, T> ranges;
+    };
+
+    Shard               m_shards[NumShards];
+    Shard               m_large;
+    std::atomic<size_t> m_num_large;
+
+    static uint64_t bucket(uint64_t addr) { return addr >> BucketBits; }
+
+    static uint64_t end_bucket(const T& v) { return bucket(v.start_addr + (v.total_size > 0 ? v.total_size - 1 : 0)); }
+
+    Shard& shard(uint64_t bucket) { return m_shards[bucket % NumShards]; }
+
+    static bool find_in(Shard& s, uint64_t addr, T* out)
+    {
+        std::lock_guard<std::mutex> g(s.lock);
+
+        // ranges don't overlap: the only candidate is the one with the
+        // greatest start address not greater than addr
+        auto it = s.ranges.upper_bound(addr);
+
+        if (it == s.ranges.begin())
+            return false;
+
+        --it;
+
+        if (addr >= it->second.start_addr + it->second.total_size)
+            return false;
+
+        if (out)
+            *out = it->second;
+
+        return true;
+    }
+
+    static bool remove_from(Shard& s, uint64_t start_addr, T* out)
+    {
+        std::lock_guard<std::mutex> g(s.lock);
+
+        auto it = s.ranges.find(start_addr);
+
+        if (it == s.ranges.end())
+            return false;
+
+        if (out)
+            *out = it->second;
+
+        s.ranges.erase(it);
+        return true;
+    }
+
+public:
+
+    AddressIndex() : m_num_large(0) {}
+
+    AddressIndex(const AddressIndex&)            = delete;
+    AddressIndex& operator= (const AddressIndex&) = delete;
+
+    /// \brief Insert \a v. Replaces any range with the same start address.
+    void insert(const T& v)
+    {
+        remove(v.start_addr);
+
+        uint64_t first = bucket(v.start_addr);
+        uint64_t span  = end_bucket(v) - first + 1;
+
+        if (span > MaxSpan) {
+            std::lock_guard<std::mutex> g(m_large.lock);
+            m_large.ranges[v.start_addr] = v;
+            ++m_num_large;
+            return;
+        }
+
+        // consecutive buckets map to distinct shards, so we never
+        // need to visit more than NumShards of them
+        for (uint64_t b = first; b < first + std::min<uint64_t>(span, NumShards); ++b) {
+            Shard&                      s = shard(b);
+            std::lock_guard<std::mutex> g(s.lock);
+            s.ranges[v.start_addr] = v;
+        }
+    }
+
+    /// \brief Remove the range starting at \a start_addr. Copies the
+    ///   removed range into \a out if given. Returns \a false if there is
+    ///   no range starting at \a start_addr.
+    bool remove(uint64_t start_addr, T* out = nullptr)
+    {
+        T    tmp;
+        bool found = remove_from(shard(bucket(start_addr)), start_addr, &tmp);
+
+        if (found) {
+            uint64_t first = bucket(start_addr);
+            uint64_t span  = std::min<uint64_t>(end_bucket(tmp) - first + 1, NumShards);
+
+            for (uint64_t b = first + 1; b < first + span; ++b)
+                remove_from(shard(b), start_addr, nullptr);
+        } else if (m_num_large.load() > 0) {
+            found = remove_from(m_large, start_addr, &tmp);
+
+            if (found)
+                --m_num_large;
+        }
+
+        if (found && out)
+            *out = tmp;
+
+        return found;
+    }
+
+    /// \brief Find the range containing \a addr and copy it into \a out.
+    ///   Returns \a false if no range contains \a addr.
+    bool find(uint64_t addr, T* out)
+    {
+        if (find_in(shard(bucket(addr)), addr, out))
+            return true;
+
+        return m_num_large.load() > 0 && find_in(m_large, addr, out);
+    }
+};
+
+} // namespace cali
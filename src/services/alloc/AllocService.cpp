@@ -3,7 +3,7 @@
 
 // Service for hooking memory allocation calls
 
-#include "SplayTree.hpp"
+#include "AddressIndex.hpp"
 
 #include "../Services.h"
 
@@ -16,7 +16,6 @@
 #include <algorithm>
 #include <atomic>
 #include <cstring>
-#include <mutex>
 #include <numeric>
 
 #define NUM_TRACKED_ALLOC_ATTRS 2
@@ -50,56 +49,14 @@ struct AllocInfo {
     size_t index_1D(uint64_t addr) const { return (addr - start_addr) / elem_size; }
 };
 
-/// Three-way predicate to tell if given address is within AllocInfo's address range, less, or higher
-class ContainsAddress
+/// Atomically raise \a val to at least \a x
+inline void atomic_max(std::atomic<uint64_t>& val, uint64_t x)
 {
-    uint64_t address;
+    uint64_t prev = val.load(std::memory_order_relaxed);
 
-public:
-
-    ContainsAddress(uint64_t a) : address(a) {}
-
-    inline int operator() (const AllocInfo& info) const
-    {
-        if (address < info.start_addr)
-            return -1;
-        else if (address >= info.start_addr && address < info.start_addr + info.total_size)
-            return 0;
-        else
-            return +1;
-    }
-};
-
-/// Three-way predicate to tell if given address is AllocInfo's start address, less, or higher
-class HasStartAddress
-{
-    uint64_t address;
-
-public:
-
-    HasStartAddress(uint64_t a) : address(a) {}
-
-    inline int operator() (const AllocInfo& info) const
-    {
-        if (address < info.start_addr)
-            return -1;
-        else if (address == info.start_addr)
-            return 0;
-        else
-            return +1;
-    }
-};
-
-struct AllocInfoCmp {
-    int operator() (const AllocInfo& lhs, const AllocInfo& rhs) const
-    {
-        if (lhs.start_addr < rhs.start_addr)
-            return -1;
-        else if (lhs.start_addr == rhs.start_addr)
-            return 0;
-        return 1;
-    }
-};
+    while (prev < x && !val.compare_exchange_weak(prev, x, std::memory_order_relaxed))
+        ;
+}
 
 class AllocService
 {
@@ -133,18 +90,16 @@ class AllocService
 
     cali::Node g_alloc_root_node { CALI_INV_ID, CALI_INV_ID, Variant() };
 
-    SplayTree<AllocInfo, AllocInfoCmp> g_tree;
-    std::mutex                         g_tree_lock;
+    AddressIndex<AllocInfo> g_index;
 
-    uint64_t   g_active_mem { 0 };
-    uint64_t   g_hwm { 0 };
-    uint64_t   g_region_hwm { 0 };
-    std::mutex g_hwm_lock;
+    std::atomic<uint64_t> g_active_mem { 0 };
+    std::atomic<uint64_t> g_hwm { 0 };
+    std::atomic<uint64_t> g_region_hwm { 0 };
 
-    unsigned long g_current_tracked { 0 };
-    unsigned long g_max_tracked { 0 };
-    unsigned long g_total_tracked { 0 };
-    unsigned      g_failed_untrack { 0 };
+    std::atomic<uint64_t> g_current_tracked { 0 };
+    std::atomic<uint64_t> g_max_tracked { 0 };
+    std::atomic<uint64_t> g_total_tracked { 0 };
+    std::atomic<unsigned> g_failed_untrack { 0 };
 
     void track_mem_snapshot(
         Caliper*       c,
@@ -213,44 +168,28 @@ class AllocService
                 Variant(CALI_TYPE_ADDR, &ptr, sizeof(void*))
             );
 
-        {
-            std::lock_guard<std::mutex> g(g_hwm_lock);
+        uint64_t active = (g_active_mem += total_size);
 
-            g_active_mem += total_size;
-            g_hwm        = std::max(g_hwm, g_active_mem);
-            g_region_hwm = std::max(g_region_hwm, g_active_mem);
-        }
+        atomic_max(g_hwm, active);
+        atomic_max(g_region_hwm, active);
 
-        {
-            std::lock_guard<std::mutex> g(g_tree_lock);
+        g_index.insert(info);
 
-            g_tree.insert(info);
-
-            g_max_tracked = std::max(++g_current_tracked, g_max_tracked);
-            ++g_total_tracked;
-        }
+        atomic_max(g_max_tracked, ++g_current_tracked);
+        ++g_total_tracked;
     }
 
     void untrack_mem_cb(Caliper* c, ChannelBody* chB, const void* ptr)
     {
         AllocInfo info;
 
-        {
-            std::lock_guard<std::mutex> g(g_tree_lock);
-
-            auto tree_node = g_tree.find(HasStartAddress(reinterpret_cast<uint64_t>(ptr)));
-
-            if (!tree_node) {
-                ++g_failed_untrack;
-                return;
-            }
-
-            info = *tree_node;
-            g_tree.remove(tree_node);
-
-            --g_current_tracked;
+        if (!g_index.remove(reinterpret_cast<uint64_t>(ptr), &info)) {
+            ++g_failed_untrack;
+            return;
         }
 
+        --g_current_tracked;
+
         if (g_track_allocations)
             track_mem_snapshot(
                 c,
@@ -261,11 +200,7 @@ class AllocService
                 Variant(CALI_TYPE_ADDR, &ptr, sizeof(void*))
             );
 
-        {
-            std::lock_guard<std::mutex> g(g_hwm_lock);
-
-            g_active_mem -= info.total_size;
-        }
+        g_active_mem -= info.total_size;
     }
 
     void resolve_addresses(Caliper* c, const SnapshotView trigger_info, SnapshotBuilder& snapshot)
@@ -278,25 +213,17 @@ class AllocService
 
             uint64_t addr = e.value().to_uint();
 
-            Entry       data[2];
-            cali::Node* label_node = nullptr;
-
-            {
-                std::lock_guard<std::mutex> g(g_tree_lock);
-
-                auto tree_node = g_tree.find(ContainsAddress(addr));
+            AllocInfo info;
 
-                if (!tree_node)
-                    continue;
+            if (!g_index.find(addr, &info))
+                continue;
 
-                data[0] = Entry(g_memoryaddress_attrs[i].alloc_uid_attr, (*tree_node).v_uid);
-                data[1] = Entry(
-                    g_memoryaddress_attrs[i].alloc_index_attr,
-                    cali_make_variant_from_uint((*tree_node).index_1D(addr))
-                );
+            Entry data[2] = {
+                Entry(g_memoryaddress_attrs[i].alloc_uid_attr, info.v_uid),
+                Entry(g_memoryaddress_attrs[i].alloc_index_attr, cali_make_variant_from_uint(info.index_1D(addr)))
+            };
 
-                label_node = (*tree_node).addr_label_nodes[i];
-            }
+            cali::Node* label_node = info.addr_label_nodes[i];
 
             snapshot.append(2, data);
 
@@ -307,14 +234,7 @@ class AllocService
 
     void record_highwatermark(Caliper* c, SnapshotBuilder& rec)
     {
-        uint64_t hwm = 0;
-
-        {
-            std::lock_guard<std::mutex> g(g_hwm_lock);
-
-            hwm          = g_region_hwm;
-            g_region_hwm = g_active_mem;
-        }
+        uint64_t hwm = g_region_hwm.exchange(g_active_mem.load());
 
         rec.append(region_hwm_attr, Variant(hwm));
     }
@@ -323,7 +243,7 @@ class AllocService
     {
         // Record currently active amount of allocated memory
         if (g_record_active_mem)
-            snapshot.append(active_mem_attr, Variant(cali_make_variant_from_uint(g_active_mem)));
+            snapshot.append(active_mem_attr, Variant(cali_make_variant_from_uint(g_active_mem.load())));
 
         if (g_resolve_addresses && !info.empty())
             resolve_addresses(c, info, snapshot);
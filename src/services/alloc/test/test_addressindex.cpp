@@ -0,0 +1,242 @@
+// Tests for the alloc service's AddressIndex
+
+#include "AddressIndex.hpp"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+namespace
+{
+
+struct Range {
+    uint64_t start_addr;
+    uint64_t total_size;
+    int      id;
+};
+
+Range make_range(uint64_t start, uint64_t size, int id)
+{
+    Range r;
+    r.start_addr = start;
+    r.total_size = size;
+    r.id         = id;
+    return r;
+}
+
+} // namespace
+
+TEST(AddressIndexTest, Boundaries)
+{
+    AddressIndex<Range> index;
+
+    index.insert(make_range(0x1000, 0x100, 1));
+
+    Range r;
+
+    EXPECT_FALSE(index.find(0x0fff, &r));
+    ASSERT_TRUE(index.find(0x1000, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x10ff, &r));
+    EXPECT_EQ(r.id, 1);
+    EXPECT_FALSE(index.find(0x1100, &r));
+}
+
+TEST(AddressIndexTest, AdjacentRanges)
+{
+    AddressIndex<Range> index;
+
+    index.insert(make_range(0x1000, 0x100, 1));
+    index.insert(make_range(0x1100, 0x100, 2));
+
+    Range r;
+
+    ASSERT_TRUE(index.find(0x10ff, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x1100, &r));
+    EXPECT_EQ(r.id, 2);
+    EXPECT_FALSE(index.find(0x1200, &r));
+}
+
+TEST(AddressIndexTest, BucketBoundaries)
+{
+    AddressIndex<Range> index;
+
+    // straddles the boundary between the first two 64 KiB buckets
+    index.insert(make_range(0xff00, 0x200, 1));
+    // starts exactly on a bucket boundary
+    index.insert(make_range(0x20000, 0x10, 2));
+
+    Range r;
+
+    ASSERT_TRUE(index.find(0xff00, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x10000, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x100ff, &r));
+    EXPECT_EQ(r.id, 1);
+    EXPECT_FALSE(index.find(0x10100, &r));
+
+    ASSERT_TRUE(index.find(0x20000, &r));
+    EXPECT_EQ(r.id, 2);
+    EXPECT_FALSE(index.find(0x1ffff, &r));
+    EXPECT_FALSE(index.find(0x20010, &r));
+
+    EXPECT_TRUE(index.remove(0xff00));
+    EXPECT_FALSE(index.find(0xff00, &r));
+    EXPECT_FALSE(index.find(0x10000, &r));
+}
+
+TEST(AddressIndexTest, LargeRanges)
+{
+    AddressIndex<Range> index;
+
+    // spans more buckets than there are shards
+    const uint64_t size = uint64_t(1) << 30;
+
+    index.insert(make_range(0x100000, size, 1));
+    index.insert(make_range(0x10, 0x10, 2));
+
+    Range r;
+
+    ASSERT_TRUE(index.find(0x100000, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x100000 + size / 2, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x100000 + size - 1, &r));
+    EXPECT_EQ(r.id, 1);
+    EXPECT_FALSE(index.find(0x100000 + size, &r));
+    EXPECT_FALSE(index.find(0xfffff, &r));
+
+    ASSERT_TRUE(index.find(0x18, &r));
+    EXPECT_EQ(r.id, 2);
+
+    Range removed;
+    ASSERT_TRUE(index.remove(0x100000, &removed));
+    EXPECT_EQ(removed.id, 1);
+    EXPECT_FALSE(index.find(0x100000 + size / 2, &r));
+    EXPECT_FALSE(index.remove(0x100000));
+}
+
+TEST(AddressIndexTest, OverlappingRanges)
+{
+    AddressIndex<Range> index;
+
+    index.insert(make_range(0x1000, 0x100, 1));
+    // overlaps the tail of the first range; the later start wins
+    index.insert(make_range(0x1080, 0x100, 2));
+
+    Range r;
+
+    ASSERT_TRUE(index.find(0x107f, &r));
+    EXPECT_EQ(r.id, 1);
+    ASSERT_TRUE(index.find(0x1080, &r));
+    EXPECT_EQ(r.id, 2);
+    ASSERT_TRUE(index.find(0x117f, &r));
+    EXPECT_EQ(r.id, 2);
+
+    // like a free followed by a reallocation at an overlapping address
+    EXPECT_TRUE(index.remove(0x1080));
+    ASSERT_TRUE(index.find(0x10ff, &r));
+    EXPECT_EQ(r.id, 1);
+    EXPECT_FALSE(index.find(0x1100, &r));
+
+    EXPECT_TRUE(index.remove(0x1000));
+    index.insert(make_range(0x0f80, 0x20000, 3));
+
+    ASSERT_TRUE(index.find(0x1000, &r));
+    EXPECT_EQ(r.id, 3);
+    ASSERT_TRUE(index.find(0x10f7f, &r));
+    EXPECT_EQ(r.id, 3);
+    EXPECT_FALSE(index.find(0x20f80, &r));
+}
+
+TEST(AddressIndexTest, ReplaceSameStart)
+{
+    AddressIndex<Range> index;
+
+    // a larger range replaces the previous one with the same start
+    // address, and a smaller one must not leave the old tail behind
+    index.insert(make_range(0x1000, 0x10, 1));
+    index.insert(make_range(0x1000, 0x30000, 2));
+
+    Range r;
+
+    ASSERT_TRUE(index.find(0x1008, &r));
+    EXPECT_EQ(r.id, 2);
+    ASSERT_TRUE(index.find(0x20000, &r));
+    EXPECT_EQ(r.id, 2);
+
+    index.insert(make_range(0x1000, 0x10, 3));
+
+    ASSERT_TRUE(index.find(0x1008, &r));
+    EXPECT_EQ(r.id, 3);
+    EXPECT_FALSE(index.find(0x1010, &r));
+    EXPECT_FALSE(index.find(0x20000, &r));
+}
+
+TEST(AddressIndexTest, Misses)
+{
+    AddressIndex<Range> index;
+
+    Range r;
+
+    EXPECT_FALSE(index.find(0, &r));
+    EXPECT_FALSE(index.find(0x1000, &r));
+    EXPECT_FALSE(index.remove(0x1000));
+
+    index.insert(make_range(0x1000, 0x100, 1));
+    index.insert(make_range(0x3000, 0x100, 2));
+
+    EXPECT_FALSE(index.find(0x2000, &r));
+    // maps to the same shard as the first range
+    EXPECT_FALSE(index.find(0x1000 + (uint64_t(64) << 16), &r));
+    // remove only matches exact start addresses
+    EXPECT_FALSE(index.remove(0x1008));
+    EXPECT_TRUE(index.find(0x1008, &r));
+
+    EXPECT_TRUE(index.remove(0x1000));
+    EXPECT_FALSE(index.find(0x1008, &r));
+    EXPECT_TRUE(index.find(0x3008, &r));
+    EXPECT_EQ(r.id, 2);
+}
+
+TEST(AddressIndexTest, Concurrent)
+{
+    AddressIndex<Range> index;
+
+    const int nthreads = 4;
+    const int nranges  = 1000;
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&index, t]() {
+            for (int i = 0; i < nranges; ++i) {
+                uint64_t start = (uint64_t(t * nranges + i) << 12) + 0x1000;
+                index.insert(make_range(start, 0x800, t * nranges + i));
+            }
+            for (int i = 0; i < nranges; i += 2)
+                index.remove((uint64_t(t * nranges + i) << 12) + 0x1000);
+        });
+
+    for (auto& t : threads)
+        t.join();
+
+    for (int n = 0; n < nthreads * nranges; ++n) {
+        uint64_t start = (uint64_t(n) << 12) + 0x1000;
+        Range    r;
+
+        EXPECT_FALSE(index.find(start + 0x800, &r));
+
+        if (n % 2 == 0) {
+            EXPECT_FALSE(index.find(start, &r));
+        } else {
+            ASSERT_TRUE(index.find(start + 0x7ff, &r));
+            EXPECT_EQ(r.id, n);
+        }
+    }
+}
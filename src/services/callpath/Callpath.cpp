@@ -5,6 +5,7 @@
 // Callpath provider for caliper records using libunwind
 
 #include "../Services.h"
+#include "../../common/util/spinlock.hpp"
 
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
@@ -12,10 +13,18 @@
 #include "caliper/common/Log.h"
 #include "caliper/common/Node.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
 #include <string>
 #include <sstream>
 #include <type_traits>
+#include <vector>
+
+#include <link.h>
+#include <pthread.h>
 
 #define UNW_LOCAL_ONLY
 #include <libunwind.h>
@@ -28,6 +37,14 @@
 #define MAX_PATH 40
 #define NAMELEN 100
 
+#if defined(__x86_64__)
+#define CALI_CALLPATH_HAVE_FRAME_POINTERS
+#define CALI_CALLPATH_FP_REG UNW_X86_64_RBP
+#elif defined(__aarch64__)
+#define CALI_CALLPATH_HAVE_FRAME_POINTERS
+#define CALI_CALLPATH_FP_REG UNW_AARCH64_X29
+#endif
+
 using namespace cali;
 
 namespace
@@ -35,92 +52,417 @@ namespace
 
 class Callpath
 {
+    //
+    // --- Per-thread unwinding state
+    //
+
+    //   ThreadData holds the stack bounds needed for safe frame-pointer
+    // unwinding, a direct-mapped cache of recently seen return-address
+    // sequences, and (with use_name) the libunwind cursors of the last
+    // unwind, so function names can be looked up on a cache miss without
+    // unwinding again. Everything is preallocated so that it can be used
+    // from signal handlers. All ThreadData objects of a channel are linked
+    // so they can be deleted at finish.
+
+    struct PathCacheEntry {
+        uint64_t  hash { 0 };
+        size_t    n { 0 };
+        uintptr_t ips[MAX_PATH];
+        Node*     addr_node { nullptr };
+        Node*     name_node { nullptr };
+    };
+
+    struct ThreadData {
+        uintptr_t stack_lo { 0 };
+        uintptr_t stack_hi { 0 };
+
+        std::vector<PathCacheEntry> cache;
+        std::vector<unw_cursor_t>   cursors;
+
+        size_t num_hits { 0 };
+        size_t num_misses { 0 };
+        size_t num_fallbacks { 0 };
+
+        ThreadData* next { nullptr };
+
+        ThreadData(size_t cache_size, bool keep_cursors) : cache(cache_size), cursors(keep_cursors ? MAX_PATH : 0)
+        {
+            pthread_attr_t attr;
+
+            if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+                void*  addr = nullptr;
+                size_t size = 0;
+
+                if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                    stack_lo = reinterpret_cast<uintptr_t>(addr);
+                    stack_hi = stack_lo + size;
+                }
+
+                pthread_attr_destroy(&attr);
+            }
+        }
+    };
+
     Attribute callpath_name_attr;
     Attribute callpath_addr_attr;
     Attribute ucursor_attr;
+    Attribute thread_data_attr;
 
     bool use_name { false };
     bool use_addr { false };
     bool skip_internal { false };
+    bool use_frame_pointers { false };
 
     unsigned skip_frames { 0 };
+    size_t   cache_size { 0 };
 
     Node callpath_root_node;
 
     uintptr_t caliper_start_addr { 0 };
     uintptr_t caliper_end_addr { 0 };
 
-    void snapshot_cb(Caliper* c, SnapshotView info, SnapshotBuilder& snapshot)
+    //   Code ranges of the modules with the thread entry functions (libc and
+    // libpthread). Frame-pointer chains end in these frames.
+    struct CodeRange {
+        uintptr_t start;
+        uintptr_t end;
+    };
+
+    CodeRange thread_entry_ranges[2] { { 0, 0 }, { 0, 0 } };
+
+    ThreadData*    thread_data_list { nullptr };
+    util::spinlock thread_data_lock;
+
+    ThreadData* acquire_thread_data(Caliper* c, bool can_alloc)
     {
-        Variant v_addr[MAX_PATH];
-        Variant v_name[MAX_PATH];
+        ThreadData* td = static_cast<ThreadData*>(c->get_blackboard_entry(thread_data_attr).value().get_ptr());
 
-        char strbuf[MAX_PATH][NAMELEN];
+        if (!td && can_alloc) {
+            td = new ThreadData(cache_size, use_name);
 
-        // Init unwind context
-        unw_cursor_t ucursor;
+            c->set(thread_data_attr, cali_make_variant_from_ptr(td));
 
-        Entry e;
-        if (ucursor_attr)
-            e = info.get(ucursor_attr);
-        if (!e.empty()) {
-            ucursor = *static_cast<unw_cursor_t*>(e.value().get_ptr());
-        } else {
-            unw_context_t uctx;
-            unw_getcontext(&uctx);
+            std::lock_guard<util::spinlock> g(thread_data_lock);
 
-            if (unw_init_local(&ucursor, &uctx) < 0) {
-                Log(0).stream() << "callpath: unable to init libunwind cursor\n";
-                return;
+            td->next         = thread_data_list;
+            thread_data_list = td;
+        }
+
+        return td;
+    }
+
+    inline bool is_internal(uintptr_t ip) const
+    {
+        return skip_internal && ip >= caliper_start_addr && ip < caliper_end_addr;
+    }
+
+    inline bool is_thread_entry(uintptr_t ip) const
+    {
+        for (const CodeRange& r : thread_entry_ranges)
+            if (ip >= r.start && ip < r.end)
+                return true;
+
+        return false;
+    }
+
+    // Find the executable segments of the module containing r->start
+    static int find_code_range_cb(struct dl_phdr_info* info, size_t, void* data)
+    {
+        CodeRange* r  = static_cast<CodeRange*>(data);
+        uintptr_t  lo = UINTPTR_MAX;
+        uintptr_t  hi = 0;
+
+        for (int i = 0; i < info->dlpi_phnum; ++i) {
+            const ElfW(Phdr)& ph = info->dlpi_phdr[i];
+
+            if (ph.p_type == PT_LOAD && (ph.p_flags & PF_X)) {
+                lo = std::min<uintptr_t>(lo, info->dlpi_addr + ph.p_vaddr);
+                hi = std::max<uintptr_t>(hi, info->dlpi_addr + ph.p_vaddr + ph.p_memsz);
             }
         }
 
+        if (r->start >= lo && r->start < hi) {
+            r->start = lo;
+            r->end   = hi;
+            return 1;
+        }
+
+        return 0;
+    }
+
+    void get_thread_entry_addresses()
+    {
+        uintptr_t anchors[2] = { reinterpret_cast<uintptr_t>(&::abort), reinterpret_cast<uintptr_t>(&::pthread_create) };
+
+        for (int i = 0; i < 2; ++i) {
+            CodeRange r { anchors[i], 0 };
+
+            if (dl_iterate_phdr(find_code_range_cb, &r) > 0)
+                thread_entry_ranges[i] = r;
+        }
+    }
+
+    // Init the libunwind cursor from the sampler-provided cursor or the given context
+    bool init_cursor(const Entry& e, unw_context_t* uctx, unw_cursor_t* ucursor)
+    {
+        if (!e.empty()) {
+            *ucursor = *static_cast<unw_cursor_t*>(e.value().get_ptr());
+        } else if (unw_init_local(ucursor, uctx) < 0) {
+            Log(0).stream() << "callpath: unable to init libunwind cursor\n";
+            return false;
+        }
+
+        return true;
+    }
+
+    static void get_proc_name(unw_cursor_t* ucursor, char* name)
+    {
+        unw_word_t offs;
+
+        if (unw_get_proc_name(ucursor, name, NAMELEN, &offs) < 0)
+            strncpy(name, "UNKNOWN", NAMELEN);
+    }
+
+    // Collect return addresses with libunwind. If names is given, also
+    // retrieve function names. If cursors is given, keep a copy of the
+    // cursor of each frame. Returns the number of frames.
+    size_t unwind_libunwind(unw_cursor_t* ucursor, uintptr_t* ips, char (*names)[NAMELEN], unw_cursor_t* cursors)
+    {
         // skip n frames
 
         size_t n = 0;
 
-        for (n = skip_frames; n > 0 && unw_step(&ucursor) > 0; --n)
+        for (n = skip_frames; n > 0 && unw_step(ucursor) > 0; --n)
             ;
 
         if (n > 0)
-            return;
-
-        while (n < MAX_PATH && unw_step(&ucursor) > 0) {
+            return 0;
 
-            // skip stack frames inside caliper
+        while (n < MAX_PATH && unw_step(ucursor) > 0) {
             unw_word_t ip;
-            unw_get_reg(&ucursor, UNW_REG_IP, &ip);
+            unw_get_reg(ucursor, UNW_REG_IP, &ip);
 
-            if (skip_internal && (ip >= caliper_start_addr && ip < caliper_end_addr))
+            // skip stack frames inside caliper
+            if (is_internal(ip))
                 continue;
 
-            // store path from top to bottom
-            if (use_addr) {
-                uint64_t uint              = ip;
-                v_addr[MAX_PATH - (n + 1)] = Variant(CALI_TYPE_ADDR, &uint, sizeof(uint64_t));
+            ips[n] = ip;
+
+            if (names)
+                get_proc_name(ucursor, names[n]);
+            if (cursors)
+                cursors[n] = *ucursor;
+
+            ++n;
+        }
+
+        return n;
+    }
+
+#ifdef CALI_CALLPATH_HAVE_FRAME_POINTERS
+    // Collect return addresses by following the frame-pointer chain,
+    // starting with return address ip (if non-zero) and frame fp, into ips.
+    // Returns false if the chain is broken before it reaches the thread
+    // entry code. A chain breaks at a frame that doesn't maintain the frame
+    // pointer: then the next frame record is outside the thread's stack,
+    // doesn't move up the stack, or holds a return address into the stack.
+    // The outermost frames in libc usually break the chain, so a break
+    // right after a libc frame is a regular end.
+    bool unwind_frame_pointers(const ThreadData* td, uintptr_t ip, uintptr_t fp, uintptr_t* ips, size_t& n)
+    {
+        size_t    skip    = skip_frames;
+        uintptr_t prev_fp = 0;
+
+        n = 0;
+
+        while (n < MAX_PATH) {
+            if (ip >= td->stack_lo && ip < td->stack_hi)
+                return false;
+
+            if (ip) {
+                if (skip > 0)
+                    --skip;
+                else if (!is_internal(ip))
+                    ips[n++] = ip;
             }
-            if (use_name) {
-                unw_word_t offs;
 
-                if (unw_get_proc_name(&ucursor, strbuf[n], NAMELEN, &offs) < 0)
-                    strncpy(strbuf[n], "UNKNOWN", NAMELEN);
+            if (fp == 0)
+                return true;
+
+            // the stack grows downwards: a valid chain moves strictly upwards
+            if (fp < td->stack_lo || fp + 2 * sizeof(uintptr_t) > td->stack_hi || fp % sizeof(uintptr_t) != 0
+                || fp <= prev_fp)
+                return is_thread_entry(ip);
+
+            const uintptr_t* frame = reinterpret_cast<const uintptr_t*>(fp);
+
+            prev_fp = fp;
+            fp      = frame[0];
+            ip      = frame[1];
+
+            if (ip == 0)
+                return fp == 0;
+        }
 
-                v_name[MAX_PATH - (n + 1)] = Variant(CALI_TYPE_STRING, strbuf[n], strlen(strbuf[n]));
+        return true;
+    }
+#endif
+
+    PathCacheEntry* find_cache_entry(ThreadData* td, const uintptr_t* ips, size_t n, uint64_t& hash)
+    {
+        // FNV-1a over the return addresses
+        hash = 0xcbf29ce484222325ull;
+
+        for (size_t i = 0; i < n; ++i) {
+            hash ^= static_cast<uint64_t>(ips[i]);
+            hash *= 0x100000001b3ull;
+        }
+
+        return &td->cache[hash % td->cache.size()];
+    }
+
+    void snapshot_cb(Caliper* c, SnapshotView info, SnapshotBuilder& snapshot)
+    {
+        uintptr_t ips[MAX_PATH];
+        char      names[MAX_PATH][NAMELEN];
+        size_t    n          = 0;
+        bool      have_names = false;
+
+        ThreadData* td = acquire_thread_data(c, !c->is_signal());
+
+        Entry e;
+        if (ucursor_attr)
+            e = info.get(ucursor_attr);
+
+        unw_context_t uctx;
+        unw_cursor_t  ucursor;
+
+        if (e.empty())
+            unw_getcontext(&uctx);
+
+        bool have_ips = false;
+
+#ifdef CALI_CALLPATH_HAVE_FRAME_POINTERS
+        if (use_frame_pointers && td && td->stack_hi > td->stack_lo) {
+            if (e.empty()) {
+                have_ips =
+                    unwind_frame_pointers(td, 0, reinterpret_cast<uintptr_t>(__builtin_frame_address(0)), ips, n);
+            } else {
+                // start at the frame interrupted by the sampler
+                unw_cursor_t tmp = *static_cast<unw_cursor_t*>(e.value().get_ptr());
+
+                if (unw_step(&tmp) > 0) {
+                    unw_word_t ip = 0, fp = 0;
+                    unw_get_reg(&tmp, UNW_REG_IP, &ip);
+                    unw_get_reg(&tmp, CALI_CALLPATH_FP_REG, &fp);
+                    have_ips = unwind_frame_pointers(td, ip, fp, ips, n);
+                }
             }
 
-            ++n;
+            // Use libunwind if the frame-pointer chain is broken or empty
+            have_ips = have_ips && n > 0;
+
+            if (!have_ips)
+                ++td->num_fallbacks;
+        }
+#endif
+
+        //   With libunwind, keep the frame cursors so names can be looked up
+        // later on a cache miss. Without thread data to keep them in, look
+        // up the names right away.
+        unw_cursor_t* cursors         = nullptr;
+        bool          cursors_for_ips = false;
+
+        if (!have_ips) {
+            if (!init_cursor(e, &uctx, &ucursor))
+                return;
+
+            if (use_name && td && !td->cursors.empty())
+                cursors = td->cursors.data();
+
+            have_names      = use_name && !cursors;
+            n               = unwind_libunwind(&ucursor, ips, have_names ? names : nullptr, cursors);
+            cursors_for_ips = (cursors != nullptr);
         }
 
-        if (n > 0) {
-            if (use_addr)
-                snapshot.append(
-                    Entry(c->make_tree_entry(callpath_addr_attr, n, v_addr + (MAX_PATH - n), &callpath_root_node))
-                );
-            if (use_name)
-                snapshot.append(
-                    Entry(c->make_tree_entry(callpath_name_attr, n, v_name + (MAX_PATH - n), &callpath_root_node))
-                );
+        if (n == 0)
+            return;
+
+        Node*           addr_node = nullptr;
+        Node*           name_node = nullptr;
+        PathCacheEntry* ce        = nullptr;
+        uint64_t        hash      = 0;
+
+        if (td && !td->cache.empty()) {
+            ce = find_cache_entry(td, ips, n, hash);
+
+            if (ce->hash == hash && ce->n == n && memcmp(ce->ips, ips, n * sizeof(uintptr_t)) == 0) {
+                addr_node = ce->addr_node;
+                name_node = ce->name_node;
+                ++td->num_hits;
+            } else {
+                ++td->num_misses;
+                ce->hash = 0; // invalidate until it is re-filled below
+            }
         }
+
+        if (!addr_node && !name_node) {
+            //   The cache key is always the unwound address sequence. The
+            // stored addresses and names come from the same set of frames.
+            const uintptr_t* path_ips = ips;
+            size_t           path_n   = n;
+            uintptr_t        name_ips[MAX_PATH];
+
+            if (use_name && !have_names) {
+                if (cursors_for_ips) {
+                    for (size_t i = 0; i < n; ++i)
+                        get_proc_name(&cursors[i], names[i]);
+                } else {
+                    // Frame-pointer unwinding doesn't give us function names:
+                    // take both addresses and names from one libunwind walk
+                    if (!init_cursor(e, &uctx, &ucursor))
+                        return;
+
+                    path_n   = unwind_libunwind(&ucursor, name_ips, names, nullptr);
+                    path_ips = name_ips;
+                }
+            }
+
+            if (use_addr && path_n > 0) {
+                Variant v_addr[MAX_PATH];
+
+                // store path from top to bottom
+                for (size_t i = 0; i < path_n; ++i) {
+                    uint64_t uint              = path_ips[i];
+                    v_addr[MAX_PATH - (i + 1)] = Variant(CALI_TYPE_ADDR, &uint, sizeof(uint64_t));
+                }
+
+                addr_node =
+                    c->make_tree_entry(callpath_addr_attr, path_n, v_addr + (MAX_PATH - path_n), &callpath_root_node);
+            }
+            if (use_name && path_n > 0) {
+                Variant v_name[MAX_PATH];
+
+                for (size_t i = 0; i < path_n; ++i)
+                    v_name[MAX_PATH - (i + 1)] = Variant(CALI_TYPE_STRING, names[i], strlen(names[i]));
+
+                name_node =
+                    c->make_tree_entry(callpath_name_attr, path_n, v_name + (MAX_PATH - path_n), &callpath_root_node);
+            }
+
+            if (ce) {
+                memcpy(ce->ips, ips, n * sizeof(uintptr_t));
+                ce->n         = n;
+                ce->addr_node = addr_node;
+                ce->name_node = name_node;
+                ce->hash      = hash;
+            }
+        }
+
+        if (addr_node)
+            snapshot.append(Entry(addr_node));
+        if (name_node)
+            snapshot.append(Entry(name_node));
     }
 
     void get_caliper_module_addresses()
@@ -174,7 +516,25 @@ class Callpath
 #endif
     }
 
-    void post_init_evt(Caliper* c, Channel*) { ucursor_attr = c->get_attribute("cali.unw_cursor"); }
+    void post_init_evt(Caliper* c, Channel*)
+    {
+        ucursor_attr = c->get_attribute("cali.unw_cursor");
+        acquire_thread_data(c, true);
+    }
+
+    void finish_evt(Caliper* c, Channel* chn)
+    {
+        size_t hits = 0, misses = 0, fallbacks = 0;
+
+        for (ThreadData* td = thread_data_list; td; td = td->next) {
+            hits += td->num_hits;
+            misses += td->num_misses;
+            fallbacks += td->num_fallbacks;
+        }
+
+        Log(2).stream() << chn->name() << ": callpath: " << hits << " path cache hits, " << misses
+                        << " misses, " << fallbacks << " frame-pointer unwind fallbacks" << std::endl;
+    }
 
     Callpath(Caliper* c, Channel* chn) : callpath_root_node(CALI_INV_ID, CALI_INV_ID, Variant())
     {
@@ -184,6 +544,21 @@ class Callpath
         use_addr      = config.get("use_address").to_bool();
         skip_frames   = config.get("skip_frames").to_uint();
         skip_internal = config.get("skip_internal").to_bool();
+        cache_size    = config.get("path_cache_size").to_uint();
+
+        use_frame_pointers = config.get("use_frame_pointers").to_bool();
+
+#ifndef CALI_CALLPATH_HAVE_FRAME_POINTERS
+        if (use_frame_pointers) {
+            Log(1).stream() << chn->name()
+                            << ": callpath: frame-pointer unwinding is not supported on this platform, using libunwind"
+                            << std::endl;
+            use_frame_pointers = false;
+        }
+#else
+        if (use_frame_pointers)
+            get_thread_entry_addresses();
+#endif
 
         Attribute symbol_class_attr = c->get_attribute("class.symboladdress");
         Variant   v_true(true);
@@ -198,6 +573,11 @@ class Callpath
         );
         callpath_name_attr =
             c->create_attribute("callpath.regname", CALI_TYPE_STRING, CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS);
+        thread_data_attr = c->create_attribute(
+            std::string("callpath.td.") + std::to_string(chn->id()),
+            CALI_TYPE_PTR,
+            CALI_ATTR_SCOPE_THREAD | CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_HIDDEN
+        );
 
 #ifdef CALIPER_HAVE_LIBDW
         if (skip_internal)
@@ -211,6 +591,17 @@ public:
 
     static const char* s_spec;
 
+    ~Callpath()
+    {
+        ThreadData* td = thread_data_list;
+
+        while (td) {
+            ThreadData* tmp = td->next;
+            delete td;
+            td = tmp;
+        }
+    }
+
     static void callpath_service_register(Caliper* c, Channel* chn)
     {
         Callpath* instance = new Callpath(c, chn);
@@ -221,7 +612,13 @@ public:
                 instance->snapshot_cb(c, info, snapshot);
             }
         );
-        chn->events().finish_evt.connect([instance](Caliper* c, Channel* chn) { delete instance; });
+        chn->events().create_thread_evt.connect([instance](Caliper* c, Channel*) {
+            instance->acquire_thread_data(c, true);
+        });
+        chn->events().finish_evt.connect([instance](Caliper* c, Channel* chn) {
+            instance->finish_evt(c, chn);
+            delete instance;
+        });
 
         Log(1).stream() << chn->name() << ": Registered callpath service" << std::endl;
     }
@@ -254,6 +651,16 @@ const char* Callpath::s_spec = R"json(
    "type": "bool",
    "description": "Skip internal (inside Caliper library) stack frames",
    "value": "true"
+  },{
+   "name": "use_frame_pointers",
+   "type": "bool",
+   "description": "Unwind by following frame pointers, falling back to libunwind if the chain is broken",
+   "value": "false"
+  },{
+   "name": "path_cache_size",
+   "type": "uint",
+   "description": "Number of call paths cached per thread (0 disables the cache)",
+   "value": "256"
   }
  ]
 }
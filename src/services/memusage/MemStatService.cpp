@@ -11,9 +11,12 @@
 
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <array>
+#include <atomic>
+#include <cstring>
 
 using namespace cali;
 
@@ -36,20 +39,78 @@ inline std::array<uint64_t, 6> parse_statm(const char* buf, ssize_t max)
     return numbers;
 }
 
+/// \brief Parse "Key:   value kB" lines as found in /proc/self/status and
+///   /proc/self/smaps_rollup. Stores the value for keys[i] in out[i].
+inline void parse_kb_fields(const char* buf, ssize_t max, const char* const* keys, uint64_t* out, int nkeys)
+{
+    ssize_t pos = 0;
+
+    while (pos < max) {
+        ssize_t eol = pos;
+        while (eol < max && buf[eol] != '\n')
+            ++eol;
+
+        const char* line = buf + pos;
+        ssize_t     len  = eol - pos;
+
+        for (int k = 0; k < nkeys; ++k) {
+            ssize_t klen = static_cast<ssize_t>(strlen(keys[k]));
+
+            if (len > klen && line[klen] == ':' && strncmp(line, keys[k], klen) == 0) {
+                uint64_t val = 0;
+                for (ssize_t n = klen + 1; n < len; ++n) {
+                    char c = line[n];
+                    if (c >= '0' && c <= '9')
+                        val = val * 10 + (static_cast<unsigned>(c) - static_cast<unsigned>('0'));
+                    else if (c != ' ' && c != '\t')
+                        break;
+                }
+                out[k] = val;
+                break;
+            }
+        }
+
+        pos = eol + 1;
+    }
+}
+
+inline uint64_t monotonic_usec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000ull + static_cast<uint64_t>(ts.tv_nsec) / 1000ull;
+}
+
 class MemstatService
 {
-    Attribute m_vmsize_attr;
-    Attribute m_vmrss_attr;
-    Attribute m_vmdata_attr;
+    enum Field { VmSize = 0, VmRSS, Data, VmHWM, RssAnon, RssFile, RssShmem, Pss, Swap, NumFields };
 
-    int m_fd;
+    static const char* const s_status_keys[];
+    static const char* const s_smaps_keys[];
 
-    unsigned m_failed;
+    Attribute m_attr[NumFields];
+    bool      m_active[NumFields];
 
-    void snapshot_cb(Caliper*, SnapshotBuilder& rec)
+    // The last values read from /proc. Fields may be updated by one
+    // thread while another reads them: values from different refreshes
+    // can mix in a snapshot, which is fine for these statistics.
+    std::atomic<uint64_t> m_values[NumFields];
+
+    int m_statm_fd;
+    int m_status_fd;
+    int m_smaps_fd;
+
+    uint64_t              m_interval_usec;
+    std::atomic<uint64_t> m_next_refresh;
+
+    std::atomic<unsigned> m_failed;
+    std::atomic<unsigned> m_num_refresh;
+    std::atomic<unsigned> m_num_reused;
+
+    void refresh()
     {
-        char    buf[80];
-        ssize_t ret = pread(m_fd, buf, sizeof(buf), 0);
+        char    buf[4096];
+        ssize_t ret = pread(m_statm_fd, buf, 80, 0);
 
         if (ret < 0) {
             ++m_failed;
@@ -58,56 +119,144 @@ class MemstatService
 
         auto val = parse_statm(buf, ret);
 
-        rec.append(m_vmsize_attr, cali_make_variant_from_uint(val[0]));
-        rec.append(m_vmrss_attr, cali_make_variant_from_uint(val[1]));
-        rec.append(m_vmdata_attr, cali_make_variant_from_uint(val[5]));
+        m_values[VmSize].store(val[0], std::memory_order_relaxed);
+        m_values[VmRSS].store(val[1], std::memory_order_relaxed);
+        m_values[Data].store(val[5], std::memory_order_relaxed);
+
+        if (m_status_fd >= 0) {
+            uint64_t kb[4] = { 0, 0, 0, 0 };
+            ret            = pread(m_status_fd, buf, sizeof(buf), 0);
+
+            if (ret < 0)
+                ++m_failed;
+            else {
+                parse_kb_fields(buf, ret, s_status_keys, kb, 4);
+
+                for (int i = 0; i < 4; ++i)
+                    m_values[VmHWM + i].store(kb[i], std::memory_order_relaxed);
+            }
+        }
+
+        if (m_smaps_fd >= 0) {
+            uint64_t kb[2] = { 0, 0 };
+            ret            = pread(m_smaps_fd, buf, sizeof(buf), 0);
+
+            if (ret < 0)
+                ++m_failed;
+            else {
+                parse_kb_fields(buf, ret, s_smaps_keys, kb, 2);
+
+                for (int i = 0; i < 2; ++i)
+                    m_values[Pss + i].store(kb[i], std::memory_order_relaxed);
+            }
+        }
+
+        ++m_num_refresh;
+    }
+
+    void snapshot_cb(Caliper*, SnapshotBuilder& rec)
+    {
+        if (m_interval_usec == 0)
+            refresh();
+        else {
+            // Only one thread wins the race to refresh the values for the
+            // next interval; everyone else uses the last values. This
+            // doesn't block, so it is safe in signal handlers.
+            uint64_t now  = monotonic_usec();
+            uint64_t next = m_next_refresh.load(std::memory_order_relaxed);
+
+            if (now >= next && m_next_refresh.compare_exchange_strong(next, now + m_interval_usec))
+                refresh();
+            else
+                ++m_num_reused;
+        }
+
+        for (int i = 0; i < NumFields; ++i)
+            if (m_active[i])
+                rec.append(m_attr[i], cali_make_variant_from_uint(m_values[i].load(std::memory_order_relaxed)));
     }
 
     void finish_cb(Caliper*, Channel* channel)
     {
         if (m_failed > 0)
-            Log(0).stream() << channel->name() << ": memstat: failed to read /proc/self/statm " << m_failed
+            Log(0).stream() << channel->name() << ": memstat: failed to read /proc/self files " << m_failed
                             << " times\n";
+        if (m_interval_usec > 0)
+            Log(2).stream() << channel->name() << ": memstat: " << m_num_refresh << " refreshes, " << m_num_reused
+                            << " snapshots used cached values\n";
     }
 
-    MemstatService(Caliper* c, int fd) : m_fd { fd }, m_failed { 0 }
+    MemstatService(Caliper* c, int statm_fd, int status_fd, int smaps_fd, uint64_t interval_usec)
+        : m_statm_fd { statm_fd },
+          m_status_fd { status_fd },
+          m_smaps_fd { smaps_fd },
+          m_interval_usec { interval_usec },
+          m_next_refresh { 0 },
+          m_failed { 0 },
+          m_num_refresh { 0 },
+          m_num_reused { 0 }
     {
-        m_vmsize_attr = c->create_attribute(
-            "memstat.vmsize",
-            CALI_TYPE_UINT,
-            CALI_ATTR_SCOPE_PROCESS | CALI_ATTR_ASVALUE | CALI_ATTR_AGGREGATABLE
-        );
-        m_vmrss_attr = c->create_attribute(
-            "memstat.vmrss",
-            CALI_TYPE_UINT,
-            CALI_ATTR_SCOPE_PROCESS | CALI_ATTR_ASVALUE | CALI_ATTR_AGGREGATABLE
-        );
-        m_vmdata_attr = c->create_attribute(
-            "memstat.data",
-            CALI_TYPE_UINT,
-            CALI_ATTR_SCOPE_PROCESS | CALI_ATTR_ASVALUE | CALI_ATTR_AGGREGATABLE
-        );
+        const char* names[NumFields] = { "memstat.vmsize",   "memstat.vmrss",    "memstat.data",
+                                         "memstat.vmhwm",    "memstat.rss_anon", "memstat.rss_file",
+                                         "memstat.rss_shmem", "memstat.pss",     "memstat.swap" };
+
+        for (int i = 0; i < NumFields; ++i) {
+            m_values[i].store(0);
+            m_active[i] = (i < VmHWM) || (i < Pss ? status_fd >= 0 : smaps_fd >= 0);
+
+            if (m_active[i])
+                m_attr[i] = c->create_attribute(
+                    names[i],
+                    CALI_TYPE_UINT,
+                    CALI_ATTR_SCOPE_PROCESS | CALI_ATTR_ASVALUE | CALI_ATTR_AGGREGATABLE
+                );
+        }
+    }
+
+    static int open_proc_file(const char* path)
+    {
+        int fd = open(path, O_RDONLY | O_NONBLOCK);
+
+        if (fd < 0)
+            Log(0).perror(errno, "memstat: open: ") << ": " << path << std::endl;
+
+        return fd;
     }
 
 public:
 
+    static const char* s_spec;
+
     static void memstat_register(Caliper* c, Channel* channel)
     {
-        int fd = open("/proc/self/statm", O_RDONLY | O_NONBLOCK);
+        auto config = services::init_config_from_spec(channel->config(), s_spec);
+
+        int statm_fd = open_proc_file("/proc/self/statm");
 
-        if (fd < 0) {
-            Log(0).perror(errno, "open(\"/proc/self/statm\")");
+        if (statm_fd < 0)
             return;
-        }
 
-        MemstatService* instance = new MemstatService(c, fd);
+        int status_fd = config.get("record_status").to_bool() ? open_proc_file("/proc/self/status") : -1;
+        int smaps_fd  = config.get("record_smaps_rollup").to_bool() ? open_proc_file("/proc/self/smaps_rollup") : -1;
+
+        uint64_t interval_usec = static_cast<uint64_t>(config.get("refresh_interval").to_double() * 1e6);
+
+        MemstatService* instance = new MemstatService(c, statm_fd, status_fd, smaps_fd, interval_usec);
+
+        // read once up front so threads that lose the first refresh race
+        // don't report zeros
+        instance->refresh();
 
         channel->events().snapshot.connect([instance](Caliper* c, SnapshotView, SnapshotBuilder& rec) {
             instance->snapshot_cb(c, rec);
         });
         channel->events().finish_evt.connect([instance](Caliper* c, Channel* channel) {
             instance->finish_cb(c, channel);
-            close(instance->m_fd);
+            close(instance->m_statm_fd);
+            if (instance->m_status_fd >= 0)
+                close(instance->m_status_fd);
+            if (instance->m_smaps_fd >= 0)
+                close(instance->m_smaps_fd);
             delete instance;
         });
 
@@ -115,10 +264,34 @@ public:
     }
 };
 
-const char* memstat_spec = R"json(
+const char* const MemstatService::s_status_keys[] = { "VmHWM", "RssAnon", "RssFile", "RssShmem" };
+const char* const MemstatService::s_smaps_keys[]  = { "Pss", "Swap" };
+
+const char* MemstatService::s_spec = R"json(
 {
     "name"        : "memstat",
-    "description" : "Record process memory info from /proc/self/statm"
+    "description" : "Record process memory info from /proc/self/statm",
+    "config"      :
+    [
+        {
+            "name"        : "refresh_interval",
+            "description" : "Minimum time in seconds between reads of /proc files. Snapshots within the interval reuse the last values.",
+            "type"        : "double",
+            "value"       : "0"
+        },
+        {
+            "name"        : "record_status",
+            "description" : "Record VmHWM, RssAnon, RssFile, and RssShmem (in KiB) from /proc/self/status",
+            "type"        : "bool",
+            "value"       : "false"
+        },
+        {
+            "name"        : "record_smaps_rollup",
+            "description" : "Record Pss and Swap (in KiB) from /proc/self/smaps_rollup",
+            "type"        : "bool",
+            "value"       : "false"
+        }
+    ]
 }
 )json";
 
@@ -127,6 +300,6 @@ const char* memstat_spec = R"json(
 namespace cali
 {
 
-CaliperService memstat_service { ::memstat_spec, ::MemstatService::memstat_register };
+CaliperService memstat_service { ::MemstatService::s_spec, ::MemstatService::memstat_register };
 
 }
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include "caliper/reader/RecordSelector.h"
 
 #include <memory>
+#include <thread>
 
 using namespace cali;
 
@@ -32,10 +33,97 @@ class MpiReport
     QuerySpec   m_local_spec;
     std::string m_filename;
     bool        m_append_to_file;
+    bool        m_shared_file;
     std::string m_channel_name;
 
+    std::thread m_async_thread;
+    MPI_Comm    m_async_comm { MPI_COMM_NULL };
+    bool        m_async_started { false };
+
+    OutputStream make_stream(Caliper* c, int rank, SnapshotView flush_info)
+    {
+        OutputStream stream;
+
+        if (rank == 0) {
+            stream.set_stream(OutputStream::StdOut);
+
+            if (m_append_to_file)
+                stream.set_mode(OutputStream::Mode::Append);
+            if (!m_filename.empty())
+                stream.set_filename(m_filename.c_str(), *c, std::vector<Entry>(flush_info.begin(), flush_info.end()));
+        }
+
+        return stream;
+    }
+
+    void wait_async()
+    {
+        if (!m_async_thread.joinable())
+            return;
+
+        m_async_thread.join();
+
+        // without the mpi service's finalize hook, we may only get here
+        // at the end of the program, after MPI_Finalize
+        int finalized = 0;
+        PMPI_Finalized(&finalized);
+
+        if (!finalized)
+            MPI_Comm_free(&m_async_comm);
+
+        m_async_comm = MPI_COMM_NULL;
+    }
+
+    void write_output_async_cb(Caliper* c, ChannelBody* chB, SnapshotView flush_info)
+    {
+        if (m_async_started)
+            return;
+
+        if (m_shared_file) {
+            Log(1).stream() << m_channel_name << ": mpireport: Shared file output is written at flush" << std::endl;
+            return;
+        }
+
+        int initialized = 0;
+        int finalized   = 0;
+
+        PMPI_Initialized(&initialized);
+        PMPI_Finalized(&finalized);
+
+        if (!initialized || finalized)
+            return;
+
+        int provided = MPI_THREAD_SINGLE;
+        MPI_Query_thread(&provided);
+
+        if (provided < MPI_THREAD_MULTIPLE) {
+            Log(1).stream() << m_channel_name << ": mpireport: Background reduction requires MPI_THREAD_MULTIPLE, "
+                            << "reducing at flush instead" << std::endl;
+            return;
+        }
+
+        int rank = 0;
+
+        MPI_Comm_dup(MPI_COMM_WORLD, &m_async_comm);
+        MPI_Comm_rank(m_async_comm, &rank);
+
+        OutputStream stream = make_stream(c, rank, flush_info);
+
+        m_async_thread =
+            collective_flush_async(stream, *c, chB, flush_info, m_local_spec, m_cross_spec, m_async_comm);
+        m_async_started = true;
+    }
+
     void write_output_cb(Caliper* c, ChannelBody* chB, SnapshotView flush_info)
     {
+        // a background reduction has been started: just wait for it
+
+        if (m_async_started) {
+            wait_async();
+            m_async_started = false;
+            return;
+        }
+
         // check if we can use MPI
 
         int initialized = 0;
@@ -58,23 +146,26 @@ class MpiReport
             MPI_Comm_rank(comm, &rank);
         }
 
-        OutputStream stream;
+        OutputStream stream = make_stream(c, rank, flush_info);
 
-        if (rank == 0) {
-            stream.set_stream(OutputStream::StdOut);
-
-            if (m_append_to_file)
-                stream.set_mode(OutputStream::Mode::Append);
-            if (!m_filename.empty())
-                stream.set_filename(m_filename.c_str(), *c, std::vector<Entry>(flush_info.begin(), flush_info.end()));
-        }
-
-        collective_flush(stream, *c, chB, flush_info, m_local_spec, m_cross_spec, comm);
+        if (m_shared_file)
+            collective_file_flush(stream, *c, chB, flush_info, m_local_spec, comm);
+        else
+            collective_flush(stream, *c, chB, flush_info, m_local_spec, m_cross_spec, comm);
 
         if (comm != MPI_COMM_NULL)
             MPI_Comm_free(&comm);
     }
 
+    void connect_mpi_finalize_wait(Channel* channel)
+    {
+        MpiEvents* events = mpiwrap_get_events(channel);
+
+        // background reductions must complete before MPI_Finalize
+        if (events)
+            events->mpi_finalize_evt.connect([this](Caliper*, Channel*) { wait_async(); });
+    }
+
     void connect_mpi_finalize(Channel* channel)
     {
         MpiEvents* events = mpiwrap_get_events(channel);
@@ -94,8 +185,10 @@ class MpiReport
         const QuerySpec& local_spec,
         const std::string& filename,
         bool append,
+        bool shared_file,
         const std::string& chname)
-        : m_cross_spec(cross_spec), m_local_spec(local_spec), m_filename(filename), m_append_to_file(append), m_channel_name(chname)
+        : m_cross_spec(cross_spec), m_local_spec(local_spec), m_filename(filename), m_append_to_file(append),
+          m_shared_file(shared_file), m_channel_name(chname)
     {}
 
 public:
@@ -124,19 +217,29 @@ public:
             local_parser.spec(),
             config.get("filename").to_string(),
             config.get("append").to_bool(),
+            config.get("shared_file").to_bool(),
             chn->name()
         );
 
         chn->events().write_output_evt.connect([instance](Caliper* c, ChannelBody* chB, SnapshotView info) {
             instance->write_output_cb(c, chB, info);
         });
-        chn->events().finish_evt.connect([instance](Caliper*, Channel*) { delete instance; });
+        chn->events().write_output_async_evt.connect([instance](Caliper* c, ChannelBody* chB, SnapshotView info) {
+            instance->write_output_async_cb(c, chB, info);
+        });
+        chn->events().finish_evt.connect([instance](Caliper*, Channel*) {
+            instance->wait_async();
+            delete instance;
+        });
+
+        bool write_on_finalize = config.get("write_on_finalize").to_bool();
 
-        if (config.get("write_on_finalize").to_bool() == true) {
-            chn->events().post_init_evt.connect([instance](Caliper*, Channel* channel) {
+        chn->events().post_init_evt.connect([instance, write_on_finalize](Caliper*, Channel* channel) {
+            instance->connect_mpi_finalize_wait(channel);
+
+            if (write_on_finalize)
                 instance->connect_mpi_finalize(channel);
-            });
-        }
+        });
 
         Log(1).stream() << chn->name() << ": Registered mpireport service" << std::endl;
     }
@@ -158,6 +261,11 @@ const char* MpiReport::s_spec = R"json(
   "description": "Append to file instead of overwriting",
   "type": "bool",
   "value": "false"
+ },{
+  "name": "shared_file",
+  "description": "Write each rank's local_config results into one shared .cali file with MPI-IO",
+  "type": "bool",
+  "value": "false"
  },{
   "name": "config",
   "description": "CalQL query for cross-process aggregation and formatting",
@@ -0,0 +1,559 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+#include "CommMatrix.h"
+
+#include "RequestTable.hpp"
+
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+#include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+
+#include "../../common/util/spinlock.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+using namespace cali;
+
+namespace cali
+{
+
+extern Attribute mpifn_attr;
+
+}
+
+struct CommMatrix::CommMatrixImpl {
+    struct Key {
+        Node* region;
+        int   dst;
+
+        bool operator== (const Key& k) const { return region == k.region && dst == k.dst; }
+        bool operator< (const Key& k) const { return region == k.region ? dst < k.dst : region < k.region; }
+    };
+
+    struct KeyHash {
+        size_t operator() (const Key& k) const
+        {
+            return std::hash<const void*>()(k.region) ^ (static_cast<size_t>(k.dst) * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    struct Counters {
+        uint64_t count { 0 };
+        uint64_t bytes { 0 };
+    };
+
+    struct ThreadData {
+        // only contended during flush
+        util::spinlock lock;
+
+        std::unordered_map<Key, Counters, KeyHash> matrix;
+
+        // Most sends in a row go to the same destination from the same
+        // region, or to the same communicator
+        Key       last_key { nullptr, -1 };
+        Counters* last_counters { nullptr };
+
+        MPI_Comm                last_comm { MPI_COMM_NULL };
+        const std::vector<int>* last_ranks { nullptr };
+        unsigned                last_comm_epoch { 0 };
+
+        ThreadData* next { nullptr };
+    };
+
+    struct PersistentSend {
+        int      dst { -1 };
+        uint64_t bytes { 0 };
+    };
+
+    Attribute dst_attr;
+    Attribute count_attr;
+    Attribute bytes_attr;
+    Attribute degree_attr;
+    Attribute volume_attr;
+    Attribute rank_degree_attr;
+    Attribute rank_volume_attr;
+    Attribute thread_data_attr;
+
+    std::string       filename;
+    int               mpi_rank { -1 };
+    std::atomic<bool> file_written { false };
+
+    ThreadData*    thread_data_list { nullptr };
+    util::spinlock thread_data_lock;
+
+    // Translation of communicator ranks to MPI_COMM_WORLD ranks. An empty
+    // list means the communicator has the same ranks as MPI_COMM_WORLD.
+    std::unordered_map<MPI_Comm, std::vector<int>> comm_ranks;
+    std::mutex                                     comm_ranks_lock;
+
+    // Incremented when a communicator is freed. MPI may reuse the handle
+    // for a new communicator, so the per-thread last_comm caches are only
+    // valid for the epoch they were filled in.
+    std::atomic<unsigned> comm_epoch { 0 };
+
+    RequestTable<PersistentSend> req_map;
+
+    ThreadData* acquire_thread_data(Caliper* c)
+    {
+        ThreadData* td = static_cast<ThreadData*>(c->get_blackboard_entry(thread_data_attr).value().get_ptr());
+
+        if (!td) {
+            td = new ThreadData;
+
+            c->set(thread_data_attr, cali_make_variant_from_ptr(td));
+
+            std::lock_guard<util::spinlock> g(thread_data_lock);
+
+            td->next         = thread_data_list;
+            thread_data_list = td;
+        }
+
+        return td;
+    }
+
+    const std::vector<int>* lookup_comm_ranks(MPI_Comm comm)
+    {
+        std::lock_guard<std::mutex> g(comm_ranks_lock);
+
+        auto it = comm_ranks.find(comm);
+
+        if (it != comm_ranks.end())
+            return &it->second;
+
+        std::vector<int>& ranks = comm_ranks[comm];
+
+        int cmp = MPI_UNEQUAL;
+        PMPI_Comm_compare(comm, MPI_COMM_WORLD, &cmp);
+
+        if (cmp != MPI_IDENT && cmp != MPI_CONGRUENT) {
+            int size = 0;
+            PMPI_Comm_size(comm, &size);
+
+            std::vector<int> ranks_in(size);
+            std::iota(ranks_in.begin(), ranks_in.end(), 0);
+            ranks.resize(size);
+
+            MPI_Group world_grp;
+            MPI_Group comm_grp;
+
+            PMPI_Comm_group(MPI_COMM_WORLD, &world_grp);
+            PMPI_Comm_group(comm, &comm_grp);
+
+            PMPI_Group_translate_ranks(comm_grp, size, ranks_in.data(), world_grp, ranks.data());
+
+            PMPI_Group_free(&comm_grp);
+            PMPI_Group_free(&world_grp);
+        }
+
+        return &ranks;
+    }
+
+    int world_rank(ThreadData* td, MPI_Comm comm, int rank)
+    {
+        if (comm == MPI_COMM_WORLD)
+            return rank;
+
+        unsigned epoch = comm_epoch.load(std::memory_order_acquire);
+
+        if (comm != td->last_comm || epoch != td->last_comm_epoch) {
+            td->last_ranks      = lookup_comm_ranks(comm);
+            td->last_comm       = comm;
+            td->last_comm_epoch = epoch;
+        }
+
+        if (td->last_ranks->empty())
+            return rank;
+
+        return rank >= 0 && static_cast<size_t>(rank) < td->last_ranks->size() ? (*td->last_ranks)[rank] : rank;
+    }
+
+    // The current region, excluding the MPI function itself
+    Node* current_region(Caliper* c)
+    {
+        Node* node = c->get_path_node().node();
+
+        if (node && node->attribute() == mpifn_attr.id()) {
+            for (node = node->parent(); node && node->id() != CALI_INV_ID; node = node->parent())
+                if (c->get_attribute(node->attribute()).is_nested())
+                    break;
+
+            if (node && node->id() == CALI_INV_ID)
+                node = nullptr;
+        }
+
+        return node;
+    }
+
+    void add(Caliper* c, MPI_Comm comm, int dst, uint64_t bytes)
+    {
+        if (dst == MPI_PROC_NULL)
+            return;
+
+        ThreadData* td  = acquire_thread_data(c);
+        Key         key { current_region(c), world_rank(td, comm, dst) };
+
+        std::lock_guard<util::spinlock> g(td->lock);
+
+        if (!td->last_counters || !(key == td->last_key)) {
+            td->last_counters = &td->matrix[key];
+            td->last_key      = key;
+        }
+
+        td->last_counters->count += 1;
+        td->last_counters->bytes += bytes;
+    }
+
+    void handle_send(Caliper* c, int count, MPI_Datatype type, int dest, MPI_Comm comm)
+    {
+        int size = 0;
+        PMPI_Type_size(type, &size);
+
+        add(c, comm, dest, static_cast<uint64_t>(size) * count);
+    }
+
+    void handle_send_init(Caliper* c, int count, MPI_Datatype type, int dest, MPI_Comm comm, MPI_Request* req)
+    {
+        if (dest == MPI_PROC_NULL)
+            return;
+
+        int size = 0;
+        PMPI_Type_size(type, &size);
+
+        PersistentSend info;
+        info.dst   = world_rank(acquire_thread_data(c), comm, dest);
+        info.bytes = static_cast<uint64_t>(size) * count;
+
+        req_map.insert(handle_key(*req), info);
+    }
+
+    void handle_start(Caliper* c, int nreq, MPI_Request* reqs)
+    {
+        for (int i = 0; i < nreq; ++i) {
+            PersistentSend info;
+
+            if (req_map.find(handle_key(reqs[i]), &info))
+                add(c, MPI_COMM_WORLD, info.dst, info.bytes);
+        }
+    }
+
+    void comm_free(MPI_Comm comm)
+    {
+        std::lock_guard<std::mutex> g(comm_ranks_lock);
+
+        comm_ranks.erase(comm);
+        comm_epoch.fetch_add(1, std::memory_order_release);
+    }
+
+    std::map<Key, Counters> merge()
+    {
+        std::map<Key, Counters> ret;
+
+        std::lock_guard<util::spinlock> g(thread_data_lock);
+
+        for (ThreadData* td = thread_data_list; td; td = td->next) {
+            std::lock_guard<util::spinlock> g_td(td->lock);
+
+            for (const auto& p : td->matrix) {
+                Counters& ctr = ret[p.first];
+                ctr.count += p.second.count;
+                ctr.bytes += p.second.bytes;
+            }
+        }
+
+        return ret;
+    }
+
+    std::string region_path(Caliper* c, Node* node)
+    {
+        std::vector<std::string> names;
+
+        for (; node && node->id() != CALI_INV_ID; node = node->parent())
+            if (c->get_attribute(node->attribute()).is_nested())
+                names.push_back(node->data().to_string());
+
+        std::string path;
+
+        for (auto it = names.rbegin(); it != names.rend(); ++it) {
+            if (!path.empty())
+                path.append("/");
+            path.append(*it);
+        }
+
+        return path;
+    }
+
+    template <typename T>
+    static void write_raw(std::ostream* os, T val)
+    {
+        os->write(reinterpret_cast<const char*>(&val), sizeof(T));
+    }
+
+    // File format (native byte order):
+    //   "CALICMTX", uint32 version (1), int32 rank, uint32 #regions,
+    //   #regions x { uint32 len, char path[len] },
+    //   uint64 #entries, #entries x { uint32 region, int32 dst, uint64 count, uint64 bytes }
+    void write_file(Caliper* c, ChannelBody* chB)
+    {
+        if (filename.empty() || file_written.exchange(true))
+            return;
+
+        std::map<Key, Counters> matrix = merge();
+
+        FixedSizeSnapshotRecord<120> context;
+        c->pull_context(context.builder());
+
+        std::vector<Entry> info = c->get_globals(chB);
+        info.insert(info.end(), context.view().begin(), context.view().end());
+
+        OutputStream stream;
+        stream.set_filename(filename.c_str(), *c, info);
+
+        std::ostream* os = stream.stream();
+
+        if (!os || !os->good()) {
+            Log(0).stream() << "mpi: comm matrix: cannot open " << filename << std::endl;
+            return;
+        }
+
+        std::map<Node*, uint32_t> region_ids;
+        std::vector<Node*>        regions;
+
+        for (const auto& p : matrix)
+            if (region_ids.emplace(p.first.region, static_cast<uint32_t>(regions.size())).second)
+                regions.push_back(p.first.region);
+
+        os->write("CALICMTX", 8);
+        write_raw<uint32_t>(os, 1);
+        write_raw<int32_t>(os, mpi_rank);
+        write_raw<uint32_t>(os, static_cast<uint32_t>(regions.size()));
+
+        for (Node* node : regions) {
+            std::string path = region_path(c, node);
+            write_raw<uint32_t>(os, static_cast<uint32_t>(path.size()));
+            os->write(path.data(), path.size());
+        }
+
+        write_raw<uint64_t>(os, static_cast<uint64_t>(matrix.size()));
+
+        for (const auto& p : matrix) {
+            write_raw<uint32_t>(os, region_ids[p.first.region]);
+            write_raw<int32_t>(os, p.first.dst);
+            write_raw<uint64_t>(os, p.second.count);
+            write_raw<uint64_t>(os, p.second.bytes);
+        }
+
+        Log(1).stream() << "mpi: Wrote " << matrix.size() << " comm matrix entries" << std::endl;
+    }
+
+    void flush(Caliper* c, SnapshotFlushFn proc_fn)
+    {
+        std::map<Key, Counters> matrix = merge();
+
+        std::vector<Entry> rec;
+        rec.reserve(4);
+
+        // Topology summary: number of destination ranks and total bytes
+        // sent per region and for the whole process. Entries are sorted
+        // by region.
+
+        Node*    region = nullptr;
+        uint64_t degree = 0;
+        uint64_t bytes  = 0;
+
+        std::set<int> all_dst;
+        uint64_t      all_bytes = 0;
+
+        auto emit_summary = [&]() {
+            if (degree == 0)
+                return;
+
+            rec.clear();
+            if (region)
+                rec.push_back(Entry(region));
+            rec.push_back(Entry(degree_attr, cali_make_variant_from_uint(degree)));
+            rec.push_back(Entry(volume_attr, cali_make_variant_from_uint(bytes)));
+
+            proc_fn(*c, rec);
+        };
+
+        for (const auto& p : matrix) {
+            if (p.first.region != region) {
+                emit_summary();
+
+                region = p.first.region;
+                degree = 0;
+                bytes  = 0;
+            }
+
+            ++degree;
+            bytes += p.second.bytes;
+
+            all_dst.insert(p.first.dst);
+            all_bytes += p.second.bytes;
+
+            if (!filename.empty())
+                continue;
+
+            rec.clear();
+            if (p.first.region)
+                rec.push_back(Entry(p.first.region));
+            rec.push_back(Entry(dst_attr, Variant(p.first.dst)));
+            rec.push_back(Entry(count_attr, cali_make_variant_from_uint(p.second.count)));
+            rec.push_back(Entry(bytes_attr, cali_make_variant_from_uint(p.second.bytes)));
+
+            proc_fn(*c, rec);
+        }
+
+        emit_summary();
+
+        if (!all_dst.empty()) {
+            rec.clear();
+            rec.push_back(Entry(rank_degree_attr, cali_make_variant_from_uint(all_dst.size())));
+            rec.push_back(Entry(rank_volume_attr, cali_make_variant_from_uint(all_bytes)));
+
+            proc_fn(*c, rec);
+        }
+    }
+
+    void clear()
+    {
+        std::lock_guard<util::spinlock> g(thread_data_lock);
+
+        for (ThreadData* td = thread_data_list; td; td = td->next) {
+            std::lock_guard<util::spinlock> g_td(td->lock);
+
+            td->matrix.clear();
+            td->last_counters = nullptr;
+        }
+    }
+
+    void init(Caliper* c, Channel* chn, const std::string& fname)
+    {
+        filename = fname;
+
+        dst_attr    = c->create_attribute("comm.matrix.dst", CALI_TYPE_INT, CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS);
+        count_attr  = c->create_attribute(
+            "comm.matrix.count",
+            CALI_TYPE_UINT,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE
+        );
+        bytes_attr  = c->create_attribute(
+            "comm.matrix.bytes",
+            CALI_TYPE_UINT,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE
+        );
+        degree_attr = c->create_attribute(
+            "comm.matrix.degree",
+            CALI_TYPE_UINT,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE
+        );
+        volume_attr = c->create_attribute(
+            "comm.matrix.volume",
+            CALI_TYPE_UINT,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE
+        );
+        rank_degree_attr = c->create_attribute(
+            "comm.matrix.rank_degree",
+            CALI_TYPE_UINT,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE
+        );
+        rank_volume_attr = c->create_attribute(
+            "comm.matrix.rank_volume",
+            CALI_TYPE_UINT,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE
+        );
+        thread_data_attr = c->create_attribute(
+            std::string("comm.matrix.td.") + std::to_string(chn->id()),
+            CALI_TYPE_PTR,
+            CALI_ATTR_SCOPE_THREAD | CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_HIDDEN
+        );
+    }
+
+    ~CommMatrixImpl()
+    {
+        ThreadData* td = thread_data_list;
+
+        while (td) {
+            ThreadData* tmp = td->next;
+            delete td;
+            td = tmp;
+        }
+    }
+};
+
+CommMatrix::CommMatrix() : mP(new CommMatrixImpl)
+{}
+
+CommMatrix::~CommMatrix()
+{
+    mP.reset();
+}
+
+void CommMatrix::init(Caliper* c, Channel* chn, const std::string& filename)
+{
+    mP->init(c, chn, filename);
+}
+
+void CommMatrix::init_mpi(Caliper*, Channel*)
+{
+    PMPI_Comm_rank(MPI_COMM_WORLD, &mP->mpi_rank);
+}
+
+void CommMatrix::handle_send(Caliper* c, ChannelBody*, int count, MPI_Datatype type, int dest, int, MPI_Comm comm)
+{
+    mP->handle_send(c, count, type, dest, comm);
+}
+
+void CommMatrix::handle_send_init(
+    Caliper*     c,
+    ChannelBody*,
+    int          count,
+    MPI_Datatype type,
+    int          dest,
+    int,
+    MPI_Comm     comm,
+    MPI_Request* req
+)
+{
+    mP->handle_send_init(c, count, type, dest, comm, req);
+}
+
+void CommMatrix::handle_start(Caliper* c, ChannelBody*, int nreq, MPI_Request* reqs)
+{
+    mP->handle_start(c, nreq, reqs);
+}
+
+void CommMatrix::request_free(Caliper*, ChannelBody*, MPI_Request* req)
+{
+    mP->req_map.remove(handle_key(*req));
+}
+
+void CommMatrix::comm_free(Caliper*, ChannelBody*, MPI_Comm* comm)
+{
+    mP->comm_free(*comm);
+}
+
+void CommMatrix::flush(Caliper* c, ChannelBody*, SnapshotFlushFn proc_fn)
+{
+    mP->flush(c, proc_fn);
+}
+
+void CommMatrix::finish(Caliper* c, ChannelBody* chB)
+{
+    mP->write_file(c, chB);
+}
+
+void CommMatrix::clear()
+{
+    mP->clear();
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file CommMatrix.h
+/// \brief Sparse per-region MPI communication matrix
+
+#include "caliper/Caliper.h"
+
+#include <mpi.h>
+
+#include <memory>
+#include <string>
+
+#pragma once
+
+namespace cali
+{
+
+/// \brief Accumulates point-to-point message counts and bytes sent per
+///   region and destination rank.
+///
+/// Messages are counted in thread-local sparse tables without taking
+/// snapshots. The matrix is emitted as flush records, or written to a
+/// binary file once at MPI_Finalize or when the channel finishes.
+class CommMatrix
+{
+    struct CommMatrixImpl;
+    std::unique_ptr<CommMatrixImpl> mP;
+
+public:
+
+    CommMatrix();
+
+    ~CommMatrix();
+
+    void init(Caliper* c, Channel* chn, const std::string& filename);
+    void init_mpi(Caliper* c, Channel* chn);
+
+    void handle_send(Caliper* c, ChannelBody* chB, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm);
+    void handle_send_init(
+        Caliper*     c,
+        ChannelBody* chB,
+        int          count,
+        MPI_Datatype type,
+        int          dest,
+        int          tag,
+        MPI_Comm     comm,
+        MPI_Request* req
+    );
+
+    void handle_start(Caliper* c, ChannelBody* chB, int nreq, MPI_Request* reqs);
+
+    void request_free(Caliper* c, ChannelBody* chB, MPI_Request* req);
+
+    /// \brief Forget the rank translation cached for \a comm. Must be
+    ///   called before the communicator is freed.
+    void comm_free(Caliper* c, ChannelBody* chB, MPI_Comm* comm);
+
+    void flush(Caliper* c, ChannelBody* chB, SnapshotFlushFn proc_fn);
+    void clear();
+
+    /// \brief Write the matrix file, if one is configured. Only the first
+    ///   call writes the file.
+    void finish(Caliper* c, ChannelBody* chB);
+};
+
+} // namespace cali
@@ -3,14 +3,14 @@
 
 #include "MpiPattern.h"
 
+#include "RequestTable.hpp"
+
 #include "caliper/AsyncEvent.h"
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
 #include <atomic>
-#include <mutex>
 #include <numeric>
-#include <unordered_map>
 #include <sstream>
 #include <set>
 
@@ -46,8 +46,7 @@ struct MpiPattern::MpiPatternImpl {
         TimedAsyncEvent timer;
     };
 
-    std::unordered_map<MPI_Request, RequestInfo> req_map;
-    std::mutex                                   req_map_lock;
+    RequestTable<RequestInfo> req_map;
 
     // --- initialization
     //
@@ -101,7 +100,6 @@ struct MpiPattern::MpiPatternImpl {
 
     void init_mpi(Caliper* c, Channel* chn)
     {
-        req_map.reserve(100);
     }
 
     // --- point-to-point
@@ -148,9 +146,7 @@ struct MpiPattern::MpiPatternImpl {
         PMPI_Type_size(type, &info.size);
         info.size *= count;
 
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map[*req] = info;
+        req_map.insert(handle_key(*req), info);
     }
 
     void push_recv_event(Caliper* c, ChannelBody*, int src, int size, int tag)
@@ -192,9 +188,7 @@ struct MpiPattern::MpiPatternImpl {
         info.count         = count;
         info.timer         = TimedAsyncEvent::begin("irecv.req_wait_gap");
 
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map[*req] = info;
+        req_map.insert(handle_key(*req), info);
     }
 
     void handle_recv_init(
@@ -218,23 +212,17 @@ struct MpiPattern::MpiPatternImpl {
         info.count         = count;
         info.size          = 0;
 
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map[*req] = info;
+        req_map.insert(handle_key(*req), info);
     }
 
     void handle_start(Caliper* c, ChannelBody* chB, int nreq, MPI_Request* reqs)
     {
         for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex> g(req_map_lock);
+            RequestInfo info;
 
-            auto it = req_map.find(reqs[i]);
-
-            if (it == req_map.end())
+            if (!req_map.find(handle_key(reqs[i]), &info))
                 continue;
 
-            RequestInfo info = it->second;
-
             if (info.op == RequestInfo::Send)
                 push_send_event(c, chB, info.size, info.target, info.tag);
         }
@@ -243,30 +231,24 @@ struct MpiPattern::MpiPatternImpl {
     void handle_pre_completion(Caliper* c, ChannelBody* chB, int nreq, MPI_Request* reqs)
     {
         for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex> g(req_map_lock);
-
-            auto it = req_map.find(reqs[i]);
-            if (it == req_map.end())
-                continue;
+            RequestInfo info;
 
-            if (it->second.op == RequestInfo::Recv)
-                it->second.timer.end();
+            if (req_map.find(handle_key(reqs[i]), &info) && info.op == RequestInfo::Recv)
+                info.timer.end();
         }
     }
 
     void handle_completion(Caliper* c, ChannelBody* chB, int nreq, MPI_Request* reqs, MPI_Status* statuses)
     {
         for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex> g(req_map_lock);
+            RequestInfo info;
 
-            auto it = req_map.find(reqs[i]);
+            bool found = req_map.update(handle_key(reqs[i]), [&info](RequestInfo& v) {
+                info = v;
+                return !v.is_persistent;
+            });
 
-            if (it == req_map.end())
-                continue;
-
-            RequestInfo info = it->second;
-
-            if (info.op == RequestInfo::Recv) {
+            if (found && info.op == RequestInfo::Recv) {
                 int size = 0;
                 PMPI_Type_size(info.type, &size);
                 int count = 0;
@@ -274,18 +256,10 @@ struct MpiPattern::MpiPatternImpl {
 
                 push_recv_event(c, chB, statuses[i].MPI_SOURCE, size * count, statuses[i].MPI_TAG);
             }
-
-            if (!info.is_persistent)
-                req_map.erase(it);
         }
     }
 
-    void request_free(MPI_Request* req)
-    {
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map.erase(*req);
-    }
+    void request_free(MPI_Request* req) { req_map.remove(handle_key(*req)); }
 
     // --- collectives
     //
@@ -3,6 +3,8 @@
 
 #include "MpiTracing.h"
 
+#include "RequestTable.hpp"
+
 #include "caliper/Caliper.h"
 #include "caliper/SnapshotRecord.h"
 
@@ -58,8 +60,7 @@ struct MpiTracing::MpiTracingImpl {
     std::unordered_map<MPI_Comm, cali::Node*> comm_map; ///< Communicator map
     std::mutex                                comm_map_lock;
 
-    std::unordered_map<MPI_Request, RequestInfo> req_map;
-    std::mutex                                   req_map_lock;
+    RequestTable<RequestInfo> req_map;
 
     // --- initialization
     //
@@ -110,7 +111,6 @@ struct MpiTracing::MpiTracingImpl {
 
     void init_mpi(Caliper* c, Channel*)
     {
-        req_map.reserve(100);
         comm_map.reserve(100);
 
         make_comm_entry(c, MPI_COMM_WORLD);
@@ -211,9 +211,7 @@ struct MpiTracing::MpiTracingImpl {
         PMPI_Type_size(type, &info.size);
         info.size *= count;
 
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map[*req] = info;
+        req_map.insert(handle_key(*req), info);
     }
 
     void push_recv_event(Caliper* c, ChannelBody* chB, int src, int size, int tag, Node* comm_node)
@@ -258,9 +256,7 @@ struct MpiTracing::MpiTracingImpl {
         info.count         = count;
         info.comm_node     = lookup_comm(c, comm);
 
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map[*req] = info;
+        req_map.insert(handle_key(*req), info);
     }
 
     void handle_recv_init(
@@ -285,23 +281,17 @@ struct MpiTracing::MpiTracingImpl {
         info.comm_node     = lookup_comm(c, comm);
         info.size          = 0;
 
-        std::lock_guard<std::mutex> g(req_map_lock);
-
-        req_map[*req] = info;
+        req_map.insert(handle_key(*req), info);
     }
 
     void handle_start(Caliper* c, ChannelBody* chB, int nreq, MPI_Request* reqs)
     {
         for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex> g(req_map_lock);
-
-            auto it = req_map.find(reqs[i]);
+            RequestInfo info;
 
-            if (it == req_map.end())
+            if (!req_map.find(handle_key(reqs[i]), &info))
                 continue;
 
-            RequestInfo info = it->second;
-
             if (info.op == RequestInfo::Send)
                 push_send_event(c, chB, info.size, info.target, info.tag, info.comm_node);
         }
@@ -310,16 +300,14 @@ struct MpiTracing::MpiTracingImpl {
     void handle_completion(Caliper* c, ChannelBody* chB, int nreq, MPI_Request* reqs, MPI_Status* statuses)
     {
         for (int i = 0; i < nreq; ++i) {
-            std::lock_guard<std::mutex> g(req_map_lock);
+            RequestInfo info;
 
-            auto it = req_map.find(reqs[i]);
+            bool found = req_map.update(handle_key(reqs[i]), [&info](RequestInfo& v) {
+                info = v;
+                return !v.is_persistent;
+            });
 
-            if (it == req_map.end())
-                continue;
-
-            RequestInfo info = it->second;
-
-            if (info.op == RequestInfo::Recv) {
+            if (found && info.op == RequestInfo::Recv) {
                 int size = 0;
                 PMPI_Type_size(info.type, &size);
                 int count = 0;
@@ -327,17 +315,10 @@ struct MpiTracing::MpiTracingImpl {
 
                 push_recv_event(c, chB, statuses[i].MPI_SOURCE, size * count, statuses[i].MPI_TAG, info.comm_node);
             }
-
-            if (!info.is_persistent)
-                req_map.erase(it);
         }
     }
 
-    void request_free(MPI_Request* req)
-    {
-        std::lock_guard<std::mutex> g(req_map_lock);
-        req_map.erase(*req);
-    }
+    void request_free(MPI_Request* req) { req_map.remove(handle_key(*req)); }
 
     // --- collectives
     //
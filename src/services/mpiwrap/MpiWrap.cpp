@@ -50,6 +50,15 @@ const char* mpi_service_spec = R"json(
     "description": "Enable message pattern analysis",
     "type": "bool",
     "value": "false"
+  },
+  { "name": "comm_matrix",
+    "description": "Count messages and bytes sent per region and destination rank",
+    "type": "bool",
+    "value": "false"
+  },
+  { "name": "comm_matrix_file",
+    "description": "Write the communication matrix into this binary file instead of flush records",
+    "type": "string"
   }
  ]
 }
@@ -0,0 +1,224 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file  RequestTable.hpp
+/// \brief Concurrent table for per-request metadata of nonblocking MPI operations
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+namespace cali
+{
+
+/// \brief Convert an MPI handle (integer or pointer, depending on the MPI
+///   implementation) into a table key.
+template <typename H>
+inline uint64_t handle_key(const H& h)
+{
+    static_assert(sizeof(H) <= sizeof(uint64_t), "MPI handle type is too large");
+
+    uint64_t key = 0;
+    std::memcpy(&key, &h, sizeof(H));
+    return key;
+}
+
+/// \brief A concurrent hash table that maps request handles to values of
+///   type T.
+///
+/// Values are stored inline in a preallocated slot array indexed by
+/// open addressing with a bounded probe window. Each slot has its own
+/// state word: threads claim and lock individual slots with a CAS, so
+/// operations on different requests never contend on a shared lock, and
+/// nothing is allocated on the fast path. Keys that don't find a free
+/// slot within the probe window go into a mutex-protected overflow map.
+template <class T>
+class RequestTable
+{
+    static constexpr unsigned ProbeWindow = 16;
+
+    enum SlotState : unsigned { Free = 0, Busy = 1, Full = 2 };
+
+    struct Slot {
+        std::atomic<unsigned> state;
+        std::atomic<uint64_t> key;
+        T                     value;
+    };
+
+    Slot*  m_slots;
+    size_t m_mask;
+
+    std::mutex                      m_overflow_lock;
+    std::unordered_map<uint64_t, T> m_overflow;
+    std::atomic<size_t>             m_num_overflow;
+
+    static uint64_t hash(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    /// \brief Lock the full slot holding \a key. Returns \a nullptr if
+    ///   the key is not in the slot array.
+    Slot* lock_slot(uint64_t key)
+    {
+        size_t h = hash(key);
+
+        for (unsigned i = 0; i < ProbeWindow; ++i) {
+            Slot& s = m_slots[(h + i) & m_mask];
+
+            while (true) {
+                unsigned st = s.state.load(std::memory_order_acquire);
+
+                if (st == Busy)
+                    continue; // slot is being modified: wait and re-check
+                if (st != Full || s.key.load(std::memory_order_relaxed) != key)
+                    break;
+                if (s.state.compare_exchange_weak(st, Busy, std::memory_order_acquire)) {
+                    // the slot may have been reused between the check and the CAS
+                    if (s.key.load(std::memory_order_relaxed) == key)
+                        return &s;
+
+                    s.state.store(Full, std::memory_order_release);
+                    break;
+                }
+            }
+        }
+
+        return nullptr;
+    }
+
+public:
+
+    /// \brief Create a table with \a capacity slots (rounded up to a power of two).
+    explicit RequestTable(size_t capacity = 8192) : m_num_overflow(0)
+    {
+        size_t n = ProbeWindow;
+        while (n < capacity)
+            n *= 2;
+
+        m_slots = new Slot[n];
+        m_mask  = n - 1;
+
+        for (size_t i = 0; i < n; ++i) {
+            m_slots[i].state.store(Free, std::memory_order_relaxed);
+            m_slots[i].key.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~RequestTable() { delete[] m_slots; }
+
+    RequestTable(const RequestTable&)            = delete;
+    RequestTable& operator= (const RequestTable&) = delete;
+
+    /// \brief Insert or replace the value for \a key.
+    void insert(uint64_t key, const T& value)
+    {
+        Slot* s = lock_slot(key);
+
+        if (!s) {
+            size_t h = hash(key);
+
+            for (unsigned i = 0; !s && i < ProbeWindow; ++i) {
+                Slot&    cand = m_slots[(h + i) & m_mask];
+                unsigned st   = Free;
+
+                if (cand.state.compare_exchange_strong(st, Busy, std::memory_order_acquire))
+                    s = &cand;
+            }
+        }
+
+        if (s) {
+            s->key.store(key, std::memory_order_relaxed);
+            s->value = value;
+            s->state.store(Full, std::memory_order_release);
+
+            // drop a stale overflow entry with the same key, if there is one
+            if (m_num_overflow.load() > 0)
+                remove_overflow(key);
+
+            return;
+        }
+
+        std::lock_guard<std::mutex> g(m_overflow_lock);
+
+        if (m_overflow.emplace(key, value).second)
+            ++m_num_overflow;
+        else
+            m_overflow[key] = value;
+    }
+
+    /// \brief Call \a fn with a reference to the value for \a key. The
+    ///   entry is removed if \a fn returns \a true. The entry is locked
+    ///   while \a fn runs, so \a fn should be short. Returns \a false if
+    ///   \a key is not in the table.
+    template <class F>
+    bool update(uint64_t key, F fn)
+    {
+        Slot* s = lock_slot(key);
+
+        if (s) {
+            bool erase = fn(s->value);
+
+            if (erase)
+                s->value = T();
+
+            s->state.store(erase ? Free : Full, std::memory_order_release);
+            return true;
+        }
+
+        if (m_num_overflow.load() == 0)
+            return false;
+
+        std::lock_guard<std::mutex> g(m_overflow_lock);
+
+        auto it = m_overflow.find(key);
+
+        if (it == m_overflow.end())
+            return false;
+
+        if (fn(it->second)) {
+            m_overflow.erase(it);
+            --m_num_overflow;
+        }
+
+        return true;
+    }
+
+    /// \brief Copy the value for \a key into \a out. Returns \a false if
+    ///   \a key is not in the table.
+    bool find(uint64_t key, T* out)
+    {
+        return update(key, [out](T& v) {
+            *out = v;
+            return false;
+        });
+    }
+
+    /// \brief Remove the entry for \a key. Returns \a false if \a key is
+    ///   not in the table.
+    bool remove(uint64_t key)
+    {
+        return update(key, [](T&) { return true; });
+    }
+
+private:
+
+    void remove_overflow(uint64_t key)
+    {
+        std::lock_guard<std::mutex> g(m_overflow_lock);
+
+        if (m_overflow.erase(key) > 0)
+            --m_num_overflow;
+    }
+};
+
+} // namespace cali
@@ -1,6 +1,7 @@
 // Copyright (c) 2019, Lawrence Livermore National Security, LLC.
 // See top-level LICENSE file for details.
 //This is the ex-wrapper.w file
+#include "CommMatrix.h"
 #include "MpiTracing.h"
 #include "MpiPattern.h"
 
@@ -17,8 +18,10 @@
 #include <mpi.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <iterator>
+#include <mutex>
 #include <numeric>
 #include <string>
 
@@ -43,13 +46,12 @@ using namespace std;
 namespace
 {
 
-bool enable_wrapper     = false;
-
-// (Foo)_is_wrapped indicates wether the gotcha wrapper for (Foo) is active.
-// (Foo)_wrap_count indicates how many current channels need (Foo) wrapped.
+// (Foo)_is_wrapped indicates wether the gotcha wrapper for (Foo) is bound.
+// (Foo)_wrap_count indicates how many active channels need (Foo) wrapped.
+// Wrappers call straight through to the MPI function if the count is 0.
 {{forallfn foo}}
-bool {{foo}}_is_wrapped = false;
-int  {{foo}}_wrap_count = 0;
+bool             {{foo}}_is_wrapped = false;
+std::atomic<int> {{foo}}_wrap_count { 0 };
 {{endforallfn}}
 
 inline void push_mpifn(Caliper* c, bool enabled, const char* fname)
@@ -138,6 +140,7 @@ struct MpiWrapperConfig
 
             enable_msg_tracing = cfg.get("msg_tracing").to_bool();
             enable_msg_pattern = cfg.get("msg_pattern").to_bool();
+            enable_comm_matrix = cfg.get("comm_matrix").to_bool();
         }
 
     ~MpiWrapperConfig()
@@ -156,6 +159,9 @@ struct MpiWrapperConfig
     bool        enable_msg_pattern;
     MpiPattern  pattern;
 
+    bool        enable_comm_matrix;
+    CommMatrix  comm_matrix;
+
     MpiWrapperConfig* next;
     MpiWrapperConfig* prev;
 
@@ -268,6 +274,8 @@ mpi_init_cb(Caliper* c, Channel* chn)
         Log(2).stream() << chn->name() << ": Enabling MPI message tracing" << std::endl;
         mwc->tracing.init_mpi(c, chn);
     }
+    if (mwc->enable_comm_matrix)
+        mwc->comm_matrix.init_mpi(c, chn);
 }
 
 void
@@ -293,9 +301,7 @@ post_init_cb(Caliper* c, Channel* channel)
 //
 
 {{fn func MPI_Send MPI_Bsend MPI_Rsend MPI_Ssend MPI_Isend MPI_Ibsend MPI_Irsend MPI_Issend}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -307,21 +313,19 @@ post_init_cb(Caliper* c, Channel* channel)
                     mwc->tracing.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{5}});
                 if (mwc->enable_msg_pattern)
                     mwc->pattern.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{5}});
+                if (mwc->enable_comm_matrix)
+                    mwc->comm_matrix.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{5}});
             }
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Send_init MPI_Bsend_init MPI_Rsend_init MPI_Ssend_init}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -333,21 +337,19 @@ post_init_cb(Caliper* c, Channel* channel)
                     mwc->tracing.handle_send_init(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
                 if (mwc->enable_msg_pattern)
                     mwc->pattern.handle_send_init(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
+                if (mwc->enable_comm_matrix)
+                    mwc->comm_matrix.handle_send_init(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{5}}, {{6}});
             }
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Recv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -368,17 +370,13 @@ post_init_cb(Caliper* c, Channel* channel)
        }
 
        ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
        {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Sendrecv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -399,21 +397,19 @@ post_init_cb(Caliper* c, Channel* channel)
                     mwc->pattern.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{10}});
                     mwc->pattern.handle_recv(&c, mwc->channel.body(), {{6}}, {{7}}, {{8}}, {{9}}, {{10}}, {{11}});
                 }
+                if (mwc->enable_comm_matrix)
+                    mwc->comm_matrix.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{10}});
             }
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Sendrecv_replace}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -434,21 +430,19 @@ post_init_cb(Caliper* c, Channel* channel)
                     mwc->pattern.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{7}});
                     mwc->pattern.handle_recv(&c, mwc->channel.body(), {{1}}, {{2}}, {{5}}, {{6}}, {{7}}, {{8}});
                 }
+                if (mwc->enable_comm_matrix)
+                    mwc->comm_matrix.handle_send(&c, mwc->channel.body(), {{1}}, {{2}}, {{3}}, {{4}}, {{7}});
             }
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Irecv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -464,17 +458,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Recv_init}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -490,17 +480,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Start}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -512,21 +498,19 @@ post_init_cb(Caliper* c, Channel* channel)
                     mwc->tracing.handle_start(&c, mwc->channel.body(), 1, {{0}});
                 if (mwc->enable_msg_pattern)
                     mwc->pattern.handle_start(&c, mwc->channel.body(), 1, {{0}});
+                if (mwc->enable_comm_matrix)
+                    mwc->comm_matrix.handle_start(&c, mwc->channel.body(), 1, {{0}});
             }
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Startall}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -538,21 +522,19 @@ post_init_cb(Caliper* c, Channel* channel)
                     mwc->tracing.handle_start(&c, mwc->channel.body(), {{0}}, {{1}});
                 if (mwc->enable_msg_pattern)
                     mwc->pattern.handle_start(&c, mwc->channel.body(), {{0}}, {{1}});
+                if (mwc->enable_comm_matrix)
+                    mwc->comm_matrix.handle_start(&c, mwc->channel.body(), {{0}}, {{1}});
             }
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Wait}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         MPI_Request tmp_req = *{{0}};
         MPI_Status  tmp_status;
 
@@ -579,17 +561,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Waitall}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         int nreq = {{0}};
 
         MPI_Request* tmp_req      = nullptr;
@@ -635,17 +613,13 @@ post_init_cb(Caliper* c, Channel* channel)
             delete[] tmp_statuses;
             delete[] tmp_req;
         }
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Waitany}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         int nreq = {{0}};
@@ -687,17 +661,13 @@ post_init_cb(Caliper* c, Channel* channel)
 
         if (copy_reqs)
             delete[] tmp_req;
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Testsome MPI_Waitsome}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         int nreq = {{0}};
@@ -745,17 +715,13 @@ post_init_cb(Caliper* c, Channel* channel)
             delete[] tmp_statuses;
             delete[] tmp_req;
         }
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Test}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         MPI_Request tmp_req = *{{0}};
@@ -780,17 +746,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Testall}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         int nreq = {{0}};
@@ -839,17 +801,13 @@ post_init_cb(Caliper* c, Channel* channel)
             delete[] tmp_req;
         }
 
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Testany}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         int nreq = {{0}};
@@ -893,17 +851,13 @@ post_init_cb(Caliper* c, Channel* channel)
 
         if (copy_reqs)
             delete[] tmp_req;
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Request_free}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -912,16 +866,40 @@ post_init_cb(Caliper* c, Channel* channel)
                 mwc->tracing.request_free(&c, mwc->channel.body(), {{0}});
             if (mwc->enable_msg_pattern && mwc->enable_{{func}} && mwc->channel.is_active())
                 mwc->pattern.request_free(&c, mwc->channel.body(), {{0}});
+            if (mwc->enable_comm_matrix && mwc->enable_{{func}} && mwc->channel.is_active())
+                mwc->comm_matrix.request_free(&c, mwc->channel.body(), {{0}});
         }
 
         {{callfn}}
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
+}{{endfn}}
+
+//
+// --- Communicators
+//
+
+{{fn func MPI_Comm_free}}{
+    // The comm matrix caches rank translations by communicator handle,
+    // which MPI can reuse. Drop them even if MPI_Comm_free itself isn't
+    // instrumented.
+    if (Caliper::is_initialized()) {
+        Caliper c;
+        ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
+
+        for (MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(); mwc; mwc = mwc->next)
+            if (mwc->enable_comm_matrix)
+                mwc->comm_matrix.comm_free(&c, mwc->channel.body(), {{0}});
+
+        {{callfn}}
+
+        ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
+    } else {
+        {{callfn}}
+    }
 }{{endfn}}
 
 //
@@ -929,9 +907,7 @@ post_init_cb(Caliper* c, Channel* channel)
 //
 
 {{fn func MPI_Barrier}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -947,17 +923,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Bcast}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -973,17 +945,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Scatter}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -999,17 +967,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Scatterv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1031,17 +995,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Gather}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1055,17 +1015,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Gatherv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1079,17 +1035,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Reduce}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
@@ -1104,17 +1056,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Scan MPI_Exscan}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1128,17 +1076,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Reduce_scatter}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1158,17 +1102,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Allreduce}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1182,17 +1122,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Allgather}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1205,17 +1141,13 @@ post_init_cb(Caliper* c, Channel* channel)
                 mwc->pattern.handle_n2n(&c, mwc->channel.body(), {{1}}, {{2}}, {{6}});
         }
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Allgatherv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1229,17 +1161,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Alltoall}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
 
@@ -1259,17 +1187,13 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 {{fn func MPI_Alltoallv}}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
 
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
@@ -1292,11 +1216,9 @@ post_init_cb(Caliper* c, Channel* channel)
         }
 
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfn}}
 
 //
@@ -1363,6 +1285,7 @@ post_init_cb(Caliper* c, Channel* channel)
     MPI_Recv MPI_Irecv MPI_Recv_init
     MPI_Sendrecv MPI_Sendrecv_replace
     MPI_Start MPI_Startall MPI_Request_free
+    MPI_Comm_free
     MPI_Wait MPI_Waitall MPI_Waitany MPI_Waitsome
     MPI_Test MPI_Testall MPI_Testany MPI_Testsome
     MPI_Barrier
@@ -1371,18 +1294,14 @@ post_init_cb(Caliper* c, Channel* channel)
     MPI_Reduce_scatter MPI_Scan MPI_Exscan
     MPI_Allgatherv MPI_Alltoallv MPI_Gatherv MPI_Scatterv
 }}{
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
-    if (::enable_wrapper) {
-#endif
+    if (::{{func}}_wrap_count.load(std::memory_order_relaxed) > 0) {
         Caliper c;
         ::push_mpifn(&c, ::{{func}}_wrap_count > 0, "{{func}}");
         {{callfn}}
         ::pop_mpifn(&c, ::{{func}}_wrap_count > 0);
-#ifndef CALIPER_MPIWRAP_USE_GOTCHA
     } else {
         {{callfn}}
     }
-#endif
 }{{endfnall}}
 
 
@@ -1390,6 +1309,70 @@ post_init_cb(Caliper* c, Channel* channel)
 // --- Wrapper initialization
 //
 
+namespace
+{
+
+#ifdef CALIPER_MPIWRAP_USE_GOTCHA
+
+/// \brief Bind the GOTCHA wrappers for MPI_Init and MPI_Finalize, and for
+///   all functions enabled in \a mwc that aren't bound yet.
+///
+/// This GOTCHA version can't remove bindings. Once bound, wrappers for
+/// functions that no active channel needs call the MPI function directly.
+void bind_gotcha_wrappers(MpiWrapperConfig* mwc)
+{
+    static std::mutex s_bind_mutex;
+    std::lock_guard<std::mutex> g(s_bind_mutex);
+
+    //   AWFUL HACK: gotcha can modify our bindings buffer later.
+    // (It should copy them instead!)
+    // Copy them to a large enough static buffer for now.
+
+    static struct gotcha_binding_t s_bindings[1024];
+    static size_t s_binding_pos = 0;
+
+    std::vector<struct gotcha_binding_t> bindings;
+
+    // we always wrap init & finalize
+    if (!::MPI_Init_is_wrapped)
+        bindings.push_back(wrap_MPI_Init_binding);
+    if (!::MPI_Init_thread_is_wrapped)
+        bindings.push_back(wrap_MPI_Init_thread_binding);
+    if (!::MPI_Finalize_is_wrapped)
+        bindings.push_back(wrap_MPI_Finalize_binding);
+
+    ::MPI_Init_is_wrapped        = true;
+    ::MPI_Init_thread_is_wrapped = true;
+    ::MPI_Finalize_is_wrapped    = true;
+
+    if (mwc) {
+        if (mwc->enable_comm_matrix && !::MPI_Comm_free_is_wrapped) {
+            bindings.push_back(wrap_MPI_Comm_free_binding);
+            ::MPI_Comm_free_is_wrapped = true;
+        }
+
+        {{forallfn name MPI_Init MPI_Init_thread MPI_Finalize}}
+        if (mwc->enable_{{name}} && !::{{name}}_is_wrapped) {
+            bindings.push_back(wrap_{{name}}_binding);
+            ::{{name}}_is_wrapped = true;
+        }
+        {{endforallfn}}
+    }
+
+    if (bindings.empty())
+        return;
+
+    std::copy_n(bindings.data(), bindings.size(), s_bindings+s_binding_pos);
+    gotcha_wrap(s_bindings+s_binding_pos, bindings.size(), "caliper/mpi");
+    s_binding_pos += bindings.size();
+
+    Log(2).stream() << "mpiwrap: Bound " << bindings.size() << " GOTCHA wrappers" << std::endl;
+}
+
+#endif
+
+} // namespace [anonymous]
+
 namespace cali
 {
 
@@ -1416,17 +1399,33 @@ void mpiwrap_init(Caliper* c, Channel* chn, ConfigSet& cfg)
 
     chn->events().post_init_evt.connect(::post_init_cb);
 
+    chn->events().activate_evt.connect(
+        [](Caliper* c, Channel* channel){
+            MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(*channel);
+#ifdef CALIPER_MPIWRAP_USE_GOTCHA
+            ::bind_gotcha_wrappers(mwc);
+#endif
+            mwc->inc_wrap_counters();
+        });
+    chn->events().deactivate_evt.connect(
+        [](Caliper* c, Channel* channel){
+            MpiWrapperConfig::get_wrapper_config(*channel)->dec_wrap_counters();
+        });
+
     chn->events().finish_evt.connect(
         [](Caliper* c, Channel* channel){
             Log(2).stream() << channel->name() << ": Finishing mpi service" << std::endl;
-            MpiWrapperConfig::get_wrapper_config(*channel)->dec_wrap_counters();
+            MpiWrapperConfig* mwc = MpiWrapperConfig::get_wrapper_config(*channel);
+            // writes the comm matrix file if MPI_Finalize didn't
+            if (mwc->enable_comm_matrix)
+                mwc->comm_matrix.finish(c, channel->body());
+            if (channel->is_active())
+                mwc->dec_wrap_counters();
             MpiWrapperConfig::delete_wrapper_config(*channel);
         });
 
     // --- setup wrappers
 
-    ::enable_wrapper = true;
-
     MpiWrapperConfig* mwc = MpiWrapperConfig::init_wrapper_config(*chn, cfg);
 
     mwc->mpi_events.mpi_init_evt.connect(::mpi_init_cb);
@@ -1451,45 +1450,34 @@ void mpiwrap_init(Caliper* c, Channel* chn, ConfigSet& cfg)
         Log(1).stream() << chn->name() << ": mpi: Enabling message pattern analysis" << std::endl;
     }
 
-#ifdef CALIPER_MPIWRAP_USE_GOTCHA
-    Log(2).stream() << chn->name() << ": mpiwrap: Using GOTCHA wrappers." << std::endl;
-
-    //   AWFUL HACK: gotcha can modify our bindings buffer later.
-    // (It should copy them instead!)
-    // Copy them to a large enough static buffer for now.
-
-    static struct gotcha_binding_t s_bindings[1024];
-    static size_t s_binding_pos = 0;
-
-    std::vector<struct gotcha_binding_t> bindings;
-
-    // we always wrap init & finalize
-    if (!::MPI_Init_is_wrapped)
-        bindings.push_back(wrap_MPI_Init_binding);
-    if (!::MPI_Init_thread_is_wrapped)
-        bindings.push_back(wrap_MPI_Init_thread_binding);
-    if (!::MPI_Finalize_is_wrapped)
-        bindings.push_back(wrap_MPI_Finalize_binding);
+    if (mwc->enable_comm_matrix) {
+        mwc->comm_matrix.init(c, chn, cfg.get("comm_matrix_file").to_string());
 
-    ::MPI_Init_is_wrapped        = true;
-    ::MPI_Init_thread_is_wrapped = true;
-    ::MPI_Finalize_is_wrapped    = true;
+        chn->events().flush_evt.connect(
+            [mwc](Caliper* c, SnapshotView info, SnapshotFlushFn proc_fn){
+                    mwc->comm_matrix.flush(c, mwc->channel.body(), proc_fn);
+                });
+        chn->events().clear_evt.connect(
+            [mwc](Caliper*, Channel*){
+                    mwc->comm_matrix.clear();
+                });
+        mwc->mpi_events.mpi_finalize_evt.connect(
+            [mwc](Caliper* c, Channel* channel){
+                    mwc->comm_matrix.finish(c, channel->body());
+                });
 
-    {{forallfn name MPI_Init MPI_Init_thread MPI_Finalize}}
-    if (mwc->enable_{{name}} && !::{{name}}_is_wrapped) {
-        bindings.push_back(wrap_{{name}}_binding);
-        ::{{name}}_is_wrapped = true;
+        Log(1).stream() << chn->name() << ": mpi: Enabling communication matrix" << std::endl;
     }
-    {{endforallfn}}
 
-    std::copy_n(bindings.data(), bindings.size(), s_bindings+s_binding_pos);
-    gotcha_wrap(s_bindings+s_binding_pos, bindings.size(), "caliper/mpi");
-    s_binding_pos += bindings.size();
+#ifdef CALIPER_MPIWRAP_USE_GOTCHA
+    Log(2).stream() << chn->name() << ": mpiwrap: Using GOTCHA wrappers." << std::endl;
+
+    // Bind init & finalize right away. The other wrappers are bound when
+    // a channel that needs them is activated.
+    ::bind_gotcha_wrappers(nullptr);
 #else
     Log(2).stream() << chn->name() << ": mpiwrap: Using PMPI wrappers." << std::endl;
 #endif
-
-    mwc->inc_wrap_counters();
 }
 
 }
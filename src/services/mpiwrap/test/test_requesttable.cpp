@@ -0,0 +1,162 @@
+// Tests for the mpiwrap service's RequestTable
+
+#include "RequestTable.hpp"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+using namespace cali;
+
+TEST(RequestTableTest, InsertFindRemove)
+{
+    RequestTable<int> table(64);
+
+    int v = 0;
+
+    EXPECT_FALSE(table.find(42, &v));
+    EXPECT_FALSE(table.remove(42));
+
+    table.insert(42, 1);
+    table.insert(43, 2);
+
+    ASSERT_TRUE(table.find(42, &v));
+    EXPECT_EQ(v, 1);
+    ASSERT_TRUE(table.find(43, &v));
+    EXPECT_EQ(v, 2);
+
+    // find doesn't remove the entry
+    ASSERT_TRUE(table.find(42, &v));
+
+    EXPECT_TRUE(table.remove(42));
+    EXPECT_FALSE(table.find(42, &v));
+    EXPECT_FALSE(table.remove(42));
+    ASSERT_TRUE(table.find(43, &v));
+    EXPECT_EQ(v, 2);
+}
+
+TEST(RequestTableTest, ReplaceAndUpdate)
+{
+    RequestTable<int> table(64);
+
+    table.insert(7, 1);
+    table.insert(7, 2);
+
+    int v = 0;
+
+    ASSERT_TRUE(table.find(7, &v));
+    EXPECT_EQ(v, 2);
+
+    EXPECT_TRUE(table.update(7, [](int& val) {
+        ++val;
+        return false;
+    }));
+    ASSERT_TRUE(table.find(7, &v));
+    EXPECT_EQ(v, 3);
+
+    EXPECT_TRUE(table.update(7, [](int&) { return true; }));
+    EXPECT_FALSE(table.find(7, &v));
+    EXPECT_FALSE(table.update(7, [](int&) { return false; }));
+}
+
+TEST(RequestTableTest, HandleReuse)
+{
+    // MPI implementations hand out the same request handle again once a
+    // request completes
+    RequestTable<int> table(64);
+
+    for (int i = 0; i < 100; ++i) {
+        table.insert(0x1234, i);
+
+        int v = -1;
+
+        ASSERT_TRUE(table.find(0x1234, &v));
+        EXPECT_EQ(v, i);
+        EXPECT_TRUE(table.remove(0x1234));
+        EXPECT_FALSE(table.find(0x1234, &v));
+    }
+}
+
+TEST(RequestTableTest, Growth)
+{
+    // many more entries than slots: the rest go into the overflow map
+    RequestTable<int> table(16);
+
+    const int n = 1000;
+
+    for (int i = 0; i < n; ++i)
+        table.insert(handle_key(i), i);
+
+    for (int i = 0; i < n; ++i) {
+        int v = -1;
+        ASSERT_TRUE(table.find(handle_key(i), &v));
+        EXPECT_EQ(v, i);
+    }
+
+    for (int i = 0; i < n; i += 2)
+        EXPECT_TRUE(table.remove(handle_key(i)));
+
+    // re-insert overflowed keys after slots were freed up
+    for (int i = 1; i < n; i += 2)
+        table.insert(handle_key(i), -i);
+
+    for (int i = 0; i < n; ++i) {
+        int v = 0;
+
+        if (i % 2 == 0) {
+            EXPECT_FALSE(table.find(handle_key(i), &v));
+        } else {
+            ASSERT_TRUE(table.find(handle_key(i), &v));
+            EXPECT_EQ(v, -i);
+            EXPECT_TRUE(table.remove(handle_key(i)));
+            EXPECT_FALSE(table.find(handle_key(i), &v));
+        }
+    }
+}
+
+TEST(RequestTableTest, HandleKey)
+{
+    int   i = 5;
+    void* p = &i;
+
+    EXPECT_EQ(handle_key(i), 5u);
+    EXPECT_EQ(handle_key(p), static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p)));
+    EXPECT_NE(handle_key(1), handle_key(2));
+}
+
+TEST(RequestTableTest, Concurrent)
+{
+    RequestTable<uint64_t> table(256);
+
+    const int nthreads = 4;
+    const int nkeys    = 2000;
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < nthreads; ++t)
+        threads.emplace_back([&table, t]() {
+            for (int round = 0; round < 4; ++round)
+                for (int i = 0; i < nkeys; ++i) {
+                    uint64_t key = uint64_t(t) * nkeys + i;
+                    uint64_t v   = 0;
+
+                    table.insert(key, key * 2);
+                    EXPECT_TRUE(table.find(key, &v));
+                    EXPECT_EQ(v, key * 2);
+
+                    if (round < 3) {
+                        EXPECT_TRUE(table.remove(key));
+                    }
+                }
+        });
+
+    for (auto& t : threads)
+        t.join();
+
+    for (uint64_t key = 0; key < uint64_t(nthreads) * nkeys; ++key) {
+        uint64_t v = 0;
+        ASSERT_TRUE(table.find(key, &v));
+        EXPECT_EQ(v, key * 2);
+    }
+}
@@ -0,0 +1,426 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// Overhead.cpp
+// Measures the time spent inside Caliper in a channel
+
+#include "../Services.h"
+
+#include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
+
+#include "caliper/common/Log.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define CALI_OVERHEAD_USE_RDTSC
+#endif
+
+using namespace cali;
+
+namespace
+{
+
+// A cheap clock: the time stamp counter where we have one, otherwise the
+// steady clock in nanoseconds. Ticks are converted into seconds at flush time.
+inline uint64_t read_ticks()
+{
+#ifdef CALI_OVERHEAD_USE_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+}
+
+class OverheadService
+{
+    using clock = std::chrono::steady_clock;
+
+    enum Category { Begin = 0, End, Set, ProcessSnapshot, Flush, NumCategories };
+
+    static const char* s_category_names[NumCategories];
+
+    struct Counter {
+        uint64_t count;
+        uint64_t ticks;
+
+        Counter() : count(0), ticks(0) {}
+
+        Counter& operator+= (const Counter& c)
+        {
+            count += c.count;
+            ticks += c.ticks;
+            return *this;
+        }
+    };
+
+    //   A per-thread counter. Only the owning thread updates it, but the
+    // flushing thread reads it concurrently, so the values are atomic.
+    struct ThreadCounter {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> ticks;
+
+        ThreadCounter() : count(0), ticks(0) {}
+
+        void add(uint64_t n, uint64_t t)
+        {
+            count.store(count.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            ticks.store(ticks.load(std::memory_order_relaxed) + t, std::memory_order_relaxed);
+        }
+
+        Counter load() const
+        {
+            Counter c;
+            c.count = count.load(std::memory_order_relaxed);
+            c.ticks = ticks.load(std::memory_order_relaxed);
+            return c;
+        }
+    };
+
+    //   Per-thread per-channel overhead counters. We keep a pointer to it
+    // on the thread-local blackboard.
+    struct ThreadStats {
+        ThreadCounter              category[NumCategories];
+        std::vector<ThreadCounter> snapshot; // one counter per snapshot service
+        ThreadCounter              total;
+        int                        depth; // nesting depth of measured callbacks
+
+        ThreadStats(std::size_t num_snapshot_services) : snapshot(num_snapshot_services), depth(0) {}
+    };
+
+    struct OutputAttributes {
+        Attribute count_attr;
+        Attribute time_attr;
+    };
+
+    //   Starts the clock and tracks nesting depth, so we can compute
+    // the overall time spent in Caliper without double-counting
+    // e.g. snapshots triggered from begin/end callbacks.
+    class ScopedMeasurement
+    {
+        ThreadStats* m_ts;
+        uint64_t     m_start;
+
+    public:
+
+        ScopedMeasurement(ThreadStats* ts) : m_ts(ts), m_start(read_ticks()) { ++m_ts->depth; }
+
+        uint64_t start() const { return m_start; }
+
+        void finish(uint64_t now)
+        {
+            if (--m_ts->depth == 0)
+                m_ts->total.add(1, now - m_start);
+        }
+    };
+
+    Attribute m_stats_attr;
+
+    std::vector<ThreadStats*> m_stats_list;
+    std::mutex                m_stats_list_mutex;
+
+    std::vector<std::function<void(Caliper*, SnapshotView, SnapshotBuilder&)>> m_snapshot_cbs;
+    std::vector<std::size_t>                                                   m_snapshot_cb_slot;
+    std::vector<std::string>                                                   m_snapshot_services;
+
+    OutputAttributes              m_category_attrs[NumCategories];
+    std::vector<OutputAttributes> m_snapshot_attrs;
+    OutputAttributes              m_total_attrs;
+    Attribute                     m_threads_attr;
+
+    uint64_t          m_start_ticks;
+    clock::time_point m_start_time;
+
+    ThreadStats* acquire_stats(Caliper* c)
+    {
+        ThreadStats* ts = static_cast<ThreadStats*>(c->get_blackboard_entry(m_stats_attr).value().get_ptr());
+
+        if (!ts && !c->is_signal()) {
+            ts = new ThreadStats(m_snapshot_services.size());
+
+            c->set(m_stats_attr, Variant(cali_make_variant_from_ptr(ts)));
+
+            std::lock_guard<std::mutex> g(m_stats_list_mutex);
+            m_stats_list.push_back(ts);
+        }
+
+        return ts;
+    }
+
+    double seconds_per_tick() const
+    {
+#ifdef CALI_OVERHEAD_USE_RDTSC
+        uint64_t ticks = read_ticks() - m_start_ticks;
+        double   sec   = std::chrono::duration<double>(clock::now() - m_start_time).count();
+
+        return ticks > 0 ? sec / static_cast<double>(ticks) : 0.0;
+#else
+        return 1e-9;
+#endif
+    }
+
+    OutputAttributes make_output_attributes(Caliper* c, const std::string& name)
+    {
+        OutputAttributes ret;
+
+        ret.count_attr = c->create_attribute(
+            std::string("overhead.") + name + ".count",
+            CALI_TYPE_UINT,
+            CALI_ATTR_GLOBAL | CALI_ATTR_SKIP_EVENTS
+        );
+        ret.time_attr = c->create_attribute(
+            std::string("overhead.") + name + ".time",
+            CALI_TYPE_DOUBLE,
+            CALI_ATTR_GLOBAL | CALI_ATTR_SKIP_EVENTS
+        );
+
+        return ret;
+    }
+
+    //   Replace the callbacks in \a cb with a single callback that invokes
+    // them and adds the time spent in them to category \a cat
+    template <class... Args>
+    void wrap_callbacks(util::callback<void(Caliper*, Args...)>& cb, Category cat, bool count)
+    {
+        auto cbs = cb.disconnect_all();
+
+        cb.connect([this, cbs, cat, count](Caliper* c, Args... args) {
+            ThreadStats* ts = acquire_stats(c);
+
+            if (!ts) {
+                for (auto& f : cbs)
+                    f(c, args...);
+                return;
+            }
+
+            ScopedMeasurement m(ts);
+
+            for (auto& f : cbs)
+                f(c, args...);
+
+            uint64_t now = read_ticks();
+
+            ts->category[cat].add(count ? 1 : 0, now - m.start());
+
+            m.finish(now);
+        });
+    }
+
+    void snapshot_cb(Caliper* c, SnapshotView info, SnapshotBuilder& rec)
+    {
+        ThreadStats* ts = acquire_stats(c);
+
+        if (!ts) {
+            for (auto& f : m_snapshot_cbs)
+                f(c, info, rec);
+            return;
+        }
+
+        ScopedMeasurement m(ts);
+        uint64_t          prev = m.start();
+
+        for (std::size_t i = 0; i < m_snapshot_cbs.size(); ++i) {
+            m_snapshot_cbs[i](c, info, rec);
+
+            uint64_t now = read_ticks();
+
+            ts->snapshot[m_snapshot_cb_slot[i]].add(1, now - prev);
+            prev = now;
+        }
+
+        m.finish(prev);
+    }
+
+    void post_init_cb(Caliper* c, Channel* channel)
+    {
+        // Assign snapshot callbacks to their services
+
+        std::vector<std::string> owners = services::get_snapshot_callback_owners(channel);
+        m_snapshot_cbs                  = channel->events().snapshot.disconnect_all();
+
+        for (std::size_t i = 0; i < m_snapshot_cbs.size(); ++i) {
+            std::string name = i < owners.size() ? owners[i] : std::string("other");
+            auto        it   = std::find(m_snapshot_services.begin(), m_snapshot_services.end(), name);
+
+            m_snapshot_cb_slot.push_back(it - m_snapshot_services.begin());
+
+            if (it == m_snapshot_services.end())
+                m_snapshot_services.push_back(name);
+        }
+
+        for (const std::string& name : m_snapshot_services)
+            m_snapshot_attrs.push_back(make_output_attributes(c, std::string("snapshot.") + name));
+
+        if (!m_snapshot_cbs.empty())
+            channel->events().snapshot.connect([this](Caliper* c, SnapshotView info, SnapshotBuilder& rec) {
+                snapshot_cb(c, info, rec);
+            });
+
+        //   Wrap the annotation, snapshot processing, and flush callbacks.
+        // Callbacks connected after this point are not measured.
+
+        Channel::Events& events = channel->events();
+
+        wrap_callbacks(events.pre_begin_evt, Begin, true);
+        if (!events.post_begin_evt.empty())
+            wrap_callbacks(events.post_begin_evt, Begin, false);
+        wrap_callbacks(events.pre_end_evt, End, true);
+        wrap_callbacks(events.pre_set_evt, Set, true);
+        if (!events.process_snapshot.empty())
+            wrap_callbacks(events.process_snapshot, ProcessSnapshot, true);
+        if (!events.flush_evt.empty())
+            wrap_callbacks(events.flush_evt, Flush, true);
+
+        // Initialize stats on this thread
+        acquire_stats(c);
+    }
+
+    void collect(Counter category[NumCategories], std::vector<Counter>& snapshot, Counter& total, std::size_t& nthreads)
+    {
+        std::lock_guard<std::mutex> g(m_stats_list_mutex);
+
+        for (const ThreadStats* ts : m_stats_list) {
+            for (int i = 0; i < NumCategories; ++i)
+                category[i] += ts->category[i].load();
+            for (std::size_t i = 0; i < snapshot.size() && i < ts->snapshot.size(); ++i)
+                snapshot[i] += ts->snapshot[i].load();
+
+            total += ts->total.load();
+        }
+
+        nthreads = m_stats_list.size();
+    }
+
+    void set_output(Caliper* c, ChannelBody* chB, const OutputAttributes& attrs, const Counter& counter, double spt)
+    {
+        c->set(chB, attrs.count_attr, cali_make_variant_from_uint(counter.count));
+        c->set(chB, attrs.time_attr, Variant(spt * counter.ticks));
+    }
+
+    void post_flush_cb(Caliper* c, ChannelBody* chB)
+    {
+        Counter              category[NumCategories];
+        std::vector<Counter> snapshot(m_snapshot_services.size());
+        Counter              total;
+        std::size_t          nthreads = 0;
+
+        collect(category, snapshot, total, nthreads);
+
+        double spt = seconds_per_tick();
+
+        for (int i = 0; i < NumCategories; ++i)
+            set_output(c, chB, m_category_attrs[i], category[i], spt);
+        for (std::size_t i = 0; i < snapshot.size(); ++i)
+            set_output(c, chB, m_snapshot_attrs[i], snapshot[i], spt);
+
+        set_output(c, chB, m_total_attrs, total, spt);
+        c->set(chB, m_threads_attr, cali_make_variant_from_uint(nthreads));
+    }
+
+    void finish_cb(Caliper*, Channel* channel)
+    {
+        if (Log::verbosity() < 1)
+            return;
+
+        Counter              category[NumCategories];
+        std::vector<Counter> snapshot(m_snapshot_services.size());
+        Counter              total;
+        std::size_t          nthreads = 0;
+
+        collect(category, snapshot, total, nthreads);
+
+        double spt = seconds_per_tick();
+
+        Log(1).stream() << channel->name() << ": overhead: " << spt * total.ticks << " sec spent in Caliper on "
+                        << nthreads << " thread(s)" << std::endl;
+
+        if (Log::verbosity() >= 2) {
+            for (int i = 0; i < NumCategories; ++i)
+                Log(2).stream() << channel->name() << ": overhead:   " << std::setw(16) << std::left
+                                << s_category_names[i] << " " << category[i].count << " calls, "
+                                << spt * category[i].ticks << " sec" << std::endl;
+            for (std::size_t i = 0; i < snapshot.size(); ++i)
+                Log(2).stream() << channel->name() << ": overhead:   " << std::setw(16) << std::left
+                                << (std::string("snapshot.") + m_snapshot_services[i]) << " " << snapshot[i].count
+                                << " calls, " << spt * snapshot[i].ticks << " sec" << std::endl;
+        }
+    }
+
+    OverheadService(Caliper* c, Channel* channel) : m_start_ticks(read_ticks()), m_start_time(clock::now())
+    {
+        m_stats_attr = c->create_attribute(
+            std::string("overhead.stats.") + std::to_string(channel->id()),
+            CALI_TYPE_PTR,
+            CALI_ATTR_ASVALUE | CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_HIDDEN
+        );
+
+        for (int i = 0; i < NumCategories; ++i)
+            m_category_attrs[i] = make_output_attributes(c, s_category_names[i]);
+
+        m_total_attrs  = make_output_attributes(c, "total");
+        m_threads_attr = c->create_attribute("overhead.threads", CALI_TYPE_UINT, CALI_ATTR_GLOBAL | CALI_ATTR_SKIP_EVENTS);
+    }
+
+    ~OverheadService()
+    {
+        std::lock_guard<std::mutex> g(m_stats_list_mutex);
+
+        for (ThreadStats* ts : m_stats_list)
+            delete ts;
+    }
+
+public:
+
+    static const char* s_spec;
+
+    static void overhead_register(Caliper* c, Channel* channel)
+    {
+        OverheadService* instance = new OverheadService(c, channel);
+
+        channel->events().post_init_evt.connect([instance](Caliper* c, Channel* channel) {
+            instance->post_init_cb(c, channel);
+        });
+        channel->events().create_thread_evt.connect([instance](Caliper* c, Channel*) {
+            instance->acquire_stats(c);
+        });
+        channel->events().post_flush_evt.connect([instance](Caliper* c, ChannelBody* chB, SnapshotView) {
+            instance->post_flush_cb(c, chB);
+        });
+        channel->events().finish_evt.connect([instance](Caliper* c, Channel* channel) {
+            instance->finish_cb(c, channel);
+            delete instance;
+        });
+
+        Log(1).stream() << channel->name() << ": Registered overhead service" << std::endl;
+    }
+};
+
+const char* OverheadService::s_category_names[] = { "begin", "end", "set", "process_snapshot", "flush" };
+
+const char* OverheadService::s_spec = R"json(
+{
+"name": "overhead",
+"description": "Measure the time spent inside Caliper"
+}
+)json";
+
+} // namespace
+
+namespace cali
+{
+
+CaliperService overhead_service = { ::OverheadService::s_spec, ::OverheadService::overhead_register };
+
+}
@@ -13,6 +13,7 @@
 #include "caliper/common/Node.h"
 #include "caliper/common/OutputStream.h"
 
+#include "caliper/reader/CaliBinaryWriter.h"
 #include "caliper/reader/CaliWriter.h"
 
 #include "../../common/util/file_util.h"
@@ -34,24 +35,48 @@ class Recorder
     {
         std::string filename  = m_config.get("filename").to_string();
         std::string directory = m_config.get("directory").to_string();
+        std::string format    = m_config.get("format").to_string();
+
+        bool binary = (format == "calib");
+
+        if (!binary && format != "cali")
+            Log(0).stream() << m_channel_name << ": Recorder: Unknown format \"" << format
+                            << "\", using \"cali\"" << std::endl;
 
         if (filename.empty())
-            filename = cali::util::create_filename();
+            filename = cali::util::create_filename(binary ? ".calib" : ".cali");
         if (!directory.empty())
             filename = directory + "/" + filename;
 
         OutputStream stream;
         stream.set_filename(filename.c_str(), *c, std::vector<Entry>(flush_info.begin(), flush_info.end()));
 
-        CaliWriter writer(stream);
+        size_t num_written = 0;
+
+        if (binary) {
+            CaliBinaryWriter writer(stream);
 
-        c->flush(chB, flush_info, [&writer](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec) {
-            writer.write_snapshot(db, rec);
-        });
+            c->flush(chB, flush_info, [&writer](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec) {
+                writer.write_snapshot(db, rec);
+            });
+
+            writer.write_globals(*c, c->get_globals(chB));
+            writer.close();
 
-        writer.write_globals(*c, c->get_globals(chB));
+            num_written = writer.num_written();
+        } else {
+            CaliWriter writer(stream);
 
-        Log(1).stream() << m_channel_name << ": Recorder: Wrote " << writer.num_written() << " records." << std::endl;
+            c->flush(chB, flush_info, [&writer](CaliperMetadataAccessInterface& db, const std::vector<Entry>& rec) {
+                writer.write_snapshot(db, rec);
+            });
+
+            writer.write_globals(*c, c->get_globals(chB));
+
+            num_written = writer.num_written();
+        }
+
+        Log(1).stream() << m_channel_name << ": Recorder: Wrote " << num_written << " records." << std::endl;
     }
 
     Recorder(const std::string& chname, const ConfigSet& cfg)
@@ -88,6 +113,11 @@ const char* Recorder::s_spec = R"json(
   "name": "directory",
   "type": "string",
   "description": "Directory to write .cali files to."
+ },{
+  "name": "format",
+  "type": "string",
+  "description": "Output format: cali (text) or calib (binary columnar)",
+  "value": "cali"
  }
 ]}
 )json";
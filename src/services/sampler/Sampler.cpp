@@ -11,8 +11,11 @@
 
 #include "caliper/common/Log.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
 #include <cstring>
+#include <vector>
 #include <signal.h>
 #include <time.h>
 #include <sys/time.h>
@@ -38,9 +41,15 @@ namespace
 Attribute timer_attr;
 Attribute sampler_attr;
 Attribute ucursor_attr;
+Attribute timestamp_attr;
 
 int nsec_interval = 0;
 
+bool   defer_samples = false;
+size_t buffer_size   = 4096;
+
+uint64_t start_nsec = 0;
+
 int n_samples           = 0;
 int n_processed_samples = 0;
 
@@ -57,14 +66,143 @@ const char* spec = R"json(
   "description": "Sampling frequency in Hz",
   "type": "int",
   "value": "50"
+ },
+ {
+  "name": "defer",
+  "description": "Buffer samples in the signal handler and process them at region boundaries or flush",
+  "type": "bool",
+  "value": "false"
+ },
+ {
+  "name": "buffer_size",
+  "description": "Number of samples per thread that can be buffered in deferred mode",
+  "type": "int",
+  "value": "4096"
  }
 ]}
 )json";
 
+uint64_t get_nsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+/// \brief Single-producer, single-consumer ring of deferred samples
+///
+/// The producer is the SIGPROF handler, the consumer is the owning
+/// thread itself. The handler never allocates and doesn't run any
+/// snapshot callbacks. It stores the PC, a timestamp, and the calling
+/// context from the blackboards (via pull_context()) in preallocated
+/// storage. The context entries of each sample are kept contiguously
+/// in a separate entry pool, which is also used as a ring.
+struct SampleRing {
+    /// Max. number of context entries we capture per sample
+    static const size_t MaxContextEntries = 64;
+
+    struct Sample {
+        uint64_t pc;
+        uint64_t timestamp;
+        uint64_t ctx_pos; // position of the context entries in the pool
+        size_t   ctx_len;
+    };
+
+    std::vector<Sample>   samples;
+    std::vector<Entry>    pool;
+    std::atomic<uint64_t> head;      // written by the signal handler
+    std::atomic<uint64_t> tail;      // written by the owning thread
+    uint64_t              pool_head; // written by the signal handler
+    std::atomic<uint64_t> pool_tail; // written by the owning thread
+    bool                  draining;
+
+    explicit SampleRing(size_t size)
+        : samples(size),
+          pool(std::max(8 * size, 2 * MaxContextEntries)),
+          head(0),
+          tail(0),
+          pool_head(0),
+          pool_tail(0),
+          draining(false)
+    {}
+
+    // signal-safe
+    bool push(Caliper& c, uint64_t pc, uint64_t timestamp)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+
+        if (h - tail.load(std::memory_order_acquire) >= samples.size())
+            return false;
+
+        // reserve MaxContextEntries contiguous pool entries, skipping to
+        // the start of the pool if there isn't enough room at the end
+        uint64_t pos = pool_head;
+        size_t   off = pos % pool.size();
+
+        if (pool.size() - off < MaxContextEntries) {
+            pos += pool.size() - off;
+            off = 0;
+        }
+
+        if (pos + MaxContextEntries - pool_tail.load(std::memory_order_acquire) > pool.size())
+            return false;
+
+        SnapshotBuilder ctx(MaxContextEntries, pool.data() + off);
+        c.pull_context(ctx);
+
+        Sample& s   = samples[h % samples.size()];
+        s.pc        = pc;
+        s.timestamp = timestamp;
+        s.ctx_pos   = pos;
+        s.ctx_len   = ctx.size();
+
+        pool_head = pos + ctx.size();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    SnapshotView context(const Sample& s) const { return SnapshotView(s.ctx_len, pool.data() + s.ctx_pos % pool.size()); }
+};
+
+struct TimerWrap {
+    timer_t     timer;
+    SampleRing* ring;
+};
+
+void on_prof_deferred(siginfo_t* info, void* context)
+{
+    if (info->si_code != SI_TIMER)
+        return;
+
+    TimerWrap* twrap = static_cast<TimerWrap*>(info->si_value.sival_ptr);
+
+    if (!twrap || !twrap->ring)
+        return;
+
+    // the context can't be read while the thread is inside Caliper
+    Caliper c = Caliper::sigsafe_instance();
+
+    if (!c)
+        return;
+
+    uint64_t pc = 0;
+
+#ifdef CALI_SAMPLER_GET_PC
+    pc = static_cast<uint64_t>(CALI_SAMPLER_GET_PC(context));
+#endif
+
+    twrap->ring->push(c, pc, get_nsec());
+}
+
 void on_prof(int sig, siginfo_t* info, void* context)
 {
     ++n_samples;
 
+    if (defer_samples) {
+        on_prof_deferred(info, context);
+        return;
+    }
+
     Caliper c = Caliper::sigsafe_instance();
 
     if (!c)
@@ -120,10 +258,6 @@ void clear_signal()
     signal(SIGPROF, SIG_IGN);
 }
 
-struct TimerWrap {
-    timer_t timer;
-};
-
 void setup_settimer(Caliper* c)
 {
     struct sigevent sev;
@@ -136,8 +270,13 @@ void setup_settimer(Caliper* c)
 
     TimerWrap* twrap = new TimerWrap;
 
+    twrap->ring                = defer_samples ? new SampleRing(buffer_size) : nullptr;
+    sev.sigev_value.sival_ptr = twrap;
+
     if (timer_create(CLOCK_MONOTONIC, &sev, &twrap->timer) == -1) {
         Log(0).stream() << "sampler: timer_create() failed" << std::endl;
+        delete twrap->ring;
+        delete twrap;
         return;
     }
 
@@ -159,6 +298,72 @@ void setup_settimer(Caliper* c)
     Log(2).stream() << "Sampler: Registered timer " << v_timer << std::endl;
 }
 
+TimerWrap* get_timer(Caliper* c)
+{
+    Entry e = c->get(timer_attr);
+    return e.empty() ? nullptr : static_cast<TimerWrap*>(e.value().get_ptr());
+}
+
+/// \brief Process buffered samples of the calling thread
+///
+/// The snapshot records are built from the context captured in the signal
+/// handler, and passed to the process_snapshot callbacks directly. Snapshot
+/// callbacks (e.g., timer or callpath) would measure the drain site instead
+/// of the sample, so they are skipped.
+void drain_samples(Caliper* c, TimerWrap* twrap)
+{
+    if (!twrap || !twrap->ring)
+        return;
+
+    SampleRing* ring = twrap->ring;
+
+    if (ring->draining)
+        return;
+
+    uint64_t h = ring->head.load(std::memory_order_acquire);
+    uint64_t t = ring->tail.load(std::memory_order_relaxed);
+
+    if (h == t)
+        return;
+
+    ring->draining = true;
+
+    for (; t != h; ++t) {
+        const SampleRing::Sample& s = ring->samples[t % ring->samples.size()];
+
+        Entry    data[2];
+        unsigned count = 0;
+
+        if (s.pc)
+            data[count++] = Entry(sampler_attr, Variant(CALI_TYPE_ADDR, &s.pc, sizeof(uint64_t)));
+
+        data[count++] = Entry(timestamp_attr, cali_make_variant_from_uint(s.timestamp - start_nsec));
+
+        FixedSizeSnapshotRecord<SampleRing::MaxContextEntries + 2> rec;
+        rec.builder().append(ring->context(s));
+        rec.builder().append(SnapshotView(count, data));
+
+        channel.events().process_snapshot(c, SnapshotView(count, data), rec.view());
+        ++n_processed_samples;
+
+        // release the slots only after they have been processed
+        ring->pool_tail.store(s.ctx_pos + s.ctx_len, std::memory_order_release);
+        ring->tail.store(t + 1, std::memory_order_release);
+    }
+
+    ring->draining = false;
+}
+
+void drain_cb(Caliper* c, ChannelBody*, const Attribute&, const Variant&)
+{
+    drain_samples(c, get_timer(c));
+}
+
+void pre_flush_cb(Caliper* c, ChannelBody*, SnapshotView)
+{
+    drain_samples(c, get_timer(c));
+}
+
 void clear_timer(Caliper* c, Channel* chn)
 {
     Entry e = c->get(timer_attr);
@@ -176,6 +381,9 @@ void clear_timer(Caliper* c, Channel* chn)
     Log(2).stream() << chn->name() << ": Sampler: Deleting timer " << e.value() << std::endl;
 
     timer_delete(twrap->timer);
+    drain_samples(c, twrap);
+
+    delete twrap->ring;
     delete twrap;
 }
 
@@ -238,8 +446,18 @@ void sampler_register(Caliper* c, Channel* chn)
         CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE | CALI_ATTR_HIDDEN
     );
 
+    timestamp_attr = c->create_attribute(
+        "cali.sampler.timestamp",
+        CALI_TYPE_UINT,
+        CALI_ATTR_SCOPE_THREAD | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_ASVALUE
+    );
+
     int frequency = config.get("frequency").to_int();
 
+    defer_samples = config.get("defer").to_bool();
+    buffer_size   = std::max(config.get("buffer_size").to_int(), 16);
+    start_nsec    = get_nsec();
+
     // some sanity checking
     frequency     = std::min(std::max(frequency, 1), 10000);
     nsec_interval = 1000000000 / frequency;
@@ -251,12 +469,22 @@ void sampler_register(Caliper* c, Channel* chn)
     chn->events().pre_finish_evt.connect(pre_finish_cb);
     chn->events().finish_evt.connect(finish_cb);
 
+    if (defer_samples) {
+        // drain before the blackboard changes so buffered samples are
+        // attributed to the context in which they were taken
+        chn->events().pre_begin_evt.connect(drain_cb);
+        chn->events().pre_set_evt.connect(drain_cb);
+        chn->events().pre_end_evt.connect(drain_cb);
+        chn->events().pre_flush_evt.connect(pre_flush_cb);
+    }
+
     channel = *chn;
 
     setup_signal();
     setup_settimer(c);
 
-    Log(1).stream() << chn->name() << ": Registered sampler service. Using " << frequency << "Hz sampling frequency.\n";
+    Log(1).stream() << chn->name() << ": Registered sampler service. Using " << frequency << "Hz sampling frequency"
+                    << (defer_samples ? " (deferred)" : "") << ".\n";
 }
 
 } // namespace
@@ -8,6 +8,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cali
 {
@@ -32,8 +33,28 @@ public:
         bool        success;
     };
 
+    struct Stats {
+        unsigned num_resolved;    ///< addresses resolved from debug info
+        unsigned num_file_cached; ///< addresses found in the persistent cache
+    };
+
     Result lookup(uint64_t address, int what) const;
 
+    /// \brief Resolve a batch of addresses up-front.
+    ///
+    /// Sorts the addresses and resolves them module-by-module in address
+    /// order. Results are kept so that subsequent lookup() calls for
+    /// these addresses are cheap.
+    void resolve_batch(std::vector<uint64_t>& addresses, int what) const;
+
+    /// \brief Load persistent lookup results (keyed by ELF build-id and
+    ///   module offset) from \a filename
+    bool load_cache(const std::string& filename);
+    /// \brief Write all lookup results for modules with a build-id to \a filename
+    bool save_cache(const std::string& filename) const;
+
+    Stats stats() const;
+
     Lookup();
     ~Lookup();
 };
@@ -10,7 +10,14 @@
 #include <elfutils/libdwfl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
 
 using namespace cali;
 using namespace symbollookup;
@@ -38,31 +45,106 @@ Dwfl_Callbacks* get_dwfl_callbacks()
 } // namespace
 
 struct Lookup::LookupImpl {
+    struct ModuleInfo {
+        std::string name;
+        std::string build_id; // hex string, empty if the module has none
+        Dwarf_Addr  start;
+        Dwarf_Addr  end;
+    };
+
+    struct CachedResult {
+        int            what;
+        Lookup::Result result;
+    };
+
     Dwfl* dwfl { nullptr };
 
-    Lookup::Result lookup(uintptr_t address, int what)
+    std::unordered_map<Dwfl_Module*, ModuleInfo> modules;
+    std::unordered_map<uint64_t, CachedResult>   results;
+    std::unordered_map<std::string, std::string> demangled_names;
+
+    // persistent results, keyed by build-id and module offset
+    std::map<std::pair<std::string, uint64_t>, CachedResult> file_cache;
+
+    Lookup::Stats stats { 0, 0 };
+
+    const ModuleInfo& get_module_info(Dwfl_Module* mod)
     {
-        Result result { "UNKNOWN", "UNKNOWN", 0, "UNKNOWN", false };
+        auto it = modules.find(mod);
 
-        if (!dwfl)
-            return result;
+        if (it != modules.end())
+            return it->second;
 
-        Dwfl_Module* mod = dwfl_addrmodule(dwfl, address);
+        ModuleInfo info { "UNKNOWN", "", 0, 0 };
 
-        if (!mod)
-            return result;
+        const char* name = dwfl_module_info(mod, nullptr, &info.start, &info.end, nullptr, nullptr, nullptr, nullptr);
+
+        if (name)
+            info.name = name;
+
+        // the build-id is only available once the module's ELF file is loaded
+        GElf_Addr bias = 0;
+        dwfl_module_getelf(mod, &bias);
+
+        const unsigned char* bits  = nullptr;
+        GElf_Addr            vaddr = 0;
+        int                  len   = dwfl_module_build_id(mod, &bits, &vaddr);
 
-        result.success = true;
+        if (len > 0) {
+            static const char hex[] = "0123456789abcdef";
+
+            info.build_id.reserve(2 * len);
+
+            for (int i = 0; i < len; ++i) {
+                info.build_id.push_back(hex[bits[i] >> 4]);
+                info.build_id.push_back(hex[bits[i] & 0xF]);
+            }
+        }
+
+        return modules.emplace(mod, std::move(info)).first->second;
+    }
+
+    const std::string& demangle(const char* name)
+    {
+        if (!name)
+            name = "UNKNOWN";
+
+        auto it = demangled_names.find(name);
+
+        if (it == demangled_names.end())
+            it = demangled_names.emplace(name, util::demangle(name)).first;
+
+        return it->second;
+    }
+
+    Lookup::Result resolve(Dwfl_Module* mod, const ModuleInfo& info, uintptr_t address, int what)
+    {
+        Result result { "UNKNOWN", "UNKNOWN", 0, info.name, true };
+
+        if (!info.build_id.empty()) {
+            auto it = file_cache.find(std::make_pair(info.build_id, static_cast<uint64_t>(address - info.start)));
+
+            if (it != file_cache.end() && (it->second.what & what) == what) {
+                ++stats.num_file_cached;
+                result.name = it->second.result.name;
+                result.file = it->second.result.file;
+                result.line = it->second.result.line;
+                return result;
+            }
+        }
+
+        ++stats.num_resolved;
 
         if (what & Kind::Name)
-            result.name = util::demangle(dwfl_module_addrname(mod, address));
+            result.name = demangle(dwfl_module_addrname(mod, address));
 
         if (what & Kind::File || what & Kind::Line) {
             Dwfl_Line* line = dwfl_module_getsrc(mod, address);
 
             if (line) {
+                Dwarf_Addr  lineaddr = address;
                 int         lineno, linecol;
-                const char* src = dwfl_lineinfo(line, &address, &lineno, &linecol, nullptr, nullptr);
+                const char* src = dwfl_lineinfo(line, &lineaddr, &lineno, &linecol, nullptr, nullptr);
 
                 if (src) {
                     result.file = src;
@@ -71,16 +153,133 @@ struct Lookup::LookupImpl {
             }
         }
 
-        if (what & Kind::Module) {
-            const char* name = dwfl_module_info(mod, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr);
+        if (!info.build_id.empty())
+            file_cache[std::make_pair(info.build_id, static_cast<uint64_t>(address - info.start))] =
+                CachedResult { what, result };
 
-            if (name)
-                result.module = name;
-        }
+        return result;
+    }
+
+    Lookup::Result lookup(uintptr_t address, int what)
+    {
+        auto it = results.find(address);
+
+        if (it != results.end() && (it->second.what & what) == what)
+            return it->second.result;
+
+        Result result { "UNKNOWN", "UNKNOWN", 0, "UNKNOWN", false };
+
+        if (!dwfl)
+            return result;
+
+        Dwfl_Module* mod = dwfl_addrmodule(dwfl, address);
+
+        if (mod)
+            result = resolve(mod, get_module_info(mod), address, what);
+
+        results[address] = CachedResult { what, result };
 
         return result;
     }
 
+    void resolve_batch(std::vector<uint64_t>& addresses, int what)
+    {
+        if (!dwfl)
+            return;
+
+        std::sort(addresses.begin(), addresses.end());
+        addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+
+        // Walk the sorted addresses; consecutive addresses mostly fall into
+        // the same module, so the module is only looked up when leaving
+        // the current module's address range.
+
+        Dwfl_Module*      mod  = nullptr;
+        const ModuleInfo* info = nullptr;
+
+        for (uint64_t address : addresses) {
+            auto it = results.find(address);
+
+            if (it != results.end() && (it->second.what & what) == what)
+                continue;
+
+            if (!mod || address < info->start || address >= info->end) {
+                mod  = dwfl_addrmodule(dwfl, address);
+                info = mod ? &get_module_info(mod) : nullptr;
+            }
+
+            Result result { "UNKNOWN", "UNKNOWN", 0, "UNKNOWN", false };
+
+            if (mod)
+                result = resolve(mod, *info, address, what);
+
+            results[address] = CachedResult { what, result };
+        }
+    }
+
+    // Cache file format: one entry per line with tab-separated
+    // build-id, module offset (hex), lookup kinds, line, function name, file name
+
+    bool load_cache(const std::string& filename)
+    {
+        std::ifstream is(filename);
+
+        if (!is)
+            return false;
+
+        std::string line;
+        size_t      count = 0;
+
+        while (std::getline(is, line)) {
+            std::istringstream ls(line);
+            std::string        build_id, offset, what, lineno, name, file;
+
+            if (!std::getline(ls, build_id, '\t') || !std::getline(ls, offset, '\t') || !std::getline(ls, what, '\t')
+                || !std::getline(ls, lineno, '\t') || !std::getline(ls, name, '\t') || !std::getline(ls, file))
+                continue;
+
+            CachedResult r { std::atoi(what.c_str()),
+                             Result { name, file, std::atoi(lineno.c_str()), std::string(), true } };
+
+            file_cache[std::make_pair(build_id, std::strtoull(offset.c_str(), nullptr, 16))] = r;
+            ++count;
+        }
+
+        Log(2).stream() << "symbollookup: Read " << count << " entries from " << filename << std::endl;
+
+        return true;
+    }
+
+    bool save_cache(const std::string& filename) const
+    {
+        // write to a temporary file first so concurrent readers never see a partial file
+        std::string tmpname = filename + ".tmp." + std::to_string(getpid());
+
+        {
+            std::ofstream os(tmpname);
+
+            if (!os) {
+                Log(0).stream() << "symbollookup: Could not open " << tmpname << std::endl;
+                return false;
+            }
+
+            for (const auto& it : file_cache)
+                os << it.first.first << '\t' << std::hex << it.first.second << std::dec << '\t' << it.second.what
+                   << '\t' << it.second.result.line << '\t' << it.second.result.name << '\t'
+                   << it.second.result.file << '\n';
+        }
+
+        if (std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+            Log(0).stream() << "symbollookup: Could not write " << filename << std::endl;
+            std::remove(tmpname.c_str());
+            return false;
+        }
+
+        Log(2).stream() << "symbollookup: Wrote " << file_cache.size() << " entries to " << filename << std::endl;
+
+        return true;
+    }
+
     LookupImpl()
     {
         Log(2).stream() << "symbollookup: Loading debug info" << std::endl;
@@ -110,6 +309,26 @@ Lookup::Result Lookup::lookup(uint64_t address, int what) const
     return mP->lookup(static_cast<uintptr_t>(address), what);
 }
 
+void Lookup::resolve_batch(std::vector<uint64_t>& addresses, int what) const
+{
+    mP->resolve_batch(addresses, what);
+}
+
+bool Lookup::load_cache(const std::string& filename)
+{
+    return mP->load_cache(filename);
+}
+
+bool Lookup::save_cache(const std::string& filename) const
+{
+    return mP->save_cache(filename);
+}
+
+Lookup::Stats Lookup::stats() const
+{
+    return mP->stats;
+}
+
 Lookup::Lookup() : mP(new LookupImpl)
 {}
 
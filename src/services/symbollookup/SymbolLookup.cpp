@@ -20,6 +20,7 @@
 #include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
 
 using namespace cali;
 using namespace symbollookup;
@@ -49,6 +50,11 @@ class SymbolLookup
     bool m_lookup_file;
     bool m_lookup_line;
     bool m_lookup_mod;
+    bool m_batch;
+
+    std::string m_cache_file;
+
+    Channel m_channel;
 
     std::map<Attribute, std::shared_ptr<SymbolAttributeInfo>> m_sym_attr_map;
     std::mutex                                                m_sym_attr_mutex;
@@ -121,6 +127,57 @@ class SymbolLookup
             make_symbol_attributes(c, a);
     }
 
+    int lookup_kinds() const
+    {
+        int what = 0;
+
+        if (m_lookup_functions)
+            what |= Lookup::Name;
+        if (m_lookup_file || m_lookup_sourceloc)
+            what |= Lookup::File;
+        if (m_lookup_line || m_lookup_sourceloc)
+            what |= Lookup::Line;
+        if (m_lookup_mod)
+            what |= Lookup::Module;
+
+        return what;
+    }
+
+    //   Collect the distinct addresses of reference-type address attributes
+    // (e.g., callpath.address) from the context tree and resolve them in one
+    // sorted batch before the flush. The flush then only hits the lookup
+    // cache. Immediate addresses (e.g., cali.sampler.pc) are not in the tree
+    // and are looked up one by one during the flush.
+    void prefetch(Caliper* c)
+    {
+        std::vector<cali_id_t> attr_ids;
+
+        {
+            std::lock_guard<std::mutex> g(m_sym_attr_mutex);
+
+            for (const auto& it : m_sym_attr_map)
+                if (!it.first.store_as_value())
+                    attr_ids.push_back(it.first.id());
+        }
+
+        if (attr_ids.empty())
+            return;
+
+        std::unordered_set<uint64_t> addresses;
+
+        c->for_each_node([&attr_ids, &addresses](const Node* node) {
+            if (std::find(attr_ids.begin(), attr_ids.end(), node->attribute()) != attr_ids.end())
+                addresses.insert(node->data().to_uint());
+        });
+
+        std::vector<uint64_t> vec(addresses.begin(), addresses.end());
+
+        Log(2).stream() << m_channel.name() << ": Symbollookup: Resolving " << vec.size() << " distinct addresses"
+                        << std::endl;
+
+        m_lookup.resolve_batch(vec, lookup_kinds());
+    }
+
     Node* perform_lookup(Caliper* c, Entry e, SymbolAttributeInfo& sym_info, Node* parent)
     {
         if (e.empty())
@@ -140,18 +197,7 @@ class SymbolLookup
             }
         }
 
-        int what = 0;
-
-        if (m_lookup_functions)
-            what |= Lookup::Name;
-        if (m_lookup_file || m_lookup_sourceloc)
-            what |= Lookup::File;
-        if (m_lookup_line || m_lookup_sourceloc)
-            what |= Lookup::Line;
-        if (m_lookup_mod)
-            what |= Lookup::Module;
-
-        Lookup::Result result = m_lookup.lookup(addr, what);
+        Lookup::Result result = m_lookup.lookup(addr, lookup_kinds());
         if (!result.success)
             ++m_num_failed;
 
@@ -247,8 +293,16 @@ class SymbolLookup
     // some final log output; print warning if we didn't find an address attribute
     void finish_log(Caliper* c, Channel* chn)
     {
+        Lookup::Stats stats = m_lookup.stats();
+
         Log(1).stream() << chn->name() << ": Symbollookup: Performed " << m_num_lookups << " address lookups, "
                         << m_num_cached << " cached, " << m_num_failed << " failed." << std::endl;
+        Log(2).stream() << chn->name() << ": Symbollookup: Resolved " << stats.num_resolved
+                        << " addresses from debug info, " << stats.num_file_cached << " from cache file."
+                        << std::endl;
+
+        if (!m_cache_file.empty())
+            m_lookup.save_cache(m_cache_file);
     }
 
     void init_lookup()
@@ -269,6 +323,11 @@ class SymbolLookup
         m_lookup_file      = config.get("lookup_file").to_bool();
         m_lookup_line      = config.get("lookup_line").to_bool();
         m_lookup_mod       = config.get("lookup_module").to_bool();
+        m_batch            = config.get("batch").to_bool();
+        m_cache_file       = config.get("cache_file").to_string();
+
+        if (!m_cache_file.empty())
+            m_lookup.load_cache(m_cache_file);
     }
 
 public:
@@ -279,9 +338,13 @@ public:
     {
         SymbolLookup* instance = new SymbolLookup(c, chn);
 
+        instance->m_channel = *chn;
+
         chn->events().pre_flush_evt.connect([instance](Caliper* c, ChannelBody*, SnapshotView) {
             instance->check_attributes(c);
             instance->init_lookup();
+            if (instance->m_batch)
+                instance->prefetch(c);
         });
         chn->events().postprocess_snapshot.connect([instance](Caliper* c, std::vector<Entry>& rec) {
             instance->process_snapshot(c, rec);
@@ -330,6 +393,15 @@ const char* SymbolLookup::s_spec = R"json(
   "description": "Perform module lookup",
   "type": "bool",
   "value": "true"
+ },{
+  "name": "batch",
+  "description": "Resolve all context tree addresses in one sorted batch before flushing",
+  "type": "bool",
+  "value": "true"
+ },{
+  "name": "cache_file",
+  "description": "File for persistent lookup results, keyed by ELF build-id and module offset",
+  "type": "string"
  }
 ]}
 )json";
@@ -4,8 +4,10 @@
 #include "../Services.h"
 
 #include "../util/ChannelList.hpp"
+#include "../../common/util/spinlock.hpp"
 
 #include "caliper/Caliper.h"
+#include "caliper/SnapshotRecord.h"
 
 #include "caliper/common/Log.h"
 
@@ -13,6 +15,7 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <mutex>
 #include <vector>
 
 #include <errno.h>
@@ -45,8 +48,39 @@ struct gotcha_binding_t alloc_bindings[] = { { malloc_str, (void*) cali_malloc_w
                                              { realloc_str, (void*) cali_realloc_wrapper, &orig_realloc_handle },
                                              { free_str, (void*) cali_free_wrapper, &orig_free_handle } };
 
+// channels that track allocated memory regions
 ChannelList* sysalloc_channels = nullptr;
 
+// Per-thread allocation counters. These are only ever incremented, by
+// the wrappers on their own thread. Counting channels compute deltas
+// against their own per-thread copy at each snapshot.
+struct AllocCounters {
+    uint64_t alloc_count;
+    uint64_t alloc_bytes;
+    uint64_t free_count;
+};
+
+thread_local AllocCounters tl_counters; // zero-initialized POD: no TLS constructor
+
+bool count_allocations = false;
+
+// Caliper-internal allocations (made while Caliper holds the thread's
+// signal lock) are not counted
+
+inline void count_alloc(void* ret, size_t bytes)
+{
+    if (count_allocations && ret && Caliper::sigsafe_instance()) {
+        ++tl_counters.alloc_count;
+        tl_counters.alloc_bytes += bytes;
+    }
+}
+
+inline void count_free(void* ptr)
+{
+    if (count_allocations && ptr && Caliper::sigsafe_instance())
+        ++tl_counters.free_count;
+}
+
 void* cali_malloc_wrapper(size_t size)
 {
     decltype(&std::malloc) orig_malloc =
@@ -54,6 +88,8 @@ void* cali_malloc_wrapper(size_t size)
 
     void* ret = (*orig_malloc)(size);
 
+    count_alloc(ret, size);
+
     int saved_errno = errno;
 
     for (ChannelList* p = sysalloc_channels; p; p = p->next) {
@@ -75,6 +111,8 @@ void* cali_calloc_wrapper(size_t num, size_t size)
 
     void* ret = (*orig_calloc)(num, size);
 
+    count_alloc(ret, num * size);
+
     int saved_errno = errno;
 
     for (ChannelList* p = sysalloc_channels; p; p = p->next) {
@@ -103,6 +141,9 @@ void* cali_realloc_wrapper(void* ptr, size_t size)
 
     void* ret = (*orig_realloc)(ptr, size);
 
+    count_free(ptr);
+    count_alloc(ret, size);
+
     int saved_errno = errno;
 
     for (ChannelList* p = sysalloc_channels; p; p = p->next) {
@@ -128,6 +169,8 @@ void cali_free_wrapper(void* ptr)
             c.memory_region_end(p->channel.body(), ptr);
     }
 
+    count_free(ptr);
+
     (*orig_free)(ptr);
 }
 
@@ -165,12 +208,146 @@ void clear_alloc_hooks()
 }
 #endif
 
+//
+// --- Per-channel allocation counting
+//
+
+class AllocCounting
+{
+    //   ThreadData holds the counter values of a thread at this channel's
+    // last snapshot on that thread. All ThreadData objects of a channel
+    // are linked so they can be deleted at finish.
+    struct ThreadData {
+        AllocCounters last;
+        ThreadData*   next;
+    };
+
+    Attribute m_alloc_count_attr;
+    Attribute m_alloc_bytes_attr;
+    Attribute m_free_count_attr;
+    Attribute m_td_attr;
+
+    ThreadData*    m_td_list { nullptr };
+    util::spinlock m_td_lock;
+
+    ThreadData* acquire_td(Caliper* c, bool can_alloc)
+    {
+        ThreadData* td = static_cast<ThreadData*>(c->get_blackboard_entry(m_td_attr).value().get_ptr());
+
+        if (!td && can_alloc) {
+            td = new ThreadData { tl_counters, nullptr };
+
+            c->set(m_td_attr, cali_make_variant_from_ptr(td));
+
+            std::lock_guard<util::spinlock> g(m_td_lock);
+
+            td->next  = m_td_list;
+            m_td_list = td;
+        }
+
+        return td;
+    }
+
+    void snapshot_cb(Caliper* c, SnapshotBuilder& rec)
+    {
+        ThreadData* td = acquire_td(c, !c->is_signal());
+
+        if (!td)
+            return;
+
+        AllocCounters now = tl_counters;
+
+        uint64_t alloc_count = now.alloc_count - td->last.alloc_count;
+        uint64_t alloc_bytes = now.alloc_bytes - td->last.alloc_bytes;
+        uint64_t free_count  = now.free_count - td->last.free_count;
+
+        td->last = now;
+
+        if (alloc_count > 0) {
+            rec.append(m_alloc_count_attr, cali_make_variant_from_uint(alloc_count));
+            rec.append(m_alloc_bytes_attr, cali_make_variant_from_uint(alloc_bytes));
+        }
+        if (free_count > 0)
+            rec.append(m_free_count_attr, cali_make_variant_from_uint(free_count));
+    }
+
+    AllocCounting(Caliper* c, Channel* chn)
+    {
+        const int prop = CALI_ATTR_SCOPE_THREAD | CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_AGGREGATABLE;
+
+        m_alloc_count_attr = c->create_attribute("sysalloc.alloc.count", CALI_TYPE_UINT, prop);
+        m_alloc_bytes_attr = c->create_attribute("sysalloc.alloc.bytes", CALI_TYPE_UINT, prop);
+        m_free_count_attr  = c->create_attribute("sysalloc.free.count", CALI_TYPE_UINT, prop);
+
+        m_td_attr = c->create_attribute(
+            std::string("sysalloc.td.") + std::to_string(chn->id()),
+            CALI_TYPE_PTR,
+            CALI_ATTR_SCOPE_THREAD | CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS | CALI_ATTR_HIDDEN
+        );
+    }
+
+    ~AllocCounting()
+    {
+        ThreadData* td = m_td_list;
+
+        while (td) {
+            ThreadData* tmp = td->next;
+            delete td;
+            td = tmp;
+        }
+    }
+
+public:
+
+    static void create(Caliper* c, Channel* chn)
+    {
+        AllocCounting* instance = new AllocCounting(c, chn);
+
+        chn->events().create_thread_evt.connect([instance](Caliper* c, Channel*) { instance->acquire_td(c, true); });
+        chn->events().snapshot.connect([instance](Caliper* c, SnapshotView, SnapshotBuilder& rec) {
+            instance->snapshot_cb(c, rec);
+        });
+        chn->events().finish_evt.connect([instance](Caliper*, Channel*) { delete instance; });
+
+        instance->acquire_td(c, true);
+        count_allocations = true;
+    }
+};
+
+const char* sysalloc_spec = R"json(
+{
+ "name"        : "sysalloc",
+ "description" : "Wrap system memory allocation calls",
+ "config"      :
+ [
+  {
+   "name"        : "count_allocations",
+   "type"        : "bool",
+   "description" : "Count allocation calls and bytes per region in thread-local counters",
+   "value"       : "false"
+  }
+ ]
+}
+)json";
+
 void sysalloc_initialize(Caliper* c, Channel* chn)
 {
+    ConfigSet config = services::init_config_from_spec(chn->config(), sysalloc_spec);
+
+    bool count = config.get("count_allocations").to_bool();
+
+    if (count)
+        AllocCounting::create(c, chn);
+
     chn->events().post_init_evt.connect([](Caliper* c, Channel* chn) {
         if (!bindings_are_active)
             init_alloc_hooks();
 
+        // Only invoke the memory region tracking API if another service
+        // in this channel is listening
+        if (chn->events().track_mem_evt.empty() && chn->events().untrack_mem_evt.empty())
+            return;
+
         ChannelList::add(&sysalloc_channels, *chn);
     });
 
@@ -179,7 +356,8 @@ void sysalloc_initialize(Caliper* c, Channel* chn)
         ChannelList::remove(&sysalloc_channels, *chn);
     });
 
-    Log(1).stream() << chn->name() << ": Registered sysalloc service" << std::endl;
+    Log(1).stream() << chn->name() << ": Registered sysalloc service"
+                    << (count ? " (counting allocations)" : "") << std::endl;
 }
 
 } // namespace
@@ -187,6 +365,6 @@ void sysalloc_initialize(Caliper* c, Channel* chn)
 namespace cali
 {
 
-CaliperService sysalloc_service { "sysalloc", ::sysalloc_initialize };
+CaliperService sysalloc_service { ::sysalloc_spec, ::sysalloc_initialize };
 
 }
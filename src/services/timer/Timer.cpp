@@ -11,6 +11,7 @@
 
 #include "caliper/common/Log.h"
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <map>
@@ -27,6 +28,12 @@ namespace
 
 class TimerService
 {
+    // Begin timestamp and overhead sum at begin for computing inclusive times
+    struct InclusiveTimerEntry {
+        uint64_t timestamp;
+        uint64_t overhead;
+    };
+
     //   This keeps per-thread per-channel timer data, which we can look up
     // on the thread-local blackboard
     struct TimerInfo {
@@ -34,9 +41,25 @@ class TimerService
         uint64_t prev_snapshot_timestamp;
 
         // A per-attribute stack of timestamps for computing inclusive times
-        std::map<cali_id_t, std::vector<uint64_t>> inclusive_timer_stack;
-
-        TimerInfo() : prev_snapshot_timestamp(0) {}
+        std::map<cali_id_t, std::vector<InclusiveTimerEntry>> inclusive_timer_stack;
+
+        // Overhead compensation: the calibrated instrumentation cost before
+        // we take the timestamp in a snapshot, the measured cost after the
+        // previous snapshot's timestamp, and the sum of all overhead
+        // subtracted so far on this thread
+        uint64_t head_overhead;
+        uint64_t pending_overhead;
+        uint64_t overhead_sum;
+
+        bool is_calibrated;
+
+        TimerInfo()
+            : prev_snapshot_timestamp(0),
+              head_overhead(0),
+              pending_overhead(0),
+              overhead_sum(0),
+              is_calibrated(false)
+        {}
     };
 
     using clock = std::chrono::steady_clock;
@@ -55,6 +78,7 @@ class TimerService
     std::mutex              info_obj_mutex;
 
     bool record_inclusive_duration;
+    bool compensate_overhead;
 
     Attribute begin_evt_attr;
     Attribute end_evt_attr;
@@ -78,10 +102,43 @@ class TimerService
         return ti;
     }
 
+    uint64_t now_nsec() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - tstart).count();
+    }
+
+    //   Estimate the instrumentation cost in our own snapshot callback
+    // before the timestamp is taken on this thread: time the clock read,
+    // timer info lookup, and record append with a scratch record and use
+    // the median. This only runs timer code, so it doesn't advance the
+    // counters of other services.
+    void calibrate(Caliper* c, TimerInfo* ti)
+    {
+        const int num_iterations = 32;
+
+        FixedSizeSnapshotRecord<4> rec;
+        std::vector<uint64_t>      samples;
+        samples.reserve(num_iterations);
+
+        for (int i = 0; i < num_iterations; ++i) {
+            rec.reset();
+            uint64_t start = now_nsec();
+            rec.builder().append(offset_attr, Variant(now_nsec()));
+            acquire_timerinfo(c);
+            samples.push_back(now_nsec() - start);
+        }
+
+        std::nth_element(samples.begin(), samples.begin() + num_iterations / 2, samples.end());
+        ti->head_overhead = samples[num_iterations / 2];
+        ti->is_calibrated = true;
+
+        Log(2).stream() << "timer: Calibrated snapshot overhead on this thread: " << ti->head_overhead << " ns"
+                        << std::endl;
+    }
+
     void snapshot_cb(Caliper* c, SnapshotView info, SnapshotBuilder& rec)
     {
-        auto     now  = clock::now();
-        uint64_t nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(now - tstart).count();
+        uint64_t nsec = now_nsec();
 
         rec.append(offset_attr, Variant(nsec));
 
@@ -90,7 +147,16 @@ class TimerService
         if (!ti)
             return;
 
-        rec.append(snapshot_duration_attr, cali_make_variant_from_uint(nsec - ti->prev_snapshot_timestamp));
+        uint64_t duration = nsec - ti->prev_snapshot_timestamp;
+
+        if (compensate_overhead) {
+            uint64_t overhead = std::min(duration, ti->pending_overhead + ti->head_overhead);
+            duration -= overhead;
+            ti->overhead_sum += overhead;
+            ti->pending_overhead = 0;
+        }
+
+        rec.append(snapshot_duration_attr, cali_make_variant_from_uint(duration));
         ti->prev_snapshot_timestamp = nsec;
 
         if (record_inclusive_duration && !info.empty() && !c->is_signal()) {
@@ -99,7 +165,7 @@ class TimerService
 
             if (v_id) {
                 // begin event: push current timestamp onto the inclusive timer stack
-                ti->inclusive_timer_stack[v_id.to_id()].push_back(nsec);
+                ti->inclusive_timer_stack[v_id.to_id()].push_back({ nsec, ti->overhead_sum });
             } else {
                 v_id = info_attr.get(end_evt_attr);
                 if (v_id) {
@@ -111,13 +177,34 @@ class TimerService
                         return;
                     }
 
-                    rec.append(inclusive_duration_attr, cali_make_variant_from_uint(nsec - stack_it->second.back()));
+                    const InclusiveTimerEntry& begin = stack_it->second.back();
+
+                    uint64_t duration = nsec - begin.timestamp;
+                    duration -= std::min(duration, ti->overhead_sum - begin.overhead);
+
+                    rec.append(inclusive_duration_attr, cali_make_variant_from_uint(duration));
                     stack_it->second.pop_back();
                 }
             }
         }
     }
 
+    //   Runs after all other snapshot processing callbacks: measures the
+    // instrumentation cost after our timestamp in the current snapshot,
+    // which is then subtracted from the next snapshot's duration.
+    void process_snapshot_cb(Caliper* c)
+    {
+        TimerInfo* ti = acquire_timerinfo(c);
+
+        if (!ti)
+            return;
+
+        if (!ti->is_calibrated && !c->is_signal())
+            calibrate(c, ti);
+
+        ti->pending_overhead = now_nsec() - ti->prev_snapshot_timestamp;
+    }
+
     void post_init_cb(Caliper* c, Channel* chn)
     {
         // Find begin/end event snapshot event info attributes
@@ -134,6 +221,14 @@ class TimerService
 
         // Initialize timer info on this thread
         acquire_timerinfo(c);
+
+        //   Connect the process_snapshot callback here, after all services
+        // have been registered, so it runs last
+        if (compensate_overhead) {
+            chn->events().process_snapshot.connect([this](Caliper* c, SnapshotView, SnapshotView) {
+                process_snapshot_cb(c);
+            });
+        }
     }
 
     void finish_cb(Caliper*, Channel* chn)
@@ -147,6 +242,7 @@ class TimerService
     {
         ConfigSet config          = services::init_config_from_spec(chn->config(), s_spec);
         record_inclusive_duration = config.get("inclusive_duration").to_bool();
+        compensate_overhead       = config.get("compensate_overhead").to_bool();
 
         Attribute unit_attr = c->create_attribute("time.unit", CALI_TYPE_STRING, CALI_ATTR_SKIP_EVENTS);
         Variant   nsec_val  = Variant("nsec");
@@ -224,6 +320,12 @@ const char* TimerService::s_spec = R"json(
   "type": "bool",
   "description": "Record inclusive duration of begin/end regions",
   "value": "false"
+ },
+ {
+  "name": "compensate_overhead",
+  "type": "bool",
+  "description": "Subtract estimated instrumentation overhead from time durations",
+  "value": "false"
  }
 ]}
 )json";
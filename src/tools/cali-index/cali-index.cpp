@@ -0,0 +1,102 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+// A tool that creates query index files for Caliper streams
+
+#include "../util/Args.h"
+#include "../util/FileIndex.h"
+
+#include "caliper/common/OutputStream.h"
+
+#include <iostream>
+
+using namespace cali;
+using namespace cali::util;
+
+namespace
+{
+const char* usage =
+    "cali-index [OPTION]... FILE..."
+    "\n  Create query index files for Caliper streams."
+    "\n  By default, writes a FILE.idx index file next to each input file.";
+
+const Args::Table option_table[] = {
+    // name, longopt name, shortopt char, has argument, info, argument info
+    { "output", "output", 'o', true, "Write a single index file for all input files", "FILE" },
+    { "verbose", "verbose", 'v', false, "Be verbose.", nullptr },
+    { "help", "help", 'h', false, "Print help message", nullptr },
+    Args::Terminator
+};
+
+bool write_index(FileIndex& index, const std::string& filename)
+{
+    OutputStream stream;
+    stream.set_filename(filename.c_str());
+
+    index.write(stream);
+
+    if (!stream.stream()->good()) {
+        std::cerr << "cali-index: error: could not write " << filename << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+} // namespace
+
+//
+// --- main()
+//
+
+int main(int argc, const char* argv[])
+{
+    Args args(::option_table);
+
+    {
+        int i = args.parse(argc, argv);
+
+        if (i < argc) {
+            std::cerr << "cali-index: error: unknown option: " << argv[i] << '\n' << "  Available options: ";
+            args.print_available_options(std::cerr);
+
+            return -1;
+        }
+
+        if (args.is_set("help") || args.arguments().empty()) {
+            std::cerr << usage << "\n\n";
+            args.print_available_options(std::cerr);
+
+            return args.is_set("help") ? 0 : -1;
+        }
+    }
+
+    bool verbose  = args.is_set("verbose");
+    bool combined = args.is_set("output");
+    int  ret      = 0;
+
+    FileIndex combined_index;
+
+    for (const std::string& file : args.arguments()) {
+        if (verbose)
+            std::cerr << "cali-index: Indexing " << file << std::endl;
+
+        FileIndex   file_index;
+        FileIndex&  index = combined ? combined_index : file_index;
+        std::string errmsg;
+
+        if (!index.add_file(file, errmsg)) {
+            std::cerr << "cali-index: error: " << file << ": " << errmsg << std::endl;
+            ret = -2;
+            continue;
+        }
+
+        if (!combined && !::write_index(index, file + ".idx"))
+            ret = -2;
+    }
+
+    if (combined && !::write_index(combined_index, args.get("output")))
+        ret = -2;
+
+    return ret;
+}
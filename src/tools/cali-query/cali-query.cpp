@@ -9,22 +9,32 @@
 #include "query_common.h"
 
 #include "../util/Args.h"
+#include "../util/FileIndex.h"
 
 #include "caliper/cali.h"
 #include "caliper/cali-manager.h"
 
+#include "caliper/reader/Aggregator.h"
 #include "caliper/reader/CaliReader.h"
 #include "caliper/reader/CaliperMetadataDB.h"
 #include "caliper/reader/FormatProcessor.h"
+#include "caliper/reader/Preprocessor.h"
 #include "caliper/reader/QueryProcessor.h"
+#include "caliper/reader/RecordSelector.h"
 
 #include "caliper/common/Node.h"
 #include "caliper/common/OutputStream.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 using namespace cali;
 using namespace cali::util;
@@ -87,6 +97,14 @@ const Args::Table option_table[] = {
       true,
       "Set Caliper configuration for profiling cali-query",
       "CALIPER-CONFIG" },
+    { "threads", "threads", 0, true, "Read input files in parallel with the given number of threads", "NUM_THREADS" },
+    { "mem-limit",
+      "mem-limit",
+      0,
+      true,
+      "Spill aggregation data to temporary files above this memory limit (e.g., 512M)",
+      "SIZE" },
+    { "index", "index", 0, true, "Use the given query index file instead of FILE.idx index files", "FILE" },
     { "verbose", "verbose", 'v', false, "Be verbose.", nullptr },
     { "version", "version", 'V', false, "Print version number", nullptr },
     { "output", "output", 'o', true, "Set the output file name", "FILE" },
@@ -109,8 +127,364 @@ const Args::Table option_table[] = {
 void node_proc_noop(CaliperMetadataAccessInterface&,const Node*) {}
 void snap_proc_noop(CaliperMetadataAccessInterface&,const EntryList&) {}
 
+/// \brief Merge the global entries \a globals from \a db into \a metadb and
+///   append them to \a list
+void append_globals(CaliperMetadataDB& metadb, CaliperMetadataAccessInterface& db, const EntryList& globals, EntryList& list)
+{
+    for (Entry e : metadb.merge_snapshot(db, globals)) {
+        // immediate strings still point into db
+        if (e.is_immediate() && e.value().type() == CALI_TYPE_STRING) {
+            Variant v = e.value();
+            e = Entry(metadb.get_attribute(e.attribute()), metadb.make_string_variant(static_cast<const char*>(v.data()), v.size()));
+        }
+
+        if (std::find(list.begin(), list.end(), e) == list.end())
+            list.push_back(e);
+    }
+}
+
+/// \brief Reads input files in parallel threads.
+///
+/// Each thread parses whole files into its own metadata DB, and runs the
+/// preprocessing, filter, and aggregation steps of the query on them. The
+/// partial results are then merged into a single metadata DB with node id
+/// remapping. Records of non-aggregating queries are streamed to the
+/// output in input file order: the file whose turn it is goes straight to
+/// the formatter, and only files read ahead of it are buffered.
+class ParallelFileReader
+{
+    struct ReaderThread {
+        CaliperMetadataDB db;
+        Aggregator        aggregator;
+        Preprocessor      preprocessor;
+        RecordSelector    filter;
+
+        ReaderThread(const QuerySpec& spec) : aggregator(spec), preprocessor(spec), filter(spec)
+        {
+            db.add_attribute_aliases(spec.aliases);
+            db.add_attribute_units(spec.units);
+        }
+    };
+
+    QuerySpec m_spec;
+    bool      m_do_aggregate;
+    bool      m_do_filter;
+    bool      m_do_preprocess;
+    bool      m_verbose;
+
+    std::vector<std::unique_ptr<ReaderThread>> m_threads;
+
+    std::vector<std::string>            m_files;
+    std::vector<unsigned>               m_file_thread;
+    std::vector<std::vector<EntryList>> m_file_records;
+    std::vector<char>                   m_file_done;
+    std::atomic<size_t>                 m_next_file;
+
+    // Output of non-aggregating queries. m_output_lock protects the
+    // formatter, m_file_done, and the records of files other than the
+    // one a thread is reading. m_next_output is only modified with the
+    // lock held.
+    CaliperMetadataDB*  m_metadb    = nullptr;
+    FormatProcessor*    m_formatter = nullptr;
+    std::atomic<size_t> m_next_output;
+    std::mutex          m_output_lock;
+
+    std::mutex m_log_mutex;
+
+    void write_buffered(size_t i)
+    {
+        CaliperMetadataDB& db = m_threads[m_file_thread[i]]->db;
+
+        for (const EntryList& rec : m_file_records[i])
+            m_formatter->process_record(*m_metadb, m_metadb->merge_snapshot(db, rec));
+
+        std::vector<EntryList>().swap(m_file_records[i]);
+    }
+
+    void write_record(size_t i, CaliperMetadataDB& db, EntryList&& rec)
+    {
+        // only the thread reading file i adds to its records while the
+        // file isn't done, so they can be appended without the lock
+        if (m_next_output.load() != i) {
+            m_file_records[i].push_back(std::move(rec));
+            return;
+        }
+
+        std::lock_guard<std::mutex> g(m_output_lock);
+
+        if (!m_file_records[i].empty())
+            write_buffered(i);
+
+        m_formatter->process_record(*m_metadb, m_metadb->merge_snapshot(db, rec));
+    }
+
+    void finish_file(size_t i)
+    {
+        std::lock_guard<std::mutex> g(m_output_lock);
+
+        m_file_done[i] = true;
+
+        // write out the files that were waiting for this one
+        for (size_t n = m_next_output.load(); n < m_files.size() && m_file_done[n]; n = m_next_output.load()) {
+            write_buffered(n);
+            m_next_output.store(n + 1);
+        }
+    }
+
+    void read_files(unsigned t)
+    {
+        ReaderThread& r = *m_threads[t];
+
+        for (size_t i = m_next_file++; i < m_files.size(); i = m_next_file++) {
+            const std::string& file = m_files[i];
+
+            if (m_verbose) {
+                std::lock_guard<std::mutex> g(m_log_mutex);
+                std::cerr << "cali-query: Reading " << file << std::endl;
+            }
+
+            m_file_thread[i] = t;
+
+            CaliReader reader;
+            reader.set_query_hints(m_spec);
+            reader.read(
+                file,
+                r.db,
+                node_proc_noop,
+                [this, &r, i](CaliperMetadataAccessInterface& db, const EntryList& in) {
+                    EntryList rec = m_do_preprocess ? r.preprocessor.process(db, in) : in;
+
+                    if (!m_do_filter || r.filter.pass(db, rec)) {
+                        if (m_do_aggregate)
+                            r.aggregator.add(db, rec);
+                        else
+                            write_record(i, r.db, std::move(rec));
+                    }
+                }
+            );
+
+            if (reader.error()) {
+                std::lock_guard<std::mutex> g(m_log_mutex);
+                std::cerr << "cali-query: Error reading " << file << ": " << reader.error_msg() << std::endl;
+            }
+
+            if (!m_do_aggregate)
+                finish_file(i);
+        }
+    }
+
+public:
+
+    ParallelFileReader(const QuerySpec& spec, unsigned num_threads, bool verbose)
+        : m_spec(spec), m_verbose(verbose), m_next_file(0), m_next_output(0)
+    {
+        m_do_aggregate  = (spec.aggregate.selection != QuerySpec::AggregationSelection::None);
+        m_do_filter     = (spec.filter.selection != QuerySpec::FilterSelection::None);
+        m_do_preprocess = !spec.preprocess_ops.empty();
+
+        for (unsigned t = 0; t < num_threads; ++t)
+            m_threads.emplace_back(new ReaderThread(spec));
+    }
+
+    /// \brief Read \a files and pass the merged query result for \a metadb
+    ///   to \a formatter
+    void process(const std::vector<std::string>& files, CaliperMetadataDB& metadb, FormatProcessor& formatter)
+    {
+        m_files = files;
+        m_file_thread.assign(files.size(), 0);
+        m_file_records.assign(m_do_aggregate ? 0 : files.size(), std::vector<EntryList>());
+        m_file_done.assign(files.size(), false);
+        m_next_file   = 0;
+        m_next_output = 0;
+        m_metadb      = &metadb;
+        m_formatter   = &formatter;
+
+        {
+            std::vector<std::thread> threads;
+
+            for (unsigned t = 1; t < m_threads.size(); ++t)
+                threads.emplace_back([this, t]() { read_files(t); });
+
+            read_files(0);
+
+            for (auto& thread : threads)
+                thread.join();
+        }
+
+        // import_globals() replaces the existing globals, so collect them first
+        EntryList globals;
+
+        for (auto& r : m_threads)
+            ::append_globals(metadb, r->db, r->db.get_globals(), globals);
+
+        metadb.import_globals(metadb, globals);
+
+        if (m_do_aggregate) {
+            Aggregator aggregator(m_spec);
+
+            for (auto& r : m_threads)
+                r->aggregator.flush(r->db, [&metadb, &aggregator](CaliperMetadataAccessInterface& db, const EntryList& rec) {
+                    aggregator.add(metadb, metadb.merge_snapshot(db, rec));
+                });
+
+            aggregator.flush(metadb, formatter);
+        }
+    }
+};
+
+/// \brief Reads a single input file in parallel threads.
+///
+/// The threads decode the snapshot records of contiguous chunks of the file
+/// into a shared metadata DB, and run the preprocessing, filter, and
+/// aggregation steps of the query on them. Partial aggregation results are
+/// merged afterwards. Records of non-aggregating queries are passed on in
+/// stream order: the thread that reads the chunk whose turn it is passes
+/// them to the formatter right away, other threads buffer them until the
+/// preceding chunks are done.
+class ParallelStreamReader
+{
+    struct ChunkProcessor {
+        Preprocessor           preprocessor;
+        RecordSelector         filter;
+        std::vector<EntryList> records;
+
+        ChunkProcessor(const QuerySpec& spec) : preprocessor(spec), filter(spec) {}
+    };
+
+    QuerySpec  m_spec;
+    Aggregator m_aggregator; // shared by all reader threads
+    bool       m_do_aggregate;
+    bool      m_do_filter;
+    bool      m_do_preprocess;
+
+    std::vector<std::unique_ptr<ChunkProcessor>> m_chunks;
+    std::vector<char>                            m_chunk_done;
+
+    // Output of non-aggregating queries. m_output_lock protects the
+    // formatter, m_chunk_done, and the records of chunks other than the
+    // one a thread is reading. m_next_output is only modified with the
+    // lock held.
+    CaliperMetadataDB*  m_metadb    = nullptr;
+    FormatProcessor*    m_formatter = nullptr;
+    std::atomic<size_t> m_next_output;
+    std::mutex          m_output_lock;
+
+    void write_buffered(size_t i)
+    {
+        for (const EntryList& rec : m_chunks[i]->records)
+            m_formatter->process_record(*m_metadb, rec);
+
+        std::vector<EntryList>().swap(m_chunks[i]->records);
+    }
+
+    void write_record(size_t i, EntryList&& rec)
+    {
+        // only the thread reading chunk i adds to its records while the
+        // chunk isn't done, so they can be appended without the lock
+        if (m_next_output.load() != i) {
+            m_chunks[i]->records.push_back(std::move(rec));
+            return;
+        }
+
+        std::lock_guard<std::mutex> g(m_output_lock);
+
+        if (!m_chunks[i]->records.empty())
+            write_buffered(i);
+
+        m_formatter->process_record(*m_metadb, rec);
+    }
+
+    void finish_chunk(size_t i)
+    {
+        std::lock_guard<std::mutex> g(m_output_lock);
+
+        m_chunk_done[i] = true;
+
+        // write out the chunks that were waiting for this one
+        for (size_t n = m_next_output.load(); n < m_chunks.size() && m_chunk_done[n]; n = m_next_output.load()) {
+            write_buffered(n);
+            m_next_output.store(n + 1);
+        }
+    }
+
+public:
+
+    ParallelStreamReader(const QuerySpec& spec, unsigned num_threads)
+        : m_spec(spec), m_aggregator(spec), m_next_output(0)
+    {
+        m_do_aggregate  = (spec.aggregate.selection != QuerySpec::AggregationSelection::None);
+        m_do_filter     = (spec.filter.selection != QuerySpec::FilterSelection::None);
+        m_do_preprocess = !spec.preprocess_ops.empty();
+
+        for (unsigned t = 0; t < num_threads; ++t)
+            m_chunks.emplace_back(new ChunkProcessor(spec));
+    }
+
+    /// \brief Read \a file into \a metadb and pass the query result to
+    ///   \a formatter
+    void process(const std::string& file, CaliperMetadataDB& metadb, FormatProcessor& formatter)
+    {
+        std::vector<SnapshotProcessFn> snap_procs;
+
+        m_chunk_done.assign(m_chunks.size(), false);
+        m_next_output = 0;
+        m_metadb      = &metadb;
+        m_formatter   = &formatter;
+
+        for (size_t i = 0; i < m_chunks.size(); ++i) {
+            ChunkProcessor* p = m_chunks[i].get();
+            snap_procs.push_back([this, p, i](CaliperMetadataAccessInterface& db, const EntryList& in) {
+                EntryList rec = m_do_preprocess ? p->preprocessor.process(db, in) : in;
+
+                if (!m_do_filter || p->filter.pass(db, rec)) {
+                    if (m_do_aggregate)
+                        m_aggregator.add(db, rec);
+                    else
+                        write_record(i, std::move(rec));
+                }
+            });
+        }
+
+        std::function<void(size_t)> chunk_done;
+
+        if (!m_do_aggregate)
+            chunk_done = [this](size_t i) { finish_chunk(i); };
+
+        CaliReader reader;
+        reader.set_query_hints(m_spec);
+        reader.read_parallel(file, metadb, node_proc_noop, snap_procs, chunk_done);
+
+        if (reader.error())
+            std::cerr << "cali-query: Error reading " << file << ": " << reader.error_msg() << std::endl;
+
+        if (m_do_aggregate) {
+            m_aggregator.flush(metadb, formatter);
+        } else {
+            // chunks that did not get any input are not reported as done
+            for (size_t i = m_next_output.load(); i < m_chunks.size(); ++i)
+                write_buffered(i);
+        }
+    }
+};
+
 } // namespace
 
+/// \brief Read the node records in the given byte ranges of \a filename
+std::string read_node_blocks(const std::string& filename, const FileIndex::ByteRanges& ranges)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+    std::string   buf;
+
+    for (const auto& r : ranges) {
+        std::string::size_type pos = buf.size();
+        buf.resize(pos + r.second);
+        is.seekg(r.first);
+        is.read(&buf[pos], r.second);
+    }
+
+    return buf;
+}
+
 void setup_caliper_config(const Args& args)
 {
     //   Configure the default config, which can be provided by the user through
@@ -161,6 +535,22 @@ int main(int argc, const char* argv[])
 
     bool verbose = args.is_set("verbose");
 
+    unsigned num_threads = 1;
+
+    if (args.is_set("threads")) {
+        std::string arg = args.get("threads");
+        char*       end = nullptr;
+        long        n   = std::strtol(arg.c_str(), &end, 10);
+
+        if (arg.empty() || *end != '\0' || n < 0) {
+            std::cerr << "cali-query: Invalid number of threads: " << arg << std::endl;
+            return -1;
+        }
+
+        // --threads=0 uses all available hardware threads
+        num_threads = (n > 0 ? static_cast<unsigned>(n) : std::max(std::thread::hardware_concurrency(), 1u));
+    }
+
     mgr.set_default_parameter("aggregate_across_ranks", "false");
     mgr.add(args.get("caliper-config").c_str());
 
@@ -224,22 +614,115 @@ int main(int argc, const char* argv[])
     metadb.add_attribute_aliases(spec.aliases);
     metadb.add_attribute_units(spec.units);
 
-    for (const std::string& file : files) {
-        Annotation::Guard g_f(Annotation("cali-query.stream").begin(file.empty() ? "stdin" : file.c_str()));
+    //   Load the query index, either from the file given with --index or
+    // from FILE.idx sidecar files. Index entries for files that have changed
+    // since they were indexed are ignored.
 
-        if (verbose)
-            std::cerr << "cali-query: Reading " << file << std::endl;
+    FileIndex                index;
+    std::vector<std::string> index_files;
 
-        CaliReader reader;
-        if (args.is_set("list-attributes"))
-            reader.read(file, metadb, AttributeExtract(processor), snap_proc_noop);
-        else if (args.is_set("list-globals"))
-            reader.read(file, metadb, node_proc_noop, snap_proc_noop);
-        else
-            reader.read(file, metadb, node_proc_noop, processor);
+    if (args.is_set("index"))
+        index_files.push_back(args.get("index"));
+    else
+        for (const std::string& file : files)
+            if (!file.empty() && std::ifstream((file + ".idx").c_str()))
+                index_files.push_back(file + ".idx");
 
-        if (reader.error())
-            std::cerr << "cali-query: Error reading " << file << ": " << reader.error_msg() << std::endl;
+    for (const std::string& idxfile : index_files) {
+        std::string errmsg;
+
+        if (!index.read(idxfile, errmsg))
+            std::cerr << "cali-query: Error reading index " << idxfile << ": " << errmsg << std::endl;
+    }
+
+    //   Skip files whose index entry shows that none of their records can
+    // match the filter
+
+    if (!args.is_set("list-attributes") && !args.is_set("list-globals")) {
+        auto it = std::remove_if(files.begin(), files.end(), [&](const std::string& file) {
+            const EntryList* rec  = index.find(file);
+            bool             skip = rec && !index.may_match(*rec, spec);
+
+            if (skip && verbose)
+                std::cerr << "cali-query: Skipping " << file << " (no match in index)" << std::endl;
+
+            return skip;
+        });
+
+        files.erase(it, files.end());
+    }
+
+    //   Read files in parallel if requested: multiple files are distributed
+    // over the threads, a single file is split into chunks. Attribute and
+    // global listings are cheap and always read serially.
+
+    bool read_parallel = num_threads > 1 && !files.empty() && !files.front().empty()
+                         && !args.is_set("list-attributes") && !args.is_set("list-globals");
+
+    std::unique_ptr<FormatProcessor> parallel_formatter;
+    EntryList                        selected_globals;
+
+    if (read_parallel) {
+        parallel_formatter.reset(new FormatProcessor(spec, stream));
+
+        if (files.size() > 1) {
+            ParallelFileReader reader(spec, static_cast<unsigned>(std::min<size_t>(num_threads, files.size())), verbose);
+            reader.process(files, metadb, *parallel_formatter);
+        } else {
+            if (verbose)
+                std::cerr << "cali-query: Reading " << files.front() << " with " << num_threads << " threads" << std::endl;
+
+            ParallelStreamReader reader(spec, num_threads);
+            reader.process(files.front(), metadb, *parallel_formatter);
+        }
+    } else {
+        RecordSelector global_filter(spec);
+
+        for (const std::string& file : files) {
+            Annotation::Guard g_f(Annotation("cali-query.stream").begin(file.empty() ? "stdin" : file.c_str()));
+
+            const EntryList*      rec = index.find(file);
+            FileIndex::ByteRanges ranges;
+
+            if (rec && args.is_set("list-globals")) {
+                // WHERE conditions select files by their globals
+                EntryList globals = index.globals(*rec);
+
+                if (verbose)
+                    std::cerr << "cali-query: Reading globals of " << file << " from index" << std::endl;
+                if (global_filter.pass(index.db(), globals))
+                    ::append_globals(metadb, index.db(), globals, selected_globals);
+
+                continue;
+            }
+
+            if (verbose)
+                std::cerr << "cali-query: Reading " << file << std::endl;
+
+            CaliReader reader;
+            if (args.is_set("list-attributes")) {
+                if (rec && index.node_blocks(*rec, ranges)) {
+                    std::istringstream is(::read_node_blocks(file, ranges));
+                    reader.read(is, metadb, AttributeExtract(processor), snap_proc_noop);
+                } else {
+                    reader.read(file, metadb, AttributeExtract(processor), snap_proc_noop);
+                }
+            } else if (args.is_set("list-globals")) {
+                CaliperMetadataDB db;
+                reader.read(file, db, node_proc_noop, snap_proc_noop);
+
+                EntryList globals = db.get_globals();
+
+                if (global_filter.pass(db, globals))
+                    ::append_globals(metadb, db, globals, selected_globals);
+            } else {
+                reader.set_query_hints(spec);
+                reader.read(file, metadb, node_proc_noop, processor);
+            }
+
+            if (reader.error())
+                std::cerr << "cali-query: Error reading " << file << ": " << reader.error_msg() << std::endl;
+        }
     }
 
     CALI_MARK_END("Processing");
@@ -265,8 +748,10 @@ int main(int argc, const char* argv[])
 
         FormatProcessor global_format(spec, stream);
 
-        global_format.process_record(metadb, metadb.get_globals());
+        global_format.process_record(metadb, selected_globals);
         global_format.flush(metadb);
+    } else if (parallel_formatter) {
+        parallel_formatter->flush(metadb);
     } else {
         processor.flush(metadb);
     }
@@ -23,6 +23,7 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdlib>
 #include <iterator>
 #include <sstream>
 
@@ -32,6 +33,37 @@ using namespace util;
 namespace
 {
 
+/// \brief Parse a byte count with an optional K, M, or G suffix (e.g., "512M")
+bool parse_size(const std::string& str, std::size_t& size)
+{
+    char*              end = nullptr;
+    unsigned long long val = std::strtoull(str.c_str(), &end, 10);
+
+    if (end == str.c_str())
+        return false;
+
+    switch (std::toupper(*end)) {
+    case 'G':
+        val <<= 10;
+        // fallthrough
+    case 'M':
+        val <<= 10;
+        // fallthrough
+    case 'K':
+        val <<= 10;
+        ++end;
+        break;
+    default:
+        break;
+    }
+
+    if (*end == 'B' || *end == 'b')
+        ++end;
+
+    size = static_cast<std::size_t>(val);
+    return *end == '\0';
+}
+
 /// \brief Parse "(arg1, arg2, ...)" argument list, ignoring whitespace
 std::vector<std::string> parse_arglist(std::istream& is)
 {
@@ -115,6 +147,8 @@ FORMAT
     <report/output formatter>
 ORDER BY
     <list of sort attributes>
+LIMIT
+    <max number of output records>
 
 All of the statements are optional; by default cali-query will pass the input
 records through as-is, without any aggregations, and output .cali data.
@@ -189,6 +223,10 @@ structure is
 The ORDER BY statement specifies a list of attributes to sort the output
 records by. It can be used with the "table" and "tree" formatters.
 
+LIMIT n restricts the output to the first n records in ORDER BY order, or to
+the first n records without ORDER BY. It works with all formatters and only
+keeps n records in memory.
+
 Available formatters:
 
 )helpstr";
@@ -333,6 +371,17 @@ bool QueryArgsParser::parse_args(const Args& args)
             m_spec.sort.list.emplace_back(s);
     }
 
+    // setup aggregation memory limit
+
+    if (args.is_set("mem-limit")) {
+        if (!::parse_size(args.get("mem-limit"), m_spec.aggregation_memory_limit)) {
+            m_error     = true;
+            m_error_msg = "invalid memory limit " + args.get("mem-limit");
+
+            return false;
+        }
+    }
+
     // setup formatter
 
     for (const QuerySpec::FunctionSignature* fmtsig = FormatProcessor::formatter_defs(); fmtsig && fmtsig->name;
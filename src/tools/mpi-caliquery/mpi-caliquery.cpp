@@ -23,7 +23,11 @@
 
 #include "../../common/StringConverter.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 using namespace cali;
 using namespace cali::util;
@@ -96,6 +100,13 @@ const Args::Table option_table[] = {
     { "verbose", "verbose", 'v', false, "Be verbose.", nullptr },
     { "help", "help", 'h', true, "Print help message", nullptr },
     { "output", "output", 'o', true, "Set the output file name", "FILE" },
+    { "threads", "threads", 0, true, "Parse the input file with the given number of threads", "NUM_THREADS" },
+    { "mem-limit",
+      "mem-limit",
+      0,
+      true,
+      "Spill aggregation data to temporary files above this memory limit (e.g., 512M)",
+      "SIZE" },
     Args::Terminator
 };
 
@@ -116,7 +127,14 @@ void format_output(const Args& args, const QuerySpec& spec, CaliperMetadataAcces
     format.flush(db);
 }
 
-void process_my_input(int rank, const Args& args, const QuerySpec& spec, CaliperMetadataDB& db, Aggregator& aggregate)
+void process_my_input(
+    int                rank,
+    const Args&        args,
+    const QuerySpec&   spec,
+    unsigned           num_threads,
+    CaliperMetadataDB& db,
+    Aggregator&        aggregate
+)
 {
     CALI_CXX_MARK_FUNCTION;
 
@@ -129,15 +147,26 @@ void process_my_input(int rank, const Args& args, const QuerySpec& spec, Caliper
     NodeProcessFn node_proc = [](CaliperMetadataAccessInterface&, const Node*) {
         return;
     };
-    SnapshotProcessFn snap_proc = aggregate;
 
-    if (!spec.preprocess_ops.empty())
-        snap_proc = SnapshotFilterStep(Preprocessor(spec), snap_proc);
-    if (spec.filter.selection == QuerySpec::FilterSelection::List)
-        snap_proc = SnapshotFilterStep(RecordSelector(spec), snap_proc);
+    // the reader threads all add into the same aggregator, which keeps a
+    // separate aggregation table for each thread
+
+    std::vector<SnapshotProcessFn> snap_procs;
+
+    for (unsigned t = 0; t < std::max(num_threads, 1u); ++t) {
+        SnapshotProcessFn snap_proc = aggregate;
+
+        if (!spec.preprocess_ops.empty())
+            snap_proc = SnapshotFilterStep(Preprocessor(spec), snap_proc);
+        if (spec.filter.selection == QuerySpec::FilterSelection::List)
+            snap_proc = SnapshotFilterStep(RecordSelector(spec), snap_proc);
+
+        snap_procs.push_back(snap_proc);
+    }
 
     CaliReader reader;
-    reader.read(filename, db, node_proc, snap_proc);
+    reader.set_query_hints(spec);
+    reader.read_parallel(filename, db, node_proc, snap_procs);
 
     if (reader.error())
         std::cerr << "mpi-caliquery (" << rank << "): error " << filename << ": " << reader.error_msg() << std::endl;
@@ -234,13 +263,31 @@ int main(int argc, char* argv[])
 
     QuerySpec spec = query_parser.spec();
 
+    unsigned num_threads = 1;
+
+    if (args.is_set("threads")) {
+        std::string arg = args.get("threads");
+        char*       end = nullptr;
+        long        n   = std::strtol(arg.c_str(), &end, 10);
+
+        if (arg.empty() || *end != '\0' || n < 0) {
+            if (rank == 0)
+                std::cerr << "mpi-caliquery: Invalid number of threads: " << arg << std::endl;
+
+            MPI_Abort(MPI_COMM_WORLD, -2);
+        }
+
+        // --threads=0 uses all available hardware threads
+        num_threads = (n > 0 ? static_cast<unsigned>(n) : std::max(std::thread::hardware_concurrency(), 1u));
+    }
+
     Aggregator        aggregate(spec);
     CaliperMetadataDB metadb;
 
     // --- Process our own input
     //
 
-    ::process_my_input(rank, args, spec, metadb, aggregate);
+    ::process_my_input(rank, args, spec, num_threads, metadb, aggregate);
 
     // --- Aggregation loop
     //
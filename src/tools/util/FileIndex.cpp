@@ -0,0 +1,415 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+///@file FileIndex.cpp
+/// Sidecar query index implementation
+
+#include "FileIndex.h"
+
+#include "caliper/reader/CaliReader.h"
+#include "caliper/reader/CaliWriter.h"
+
+#include "caliper/common/Node.h"
+#include "caliper/common/OutputStream.h"
+
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+using namespace cali;
+using namespace cali::util;
+
+namespace
+{
+
+std::string get_realpath(const std::string& filename)
+{
+    char*       p   = ::realpath(filename.c_str(), nullptr);
+    std::string ret = (p ? p : filename);
+
+    free(p);
+    return ret;
+}
+
+bool has_stats(cali_attr_type type)
+{
+    return type == CALI_TYPE_INT || type == CALI_TYPE_UINT || type == CALI_TYPE_DOUBLE || type == CALI_TYPE_ADDR;
+}
+
+/// \brief Collects the attributes and min/max values in a file's snapshot records
+struct FileStats {
+    uint64_t                                       num_records = 0;
+    std::set<cali_id_t>                            attributes;
+    std::set<cali_id_t>                            ref_attributes;
+    std::set<cali_id_t>                            seen_nodes;
+    std::map<cali_id_t, std::pair<Variant, Variant>> min_max;
+
+    void add(const EntryList& rec)
+    {
+        ++num_records;
+
+        for (const Entry& e : rec) {
+            if (e.is_reference()) {
+                // all parents of a node we have seen have been visited too
+                for (const Node* node = e.node(); node && node->id() != CALI_INV_ID; node = node->parent()) {
+                    if (!seen_nodes.insert(node->id()).second)
+                        break;
+
+                    attributes.insert(node->attribute());
+                    ref_attributes.insert(node->attribute());
+                }
+            } else if (e.is_immediate()) {
+                attributes.insert(e.attribute());
+
+                Variant v = e.value();
+
+                if (!has_stats(v.type()))
+                    continue;
+
+                auto it = min_max.find(e.attribute());
+
+                if (it == min_max.end()) {
+                    min_max.emplace(e.attribute(), std::make_pair(v, v));
+                } else {
+                    if (v < it->second.first)
+                        it->second.first = v;
+                    if (it->second.second < v)
+                        it->second.second = v;
+                }
+            }
+        }
+    }
+};
+
+/// \brief Find the byte ranges of contiguous node record lines in a text .cali file
+bool scan_node_blocks(const std::string& filename, FileIndex::ByteRanges& ranges)
+{
+    std::ifstream is(filename.c_str(), std::ios::binary);
+
+    if (!is)
+        return false;
+    if (is.peek() == 0x89) // binary .calib file
+        return false;
+
+    std::string line;
+    uint64_t    pos      = 0;
+    uint64_t    begin    = 0;
+    bool        in_block = false;
+
+    while (std::getline(is, line)) {
+        uint64_t next    = pos + line.size() + (is.eof() ? 0 : 1);
+        bool     is_node = line.compare(0, 11, "__rec=node,") == 0;
+
+        if (is_node && !in_block) {
+            begin    = pos;
+            in_block = true;
+        } else if (!is_node && in_block) {
+            ranges.emplace_back(begin, pos - begin);
+            in_block = false;
+        }
+
+        pos = next;
+    }
+
+    if (in_block)
+        ranges.emplace_back(begin, pos - begin);
+
+    return true;
+}
+
+} // namespace
+
+void FileIndex::setup_attributes()
+{
+    int prop = CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS;
+
+    m_file_attr        = m_db.create_attribute("cali.index.file", CALI_TYPE_STRING, prop);
+    m_size_attr        = m_db.create_attribute("cali.index.size", CALI_TYPE_UINT, prop);
+    m_mtime_attr       = m_db.create_attribute("cali.index.mtime", CALI_TYPE_INT, prop);
+    m_records_attr     = m_db.create_attribute("cali.index.records", CALI_TYPE_UINT, prop);
+    m_node_blocks_attr = m_db.create_attribute("cali.index.node_blocks", CALI_TYPE_STRING, prop);
+    m_attribute_attr   = m_db.create_attribute("cali.index.attribute", CALI_TYPE_STRING, prop);
+}
+
+FileIndex::FileIndex()
+{
+    setup_attributes();
+}
+
+bool FileIndex::add_file(const std::string& filename, std::string& errmsg)
+{
+    struct stat st;
+
+    if (stat(filename.c_str(), &st) != 0) {
+        errmsg = "Cannot stat " + filename;
+        return false;
+    }
+
+    CaliperMetadataDB fdb;
+    FileStats         stats;
+    CaliReader        reader;
+
+    reader.read(
+        filename,
+        fdb,
+        [](CaliperMetadataAccessInterface&, const Node*) {},
+        [&stats](CaliperMetadataAccessInterface&, const EntryList& rec) { stats.add(rec); }
+    );
+
+    if (reader.error()) {
+        errmsg = reader.error_msg();
+        return false;
+    }
+
+    std::string path = ::get_realpath(filename);
+    int         prop = CALI_ATTR_ASVALUE | CALI_ATTR_SKIP_EVENTS;
+    EntryList   rec;
+
+    rec.push_back(Entry(m_file_attr, m_db.make_string_variant(path.data(), path.size())));
+    rec.push_back(Entry(m_size_attr, Variant(cali_make_variant_from_uint(static_cast<uint64_t>(st.st_size)))));
+    rec.push_back(Entry(m_mtime_attr, Variant(cali_make_variant_from_int64(static_cast<int64_t>(st.st_mtime)))));
+    rec.push_back(Entry(m_records_attr, Variant(cali_make_variant_from_uint(stats.num_records))));
+
+    ByteRanges ranges;
+
+    if (::scan_node_blocks(filename, ranges)) {
+        std::ostringstream os;
+
+        for (size_t i = 0; i < ranges.size(); ++i)
+            os << (i > 0 ? ";" : "") << ranges[i].first << '+' << ranges[i].second;
+
+        std::string str = os.str();
+        rec.push_back(Entry(m_node_blocks_attr, m_db.make_string_variant(str.data(), str.size())));
+    }
+
+    std::set<std::string> names;
+
+    for (cali_id_t id : stats.attributes) {
+        Attribute attr = fdb.get_attribute(id);
+
+        if (attr)
+            names.insert(attr.name());
+    }
+
+    for (const std::string& name : names)
+        rec.push_back(Entry(m_attribute_attr, m_db.make_string_variant(name.data(), name.size())));
+
+    //   Min/max values are only kept for attributes that appear exclusively
+    // as immediate entries, the same as .calib row group statistics.
+
+    for (const auto& p : stats.min_max) {
+        if (stats.ref_attributes.count(p.first))
+            continue;
+
+        Attribute attr = fdb.get_attribute(p.first);
+
+        if (!attr)
+            continue;
+
+        Attribute min_attr = m_db.create_attribute("min#" + attr.name(), attr.type(), prop);
+        Attribute max_attr = m_db.create_attribute("max#" + attr.name(), attr.type(), prop);
+
+        rec.push_back(Entry(min_attr, p.second.first));
+        rec.push_back(Entry(max_attr, p.second.second));
+    }
+
+    // merge the file's globals. Immediate strings point into fdb and must be copied.
+
+    for (const Entry& e : m_db.merge_snapshot(fdb, fdb.get_globals())) {
+        if (e.is_immediate() && e.value().type() == CALI_TYPE_STRING) {
+            Variant v = e.value();
+            rec.push_back(
+                Entry(m_db.get_attribute(e.attribute()), m_db.make_string_variant(static_cast<const char*>(v.data()), v.size()))
+            );
+        } else {
+            rec.push_back(e);
+        }
+    }
+
+    m_files[path] = rec;
+
+    return true;
+}
+
+void FileIndex::write(OutputStream& os)
+{
+    CaliWriter writer(os);
+
+    for (const auto& p : m_files)
+        writer.write_snapshot(m_db, p.second);
+}
+
+bool FileIndex::read(const std::string& filename, std::string& errmsg)
+{
+    CaliReader reader;
+
+    reader.read(
+        filename,
+        m_db,
+        [](CaliperMetadataAccessInterface&, const Node*) {},
+        [this](CaliperMetadataAccessInterface&, const EntryList& rec) {
+            for (const Entry& e : rec)
+                if (e.is_immediate() && e.attribute() == m_file_attr.id()) {
+                    m_files[e.value().to_string()] = rec;
+                    break;
+                }
+        }
+    );
+
+    if (reader.error()) {
+        errmsg = reader.error_msg();
+        return false;
+    }
+
+    return true;
+}
+
+const EntryList* FileIndex::find(const std::string& filename) const
+{
+    auto it = m_files.find(::get_realpath(filename));
+
+    if (it == m_files.end())
+        return nullptr;
+
+    struct stat st;
+
+    if (stat(filename.c_str(), &st) != 0)
+        return nullptr;
+
+    bool size_ok  = false;
+    bool mtime_ok = false;
+
+    for (const Entry& e : it->second) {
+        if (!e.is_immediate())
+            continue;
+        if (e.attribute() == m_size_attr.id())
+            size_ok = (e.value().to_uint() == static_cast<uint64_t>(st.st_size));
+        else if (e.attribute() == m_mtime_attr.id())
+            mtime_ok = (e.value().to_int64() == static_cast<int64_t>(st.st_mtime));
+    }
+
+    return (size_ok && mtime_ok) ? &(it->second) : nullptr;
+}
+
+EntryList FileIndex::globals(const EntryList& rec) const
+{
+    EntryList ret;
+
+    for (const Entry& e : rec) {
+        if (e.is_reference())
+            ret.push_back(e);
+        else if (e.is_immediate() && m_db.get_attribute(e.attribute()).is_global())
+            ret.push_back(e);
+    }
+
+    return ret;
+}
+
+bool FileIndex::node_blocks(const EntryList& rec, ByteRanges& ranges) const
+{
+    for (const Entry& e : rec) {
+        if (!e.is_immediate() || e.attribute() != m_node_blocks_attr.id())
+            continue;
+
+        std::istringstream is(e.value().to_string());
+        std::string        str;
+
+        while (std::getline(is, str, ';')) {
+            auto plus = str.find('+');
+
+            if (plus == std::string::npos)
+                return false;
+
+            ranges.emplace_back(std::stoull(str.substr(0, plus)), std::stoull(str.substr(plus + 1)));
+        }
+
+        return true;
+    }
+
+    return false;
+}
+
+bool FileIndex::may_match(const EntryList& rec, const QuerySpec& spec) const
+{
+    typedef QuerySpec::Condition Cond;
+
+    if (spec.filter.selection != QuerySpec::FilterSelection::List)
+        return true;
+
+    std::set<std::string> targets;
+
+    for (const auto& p : spec.preprocess_ops)
+        targets.insert(p.target);
+
+    std::set<std::string> names;
+
+    for (const Entry& e : rec)
+        if (e.is_immediate() && e.attribute() == m_attribute_attr.id())
+            names.insert(e.value().to_string());
+
+    for (const Cond& c : spec.filter.list) {
+        // we can't rule out negated conditions or conditions on attributes
+        // created in preprocessing
+        if (c.op == Cond::None || c.op == Cond::NotExist || c.op == Cond::NotEqual || targets.count(c.attr_name))
+            continue;
+        if (names.count(c.attr_name) == 0)
+            return false;
+        if (c.op == Cond::Exist)
+            continue;
+
+        Attribute min_attr = m_db.get_attribute("min#" + c.attr_name);
+        Attribute max_attr = m_db.get_attribute("max#" + c.attr_name);
+
+        if (!min_attr || !max_attr)
+            continue;
+
+        Variant lo, hi;
+
+        for (const Entry& e : rec) {
+            if (!e.is_immediate())
+                continue;
+            if (e.attribute() == min_attr.id())
+                lo = e.value();
+            else if (e.attribute() == max_attr.id())
+                hi = e.value();
+        }
+
+        if (lo.empty() || hi.empty())
+            continue;
+
+        Variant val = Variant::from_string(lo.type(), c.value.c_str());
+
+        if (val.type() != lo.type())
+            continue;
+
+        bool match = true;
+
+        switch (c.op) {
+        case Cond::Equal:
+            match = !(val < lo) && !(hi < val);
+            break;
+        case Cond::LessThan:
+            match = lo < val;
+            break;
+        case Cond::GreaterThan:
+            match = val < hi;
+            break;
+        case Cond::LessOrEqual:
+            match = !(val < lo);
+            break;
+        case Cond::GreaterOrEqual:
+            match = !(hi < val);
+            break;
+        default:
+            break;
+        }
+
+        if (!match)
+            return false;
+    }
+
+    return true;
+}
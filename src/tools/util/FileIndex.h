@@ -0,0 +1,87 @@
+// Copyright (c) 2015-2022, Lawrence Livermore National Security, LLC.
+// See top-level LICENSE file for details.
+
+/// \file FileIndex.h
+/// \brief Sidecar query index for .cali files
+
+#ifndef UTIL_FILEINDEX_H
+#define UTIL_FILEINDEX_H
+
+#include "caliper/reader/CaliperMetadataDB.h"
+#include "caliper/reader/QuerySpec.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cali
+{
+
+class OutputStream;
+
+namespace util
+{
+
+/// \brief Reads and writes .cali.idx query index files.
+///
+/// An index file is a .cali stream with one record per indexed file. The
+/// record holds the file's path, size, and modification time, the byte
+/// ranges of its node records, the names of the attributes used in its
+/// snapshot records, min/max values of numeric attributes (as
+/// "min#<attribute>" and "max#<attribute>"), and the file's globals.
+/// Index entries are only used if the file's size and modification time
+/// still match.
+class FileIndex
+{
+    CaliperMetadataDB              m_db;
+    std::map<std::string, EntryList> m_files;
+
+    Attribute m_file_attr;
+    Attribute m_size_attr;
+    Attribute m_mtime_attr;
+    Attribute m_records_attr;
+    Attribute m_node_blocks_attr;
+    Attribute m_attribute_attr;
+
+    void setup_attributes();
+
+public:
+
+    typedef std::vector<std::pair<uint64_t, uint64_t>> ByteRanges;
+
+    FileIndex();
+
+    /// \brief Parse \a filename and add it to the index
+    bool add_file(const std::string& filename, std::string& errmsg);
+
+    /// \brief Write the index records to \a os
+    void write(OutputStream& os);
+
+    /// \brief Read the index file \a filename
+    bool read(const std::string& filename, std::string& errmsg);
+
+    /// \brief Return the index record for \a filename, or \a nullptr if the
+    ///   file is not in the index or has changed since it was indexed
+    const EntryList* find(const std::string& filename) const;
+
+    CaliperMetadataDB& db() { return m_db; }
+
+    /// \brief Return the global entries in index record \a rec
+    EntryList globals(const EntryList& rec) const;
+
+    /// \brief Get the byte ranges of the node records in the file
+    ///   described by \a rec. Returns \a false if the index has no node
+    ///   record ranges for the file (e.g., for .calib files).
+    bool node_blocks(const EntryList& rec, ByteRanges& ranges) const;
+
+    /// \brief Return \a false if no snapshot record in the file described by
+    ///   \a rec can match all of the filter conditions in \a spec
+    bool may_match(const EntryList& rec, const QuerySpec& spec) const;
+};
+
+} // namespace util
+} // namespace cali
+
+#endif
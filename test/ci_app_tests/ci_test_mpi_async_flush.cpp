@@ -0,0 +1,54 @@
+// Test Caliper MPI runtime: background cross-rank reduction with flush_async()
+
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+
+#include <mpi.h>
+
+#include <cstring>
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+    int provided = MPI_THREAD_SINGLE;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided);
+
+    int rank = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    cali::ConfigManager mgr;
+
+    if (argc > 1)
+        mgr.add(argv[1]);
+    if (mgr.error()) {
+        if (rank == 0)
+            std::cerr << mgr.error_msg() << std::endl;
+
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    mgr.start();
+
+    {
+        CALI_CXX_MARK_FUNCTION;
+
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    mgr.flush_async();
+
+    // keep the application communicating while the reduction runs
+    {
+        CALI_CXX_MARK_SCOPE("after_flush");
+
+        int in = rank, out = 0;
+        MPI_Allreduce(&in, &out, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Barrier(MPI_COMM_WORLD);
+    }
+
+    // with "finalize", leave joining the reduction to the MPI_Finalize hook
+    if (!(argc > 2 && strcmp(argv[2], "finalize") == 0))
+        mgr.flush();
+
+    MPI_Finalize();
+}
@@ -0,0 +1,80 @@
+// Test Caliper MPI runtime: point-to-point messages for the comm matrix
+
+#include <caliper/cali.h>
+#include <caliper/cali-manager.h>
+
+#include <mpi.h>
+
+#include <iostream>
+
+namespace
+{
+
+// Send to the next rank in comm, in a ring
+void ring_exchange(MPI_Comm comm)
+{
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    int sendval = rank, recvval = -1;
+    MPI_Sendrecv(
+        &sendval, 1, MPI_INT, (rank + 1) % size, 1,
+        &recvval, 1, MPI_INT, (rank + size - 1) % size, 1,
+        comm, MPI_STATUS_IGNORE
+    );
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    MPI_Init(&argc, &argv);
+
+    int rank = 0, size = 1;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    cali::ConfigManager mgr;
+
+    if (argc > 1)
+        mgr.add(argv[1]);
+    if (mgr.error()) {
+        if (rank == 0)
+            std::cerr << mgr.error_msg() << std::endl;
+
+        MPI_Abort(MPI_COMM_WORLD, -1);
+    }
+
+    mgr.start();
+
+    {
+        CALI_CXX_MARK_FUNCTION;
+
+        ring_exchange(MPI_COMM_WORLD);
+
+        // flushing must not write out the comm matrix file yet
+        cali_flush(0);
+        mgr.flush();
+
+        // Communicator handles are reused after MPI_Comm_free. Alternate
+        // between a communicator with reversed ranks and a duplicate of
+        // MPI_COMM_WORLD so a stale rank translation would show up in the
+        // destination ranks.
+        for (int i = 0; i < 2; ++i) {
+            MPI_Comm comm;
+
+            MPI_Comm_split(MPI_COMM_WORLD, 0, size - rank - 1, &comm);
+            ring_exchange(comm);
+            MPI_Comm_free(&comm);
+
+            MPI_Comm_dup(MPI_COMM_WORLD, &comm);
+            ring_exchange(comm);
+            MPI_Comm_free(&comm);
+        }
+    }
+
+    mgr.flush();
+
+    MPI_Finalize();
+}
@@ -89,5 +89,14 @@ class CaliperAllocServiceTest(unittest.TestCase):
         self.assertTrue(int(obj[1]['Alloc tMax']) >= 2000)
         self.assertTrue(int(obj[1]['Alloc count']) >= 1)
 
+    def test_sysalloc_counts(self):
+        target_cmd = [ './ci_test_macros', '10', 'runtime-profile,use.mpi=false,output=stdout,output.format=json,alloc.counts' ]
+
+        obj = json.loads( cat.run_test(target_cmd, None)[0] )
+
+        self.assertEqual(obj[1]['path'], 'main')
+        self.assertTrue(int(obj[1]['Allocs']) >= 1)
+        self.assertTrue(int(obj[1]['Bytes allocated']) >= 2000)
+
 if __name__ == "__main__":
     unittest.main()
@@ -475,6 +475,73 @@ class CaliperBasicTest(unittest.TestCase):
                          'measurement.val.ci_test',
                          'measurement.ci_test' }))
 
+    def test_overhead(self):
+        """ Test the overhead service """
+
+        target_cmd = [ './ci_test_basic' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event,timer,overhead,aggregate,recorder',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+        }
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        _,globals = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        self.assertTrue({ 'overhead.begin.count', 'overhead.begin.time',
+                          'overhead.end.count', 'overhead.process_snapshot.count',
+                          'overhead.snapshot.timer.count', 'overhead.snapshot.timer.time',
+                          'overhead.total.time', 'overhead.threads' }.issubset(set(globals.keys())))
+
+        self.assertTrue(int(globals['overhead.begin.count']) > 0)
+        self.assertEqual(int(globals['overhead.snapshot.timer.count']), int(globals['overhead.process_snapshot.count']))
+        self.assertTrue(float(globals['overhead.total.time']) > 0.0)
+
+    def test_timer_compensate_overhead(self):
+        """ Test the timer service overhead compensation """
+
+        target_cmd = [ './ci_test_macros', '0', 'none', '20' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event,timer,trace,recorder',
+            'CALI_TIMER_INCLUSIVE_DURATION' : 'true',
+            'CALI_TIMER_COMPENSATE_OVERHEAD' : 'true',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+        }
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        self.assertTrue(len(snapshots) > 400)
+        self.assertTrue(cat.has_snapshot_with_keys(
+            snapshots, { 'region', 'time.duration.ns', 'time.inclusive.duration.ns' }))
+
+        def durations(snapshots):
+            """ Return the sum of exclusive durations, the last time offset,
+                and the inclusive duration of the main region """
+            total  = sum([ int(s['time.duration.ns']) for s in snapshots if 'time.duration.ns' in s ])
+            offset = max([ int(s['time.offset.ns']) for s in snapshots if 'time.offset.ns' in s ])
+            main   = [ int(s['time.inclusive.duration.ns']) for s in snapshots
+                        if s.get('event.end#region') == 'main' ]
+            self.assertEqual(len(main), 1)
+            return total, offset, main[0]
+
+        total, offset, main = durations(snapshots)
+
+        # without compensation, the exclusive durations add up to the last
+        # time offset; with compensation, the overhead is subtracted
+        caliper_config['CALI_TIMER_COMPENSATE_OVERHEAD'] = 'false'
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        uncomp_snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        uncomp_total, uncomp_offset, uncomp_main = durations(uncomp_snapshots)
+
+        self.assertEqual(uncomp_total, uncomp_offset)
+        self.assertTrue(total < offset)
+        self.assertTrue(main < offset)
+        self.assertTrue(uncomp_main <= uncomp_offset)
+
 
 class CaliperCAPITest(unittest.TestCase):
     """ Caliper C API test cases """
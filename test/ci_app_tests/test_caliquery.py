@@ -1,6 +1,9 @@
 # Some tests for the cali-query tool
 
 import json
+import os
+import subprocess
+import tempfile
 import unittest
 
 import calipertest as cat
@@ -24,6 +27,326 @@ class CaliperCaliQueryTest(unittest.TestCase):
         self.assertEqual(obj[0]["count"], 9)
         self.assertTrue("sum#time.duration.ns" in obj[0])
 
+    def test_caliquery_threads(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            files = [ os.path.join(tmpdir, 'run%d.cali' % i) for i in range(3) ]
+
+            for filename in files:
+                caliper_config = {
+                    'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                    'CALI_RECORDER_FILENAME' : filename,
+                    'CALI_LOG_VERBOSITY'     : '0',
+                }
+                cat.run_test([ './ci_test_macros' ], caliper_config)
+
+            query = [ '-q', 'select loop,count() group by loop where loop=fooloop format json' ]
+            cali_query = '../../src/tools/cali-query/cali-query'
+
+            single = json.loads( cat.run_test([ cali_query ] + query + files[:1], None)[0] )
+            obj = json.loads( cat.run_test([ cali_query, '--threads=2' ] + query + files, None)[0] )
+
+            self.assertEqual(obj[0]["path"], "main loop/fooloop")
+            self.assertEqual(obj[0]["count"], 3*single[0]["count"])
+
+            serial_out,_ = cat.run_test([ cali_query, '-e', '-s', 'loop=fooloop' ] + files, None)
+            threads_out,_ = cat.run_test([ cali_query, '--threads=2', '-e', '-s', 'loop=fooloop' ] + files, None)
+
+            serial_snapshots = cat.get_snapshots_from_text(serial_out)
+            threads_snapshots = cat.get_snapshots_from_text(threads_out)
+
+            self.assertEqual(len(serial_snapshots), 3*single[0]["count"])
+            self.assertEqual(serial_snapshots, threads_snapshots)
+
+            # globals of all input files are kept
+            globals = []
+
+            for threads in [ 1, 2 ]:
+                out_file = os.path.join(tmpdir, 'out%d.cali' % threads)
+                cat.run_test([ cali_query, '--threads=%d' % threads, '-o', out_file ] + files, None)
+                globals_out,_ = cat.run_test([ cali_query, '-G', '-e', out_file ], None)
+                globals.append(set(globals_out.decode().strip().split(',')))
+
+            self.assertEqual(globals[0], globals[1])
+
+            # a single file is split into chunks
+            obj = json.loads( cat.run_test([ cali_query, '--threads=3' ] + query + files[:1], None)[0] )
+            self.assertEqual(obj, single)
+
+            serial_out,_ = cat.run_test([ cali_query, '-e' ] + files[:1], None)
+            threads_out,_ = cat.run_test([ cali_query, '--threads=3', '-e' ] + files[:1], None)
+
+            self.assertEqual(cat.get_snapshots_from_text(serial_out), cat.get_snapshots_from_text(threads_out))
+
+    def test_caliquery_binary_format(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            cali_file  = os.path.join(tmpdir, 'run.cali')
+            calib_file = os.path.join(tmpdir, 'run.calib')
+
+            for filename, fmt in [ (cali_file, 'cali'), (calib_file, 'calib') ]:
+                caliper_config = {
+                    'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                    'CALI_RECORDER_FILENAME' : filename,
+                    'CALI_RECORDER_FORMAT'   : fmt,
+                    'CALI_LOG_VERBOSITY'     : '0',
+                }
+                cat.run_test([ './ci_test_macros' ], caliper_config)
+
+            cali_query = '../../src/tools/cali-query/cali-query'
+
+            text_out,_ = cat.run_test([ cali_query, '-e', cali_file ], None)
+            binary_out,_ = cat.run_test([ cali_query, '-e', calib_file ], None)
+
+            text_snapshots = cat.get_snapshots_from_text(text_out)
+
+            # timings differ between the two runs
+            def without_time(snapshots):
+                return [ { k: v for k, v in s.items() if not k.startswith('time.') } for s in snapshots ]
+
+            self.assertEqual(without_time(cat.get_snapshots_from_text(binary_out)), without_time(text_snapshots))
+
+            # convert with "format calib"
+            converted_file = os.path.join(tmpdir, 'converted.calib')
+            cat.run_test([ cali_query, '-q', 'format calib', '-o', converted_file, cali_file ], None)
+            converted_out,_ = cat.run_test([ cali_query, '-e', converted_file ], None)
+
+            self.assertEqual(cat.get_snapshots_from_text(converted_out), text_snapshots)
+
+            # filters and globals
+            query = [ '-q', 'select loop,count() group by loop where iteration#fooloop=2 format json' ]
+            obj = json.loads( cat.run_test([ cali_query ] + query + [ calib_file ], None)[0] )
+            self.assertEqual(obj, json.loads( cat.run_test([ cali_query ] + query + [ cali_file ], None)[0] ))
+
+            globals_out,_ = cat.run_test([ cali_query, '-G', '-e', calib_file ], None)
+            self.assertTrue('cali.caliper.version' in cat.get_snapshots_from_text(globals_out)[0])
+
+    def test_caliquery_binary_reaggregate(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            trace_file = os.path.join(tmpdir, 'trace.cali')
+
+            caliper_config = {
+                'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                'CALI_RECORDER_FILENAME' : trace_file,
+                'CALI_LOG_VERBOSITY'     : '0',
+            }
+            cat.run_test([ './ci_test_macros' ], caliper_config)
+
+            cali_query = '../../src/tools/cali-query/cali-query'
+
+            # aggregate into .cali and .calib files, then aggregate those again
+            agg_query = 'select count(),scale_count(2),sum(time.duration.ns),median(time.duration.ns,sketch) group by region format '
+
+            for fmt in [ 'cali', 'calib' ]:
+                out_file = os.path.join(tmpdir, 'agg.' + fmt)
+                cat.run_test([ cali_query, '-q', agg_query + fmt, '-o', out_file, trace_file ], None)
+
+            query = [ '-q', 'select region,count(),scale_count(2),sum(sum#time.duration.ns),median(time.duration.ns,sketch) group by region format json' ]
+
+            text_obj = json.loads( cat.run_test([ cali_query ] + query + [ os.path.join(tmpdir, 'agg.cali') ], None)[0] )
+            binary_obj = json.loads( cat.run_test([ cali_query ] + query + [ os.path.join(tmpdir, 'agg.calib') ], None)[0] )
+
+            self.assertEqual(text_obj, binary_obj)
+
+            main = [ r for r in binary_obj if r.get('path') == 'main' ]
+
+            self.assertEqual(len(main), 1)
+            self.assertEqual(int(main[0]['count']), 19)
+            self.assertEqual(float(main[0]['scount']), 38.0)
+
+            # percentiles are re-computed from the saved sketch state
+            first = json.loads( cat.run_test([ cali_query, '-q', agg_query.replace('select ', 'select region,') + 'json', trace_file ], None)[0] )
+            medians = { r.get('path') : r['median.sketch#time.duration.ns'] for r in first }
+
+            self.assertEqual(len(binary_obj), len(first))
+
+            for rec in binary_obj:
+                self.assertAlmostEqual(rec['median.sketch#time.duration.ns'], medians[rec.get('path')], delta=0.01*medians[rec.get('path')])
+
+    def test_caliquery_index(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            files = [ os.path.join(tmpdir, 'macros.cali'), os.path.join(tmpdir, 'c_ann.cali') ]
+
+            for filename, target in zip(files, [ './ci_test_macros', './ci_test_c_ann' ]):
+                caliper_config = {
+                    'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                    'CALI_RECORDER_FILENAME' : filename,
+                    'CALI_LOG_VERBOSITY'     : '0',
+                }
+                cat.run_test([ target ], caliper_config)
+
+            # unindexed copies of the input files
+            copies = [ os.path.join(tmpdir, 'copy_' + os.path.basename(f)) for f in files ]
+
+            for src, dst in zip(files, copies):
+                with open(src, 'rb') as i, open(dst, 'wb') as o:
+                    o.write(i.read())
+
+            cat.run_test([ '../../src/tools/cali-index/cali-index' ] + files, None)
+
+            for filename in files:
+                self.assertTrue(os.path.exists(filename + '.idx'))
+
+            cali_query = '../../src/tools/cali-query/cali-query'
+
+            # globals and attributes from the index match the full parse
+            for args in [ [ '-G', '-e' ], [ '-G', '-e', '-q', 'where global.int=1337' ], [ '--list-attributes', '-e' ] ]:
+                index_out,_ = cat.run_test([ cali_query ] + args + files, None)
+                copy_out,_ = cat.run_test([ cali_query ] + args + copies, None)
+
+                self.assertEqual(cat.get_snapshots_from_text(index_out), cat.get_snapshots_from_text(copy_out))
+
+            globals_out,_ = cat.run_test([ cali_query, '-G', '-e', '-q', 'where global.int=1337' ] + files, None)
+            self.assertTrue('global.string' in cat.get_snapshots_from_text(globals_out)[0])
+
+            globals_out,_ = cat.run_test([ cali_query, '-G', '-e', '-q', 'where global.int=42' ] + files, None)
+            self.assertFalse('global.string' in globals_out.decode())
+
+            # files that can't match the filter are skipped
+            query = [ '-q', 'select count() where iteration#fooloop>2 format json' ]
+
+            index_out,err = cat.run_test([ cali_query, '-v' ] + query + files, None)
+            self.assertTrue('Skipping ' + files[1] in err.decode())
+            self.assertEqual(json.loads(index_out), json.loads(cat.run_test([ cali_query ] + query + copies, None)[0]))
+
+            _,err = cat.run_test([ cali_query, '-v', '-q', 'select count() where iteration#fooloop>100' ] + files, None)
+            self.assertTrue('Skipping ' + files[0] in err.decode())
+
+            # a combined index file
+            index_file = os.path.join(tmpdir, 'all.idx')
+            cat.run_test([ '../../src/tools/cali-index/cali-index', '-o', index_file ] + files, None)
+            _,err = cat.run_test([ cali_query, '-v', '--index=' + index_file ] + query + files, None)
+            self.assertTrue('Skipping ' + files[1] in err.decode())
+
+            # stale index entries are ignored
+            os.utime(files[1], (0, 0))
+            _,err = cat.run_test([ cali_query, '-v' ] + query + files, None)
+            self.assertFalse('Skipping' in err.decode())
+
+    def test_caliquery_percentiles(self):
+        target_cmd = [ './ci_test_macros' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-q',
+                       'select loop,count(),min(time.duration.ns),max(time.duration.ns),'
+                       'median(time.duration.ns),median(time.duration.ns,sketch),percentile(time.duration.ns,50),'
+                       'histogram(time.duration.ns,4) '
+                       'group by loop where loop format json' ]
+
+        caliper_config = {
+            'CALI_CONFIG_PROFILE'    : 'serial-trace',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+            'CALI_LOG_VERBOSITY'     : '0',
+        }
+
+        obj = json.loads( cat.run_test_with_query(target_cmd, query_cmd, caliper_config) )
+
+        self.assertEqual(len(obj), 2)
+
+        for rec in obj:
+            tmin = rec['min#time.duration.ns']
+            tmax = rec['max#time.duration.ns']
+
+            self.assertTrue(tmin <= rec['p50#time.duration.ns'] <= tmax)
+            # exact and sketch-mode results have separate columns
+            self.assertEqual(rec['median#time.duration.ns'], rec['p50#time.duration.ns'])
+            self.assertAlmostEqual(rec['median.sketch#time.duration.ns'], rec['p50#time.duration.ns'], delta=0.1*rec['p50#time.duration.ns'])
+
+            self.assertEqual(rec['histogram.min#time.duration.ns'], tmin)
+            self.assertEqual(rec['histogram.max#time.duration.ns'], tmax)
+            self.assertEqual(sum([ rec['histogram.bin.%d#time.duration.ns' % i] for i in range(4) ]), rec['count'])
+            self.assertFalse('sketch#time.duration.ns' in rec)
+
+    def test_caliquery_limit(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            cali_file = os.path.join(tmpdir, 'run.cali')
+
+            caliper_config = {
+                'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                'CALI_RECORDER_FILENAME' : cali_file,
+                'CALI_LOG_VERBOSITY'     : '0',
+            }
+            cat.run_test([ './ci_test_macros' ], caliper_config)
+
+            cali_query = '../../src/tools/cali-query/cali-query'
+            query = 'select path,count(),sum(time.duration.ns) group by path order by sum#time.duration.ns desc format json'
+
+            full = json.loads( cat.run_test([ cali_query, '-q', query, cali_file ], None)[0] )
+            top  = json.loads( cat.run_test([ cali_query, '-q', query + ' limit 3', cali_file ], None)[0] )
+
+            self.assertTrue(len(full) > 3)
+            self.assertEqual(len(top), 3)
+
+            times = sorted([ rec['sum#time.duration.ns'] for rec in full if 'sum#time.duration.ns' in rec ], reverse=True)
+            self.assertEqual([ rec['sum#time.duration.ns'] for rec in top ], times[:3])
+
+            # without ORDER BY, the first records are passed through
+            first = json.loads( cat.run_test([ cali_query, '-q', 'limit 5 format json', cali_file ], None)[0] )
+            every = json.loads( cat.run_test([ cali_query, '-q', 'format json', cali_file ], None)[0] )
+            self.assertEqual(first, every[:5])
+
+            # the table formatter prints a header and three rows
+            table_out,_ = cat.run_test([ cali_query, '-q', query.replace('json', 'table') + ' limit 3', cali_file ], None)
+            self.assertEqual(len(table_out.decode().strip().split('\n')), 4)
+
+    def test_caliquery_mem_limit(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            cali_file = os.path.join(tmpdir, 'run.cali')
+
+            caliper_config = {
+                'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                'CALI_RECORDER_FILENAME' : cali_file,
+                'CALI_LOG_VERBOSITY'     : '0',
+            }
+            cat.run_test([ './ci_test_macros' ], caliper_config)
+
+            cali_query = '../../src/tools/cali-query/cali-query'
+            query = [ '-q', 'select *,count(),sum(time.duration.ns),inclusive_sum(time.duration.ns),percent_total(time.duration.ns) group by path,iteration#fooloop format json' ]
+
+            def sorted_records(out):
+                return sorted(json.loads(out), key=lambda rec: json.dumps(rec, sort_keys=True))
+
+            expect = sorted_records( cat.run_test([ cali_query ] + query + [ cali_file ], None)[0] )
+            self.assertTrue(len(expect) > 10)
+
+            # spilled aggregation results must be identical to in-memory results
+            for args in [ [ '--mem-limit=1K' ], [ '--mem-limit=16K', '--threads=2' ] ]:
+                out = cat.run_test([ cali_query ] + args + query + [ cali_file ], None)[0]
+                self.assertEqual(sorted_records(out), expect)
+
+            proc = subprocess.run([ cali_query, '--mem-limit=abc' ] + query + [ cali_file ], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            self.assertNotEqual(proc.returncode, 0)
+            self.assertIn('invalid memory limit', proc.stderr.decode())
+
+    def test_caliquery_mem_limit_percentile(self):
+        with tempfile.TemporaryDirectory() as tmpdir:
+            cali_file = os.path.join(tmpdir, 'run.cali')
+
+            caliper_config = {
+                'CALI_CONFIG_PROFILE'    : 'serial-trace',
+                'CALI_RECORDER_FILENAME' : cali_file,
+                'CALI_LOG_VERBOSITY'     : '0',
+            }
+            cat.run_test([ './ci_test_macros', '0', 'none', '40' ], caliper_config)
+
+            # cali-query reads its log settings from this file in the working directory
+            with open(os.path.join(tmpdir, 'cali-query_caliper.config'), 'w') as f:
+                f.write('CALI_LOG_VERBOSITY=2\n')
+
+            cali_query = os.path.abspath('../../src/tools/cali-query/cali-query')
+            query = [ '-q', 'select count(),percentile(time.duration.ns,50) group by cali.caliper.version format json' ]
+
+            def run(args):
+                proc = subprocess.run([ cali_query ] + args + query + [ cali_file ], stdout=subprocess.PIPE, stderr=subprocess.PIPE, cwd=tmpdir)
+                self.assertEqual(proc.returncode, 0)
+                return json.loads(proc.stdout), proc.stderr.decode()
+
+            expect, err = run([])
+            self.assertEqual(len(expect), 1)
+            self.assertTrue(expect[0]['count'] > 2000)
+            self.assertNotIn('spilling', err)
+
+            # a single group's percentile values exceed the limit
+            result, err = run([ '--mem-limit=16K' ])
+            self.assertIn('spilling', err)
+            self.assertEqual(result, expect)
+
     def test_caliquery_list_services(self):
         target_cmd = [ '../../src/tools/cali-query/cali-query', '--help=services' ]
 
@@ -47,5 +47,29 @@ class CaliperLinuxServicesTest(unittest.TestCase):
                          'myphase',
                          'iteration' }))
 
+    def test_memstat_status_interval(self):
+        target_cmd = [ './ci_test_basic' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'            : 'event,memstat,trace,recorder',
+            'CALI_MEMSTAT_RECORD_STATUS'      : 'true',
+            'CALI_MEMSTAT_REFRESH_INTERVAL'   : '60',
+            'CALI_RECORDER_FILENAME'          : 'stdout',
+        }
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        self.assertTrue(len(snapshots) > 1)
+
+        self.assertTrue(cat.has_snapshot_with_keys(
+            snapshots, { 'memstat.vmrss',
+                         'memstat.vmhwm',
+                         'memstat.rss_anon',
+                         'myphase' }))
+
+        # with a long refresh interval all snapshots reuse the same values
+        self.assertEqual(len(set(s['memstat.vmhwm'] for s in snapshots if 'memstat.vmhwm' in s)), 1)
+
 if __name__ == "__main__":
     unittest.main()
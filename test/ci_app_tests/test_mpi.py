@@ -1,8 +1,12 @@
 # MPI application tests
-# For simplicity, these tests only run on a single rank without mpiexec
+# For simplicity, most of these tests only run on a single rank without mpiexec
 
 import io
+import json
 import os
+import shutil
+import struct
+import tempfile
 import unittest
 
 import caliperreader
@@ -37,6 +41,47 @@ class CaliperMPITest(unittest.TestCase):
         self.assertTrue(cat.has_snapshot_with_attributes(
             snapshots, { 'region' : 'main', 'mpi.function' : 'MPI_Reduce',  'count' : '1' }))
 
+    @unittest.skipUnless(shutil.which('mpiexec'), 'requires mpiexec')
+    def test_mpireport_large_records(self):
+        # Aggregation records with a 100-bin histogram and two percentile
+        # sketches have more entries than a compressed snapshot record holds
+        target_cmd = [ 'mpiexec', '-n', '4', './ci_test_mpi_before_cali' ]
+
+        caliper_config = {
+            'PATH'                    : '/usr/bin', # for ssh/rsh
+            'CALI_CHANNEL_FLUSH_ON_EXIT' : 'false',
+            'CALI_SERVICES_ENABLE'    : 'event,mpi,mpireport,timer,trace',
+            'CALI_MPI_WHITELIST'      : 'all',
+            'CALI_MPIREPORT_FILENAME' : 'stdout',
+            'CALI_MPIREPORT_CONFIG'   : 'select count(),histogram(time.duration.ns,100),'
+                                        'percentile(time.duration.ns,90),percentile(time.offset.ns,90),'
+                                        'histogram(time.offset.ns,4) '
+                                        'group by mpi.world.size format json',
+            # let Open MPI run as root and on few cores in CI containers
+            'OMPI_ALLOW_RUN_AS_ROOT'  : '1',
+            'OMPI_ALLOW_RUN_AS_ROOT_CONFIRM' : '1',
+            'OMPI_MCA_rmaps_base_oversubscribe' : '1'
+        }
+
+        # cover both the shared-memory and the reduction tree exchange
+        for shared_memory in [ 'true', 'false' ]:
+            caliper_config['CALI_MPIREDUCE_SHARED_MEMORY'] = shared_memory
+
+            out,_ = cat.run_test(target_cmd, caliper_config)
+            obj = json.loads(out.decode())
+
+            self.assertEqual(len(obj), 1)
+
+            rec = obj[0]
+
+            # every rank's complete sketches arrive at the root
+            self.assertEqual(rec['count'] % 4, 0)
+            self.assertEqual(sum([ rec['histogram.bin.%d#time.duration.ns' % i] for i in range(100) ]), rec['count'])
+            self.assertEqual(sum([ rec['histogram.bin.%d#time.offset.ns' % i] for i in range(4) ]), rec['count'])
+
+            for target in [ 'time.duration.ns', 'time.offset.ns' ]:
+                self.assertTrue(rec['histogram.min#' + target] <= rec['p90#' + target] <= rec['histogram.max#' + target])
+
     def test_cali_before_mpi(self):
         target_cmd = [ './ci_test_cali_before_mpi' ]
 
@@ -162,6 +207,98 @@ class CaliperMPITest(unittest.TestCase):
             snapshots, { 'region', 'mpi.function', 'mpi.coll.type'
             }))
 
+    def test_mpi_comm_matrix(self):
+        target_cmd = [ './ci_test_mpi_comm_matrix' ]
+
+        caliper_config = {
+            'PATH'                    : '/usr/bin', # for ssh/rsh
+            'CALI_LOG_VERBOSITY'      : '0',
+            'CALI_SERVICES_ENABLE'    : 'event,mpi,recorder,trace',
+            'CALI_MPI_COMM_MATRIX'    : 'true',
+            'CALI_MPI_WHITELIST'      : 'all',
+            'CALI_RECORDER_FILENAME'  : 'stdout'
+        }
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        # one message before the mid-run flush and four on communicators
+        # that were freed afterwards
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'region'            : 'main',
+                         'comm.matrix.dst'   : '0',
+                         'comm.matrix.count' : '5',
+                         'comm.matrix.bytes' : '20'
+            }))
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'region'             : 'main',
+                         'comm.matrix.degree' : '1',
+                         'comm.matrix.volume' : '20'
+            }))
+        self.assertTrue(cat.has_snapshot_with_keys(
+            snapshots, { 'comm.matrix.rank_degree', 'comm.matrix.rank_volume' }))
+
+    def test_mpi_comm_matrix_file(self):
+        target_cmd = [ './ci_test_mpi_comm_matrix' ]
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            filename = os.path.join(tmpdir, 'matrix-%mpi.rank%.bin')
+
+            caliper_config = {
+                'PATH'                      : '/usr/bin', # for ssh/rsh
+                'CALI_LOG_VERBOSITY'        : '1',
+                'CALI_SERVICES_ENABLE'      : 'event,mpi,recorder,trace',
+                'CALI_MPI_COMM_MATRIX'      : 'true',
+                'CALI_MPI_COMM_MATRIX_FILE' : filename,
+                'CALI_MPI_WHITELIST'        : 'all',
+                'CALI_RECORDER_FILENAME'    : 'stdout'
+            }
+
+            _,err = cat.run_test(target_cmd, caliper_config)
+
+            # the file is written once, at MPI_Finalize, with all messages
+            self.assertEqual(err.decode().count('comm matrix entries'), 1)
+
+            with open(os.path.join(tmpdir, 'matrix-0.bin'), 'rb') as f:
+                data = f.read()
+
+        self.assertEqual(data[0:8], b'CALICMTX')
+
+        version, rank, nregions = struct.unpack_from('=IiI', data, 8)
+        self.assertEqual((version, rank, nregions), (1, 0, 1))
+
+        pathlen = struct.unpack_from('=I', data, 20)[0]
+        self.assertEqual(data[24:24+pathlen], b'main')
+
+        pos = 24 + pathlen
+        nentries = struct.unpack_from('=Q', data, pos)[0]
+        self.assertEqual(nentries, 1)
+        self.assertEqual(struct.unpack_from('=IiQQ', data, pos+8), (0, 0, 5, 20))
+
+    def test_mpireport_topology(self):
+        target_cmd = [ './ci_test_mpi_comm_matrix', 'mpi-report,topology' ]
+
+        report_out,_ = cat.run_test(target_cmd, { 'PATH': '/usr/bin' })
+        lines = report_out.decode().splitlines()
+
+        self.assertTrue('Dst ranks (max)' in lines[0])
+        self.assertTrue('Bytes sent (max)' in lines[0])
+
+    def test_runtime_profile_shared_file(self):
+        target_cmd = [ './ci_test_mpi_before_cali', 'runtime-profile,use.mpi,output.shared_file,output=stdout' ]
+        query_cmd  = [ '../../src/tools/cali-query/cali-query', '-e' ]
+
+        caliper_config = {
+            'PATH'                    : '/usr/bin', # for ssh/rsh
+            'CALI_LOG_VERBOSITY'      : '0',
+        }
+
+        query_output = cat.run_test_with_query(target_cmd, query_cmd, caliper_config)
+        snapshots = cat.get_snapshots_from_text(query_output)
+
+        self.assertTrue(cat.has_snapshot_with_attributes(
+            snapshots, { 'region': 'main', 'mpi.rank': '0' }))
+
     def test_mpireport_controller(self):
         target_cmd = [ './ci_test_mpi_before_cali', 'mpi-report' ]
 
@@ -180,6 +317,28 @@ class CaliperMPITest(unittest.TestCase):
             else:
                 self.fail('%s not found in log' % target)
 
+    def test_mpireport_flush_async(self):
+        target_cmd = [ './ci_test_mpi_async_flush', 'mpi-report,output=stdout' ]
+
+        report_out,_ = cat.run_test(target_cmd, { 'PATH': '/usr/bin' })
+        lines = report_out.decode().splitlines()
+
+        # the report is written once, by the background reduction
+        self.assertEqual(len([ l for l in lines if l.startswith('Function') ]), 1)
+        self.assertTrue(any(l.startswith('MPI_Barrier') for l in lines))
+        # regions after flush_async() are not part of the report
+        self.assertFalse(any(l.startswith('MPI_Allreduce') for l in lines))
+
+    def test_runtime_report_flush_async_at_finalize(self):
+        target_cmd = [ './ci_test_mpi_async_flush', 'runtime-report,output=stdout', 'finalize' ]
+
+        report_out,_ = cat.run_test(target_cmd, { 'PATH': '/usr/bin' })
+        lines = report_out.decode().splitlines()
+
+        self.assertEqual(len([ l for l in lines if l.startswith('Path') ]), 1)
+        self.assertTrue(any(l.startswith('main') for l in lines))
+        self.assertFalse(any(l.startswith('after_flush') for l in lines))
+
     def test_mpi_inst_options(self):
         target_cmd = [ './ci_test_mpi_before_cali', 'spot,profile.mpi,mpi.exclude=MPI_Barrier,output=stdout' ]
 
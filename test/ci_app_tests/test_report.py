@@ -268,6 +268,26 @@ class CaliperRuntimeReportTest(unittest.TestCase):
             else:
                 self.fail('%s not found in log' % target)
 
+    def test_runtime_report_overhead(self):
+        target_cmd = [ './ci_test_macros', '10', 'runtime-report,overhead,output=stdout' ]
+
+        log_targets = [
+            'overhead.begin.count',
+            'overhead.total.time',
+            'Path',
+            '  main loop'
+        ]
+
+        report_out,_ = cat.run_test(target_cmd, {})
+        lines = report_out.decode().splitlines()
+
+        for target in log_targets:
+            for line in lines:
+                if target in line:
+                    break
+            else:
+                self.fail('%s not found in log' % target)
+
 
 class CaliperLoopReportTest(unittest.TestCase):
     """ Loop report controller (summary info) """
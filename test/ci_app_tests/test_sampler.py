@@ -2,6 +2,9 @@
 
 import io
 import json
+import os
+import re
+import tempfile
 import unittest
 
 import caliperreader
@@ -65,6 +68,50 @@ class CaliperSamplingTest(unittest.TestCase):
                             'module#cali.sampler.pc',
                             'region', 'loop' }))
 
+    def test_sampler_deferred(self):
+        target_cmd = [ './ci_test_macros', '5000' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'sampler:trace:recorder',
+            'CALI_SAMPLER_DEFER'     : 'true',
+            'CALI_SAMPLER_FREQUENCY' : '1000',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+        }
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        self.assertTrue(len(snapshots) > 1)
+
+        self.assertTrue(cat.has_snapshot_with_keys(
+            snapshots, { 'cali.sampler.pc', 'cali.sampler.timestamp', 'region', 'loop' }))
+
+    def test_sampler_deferred_context(self):
+        target_cmd = [ './ci_test_macros', '5000' ]
+
+        caliper_config = {
+            'CALI_SERVICES_ENABLE'   : 'event:sampler:timer:trace:recorder',
+            'CALI_SAMPLER_DEFER'     : 'true',
+            'CALI_SAMPLER_FREQUENCY' : '1000',
+            'CALI_RECORDER_FILENAME' : 'stdout',
+        }
+
+        out,_ = cat.run_test(target_cmd, caliper_config)
+        snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+        samples = [ s for s in snapshots if 'cali.sampler.pc' in s ]
+
+        self.assertTrue(len(samples) > 1)
+        self.assertTrue(cat.has_snapshot_with_keys(snapshots, { 'event.begin#region', 'time.offset.ns' }))
+
+        # deferred samples carry the context of the sample, and no
+        # measurements from snapshot services taken at the drain site
+        for s in samples:
+            self.assertFalse('time.offset.ns' in s)
+            self.assertTrue('region' in s)
+
+        self.assertTrue(len(set([ s.get('iteration#fooloop') for s in samples ])) > 1)
+
     def test_sample_profile_lookup(self):
         target_cmd = [ './ci_test_macros', '5000', 'sample-profile(use.mpi=false,output.format=json-split,output=stdout,callpath=false,source.location=true,source.module=true,source.function=true)' ]
 
@@ -97,5 +144,96 @@ class CaliperSamplingTest(unittest.TestCase):
 
         self.assertTrue('main' in sreg.get('callpath.regname'))
 
+    def test_callpath_cache(self):
+        target_cmd = [ './ci_test_macros', '0', 'none', '4' ]
+
+        def get_paths(extra_config):
+            caliper_config = {
+                'CALI_SERVICES_ENABLE'   : 'event,callpath,trace,recorder',
+                'CALI_CALLPATH_USE_NAME' : 'true',
+                'CALI_RECORDER_FILENAME' : 'stdout',
+                'CALI_LOG_VERBOSITY'     : '2',
+            }
+            caliper_config.update(extra_config)
+
+            out,err = cat.run_test(target_cmd, caliper_config)
+            snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+            def to_list(v):
+                return v if isinstance(v, list) else ([] if v is None else v.split('/'))
+
+            paths = [ (to_list(s.get('callpath.address')), to_list(s.get('callpath.regname'))) for s in snapshots ]
+            return paths, err.decode()
+
+        nocache,_ = get_paths({ 'CALI_CALLPATH_PATH_CACHE_SIZE' : '0' })
+        cached,log = get_paths({ 'CALI_CALLPATH_PATH_CACHE_SIZE' : '256' })
+
+        self.assertTrue(len(nocache) > 20)
+        self.assertEqual(len(nocache), len(cached))
+        self.assertEqual([ p[1] for p in nocache ], [ p[1] for p in cached ])
+        self.assertTrue(any([ 'main' in p[1] for p in cached ]))
+
+        # the loop iterations repeat the same call stacks
+        match = re.search(r'callpath: (\d+) path cache hits, (\d+) misses', log)
+        self.assertIsNotNone(match)
+        self.assertTrue(int(match.group(1)) > int(match.group(2)))
+
+        # addresses and names of a cached path are consistent with frame pointers, too
+        fp,_ = get_paths({ 'CALI_CALLPATH_USE_FRAME_POINTERS' : 'true' })
+
+        self.assertEqual(len(fp), len(cached))
+        for addr, name in fp:
+            self.assertEqual(len(addr), len(name))
+
+        # frame-pointer unwinding (or its libunwind fallback) finds the same paths
+        self.assertEqual([ p[1] for p in fp ], [ p[1] for p in cached ])
+
+    def test_symbollookup_batch_and_cache(self):
+        target_cmd = [ './ci_test_macros', '0', 'none', '4' ]
+
+        def run(extra_config):
+            caliper_config = {
+                'CALI_SERVICES_ENABLE'   : 'event,callpath,symbollookup,trace,recorder',
+                'CALI_RECORDER_FILENAME' : 'stdout',
+                'CALI_LOG_VERBOSITY'     : '2',
+            }
+            caliper_config.update(extra_config)
+
+            out,err = cat.run_test(target_cmd, caliper_config)
+            snapshots,_ = caliperreader.read_caliper_contents(io.StringIO(out.decode()))
+
+            funcs = [ str(s.get('source.function#callpath.address')) for s in snapshots ]
+            return funcs, err.decode()
+
+        batch,log = run({ 'CALI_SYMBOLLOOKUP_BATCH' : 'true' })
+        nobatch,_ = run({ 'CALI_SYMBOLLOOKUP_BATCH' : 'false' })
+
+        self.assertTrue(len(batch) > 20)
+        self.assertEqual(batch, nobatch)
+        self.assertTrue(any([ 'main' in f for f in batch ]))
+
+        match = re.search(r'Symbollookup: Resolving (\d+) distinct addresses', log)
+        self.assertIsNotNone(match)
+        self.assertTrue(int(match.group(1)) > 0)
+
+        # the batch lookup must not run the flush callbacks a second time
+        self.assertEqual(len(re.findall(r'trace: Flushed', log)), 1)
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            cache_file = os.path.join(tmpdir, 'symbols.cache')
+
+            first,_ = run({ 'CALI_SYMBOLLOOKUP_CACHE_FILE' : cache_file })
+            self.assertTrue(os.path.getsize(cache_file) > 0)
+
+            second,log = run({ 'CALI_SYMBOLLOOKUP_CACHE_FILE' : cache_file })
+
+            self.assertEqual(first, batch)
+            self.assertEqual(second, batch)
+
+            match = re.search(r'Resolved (\d+) addresses from debug info, (\d+) from cache file', log)
+            self.assertIsNotNone(match)
+            self.assertEqual(int(match.group(1)), 0)
+            self.assertTrue(int(match.group(2)) > 0)
+
 if __name__ == "__main__":
     unittest.main()